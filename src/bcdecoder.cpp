@@ -0,0 +1,556 @@
+#include "bcdecoder.h"
+#include "pixelops.h"
+#define BCDEC_IMPLEMENTATION
+#include "libs/bcdec/bcdec.h"
+
+
+using BlockRowDecoder = void(*)(const uint8_t* src, uint8_t* dst, const size_t numBlocks, const size_t dstPitch);
+
+static inline uint32_t Load32(const uint8_t* ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint64_t Load64(const uint8_t* ptr) {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+// every decoder is instantiated per output layout, the conversion happens right before the pixels are stored
+template <BCFormat F, PixelLayout L>
+static void DecodeBlockRow_Scalar(const uint8_t* src, uint8_t* dst, const size_t numBlocks, const size_t dstPitch) {
+    const int pitch = scast<int>(dstPitch);
+    for (size_t i = 0; i < numBlocks; ++i, src += BCGetBlockSize(F), dst += 16) {
+        if constexpr (F == BCFormat::BC1) {
+            bcdec_bc1(src, dst, pitch);
+        } else if constexpr (F == BCFormat::BC2) {
+            bcdec_bc2(src, dst, pitch);
+        } else {
+            bcdec_bc3(src, dst, pitch);
+        }
+
+        if constexpr (L != PixelLayout::RGBA) {
+            // still in the cache
+            for (size_t r = 0; r < 4; ++r) {
+                uint8_t* row = dst + r * dstPitch;
+                for (size_t x = 0; x < 16; x += 4) {
+                    uint32_t c;
+                    std::memcpy(&c, row + x, sizeof(c));
+                    c = FromRGBAOp<L>::Scalar(c);
+                    std::memcpy(row + x, &c, sizeof(c));
+                }
+            }
+        }
+    }
+}
+
+
+#if SH2TEX_X86
+
+// BC3 alpha palette weights, [0] - 8 interpolated values (a0 > a1), [1] - 6 values plus 0 and 255
+alignas(32) static const int32_t kAlphaWeights0[2][8] = { { 7, 0, 6, 5, 4, 3, 2, 1 }, { 5, 0, 4, 3, 2, 1, 0, 0 } };
+alignas(32) static const int32_t kAlphaWeights1[2][8] = { { 0, 7, 1, 2, 3, 4, 5, 6 }, { 0, 5, 1, 2, 3, 4, 0, 0 } };
+alignas(32) static const int32_t kAlphaConstant[2][8] = { { 0, 0, 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0, 0, 255 } };
+// x / 7 and x / 5 done as (x * magic) >> 16, exact for every sum we can get here
+static const int32_t kAlphaDivMagic[2] = { 9363, 13108 };
+// same for x / 3 of the color interpolation, exact for x < 32768
+static const int32_t kDiv3Magic = 21846;
+
+static const int32_t kColorMask = 0x00FFFFFF;
+static const int32_t kOpaqueAlpha = scast<int32_t>(0xFF000000);
+
+
+//// SSE2 path - 4 blocks per iteration
+
+SH2TEX_TARGET_SSE2 static inline __m128i Select_SSE2(const __m128i mask, const __m128i a, const __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// all the math below works on 16 bit values sitting in the low half of 32 bit lanes,
+// so the 16 bit multiplies are enough and the high halves stay zero
+SH2TEX_TARGET_SSE2 static inline __m128i Expand5_SSE2(const __m128i v) {
+    const __m128i masked = _mm_and_si128(v, _mm_set1_epi32(0x1F));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(masked, _mm_set1_epi32(527)), _mm_set1_epi32(23)), 6);
+}
+
+SH2TEX_TARGET_SSE2 static inline __m128i Expand6_SSE2(const __m128i v) {
+    const __m128i masked = _mm_and_si128(v, _mm_set1_epi32(0x3F));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(masked, _mm_set1_epi32(259)), _mm_set1_epi32(33)), 6);
+}
+
+// (2 * a + b + 1) / 3
+SH2TEX_TARGET_SSE2 static inline __m128i Lerp3_SSE2(const __m128i a, const __m128i b) {
+    const __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(a, a), b), _mm_set1_epi32(1));
+    return _mm_mulhi_epu16(sum, _mm_set1_epi32(kDiv3Magic));
+}
+
+// (a + b + 1) / 2
+SH2TEX_TARGET_SSE2 static inline __m128i Lerp2_SSE2(const __m128i a, const __m128i b) {
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(a, b), _mm_set1_epi32(1)), 1);
+}
+
+SH2TEX_TARGET_SSE2 static inline __m128i PackRGB_SSE2(const __m128i r, const __m128i g, const __m128i b) {
+    const __m128i rg = _mm_or_si128(r, _mm_slli_epi32(g, 8));
+    return _mm_or_si128(rg, _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32(kOpaqueAlpha)));
+}
+
+// colors holds c0 | (c1 << 16) of one block per lane, pal[i] receives palette entry i of every block
+SH2TEX_TARGET_SSE2 static inline void BuildColorPalettes_SSE2(const __m128i colors, const bool opaqueOnly, __m128i (&pal)[4]) {
+    const __m128i c0 = _mm_and_si128(colors, _mm_set1_epi32(0xFFFF));
+    const __m128i c1 = _mm_srli_epi32(colors, 16);
+
+    const __m128i r0 = Expand5_SSE2(_mm_srli_epi32(c0, 11));
+    const __m128i g0 = Expand6_SSE2(_mm_srli_epi32(c0, 5));
+    const __m128i b0 = Expand5_SSE2(c0);
+    const __m128i r1 = Expand5_SSE2(_mm_srli_epi32(c1, 11));
+    const __m128i g1 = Expand6_SSE2(_mm_srli_epi32(c1, 5));
+    const __m128i b1 = Expand5_SSE2(c1);
+
+    const __m128i color2 = PackRGB_SSE2(Lerp3_SSE2(r0, r1), Lerp3_SSE2(g0, g1), Lerp3_SSE2(b0, b1));
+    const __m128i color3 = PackRGB_SSE2(Lerp3_SSE2(r1, r0), Lerp3_SSE2(g1, g0), Lerp3_SSE2(b1, b0));
+    // BC1 punch-through blocks (c0 <= c1) get the half way color and transparent black instead
+    const __m128i colorHalf = PackRGB_SSE2(Lerp2_SSE2(r0, r1), Lerp2_SSE2(g0, g1), Lerp2_SSE2(b0, b1));
+    const __m128i fourColors = opaqueOnly ? _mm_set1_epi32(-1) : _mm_cmpgt_epi32(c0, c1);
+
+    pal[0] = PackRGB_SSE2(r0, g0, b0);
+    pal[1] = PackRGB_SSE2(r1, g1, b1);
+    pal[2] = Select_SSE2(fourColors, color2, colorHalf);
+    pal[3] = _mm_and_si128(fourColors, color3);
+}
+
+SH2TEX_TARGET_SSE2 static inline void Transpose4x4_SSE2(__m128i (&v)[4]) {
+    const __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+    const __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+    const __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+    const __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm_unpacklo_epi64(t0, t1);
+    v[1] = _mm_unpackhi_epi64(t0, t1);
+    v[2] = _mm_unpacklo_epi64(t2, t3);
+    v[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+// no variable shifts or shuffles in SSE2, so every index bit becomes a lane mask and picks between entries
+SH2TEX_TARGET_SSE2 static inline void ExpandColorBlock_SSE2(const __m128i palette, const uint32_t indices, __m128i (&rows)[4]) {
+    const __m128i p0 = _mm_shuffle_epi32(palette, 0x00);
+    const __m128i p1 = _mm_shuffle_epi32(palette, 0x55);
+    const __m128i p2 = _mm_shuffle_epi32(palette, 0xAA);
+    const __m128i p3 = _mm_shuffle_epi32(palette, 0xFF);
+    const __m128i bit0 = _mm_setr_epi32(1, 4, 16, 64);
+    const __m128i bit1 = _mm_setr_epi32(2, 8, 32, 128);
+
+    for (int r = 0; r < 4; ++r) {
+        const __m128i idx = _mm_set1_epi32(scast<int>(indices >> (r * 8)));
+        const __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(idx, bit0), bit0);
+        const __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(idx, bit1), bit1);
+        rows[r] = Select_SSE2(m1, Select_SSE2(m0, p3, p2), Select_SSE2(m0, p1, p0));
+    }
+}
+
+SH2TEX_TARGET_SSE2 static inline void ApplySharpAlpha_SSE2(const uint8_t* block, __m128i (&rows)[4]) {
+    const __m128i nibbleMask = _mm_setr_epi32(0x000F, 0x00F0, 0x0F00, 0xF000);
+    // 16 bit multiply moves every lane's nibble up to bits 12..15
+    const __m128i nibbleShift = _mm_setr_epi32(1 << 12, 1 << 8, 1 << 4, 1);
+
+    for (int r = 0; r < 4; ++r) {
+        const uint32_t alphas = block[r * 2] | (block[r * 2 + 1] << 8);
+        __m128i alpha = _mm_mullo_epi16(_mm_and_si128(_mm_set1_epi32(scast<int>(alphas)), nibbleMask), nibbleShift);
+        alpha = _mm_slli_epi32(alpha, 16);
+        alpha = _mm_or_si128(alpha, _mm_srli_epi32(alpha, 4)); // n * 17
+        rows[r] = _mm_or_si128(_mm_and_si128(rows[r], _mm_set1_epi32(kColorMask)), alpha);
+    }
+}
+
+// 8 palette entries of a single block, already shifted into the alpha byte
+SH2TEX_TARGET_SSE2 static inline void BuildAlphaPalette_SSE2(const uint8_t a0, const uint8_t a1, __m128i (&pal)[2]) {
+    const int mode = a0 > a1 ? 0 : 1;
+    const __m128i va0 = _mm_set1_epi32(a0);
+    const __m128i va1 = _mm_set1_epi32(a1);
+    const __m128i magic = _mm_set1_epi32(kAlphaDivMagic[mode]);
+
+    for (int i = 0; i < 2; ++i) {
+        const __m128i w0 = _mm_load_si128(rcast<const __m128i*>(&kAlphaWeights0[mode][i * 4]));
+        const __m128i w1 = _mm_load_si128(rcast<const __m128i*>(&kAlphaWeights1[mode][i * 4]));
+        const __m128i constant = _mm_load_si128(rcast<const __m128i*>(&kAlphaConstant[mode][i * 4]));
+        const __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi16(va0, w0), _mm_mullo_epi16(va1, w1)), _mm_set1_epi32(1));
+        pal[i] = _mm_slli_epi32(_mm_or_si128(_mm_mulhi_epu16(sum, magic), constant), 24);
+    }
+}
+
+SH2TEX_TARGET_SSE2 static inline void ApplySmoothAlpha_SSE2(const uint8_t* block, __m128i (&rows)[4]) {
+    __m128i pal[2];
+    BuildAlphaPalette_SSE2(block[0], block[1], pal);
+
+    const __m128i a0 = _mm_shuffle_epi32(pal[0], 0x00);
+    const __m128i a1 = _mm_shuffle_epi32(pal[0], 0x55);
+    const __m128i a2 = _mm_shuffle_epi32(pal[0], 0xAA);
+    const __m128i a3 = _mm_shuffle_epi32(pal[0], 0xFF);
+    const __m128i a4 = _mm_shuffle_epi32(pal[1], 0x00);
+    const __m128i a5 = _mm_shuffle_epi32(pal[1], 0x55);
+    const __m128i a6 = _mm_shuffle_epi32(pal[1], 0xAA);
+    const __m128i a7 = _mm_shuffle_epi32(pal[1], 0xFF);
+    const __m128i bit0 = _mm_setr_epi32(1 << 0, 1 << 3, 1 << 6, 1 << 9);
+    const __m128i bit1 = _mm_setr_epi32(1 << 1, 1 << 4, 1 << 7, 1 << 10);
+    const __m128i bit2 = _mm_setr_epi32(1 << 2, 1 << 5, 1 << 8, 1 << 11);
+
+    const uint64_t indices = Load64(block) >> 16;
+    for (int r = 0; r < 4; ++r) {
+        const __m128i idx = _mm_set1_epi32(scast<int>((indices >> (r * 12)) & 0xFFF));
+        const __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(idx, bit0), bit0);
+        const __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(idx, bit1), bit1);
+        const __m128i m2 = _mm_cmpeq_epi32(_mm_and_si128(idx, bit2), bit2);
+        const __m128i lo = Select_SSE2(m1, Select_SSE2(m0, a3, a2), Select_SSE2(m0, a1, a0));
+        const __m128i hi = Select_SSE2(m1, Select_SSE2(m0, a7, a6), Select_SSE2(m0, a5, a4));
+        const __m128i alpha = Select_SSE2(m2, hi, lo);
+        rows[r] = _mm_or_si128(_mm_and_si128(rows[r], _mm_set1_epi32(kColorMask)), alpha);
+    }
+}
+
+template <BCFormat F, PixelLayout L>
+SH2TEX_TARGET_SSE2 static void DecodeBlockRow_SSE2(const uint8_t* src, uint8_t* dst, const size_t numBlocks, const size_t dstPitch) {
+    constexpr size_t kBlockSize = BCGetBlockSize(F);
+    constexpr size_t kColorOffset = (F == BCFormat::BC1) ? 0 : 8;
+
+    size_t i = 0;
+    for (; i + 4 <= numBlocks; i += 4, src += kBlockSize * 4, dst += 16 * 4) {
+        // endpoints of the 4 blocks, one block per lane
+        __m128i colors;
+        if constexpr (F == BCFormat::BC1) {
+            const __m128 b01 = _mm_castsi128_ps(_mm_loadu_si128(rcast<const __m128i*>(src)));
+            const __m128 b23 = _mm_castsi128_ps(_mm_loadu_si128(rcast<const __m128i*>(src + 16)));
+            colors = _mm_castps_si128(_mm_shuffle_ps(b01, b23, _MM_SHUFFLE(2, 0, 2, 0)));
+        } else {
+            const __m128i b0 = _mm_loadu_si128(rcast<const __m128i*>(src));
+            const __m128i b1 = _mm_loadu_si128(rcast<const __m128i*>(src + 16));
+            const __m128i b2 = _mm_loadu_si128(rcast<const __m128i*>(src + 32));
+            const __m128i b3 = _mm_loadu_si128(rcast<const __m128i*>(src + 48));
+            colors = _mm_unpacklo_epi64(_mm_unpackhi_epi32(b0, b1), _mm_unpackhi_epi32(b2, b3));
+        }
+
+        __m128i pal[4];
+        BuildColorPalettes_SSE2(colors, F != BCFormat::BC1, pal);
+        Transpose4x4_SSE2(pal);
+
+        for (size_t b = 0; b < 4; ++b) {
+            const uint8_t* block = src + b * kBlockSize;
+
+            __m128i rows[4];
+            ExpandColorBlock_SSE2(pal[b], Load32(block + kColorOffset + 4), rows);
+            if constexpr (F == BCFormat::BC2) {
+                ApplySharpAlpha_SSE2(block, rows);
+            } else if constexpr (F == BCFormat::BC3) {
+                ApplySmoothAlpha_SSE2(block, rows);
+            }
+
+            for (size_t r = 0; r < 4; ++r) {
+                _mm_storeu_si128(rcast<__m128i*>(dst + b * 16 + r * dstPitch), FromRGBAOp<L>::SSE2(rows[r]));
+            }
+        }
+    }
+
+    DecodeBlockRow_Scalar<F, L>(src, dst, numBlocks - i, dstPitch);
+}
+
+
+//// AVX2 path - 8 blocks per iteration, variable shifts and permutes replace the mask selects
+
+SH2TEX_TARGET_AVX2 static inline __m256i Expand5_AVX2(const __m256i v) {
+    const __m256i masked = _mm256_and_si256(v, _mm256_set1_epi32(0x1F));
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(masked, _mm256_set1_epi32(527)), _mm256_set1_epi32(23)), 6);
+}
+
+SH2TEX_TARGET_AVX2 static inline __m256i Expand6_AVX2(const __m256i v) {
+    const __m256i masked = _mm256_and_si256(v, _mm256_set1_epi32(0x3F));
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(masked, _mm256_set1_epi32(259)), _mm256_set1_epi32(33)), 6);
+}
+
+SH2TEX_TARGET_AVX2 static inline __m256i Lerp3_AVX2(const __m256i a, const __m256i b) {
+    const __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(a, a), b), _mm256_set1_epi32(1));
+    return _mm256_mulhi_epu16(sum, _mm256_set1_epi32(kDiv3Magic));
+}
+
+SH2TEX_TARGET_AVX2 static inline __m256i Lerp2_AVX2(const __m256i a, const __m256i b) {
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(a, b), _mm256_set1_epi32(1)), 1);
+}
+
+SH2TEX_TARGET_AVX2 static inline __m256i PackRGB_AVX2(const __m256i r, const __m256i g, const __m256i b) {
+    const __m256i rg = _mm256_or_si256(r, _mm256_slli_epi32(g, 8));
+    return _mm256_or_si256(rg, _mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_set1_epi32(kOpaqueAlpha)));
+}
+
+SH2TEX_TARGET_AVX2 static inline void BuildColorPalettes_AVX2(const __m256i colors, const bool opaqueOnly, __m256i (&pal)[4]) {
+    const __m256i c0 = _mm256_and_si256(colors, _mm256_set1_epi32(0xFFFF));
+    const __m256i c1 = _mm256_srli_epi32(colors, 16);
+
+    const __m256i r0 = Expand5_AVX2(_mm256_srli_epi32(c0, 11));
+    const __m256i g0 = Expand6_AVX2(_mm256_srli_epi32(c0, 5));
+    const __m256i b0 = Expand5_AVX2(c0);
+    const __m256i r1 = Expand5_AVX2(_mm256_srli_epi32(c1, 11));
+    const __m256i g1 = Expand6_AVX2(_mm256_srli_epi32(c1, 5));
+    const __m256i b1 = Expand5_AVX2(c1);
+
+    const __m256i color2 = PackRGB_AVX2(Lerp3_AVX2(r0, r1), Lerp3_AVX2(g0, g1), Lerp3_AVX2(b0, b1));
+    const __m256i color3 = PackRGB_AVX2(Lerp3_AVX2(r1, r0), Lerp3_AVX2(g1, g0), Lerp3_AVX2(b1, b0));
+    const __m256i colorHalf = PackRGB_AVX2(Lerp2_AVX2(r0, r1), Lerp2_AVX2(g0, g1), Lerp2_AVX2(b0, b1));
+    const __m256i fourColors = opaqueOnly ? _mm256_set1_epi32(-1) : _mm256_cmpgt_epi32(c0, c1);
+
+    pal[0] = PackRGB_AVX2(r0, g0, b0);
+    pal[1] = PackRGB_AVX2(r1, g1, b1);
+    pal[2] = _mm256_blendv_epi8(colorHalf, color2, fourColors);
+    pal[3] = _mm256_and_si256(fourColors, color3);
+}
+
+// transposes within 128 bit lanes, so v[i] ends up as [palette i | palette i + 4]
+SH2TEX_TARGET_AVX2 static inline void Transpose4x4_AVX2(__m256i (&v)[4]) {
+    const __m256i t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+    const __m256i t1 = _mm256_unpacklo_epi32(v[2], v[3]);
+    const __m256i t2 = _mm256_unpackhi_epi32(v[0], v[1]);
+    const __m256i t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm256_unpacklo_epi64(t0, t1);
+    v[1] = _mm256_unpackhi_epi64(t0, t1);
+    v[2] = _mm256_unpacklo_epi64(t2, t3);
+    v[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+SH2TEX_TARGET_AVX2 static inline __m256i BuildAlphaPalette_AVX2(const uint8_t a0, const uint8_t a1) {
+    const int mode = a0 > a1 ? 0 : 1;
+    const __m256i w0 = _mm256_load_si256(rcast<const __m256i*>(kAlphaWeights0[mode]));
+    const __m256i w1 = _mm256_load_si256(rcast<const __m256i*>(kAlphaWeights1[mode]));
+    const __m256i constant = _mm256_load_si256(rcast<const __m256i*>(kAlphaConstant[mode]));
+    const __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi16(_mm256_set1_epi32(a0), w0),
+                                                          _mm256_mullo_epi16(_mm256_set1_epi32(a1), w1)),
+                                         _mm256_set1_epi32(1));
+    const __m256i values = _mm256_or_si256(_mm256_mulhi_epu16(sum, _mm256_set1_epi32(kAlphaDivMagic[mode])), constant);
+    return _mm256_slli_epi32(values, 24);
+}
+
+// palette has the block's 4 colors in both 128 bit lanes, every __m256i holds two rows of pixels
+template <BCFormat F, PixelLayout L>
+SH2TEX_TARGET_AVX2 static inline void DecodeBlock_AVX2(const __m256i palette, const uint8_t* block, uint8_t* dst, const size_t dstPitch) {
+    constexpr size_t kColorOffset = (F == BCFormat::BC1) ? 0 : 8;
+
+    const __m256i indices = _mm256_set1_epi32(scast<int>(Load32(block + kColorOffset + 4)));
+    const __m256i three = _mm256_set1_epi32(3);
+    __m256i rows01 = _mm256_permutevar8x32_epi32(palette, _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14)), three));
+    __m256i rows23 = _mm256_permutevar8x32_epi32(palette, _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_setr_epi32(16, 18, 20, 22, 24, 26, 28, 30)), three));
+
+    if constexpr (F != BCFormat::BC1) {
+        __m256i alpha01, alpha23;
+        if constexpr (F == BCFormat::BC2) {
+            const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+            const __m256i nibble = _mm256_set1_epi32(0xF);
+            alpha01 = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(scast<int>(Load32(block))), shifts), nibble);
+            alpha23 = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(scast<int>(Load32(block + 4))), shifts), nibble);
+            alpha01 = _mm256_or_si256(_mm256_slli_epi32(alpha01, 24), _mm256_slli_epi32(alpha01, 28));
+            alpha23 = _mm256_or_si256(_mm256_slli_epi32(alpha23, 24), _mm256_slli_epi32(alpha23, 28));
+        } else {
+            const __m256i alphaPalette = BuildAlphaPalette_AVX2(block[0], block[1]);
+            const __m256i shifts = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+            const __m256i seven = _mm256_set1_epi32(7);
+            const uint64_t alphaIndices = Load64(block) >> 16;
+            const __m256i idx01 = _mm256_set1_epi32(scast<int>(alphaIndices & 0xFFFFFF));
+            const __m256i idx23 = _mm256_set1_epi32(scast<int>(alphaIndices >> 24));
+            alpha01 = _mm256_permutevar8x32_epi32(alphaPalette, _mm256_and_si256(_mm256_srlv_epi32(idx01, shifts), seven));
+            alpha23 = _mm256_permutevar8x32_epi32(alphaPalette, _mm256_and_si256(_mm256_srlv_epi32(idx23, shifts), seven));
+        }
+
+        const __m256i colorMask = _mm256_set1_epi32(kColorMask);
+        rows01 = _mm256_or_si256(_mm256_and_si256(rows01, colorMask), alpha01);
+        rows23 = _mm256_or_si256(_mm256_and_si256(rows23, colorMask), alpha23);
+    }
+
+    rows01 = FromRGBAOp<L>::AVX2(rows01);
+    rows23 = FromRGBAOp<L>::AVX2(rows23);
+
+    _mm_storeu_si128(rcast<__m128i*>(dst), _mm256_castsi256_si128(rows01));
+    _mm_storeu_si128(rcast<__m128i*>(dst + dstPitch), _mm256_extracti128_si256(rows01, 1));
+    _mm_storeu_si128(rcast<__m128i*>(dst + dstPitch * 2), _mm256_castsi256_si128(rows23));
+    _mm_storeu_si128(rcast<__m128i*>(dst + dstPitch * 3), _mm256_extracti128_si256(rows23, 1));
+}
+
+template <BCFormat F, PixelLayout L>
+SH2TEX_TARGET_AVX2 static void DecodeBlockRow_AVX2(const uint8_t* src, uint8_t* dst, const size_t numBlocks, const size_t dstPitch) {
+    constexpr size_t kBlockSize = BCGetBlockSize(F);
+
+    size_t i = 0;
+    for (; i + 8 <= numBlocks; i += 8, src += kBlockSize * 8, dst += 16 * 8) {
+        __m256i colors;
+        if constexpr (F == BCFormat::BC1) {
+            const __m256 b0123 = _mm256_castsi256_ps(_mm256_loadu_si256(rcast<const __m256i*>(src)));
+            const __m256 b4567 = _mm256_castsi256_ps(_mm256_loadu_si256(rcast<const __m256i*>(src + 32)));
+            // [0 1 4 5 | 2 3 6 7] -> [0 1 2 3 | 4 5 6 7]
+            colors = _mm256_castps_si256(_mm256_shuffle_ps(b0123, b4567, _MM_SHUFFLE(2, 0, 2, 0)));
+            colors = _mm256_permute4x64_epi64(colors, _MM_SHUFFLE(3, 1, 2, 0));
+        } else {
+            const __m256i b01 = _mm256_loadu_si256(rcast<const __m256i*>(src));
+            const __m256i b23 = _mm256_loadu_si256(rcast<const __m256i*>(src + 32));
+            const __m256i b45 = _mm256_loadu_si256(rcast<const __m256i*>(src + 64));
+            const __m256i b67 = _mm256_loadu_si256(rcast<const __m256i*>(src + 96));
+            // [0 2 4 6 | 1 3 5 7] -> [0 1 2 3 | 4 5 6 7]
+            colors = _mm256_unpacklo_epi64(_mm256_unpackhi_epi32(b01, b23), _mm256_unpackhi_epi32(b45, b67));
+            colors = _mm256_permutevar8x32_epi32(colors, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        }
+
+        __m256i pal[4];
+        BuildColorPalettes_AVX2(colors, F != BCFormat::BC1, pal);
+        Transpose4x4_AVX2(pal);
+
+        for (size_t b = 0; b < 4; ++b) {
+            DecodeBlock_AVX2<F, L>(_mm256_permute2x128_si256(pal[b], pal[b], 0x00), src + b * kBlockSize, dst + b * 16, dstPitch);
+            DecodeBlock_AVX2<F, L>(_mm256_permute2x128_si256(pal[b], pal[b], 0x11), src + (b + 4) * kBlockSize, dst + (b + 4) * 16, dstPitch);
+        }
+    }
+
+    DecodeBlockRow_SSE2<F, L>(src, dst, numBlocks - i, dstPitch);
+}
+
+#endif // SH2TEX_X86
+
+
+template <PixelLayout L>
+static BlockRowDecoder GetBlockRowDecoder(const BCFormat format, const SIMDLevel level) {
+    static const BlockRowDecoder kScalarDecoders[3] = {
+        DecodeBlockRow_Scalar<BCFormat::BC1, L>, DecodeBlockRow_Scalar<BCFormat::BC2, L>, DecodeBlockRow_Scalar<BCFormat::BC3, L>
+    };
+#if SH2TEX_X86
+    static const BlockRowDecoder kSSE2Decoders[3] = {
+        DecodeBlockRow_SSE2<BCFormat::BC1, L>, DecodeBlockRow_SSE2<BCFormat::BC2, L>, DecodeBlockRow_SSE2<BCFormat::BC3, L>
+    };
+    static const BlockRowDecoder kAVX2Decoders[3] = {
+        DecodeBlockRow_AVX2<BCFormat::BC1, L>, DecodeBlockRow_AVX2<BCFormat::BC2, L>, DecodeBlockRow_AVX2<BCFormat::BC3, L>
+    };
+
+    if (level >= SIMDLevel::AVX2) {
+        return kAVX2Decoders[scast<int>(format)];
+    } else if (level >= SIMDLevel::SSE2) {
+        return kSSE2Decoders[scast<int>(format)];
+    }
+#endif
+    return kScalarDecoders[scast<int>(format)];
+}
+
+static BlockRowDecoder GetBlockRowDecoder(const BCFormat format, const PixelLayout layout, const SIMDLevel level) {
+    if (layout == PixelLayout::BGRA) {
+        return GetBlockRowDecoder<PixelLayout::BGRA>(format, level);
+    } else if (layout == PixelLayout::RGBAPremultiplied) {
+        return GetBlockRowDecoder<PixelLayout::RGBAPremultiplied>(format, level);
+    } else {
+        return GetBlockRowDecoder<PixelLayout::RGBA>(format, level);
+    }
+}
+
+void BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst) {
+    BCDecodeImage(format, src, width, height, dst, PixelLayout::RGBA, GetSupportedSIMDLevel());
+}
+
+void BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst, const PixelLayout layout) {
+    BCDecodeImage(format, src, width, height, dst, layout, GetSupportedSIMDLevel());
+}
+
+void BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst, const PixelLayout layout, const SIMDLevel level) {
+    const BlockRowDecoder decodeRow = GetBlockRowDecoder(format, layout, std::min(level, GetSupportedSIMDLevel()));
+
+    const size_t blockSize = BCGetBlockSize(format);
+    const size_t blocksX = (width + 3) / 4;
+    const size_t blocksY = (height + 3) / 4;
+    const size_t fullBlocksX = width / 4;
+    const size_t pitch = scast<size_t>(width) * 4;
+
+    // blocks hanging over the right or bottom edge are decoded into scratch and clipped
+    BytesArray scratch;
+
+    for (size_t by = 0; by < blocksY; ++by, src += blocksX * blockSize) {
+        uint8_t* rowDst = dst + by * 4 * pitch;
+        const size_t numRows = std::min<size_t>(4, height - by * 4);
+
+        if (numRows == 4 && fullBlocksX == blocksX) {
+            decodeRow(src, rowDst, blocksX, pitch);
+        } else {
+            const size_t scratchPitch = blocksX * 16;
+            scratch.resize(scratchPitch * 4);
+            decodeRow(src, scratch.data(), blocksX, scratchPitch);
+            for (size_t r = 0; r < numRows; ++r) {
+                std::memcpy(rowDst + r * pitch, scratch.data() + r * scratchPitch, pitch);
+            }
+        }
+    }
+}
+
+static inline int PopCount32(uint32_t v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return scast<int>((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+uint32_t BCAverageBlock(const BCFormat format, const uint8_t* src) {
+    const uint8_t* colorBlock = (format == BCFormat::BC1) ? src : src + 8;
+    const uint32_t c0 = colorBlock[0] | (colorBlock[1] << 8);
+    const uint32_t c1 = colorBlock[2] | (colorBlock[3] << 8);
+    const uint32_t indices = Load32(colorBlock + 4);
+
+    // same expansion and interpolation as bcdec, so the sums match the decoded texels exactly
+    int pal[4][4];  // rgba
+    pal[0][0] = (((c0 >> 11) & 0x1F) * 527 + 23) >> 6;
+    pal[0][1] = (((c0 >> 5) & 0x3F) * 259 + 33) >> 6;
+    pal[0][2] = ((c0 & 0x1F) * 527 + 23) >> 6;
+    pal[1][0] = (((c1 >> 11) & 0x1F) * 527 + 23) >> 6;
+    pal[1][1] = (((c1 >> 5) & 0x3F) * 259 + 33) >> 6;
+    pal[1][2] = ((c1 & 0x1F) * 527 + 23) >> 6;
+    pal[0][3] = pal[1][3] = pal[2][3] = pal[3][3] = 255;
+
+    if (c0 > c1 || format != BCFormat::BC1) {
+        for (int i = 0; i < 3; ++i) {
+            pal[2][i] = (2 * pal[0][i] + pal[1][i] + 1) / 3;
+            pal[3][i] = (pal[0][i] + 2 * pal[1][i] + 1) / 3;
+        }
+    } else {
+        for (int i = 0; i < 3; ++i) {
+            pal[2][i] = (pal[0][i] + pal[1][i] + 1) >> 1;
+            pal[3][i] = 0;
+        }
+        pal[3][3] = 0;
+    }
+
+    // how many texels use each palette entry
+    const uint32_t bit0 = indices & 0x55555555;
+    const uint32_t bit1 = (indices >> 1) & 0x55555555;
+    const int n3 = PopCount32(bit0 & bit1);
+    const int n1 = PopCount32(bit0) - n3;
+    const int n2 = PopCount32(bit1) - n3;
+    const int n0 = 16 - n1 - n2 - n3;
+
+    int sum[4];
+    for (int i = 0; i < 4; ++i) {
+        sum[i] = n0 * pal[0][i] + n1 * pal[1][i] + n2 * pal[2][i] + n3 * pal[3][i];
+    }
+
+    if (format == BCFormat::BC2) {
+        sum[3] = 0;
+        for (int i = 0; i < 8; ++i) {
+            sum[3] += ((src[i] & 0x0F) + (src[i] >> 4)) * 17;
+        }
+    } else if (format == BCFormat::BC3) {
+        const int a0 = src[0], a1 = src[1];
+        int alphas[8] = { a0, a1 };
+        if (a0 > a1) {
+            for (int i = 2; i < 8; ++i) {
+                alphas[i] = ((8 - i) * a0 + (i - 1) * a1 + 1) / 7;
+            }
+        } else {
+            for (int i = 2; i < 6; ++i) {
+                alphas[i] = ((6 - i) * a0 + (i - 1) * a1 + 1) / 5;
+            }
+            alphas[6] = 0;
+            alphas[7] = 255;
+        }
+
+        const uint64_t alphaIndices = Load64(src) >> 16;
+        sum[3] = 0;
+        for (int i = 0; i < 16; ++i) {
+            sum[3] += alphas[(alphaIndices >> (i * 3)) & 7];
+        }
+    }
+
+    return scast<uint32_t>(((sum[0] + 8) >> 4) | (((sum[1] + 8) >> 4) << 8) | (((sum[2] + 8) >> 4) << 16) | (((sum[3] + 8) >> 4) << 24));
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "mycommon.h"
+#include "cpufeatures.h"
+#include "pixelconvert.h" // PixelLayout
+
+enum class BCFormat : int {
+    BC1,    // DXT1
+    BC2,    // DXT2/DXT3
+    BC3     // DXT4/DXT5
+};
+
+inline constexpr size_t BCGetBlockSize(const BCFormat format) {
+    return format == BCFormat::BC1 ? 8 : 16;
+}
+
+// bytes a whole image takes, partial edge blocks are stored as full ones
+inline constexpr size_t BCGetImageSize(const BCFormat format, const uint32_t width, const uint32_t height) {
+    return ((scast<size_t>(width) + 3) / 4) * ((scast<size_t>(height) + 3) / 4) * BCGetBlockSize(format);
+}
+
+// Decodes a whole BCn image into tightly packed RGBA pixels (dst holds width * height * 4 bytes).
+// Several blocks are decoded per iteration with the best SIMD path the CPU supports,
+// the output is bit-exact with bcdec which is still used as the scalar fallback.
+void    BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst);
+// Same, but writes the pixels in the given layout as they are decoded, every format and layout pair has its own loop.
+// RGBAPremultiplied multiplies the decoded colors, DXT2/DXT4 data that is premultiplied already wants RGBA instead.
+void    BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst, const PixelLayout layout);
+// Same, but forces a specific code path (clamped to what the CPU supports)
+void    BCDecodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst, const PixelLayout layout, const SIMDLevel level);
+// Average RGBA color of a block (R in the low byte), computed from the endpoints and the index histogram.
+// Same result as decoding the block and averaging its 16 texels, just without the decoding.
+uint32_t BCAverageBlock(const BCFormat format, const uint8_t* src);
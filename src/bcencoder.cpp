@@ -0,0 +1,636 @@
+#include "bcencoder.h"
+#include "parallel.h"
+
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+#if SH2TEX_X86
+#include <immintrin.h>
+#endif
+
+
+// one 4x4 block split into planes, so 4 (SSE2) or 8 (AVX2) texels are scored at once
+struct ColorBlock {
+    alignas(32) float r[16];
+    alignas(32) float g[16];
+    alignas(32) float b[16];
+    alignas(32) float w[16];    // 1..4 by alpha, 0 for texels whose color doesn't matter (transparent in BC1)
+};
+
+// the 4 colors a pair of endpoints decodes to, bit-exact with the decoder
+struct ColorPalette {
+    alignas(16) float r[4];
+    alignas(16) float g[4];
+    alignas(16) float b[4];
+};
+
+struct Endpoint565 {
+    int r;  // 0..31
+    int g;  // 0..63
+    int b;  // 0..31
+};
+
+// returns the weighted squared error of the block and the best 2 bit index of every texel,
+// ties go to the lower index. All the sums are integers below 2^24, so every path gives the same result
+using ColorErrorFunc = float(*)(const ColorBlock& block, const ColorPalette& palette, uint32_t& indices);
+
+static const int kMaxSearchPasses = 8;
+
+
+static inline int Expand5(const int v) {
+    return (v * 527 + 23) >> 6;
+}
+
+static inline int Expand6(const int v) {
+    return (v * 259 + 33) >> 6;
+}
+
+static inline uint16_t Pack565(const Endpoint565& e) {
+    return scast<uint16_t>((e.r << 11) | (e.g << 5) | e.b);
+}
+
+// nearest value that survives the expansion, not just the nearest rounding
+static int QuantizeChannel(const float value, const int maxValue, int (*expand)(int)) {
+    const int guess = std::clamp(scast<int>(value * maxValue / 255.0f + 0.5f), 0, maxValue);
+    int best = guess;
+    float bestDiff = std::fabs(scast<float>(expand(guess)) - value);
+    for (int q = std::max(guess - 1, 0); q <= std::min(guess + 1, maxValue); ++q) {
+        const float diff = std::fabs(scast<float>(expand(q)) - value);
+        if (diff < bestDiff) {
+            best = q;
+            bestDiff = diff;
+        }
+    }
+    return best;
+}
+
+static Endpoint565 Quantize565(const float (&color)[3]) {
+    return { QuantizeChannel(color[0], 31, Expand5), QuantizeChannel(color[1], 63, Expand6), QuantizeChannel(color[2], 31, Expand5) };
+}
+
+// threeColors is the BC1 punch-through mode, its unused 4th entry repeats the first one so it never wins a tie
+static void BuildColorPalette(const Endpoint565& e0, const Endpoint565& e1, const bool threeColors, ColorPalette& palette) {
+    const int c0[3] = { Expand5(e0.r), Expand6(e0.g), Expand5(e0.b) };
+    const int c1[3] = { Expand5(e1.r), Expand6(e1.g), Expand5(e1.b) };
+    float* planes[3] = { palette.r, palette.g, palette.b };
+
+    for (int i = 0; i < 3; ++i) {
+        planes[i][0] = scast<float>(c0[i]);
+        planes[i][1] = scast<float>(c1[i]);
+        if (threeColors) {
+            planes[i][2] = scast<float>((c0[i] + c1[i] + 1) >> 1);
+            planes[i][3] = scast<float>(c0[i]);
+        } else {
+            planes[i][2] = scast<float>((2 * c0[i] + c1[i] + 1) / 3);
+            planes[i][3] = scast<float>((c0[i] + 2 * c1[i] + 1) / 3);
+        }
+    }
+}
+
+static float EvaluateColors_Scalar(const ColorBlock& block, const ColorPalette& palette, uint32_t& indices) {
+    float error = 0.0f;
+    indices = 0;
+    for (int i = 0; i < 16; ++i) {
+        float best = FLT_MAX;
+        uint32_t bestIdx = 0;
+        for (uint32_t j = 0; j < 4; ++j) {
+            const float dr = block.r[i] - palette.r[j];
+            const float dg = block.g[i] - palette.g[j];
+            const float db = block.b[i] - palette.b[j];
+            const float d = dr * dr + dg * dg + db * db;
+            if (d < best) {
+                best = d;
+                bestIdx = j;
+            }
+        }
+        error += best * block.w[i];
+        indices |= bestIdx << (i * 2);
+    }
+    return error;
+}
+
+
+#if SH2TEX_X86
+
+SH2TEX_TARGET_SSE2 static float EvaluateColors_SSE2(const ColorBlock& block, const ColorPalette& palette, uint32_t& indices) {
+    __m128 total = _mm_setzero_ps();
+    indices = 0;
+
+    for (int i = 0; i < 16; i += 4) {
+        const __m128 r = _mm_load_ps(block.r + i);
+        const __m128 g = _mm_load_ps(block.g + i);
+        const __m128 b = _mm_load_ps(block.b + i);
+
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIdx = _mm_setzero_si128();
+        for (int j = 0; j < 4; ++j) {
+            const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette.r[j]));
+            const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette.g[j]));
+            const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette.b[j]));
+            const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            const __m128i less = _mm_castps_si128(_mm_cmplt_ps(d, best));
+            best = _mm_min_ps(d, best);
+            bestIdx = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(j)), _mm_andnot_si128(less, bestIdx));
+        }
+        total = _mm_add_ps(total, _mm_mul_ps(best, _mm_load_ps(block.w + i)));
+
+        // indices are below 4, so the 16 bit multiply shifts them into place
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(rcast<__m128i*>(lanes), _mm_mullo_epi16(bestIdx, _mm_setr_epi32(1, 4, 16, 64)));
+        indices |= (lanes[0] | lanes[1] | lanes[2] | lanes[3]) << (i * 2);
+    }
+
+    total = _mm_add_ps(total, _mm_movehl_ps(total, total));
+    total = _mm_add_ss(total, _mm_shuffle_ps(total, total, 1));
+    return _mm_cvtss_f32(total);
+}
+
+SH2TEX_TARGET_AVX2 static float EvaluateColors_AVX2(const ColorBlock& block, const ColorPalette& palette, uint32_t& indices) {
+    __m256 total = _mm256_setzero_ps();
+    indices = 0;
+
+    for (int i = 0; i < 16; i += 8) {
+        const __m256 r = _mm256_load_ps(block.r + i);
+        const __m256 g = _mm256_load_ps(block.g + i);
+        const __m256 b = _mm256_load_ps(block.b + i);
+
+        __m256 best = _mm256_set1_ps(FLT_MAX);
+        __m256 bestIdx = _mm256_setzero_ps();
+        for (int j = 0; j < 4; ++j) {
+            const __m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette.r[j]));
+            const __m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette.g[j]));
+            const __m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette.b[j]));
+            const __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_mul_ps(db, db));
+            const __m256 less = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+            best = _mm256_min_ps(d, best);
+            bestIdx = _mm256_blendv_ps(bestIdx, _mm256_set1_ps(scast<float>(j)), less);
+        }
+        total = _mm256_add_ps(total, _mm256_mul_ps(best, _mm256_load_ps(block.w + i)));
+
+        // the shifted indices don't overlap, so adding them up is the same as or-ing
+        __m256i shifted = _mm256_sllv_epi32(_mm256_cvtps_epi32(bestIdx), _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14));
+        __m128i packed = _mm_add_epi32(_mm256_castsi256_si128(shifted), _mm256_extracti128_si256(shifted, 1));
+        packed = _mm_add_epi32(packed, _mm_unpackhi_epi64(packed, packed));
+        packed = _mm_add_epi32(packed, _mm_shuffle_epi32(packed, 1));
+        indices |= scast<uint32_t>(_mm_cvtsi128_si32(packed)) << (i * 2);
+    }
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(total), _mm256_extractf128_ps(total, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+#endif // SH2TEX_X86
+
+
+static ColorErrorFunc GetColorErrorFunc(const SIMDLevel level) {
+#if SH2TEX_X86
+    if (level >= SIMDLevel::AVX2) {
+        return EvaluateColors_AVX2;
+    } else if (level >= SIMDLevel::SSE2) {
+        return EvaluateColors_SSE2;
+    }
+#endif
+    return EvaluateColors_Scalar;
+}
+
+// endpoints on the block's principal axis, spanning all the texels that matter
+static void ComputePrincipalEndpoints(const ColorBlock& block, float (&e0)[3], float (&e1)[3]) {
+    float mean[3] = {}, weight = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        mean[0] += block.r[i] * block.w[i];
+        mean[1] += block.g[i] * block.w[i];
+        mean[2] += block.b[i] * block.w[i];
+        weight += block.w[i];
+    }
+    for (float& m : mean) {
+        m /= weight;
+    }
+
+    float cov[6] = {};  // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i) {
+        const float r = block.r[i] - mean[0], g = block.g[i] - mean[1], b = block.b[i] - mean[2], w = block.w[i];
+        cov[0] += r * r * w; cov[1] += r * g * w; cov[2] += r * b * w;
+        cov[3] += g * g * w; cov[4] += g * b * w; cov[5] += b * b * w;
+    }
+
+    // power iteration, starting from the row of the widest channel
+    float axis[3];
+    if (cov[0] >= cov[3] && cov[0] >= cov[5]) {
+        axis[0] = cov[0]; axis[1] = cov[1]; axis[2] = cov[2];
+    } else if (cov[3] >= cov[5]) {
+        axis[0] = cov[1]; axis[1] = cov[3]; axis[2] = cov[4];
+    } else {
+        axis[0] = cov[2]; axis[1] = cov[4]; axis[2] = cov[5];
+    }
+    for (int iter = 0; iter < 8; ++iter) {
+        const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        const float norm = std::max({ std::fabs(x), std::fabs(y), std::fabs(z) });
+        if (norm < 1e-6f) {
+            break;
+        }
+        axis[0] = x / norm; axis[1] = y / norm; axis[2] = z / norm;
+    }
+
+    const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float tMin = 0.0f, tMax = 0.0f;
+    if (length > 1e-6f) {
+        for (float& a : axis) {
+            a /= length;
+        }
+        tMin = FLT_MAX;
+        tMax = -FLT_MAX;
+        for (int i = 0; i < 16; ++i) {
+            if (block.w[i] > 0.0f) {
+                const float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2];
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        e0[i] = std::clamp(mean[i] + axis[i] * tMax, 0.0f, 255.0f);
+        e1[i] = std::clamp(mean[i] + axis[i] * tMin, 0.0f, 255.0f);
+    }
+}
+
+// best endpoints for the given indices in the least squares sense, false if the system is degenerate
+static bool SolveLeastSquares(const ColorBlock& block, const uint32_t indices, const bool threeColors, float (&e0)[3], float (&e1)[3]) {
+    // how much of e1 every index takes
+    static const float kFactors4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    static const float kFactors3[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+    const float* factors = threeColors ? kFactors3 : kFactors4;
+
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; ++i) {
+        const float w = block.w[i];
+        const float t = factors[(indices >> (i * 2)) & 3];
+        const float s = 1.0f - t;
+        const float p[3] = { block.r[i], block.g[i], block.b[i] };
+
+        aa += s * s * w;
+        ab += s * t * w;
+        bb += t * t * w;
+        for (int c = 0; c < 3; ++c) {
+            ax[c] += s * p[c] * w;
+            bx[c] += t * p[c] * w;
+        }
+    }
+
+    const float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) {
+        return false;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+        e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+static void EncodeColorBlock(const ColorBlock& block, const bool threeColors, const BCEncodeQuality quality, const ColorErrorFunc evaluate, uint8_t* dst) {
+    uint16_t c0 = 0, c1 = 0;
+    uint32_t indices = 0;
+
+    const bool anyOpaque = std::any_of(std::begin(block.w), std::end(block.w), [](const float w) { return w > 0.0f; });
+    if (!anyOpaque) {
+        // all transparent black
+        indices = 0xFFFFFFFF;
+    } else {
+        float f0[3], f1[3];
+        ComputePrincipalEndpoints(block, f0, f1);
+
+        Endpoint565 best[2] = { Quantize565(f0), Quantize565(f1) };
+        ColorPalette palette;
+        BuildColorPalette(best[0], best[1], threeColors, palette);
+        float bestError = evaluate(block, palette, indices);
+
+        if (quality == BCEncodeQuality::High) {
+            for (int iter = 0; iter < 2 && bestError > 0.0f; ++iter) {
+                if (!SolveLeastSquares(block, indices, threeColors, f0, f1)) {
+                    break;
+                }
+
+                const Endpoint565 refined[2] = { Quantize565(f0), Quantize565(f1) };
+                uint32_t refinedIndices;
+                BuildColorPalette(refined[0], refined[1], threeColors, palette);
+                const float error = evaluate(block, palette, refinedIndices);
+                if (error >= bestError) {
+                    break;
+                }
+                best[0] = refined[0];
+                best[1] = refined[1];
+                bestError = error;
+                indices = refinedIndices;
+            }
+
+            // greedy +-1 steps on every 565 component, the quantized least squares result is rarely the best pair
+            static const int kLimits[3] = { 31, 63, 31 };
+            bool improved = true;
+            for (int pass = 0; pass < kMaxSearchPasses && improved && bestError > 0.0f; ++pass) {
+                improved = false;
+                for (int component = 0; component < 6; ++component) {
+                    for (int delta = -1; delta <= 1; delta += 2) {
+                        Endpoint565 candidate[2] = { best[0], best[1] };
+                        int* channels[3] = { &candidate[component / 3].r, &candidate[component / 3].g, &candidate[component / 3].b };
+                        int& value = *channels[component % 3];
+                        value += delta;
+                        if (value < 0 || value > kLimits[component % 3]) {
+                            continue;
+                        }
+
+                        uint32_t candidateIndices;
+                        BuildColorPalette(candidate[0], candidate[1], threeColors, palette);
+                        const float error = evaluate(block, palette, candidateIndices);
+                        if (error < bestError) {
+                            best[0] = candidate[0];
+                            best[1] = candidate[1];
+                            bestError = error;
+                            indices = candidateIndices;
+                            improved = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        c0 = Pack565(best[0]);
+        c1 = Pack565(best[1]);
+
+        if (threeColors) {
+            // the decoder picks the mode from the endpoint order, c0 <= c1 here
+            if (c0 > c1) {
+                std::swap(c0, c1);
+                for (int i = 0; i < 16; ++i) {
+                    const uint32_t idx = (indices >> (i * 2)) & 3;
+                    if (idx < 2) {
+                        indices ^= 1u << (i * 2);
+                    }
+                }
+            }
+            for (int i = 0; i < 16; ++i) {
+                if (block.w[i] == 0.0f) {
+                    indices |= 3u << (i * 2);
+                }
+            }
+        } else if (c0 < c1) {
+            // and c0 > c1 for 4 colors, flipping the low bit swaps 0 <-> 1 and 2 <-> 3
+            std::swap(c0, c1);
+            indices ^= 0x55555555;
+        } else if (c0 == c1) {
+            // would be decoded as 3 colors, but every entry we'd pick is c0 anyway
+            indices = 0;
+        }
+    }
+
+    dst[0] = scast<uint8_t>(c0 & 0xFF);
+    dst[1] = scast<uint8_t>(c0 >> 8);
+    dst[2] = scast<uint8_t>(c1 & 0xFF);
+    dst[3] = scast<uint8_t>(c1 >> 8);
+    std::memcpy(dst + 4, &indices, sizeof(indices));
+}
+
+
+// same palette as the decoder, a0 > a1 gives 8 interpolated values, otherwise 6 plus 0 and 255
+static void BuildAlphaPalette(const int a0, const int a1, int (&palette)[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 2; i < 8; ++i) {
+            palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 1) / 7;
+        }
+    } else {
+        for (int i = 2; i < 6; ++i) {
+            palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static int EvaluateAlpha(const uint8_t (&alphas)[16], const int a0, const int a1, uint64_t& indices) {
+    int palette[8];
+    BuildAlphaPalette(a0, a1, palette);
+
+    int error = 0;
+    indices = 0;
+    for (int i = 0; i < 16; ++i) {
+        int best = INT_MAX;
+        uint64_t bestIdx = 0;
+        for (int j = 0; j < 8; ++j) {
+            const int d = (alphas[i] - palette[j]) * (alphas[i] - palette[j]);
+            if (d < best) {
+                best = d;
+                bestIdx = scast<uint64_t>(j);
+            }
+        }
+        error += best;
+        indices |= bestIdx << (i * 3);
+    }
+    return error;
+}
+
+// the search only needs the error, and blocks rarely have 16 different alphas
+struct AlphaHistogram {
+    int values[16];
+    int counts[16];
+    int numValues;
+};
+
+static int EvaluateAlphaHistogram(const AlphaHistogram& histogram, const int a0, const int a1) {
+    int palette[8];
+    BuildAlphaPalette(a0, a1, palette);
+
+    int error = 0;
+    for (int i = 0; i < histogram.numValues; ++i) {
+        int best = INT_MAX;
+        for (int j = 0; j < 8; ++j) {
+            best = std::min(best, (histogram.values[i] - palette[j]) * (histogram.values[i] - palette[j]));
+        }
+        error += best * histogram.counts[i];
+    }
+    return error;
+}
+
+static void EncodeAlphaBlockBC3(const uint8_t (&alphas)[16], const BCEncodeQuality quality, uint8_t* dst) {
+    const int minAlpha = *std::min_element(std::begin(alphas), std::end(alphas));
+    const int maxAlpha = *std::max_element(std::begin(alphas), std::end(alphas));
+
+    int a0 = maxAlpha, a1 = minAlpha;
+    uint64_t indices = 0;
+    int bestError = EvaluateAlpha(alphas, a0, a1, indices);
+
+    if (quality == BCEncodeQuality::High && bestError > 0) {
+        // the 6 value mode spends its range on the values in between and gets 0 and 255 for free
+        int innerMin = 255, innerMax = 0;
+        for (const uint8_t a : alphas) {
+            if (a != 0 && a != 255) {
+                innerMin = std::min<int>(innerMin, a);
+                innerMax = std::max<int>(innerMax, a);
+            }
+        }
+
+        struct Candidate {
+            int a0, a1;
+        };
+        MyArray<Candidate> candidates = { { a0, a1 } };
+        if (innerMin <= innerMax) {
+            candidates.push_back({ innerMin, innerMax });
+        }
+
+        AlphaHistogram histogram = {};
+        for (const uint8_t a : alphas) {
+            int i = 0;
+            while (i < histogram.numValues && histogram.values[i] != a) {
+                ++i;
+            }
+            if (i == histogram.numValues) {
+                histogram.values[histogram.numValues++] = a;
+            }
+            ++histogram.counts[i];
+        }
+
+        for (const Candidate& start : candidates) {
+            const bool eightValues = start.a0 > start.a1;
+            Candidate best = start;
+            int error = EvaluateAlphaHistogram(histogram, best.a0, best.a1);
+
+            bool improved = true;
+            for (int pass = 0; pass < kMaxSearchPasses && improved && error > 0; ++pass) {
+                improved = false;
+                for (int step = 0; step < 4; ++step) {
+                    Candidate c = best;
+                    int& value = (step < 2) ? c.a0 : c.a1;
+                    value += (step & 1) ? 1 : -1;
+                    // stepping over the other endpoint would flip the mode
+                    if (value < 0 || value > 255 || (c.a0 > c.a1) != eightValues) {
+                        continue;
+                    }
+
+                    const int candidateError = EvaluateAlphaHistogram(histogram, c.a0, c.a1);
+                    if (candidateError < error) {
+                        best = c;
+                        error = candidateError;
+                        improved = true;
+                    }
+                }
+            }
+
+            if (error < bestError) {
+                a0 = best.a0;
+                a1 = best.a1;
+                bestError = error;
+            }
+        }
+
+        EvaluateAlpha(alphas, a0, a1, indices);
+    }
+
+    dst[0] = scast<uint8_t>(a0);
+    dst[1] = scast<uint8_t>(a1);
+    for (int i = 0; i < 6; ++i) {
+        dst[2 + i] = scast<uint8_t>(indices >> (i * 8));
+    }
+}
+
+static void EncodeAlphaBlockBC2(const uint8_t (&alphas)[16], uint8_t* dst) {
+    // nearest n * 17
+    for (int i = 0; i < 8; ++i) {
+        const int lo = (alphas[i * 2 + 0] + 8) / 17;
+        const int hi = (alphas[i * 2 + 1] + 8) / 17;
+        dst[i] = scast<uint8_t>(lo | (hi << 4));
+    }
+}
+
+
+struct EncodeContext {
+    BCFormat        format;
+    BCEncodeQuality quality;
+    ColorErrorFunc  evaluate;
+    const uint8_t*  src;
+    uint32_t        width;
+    uint32_t        height;
+    uint8_t*        dst;
+};
+
+static void EncodeBlockRow(const EncodeContext& ctx, const size_t by) {
+    const size_t blockSize = BCGetBlockSize(ctx.format);
+    const size_t blocksX = (ctx.width + 3) / 4;
+    const size_t pitch = scast<size_t>(ctx.width) * 4;
+    uint8_t* dst = ctx.dst + by * blocksX * blockSize;
+
+    for (size_t bx = 0; bx < blocksX; ++bx, dst += blockSize) {
+        ColorBlock block;
+        uint8_t alphas[16];
+        bool hasTransparent = false;
+
+        for (size_t y = 0; y < 4; ++y) {
+            const size_t sy = std::min<size_t>(by * 4 + y, ctx.height - 1);
+            for (size_t x = 0; x < 4; ++x) {
+                const size_t sx = std::min<size_t>(bx * 4 + x, ctx.width - 1);
+                const uint8_t* texel = ctx.src + sy * pitch + sx * 4;
+                const size_t i = y * 4 + x;
+                block.r[i] = scast<float>(texel[0]);
+                block.g[i] = scast<float>(texel[1]);
+                block.b[i] = scast<float>(texel[2]);
+                block.w[i] = 1.0f;
+                alphas[i] = texel[3];
+                hasTransparent = hasTransparent || texel[3] < 128;
+            }
+        }
+
+        if (ctx.format == BCFormat::BC1) {
+            if (hasTransparent) {
+                for (size_t i = 0; i < 16; ++i) {
+                    block.w[i] = (alphas[i] < 128) ? 0.0f : 1.0f;
+                }
+            }
+            EncodeColorBlock(block, hasTransparent, ctx.quality, ctx.evaluate, dst);
+        } else {
+            // colors hidden by alpha matter less, the weights stay small enough to keep the sums exact
+            for (size_t i = 0; i < 16; ++i) {
+                block.w[i] = scast<float>(1 + (alphas[i] >> 6));
+            }
+
+            if (ctx.format == BCFormat::BC2) {
+                EncodeAlphaBlockBC2(alphas, dst);
+            } else {
+                EncodeAlphaBlockBC3(alphas, ctx.quality, dst);
+            }
+            EncodeColorBlock(block, false, ctx.quality, ctx.evaluate, dst + 8);
+        }
+    }
+}
+
+void BCEncodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst,
+                   const BCEncodeQuality quality, const size_t numThreads) {
+    BCEncodeImage(format, src, width, height, dst, quality, numThreads, GetSupportedSIMDLevel());
+}
+
+void BCEncodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst,
+                   const BCEncodeQuality quality, const size_t numThreads, const SIMDLevel level) {
+    if (!width || !height) {
+        return;
+    }
+
+    EncodeContext ctx;
+    ctx.format = format;
+    ctx.quality = quality;
+    ctx.evaluate = GetColorErrorFunc(std::min(level, GetSupportedSIMDLevel()));
+    ctx.src = src;
+    ctx.width = width;
+    ctx.height = height;
+    ctx.dst = dst;
+
+    const size_t blocksY = (height + 3) / 4;
+    ParallelFor(blocksY, [&ctx](const size_t by) {
+        EncodeBlockRow(ctx, by);
+    }, numThreads);
+}
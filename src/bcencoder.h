@@ -0,0 +1,19 @@
+#pragma once
+#include "mycommon.h"
+#include "bcdecoder.h"
+
+enum class BCEncodeQuality : int {
+    Fast,   // principal axis endpoints, one pass
+    High    // plus least squares refinement and a 565 endpoint search
+};
+
+// Encodes tightly packed RGBA pixels (width * height * 4 bytes) into BCn blocks, dst must hold
+// BCGetImageSize(format, width, height) bytes. Partial edge blocks repeat the last row/column.
+// Block rows are spread over numThreads threads (0 means all cores), candidate endpoints are scored
+// with the best SIMD path the CPU supports. The error is measured against what BCDecodeImage returns.
+// BC1 blocks with any alpha below 128 use the 3 color mode with transparent black.
+void    BCEncodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst,
+                      const BCEncodeQuality quality, const size_t numThreads);
+// Same, but forces a specific code path (clamped to what the CPU supports)
+void    BCEncodeImage(const BCFormat format, const uint8_t* src, const uint32_t width, const uint32_t height, uint8_t* dst,
+                      const BCEncodeQuality quality, const size_t numThreads, const SIMDLevel level);
@@ -0,0 +1,553 @@
+#include "../sh2texture.h"
+#include "../sh2map.h"
+#include "../sh2model.h"
+#include "../sh2file.h"
+#include "../mappedfile.h"
+#include "../textureexport.h"
+#include "../textureimport.h"
+#include "selftest.h"
+
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <tuple>
+
+
+struct Options {
+    bool        recursive = false;
+    bool        png = false;
+    bool        fast = false;
+    bool        dither = false;
+    size_t      numThreads = 0;
+    fs::path    output;
+    fs::path    images;
+    fs::path    manifest;
+    StringArray positional;
+};
+
+static std::mutex sLogMutex;
+
+template <typename... Args>
+static void LogLine(const char* fmt, Args... args) {
+    std::lock_guard<std::mutex> lock(sLogMutex);
+    std::fprintf(stdout, fmt, args...);
+    std::fputc('\n', stdout);
+}
+
+template <typename... Args>
+static void ErrorLine(const char* fmt, Args... args) {
+    std::lock_guard<std::mutex> lock(sLogMutex);
+    std::fprintf(stderr, fmt, args...);
+    std::fputc('\n', stderr);
+}
+
+static const char* SH2FormatToString(const SH2Texture::Format format, const bool isPS2) {
+    switch (format) {
+        case SH2Texture::Format::DXT1: return "DXT1";
+        case SH2Texture::Format::DXT2: return "DXT2";
+        case SH2Texture::Format::DXT3: return "DXT3";
+        case SH2Texture::Format::DXT4: return "DXT4";
+        case SH2Texture::Format::DXT5: return isPS2 ? "Paletted4" : "DXT5";
+        case SH2Texture::Format::Paletted: return "Paletted8";
+        case SH2Texture::Format::RGBX8: return "RGBX8";
+        case SH2Texture::Format::RGBA8: return "RGBA8";
+        default: return "Unknown";
+    }
+}
+
+struct InputFile {
+    fs::path    path;
+    fs::path    relativeFolder;     // relative to the input folder it was found in, empty for direct inputs
+
+    bool operator <(const InputFile& other) const {
+        return path < other.path;
+    }
+};
+
+static MyArray<InputFile> CollectFiles(const StringArray& inputs, const bool recursive) {
+    MyArray<InputFile> result;
+
+    std::error_code ec{};
+    for (const CharString& input : inputs) {
+        const fs::path inputPath = fs::u8path(input);
+        if (fs::is_directory(inputPath, ec)) {
+            if (recursive) {
+                for (const fs::directory_entry& e : fs::recursive_directory_iterator(inputPath, ec)) {
+                    if (e.is_regular_file(ec) && IsSH2FileExtension(e.path())) {
+                        result.push_back({ e.path(), e.path().parent_path().lexically_relative(inputPath) });
+                    }
+                }
+            } else {
+                for (const fs::directory_entry& e : fs::directory_iterator(inputPath, ec)) {
+                    if (e.is_regular_file(ec) && IsSH2FileExtension(e.path())) {
+                        result.push_back({ e.path(), fs::path() });
+                    }
+                }
+            }
+        } else {
+            result.push_back({ inputPath, fs::path() });
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+static int CommandInfo(const Options& options) {
+    const MyArray<InputFile> files = CollectFiles(options.positional, options.recursive);
+
+    int result = 0;
+    for (const InputFile& input : files) {
+        const fs::path& path = input.path;
+
+        SH2File file;
+        if (!file.Load(path)) {
+            ErrorLine("%s: failed to load", path.u8string().c_str());
+            result = 1;
+            continue;
+        }
+
+        LogLine("%s: %zu texture(s)", path.u8string().c_str(), file.container->GetNumTextures());
+        for (size_t i = 0; i < file.container->GetNumTextures(); ++i) {
+            const SH2Texture* texture = file.container->GetTexture(i);
+            LogLine("  [%zu] id: %u, %ux%u, %s%s", i, texture->GetID(), texture->GetWidth(), texture->GetHeight(),
+                    SH2FormatToString(texture->GetFormat(), texture->IsPS2File()),
+                    texture->IsPS2File() ? ", PS2" : "");
+        }
+    }
+
+    return result;
+}
+
+static int CommandExport(const Options& options) {
+    if (options.positional.empty() || options.output.empty()) {
+        ErrorLine("export: input and --output are required");
+        return 1;
+    }
+
+    const MyArray<InputFile> files = CollectFiles(options.positional, options.recursive);
+
+    // folder structure is mirrored, so same-named files from different folders don't clash
+    MyArray<BatchExportJob> jobs;
+    for (const InputFile& input : files) {
+        fs::path outputFolder = options.output;
+        if (!input.relativeFolder.empty() && input.relativeFolder != ".") {
+            outputFolder /= input.relativeFolder;
+        }
+        jobs.push_back({ input.path, outputFolder });
+    }
+
+    std::atomic<size_t> numExported{ 0 };
+    std::atomic<uint64_t> totalBytes{ 0 };
+    const auto startTime = std::chrono::steady_clock::now();
+
+    const size_t numFailed = ExportTexturesBatch(jobs, options.png, options.numThreads, [&](const BatchExportFileStats& stats) {
+        if (!stats.loaded) {
+            ErrorLine("%s: failed to load", stats.source.u8string().c_str());
+            return;
+        }
+
+        if (stats.numFailed) {
+            ErrorLine("%s: failed to export %zu texture(s)", stats.source.u8string().c_str(), stats.numFailed);
+        }
+
+        numExported += stats.numTextures - stats.numFailed;
+        totalBytes += stats.bytesWritten;
+
+        const double megabytes = scast<double>(stats.bytesWritten) / (1024.0 * 1024.0);
+        LogLine("%s: %zu texture(s), %.2f MB in %.1f ms (%.1f MB/s)", stats.source.u8string().c_str(), stats.numTextures,
+                megabytes, stats.seconds * 1000.0, (stats.seconds > 0.0) ? (megabytes / stats.seconds) : 0.0);
+    });
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const double totalMegabytes = scast<double>(totalBytes.load()) / (1024.0 * 1024.0);
+    LogLine("Exported %zu texture(s) from %zu file(s) in %.2f sec (%.1f MB/s), %zu failure(s)", numExported.load(), files.size(),
+            elapsed, (elapsed > 0.0) ? (totalMegabytes / elapsed) : 0.0, numFailed);
+
+    return numFailed ? 1 : 0;
+}
+
+static TextureImportOptions MakeImportOptions(const Options& options) {
+    TextureImportOptions importOptions;
+    importOptions.quality = options.fast ? BCEncodeQuality::Fast : BCEncodeQuality::High;
+    importOptions.dither = options.dither;
+    importOptions.numThreads = options.numThreads;
+    return importOptions;
+}
+
+static int CommandImport(const Options& options) {
+    if (options.positional.size() < 3) {
+        ErrorLine("import: expected <file> <texture index> <image.dds|png>, or one .png per palette");
+        return 1;
+    }
+
+    const fs::path srcPath = fs::u8path(options.positional[0]);
+    const size_t idx = scast<size_t>(std::strtoull(options.positional[1].c_str(), nullptr, 10));
+    MyArray<fs::path> imagePaths;
+    for (size_t i = 2; i < options.positional.size(); ++i) {
+        imagePaths.push_back(fs::u8path(options.positional[i]));
+    }
+    const fs::path dstPath = options.output.empty() ? srcPath : options.output;
+
+    SH2File file;
+    if (!file.Load(srcPath)) {
+        ErrorLine("%s: failed to load", srcPath.u8string().c_str());
+        return 1;
+    }
+
+    if (idx >= file.container->GetNumTextures()) {
+        ErrorLine("%s: texture index %zu is out of range", srcPath.u8string().c_str(), idx);
+        return 1;
+    }
+
+    CharString error;
+    if (!ImportTextureFromFiles(file.container->GetTexture(idx), imagePaths, MakeImportOptions(options), error)) {
+        ErrorLine("%s: %s", imagePaths.front().u8string().c_str(), error.c_str());
+        return 1;
+    }
+
+    if (!file.Save(dstPath)) {
+        ErrorLine("%s: failed to save", dstPath.u8string().c_str());
+        return 1;
+    }
+
+    LogLine("%s: replaced texture %zu", dstPath.u8string().c_str(), idx);
+    return 0;
+}
+
+static const size_t kNoPaletteIdx = ~size_t(0);
+
+static bool IsNumber(const CharString& s) {
+    return !s.empty() && std::all_of(s.begin(), s.end(), [](const char c) { return c >= '0' && c <= '9'; });
+}
+
+// exported images are named <stem>_<index>.dds|png, in the same folder structure as the sources.
+// PS2 textures with several palettes can take a <stem>_<index>_p<palette>.png for each of them instead
+static bool ParseExportedImageName(const fs::path& imagePath, CharString& stem, size_t& textureIdx, size_t& paletteIdx) {
+    const WideString ext = imagePath.extension().wstring();
+    if (!WStrEqualsCaseInsensitive(ext, L".dds") && !WStrEqualsCaseInsensitive(ext, L".png")) {
+        return false;
+    }
+
+    CharString name = imagePath.stem().u8string();
+    paletteIdx = kNoPaletteIdx;
+
+    const size_t paletteUnderscore = name.rfind("_p");
+    if (paletteUnderscore != CharString::npos && paletteUnderscore > 0 && IsNumber(name.substr(paletteUnderscore + 2)) && WStrEqualsCaseInsensitive(ext, L".png")) {
+        const size_t prevUnderscore = name.rfind('_', paletteUnderscore - 1);
+        if (prevUnderscore != CharString::npos && IsNumber(name.substr(prevUnderscore + 1, paletteUnderscore - prevUnderscore - 1))) {
+            paletteIdx = scast<size_t>(std::strtoull(name.c_str() + paletteUnderscore + 2, nullptr, 10));
+            name.resize(paletteUnderscore);
+        }
+    }
+
+    const size_t underscore = name.rfind('_');
+    if (underscore == CharString::npos || underscore == 0 || underscore + 1 == name.size()) {
+        return false;
+    }
+
+    const CharString idxString = name.substr(underscore + 1);
+    if (!IsNumber(idxString)) {
+        return false;
+    }
+
+    stem = name.substr(0, underscore);
+    textureIdx = scast<size_t>(std::strtoull(idxString.c_str(), nullptr, 10));
+    return true;
+}
+
+static fs::path MakeOutputPath(const Options& options, const InputFile& input) {
+    if (options.output.empty()) {
+        return input.path;
+    }
+
+    fs::path result = options.output;
+    if (!input.relativeFolder.empty() && input.relativeFolder != ".") {
+        result /= input.relativeFolder;
+    }
+    return result / input.path.filename();
+}
+
+// manifest lines are <file>|<texture index>|<image>, or with a |<image> for every palette of a PS2 texture,
+// paths are relative to the manifest, # starts a comment
+static bool ReadManifest(const Options& options, MyArray<BatchImportJob>& jobs) {
+    MemStream stream = MapFileToStream(options.manifest);
+    if (!stream) {
+        ErrorLine("%s: failed to read the manifest", options.manifest.u8string().c_str());
+        return false;
+    }
+
+    const fs::path manifestFolder = options.manifest.parent_path();
+    const CharString text(rcast<const char*>(stream.Data()), stream.Length());
+
+    MyDict<CharString, size_t> jobsBySource;
+    MyDict<CharString, fs::path> sourcesByOutput;
+    size_t lineNumber = 0;
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == CharString::npos) {
+            lineEnd = text.size();
+        }
+
+        CharString line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        ++lineNumber;
+
+        const size_t comment = line.find('#');
+        if (comment != CharString::npos) {
+            line.resize(comment);
+        }
+        while (!line.empty() && std::isspace(scast<unsigned char>(line.back()))) {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        const size_t sep0 = line.find('|');
+        const size_t sep1 = (sep0 == CharString::npos) ? CharString::npos : line.find('|', sep0 + 1);
+        if (sep1 == CharString::npos) {
+            ErrorLine("%s:%zu: expected <file>|<texture index>|<image>", options.manifest.u8string().c_str(), lineNumber);
+            return false;
+        }
+
+        const CharString idxString = line.substr(sep0 + 1, sep1 - sep0 - 1);
+        if (!IsNumber(idxString)) {
+            ErrorLine("%s:%zu: texture index \"%s\" is not a number", options.manifest.u8string().c_str(), lineNumber, idxString.c_str());
+            return false;
+        }
+
+        const fs::path source = manifestFolder / fs::u8path(line.substr(0, sep0));
+        const size_t textureIdx = scast<size_t>(std::strtoull(idxString.c_str(), nullptr, 10));
+        MyArray<fs::path> images;
+        for (size_t sep = sep1; sep != CharString::npos; ) {
+            const size_t next = line.find('|', sep + 1);
+            images.push_back(manifestFolder / fs::u8path(line.substr(sep + 1, (next == CharString::npos) ? CharString::npos : next - sep - 1)));
+            sep = next;
+        }
+
+        const CharString key = source.lexically_normal().u8string();
+        auto it = jobsBySource.find(key);
+        if (it == jobsBySource.end()) {
+            // the output folder is flat, two sources with the same name from different folders would overwrite each other
+            const InputFile input = { source, fs::path() };
+            const fs::path output = MakeOutputPath(options, input);
+            const CharString outputKey = output.lexically_normal().u8string();
+            auto sameOutput = sourcesByOutput.find(outputKey);
+            if (sameOutput != sourcesByOutput.end()) {
+                ErrorLine("%s:%zu: %s and %s would both be saved as %s", options.manifest.u8string().c_str(), lineNumber,
+                          sameOutput->second.u8string().c_str(), source.u8string().c_str(), output.u8string().c_str());
+                return false;
+            }
+
+            sourcesByOutput.emplace(outputKey, source);
+            it = jobsBySource.emplace(key, jobs.size()).first;
+            jobs.push_back({ source, output, {} });
+        }
+        jobs[it->second].replacements.push_back({ textureIdx, std::move(images) });
+    }
+
+    return true;
+}
+
+// matches <images>/<relative folder>/<stem>_<index>.dds|png against the collected sources
+static bool MatchExportedImages(const Options& options, MyArray<BatchImportJob>& jobs) {
+    const MyArray<InputFile> files = CollectFiles(options.positional, options.recursive);
+
+    // sources are keyed by their relative folder and stem, same as the export names them
+    MyDict<CharString, size_t> jobsByKey;
+    for (const InputFile& input : files) {
+        const fs::path folder = (input.relativeFolder == ".") ? fs::path() : input.relativeFolder;
+        const CharString key = (folder / input.path.stem()).generic_u8string();
+        if (jobsByKey.count(key)) {
+            ErrorLine("%s: another source has the same name, its images would be ambiguous", input.path.u8string().c_str());
+            return false;
+        }
+
+        jobsByKey.emplace(key, jobs.size());
+        jobs.push_back({ input.path, MakeOutputPath(options, input), {} });
+    }
+
+    struct PaletteImage {
+        size_t      jobIdx;
+        size_t      textureIdx;
+        size_t      paletteIdx;
+        fs::path    path;
+    };
+    MyArray<PaletteImage> paletteImages;
+
+    std::error_code ec{};
+    for (const fs::directory_entry& e : fs::recursive_directory_iterator(options.images, ec)) {
+        CharString stem;
+        size_t textureIdx = 0, paletteIdx = kNoPaletteIdx;
+        if (!e.is_regular_file(ec) || !ParseExportedImageName(e.path(), stem, textureIdx, paletteIdx)) {
+            continue;
+        }
+
+        fs::path folder = e.path().parent_path().lexically_relative(options.images);
+        if (folder == ".") {
+            folder.clear();
+        }
+
+        auto it = jobsByKey.find((folder / fs::u8path(stem)).generic_u8string());
+        if (it == jobsByKey.end()) {
+            continue;
+        }
+
+        if (paletteIdx == kNoPaletteIdx) {
+            jobs[it->second].replacements.push_back({ textureIdx, { e.path() } });
+        } else {
+            paletteImages.push_back({ it->second, textureIdx, paletteIdx, e.path() });
+        }
+    }
+
+    // per palette images become one replacement, they have to go _p0, _p1 and so on
+    std::sort(paletteImages.begin(), paletteImages.end(), [](const PaletteImage& a, const PaletteImage& b) {
+        return std::tie(a.jobIdx, a.textureIdx, a.paletteIdx) < std::tie(b.jobIdx, b.textureIdx, b.paletteIdx);
+    });
+    for (size_t i = 0; i < paletteImages.size(); ) {
+        const PaletteImage& first = paletteImages[i];
+        BatchImportReplacement replacement = { first.textureIdx, {} };
+        for (; i < paletteImages.size() && paletteImages[i].jobIdx == first.jobIdx && paletteImages[i].textureIdx == first.textureIdx; ++i) {
+            if (paletteImages[i].paletteIdx != replacement.images.size()) {
+                ErrorLine("%s: palette images of texture %zu don't go from _p0 up without gaps", jobs[first.jobIdx].source.u8string().c_str(), first.textureIdx);
+                return false;
+            }
+            replacement.images.push_back(paletteImages[i].path);
+        }
+        jobs[first.jobIdx].replacements.push_back(std::move(replacement));
+    }
+
+    // untouched sources don't need re-saving
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const BatchImportJob& job) {
+        return job.replacements.empty();
+    }), jobs.end());
+
+    // .dds and .png (or per palette images) for the same texture, no way to tell which one is meant
+    for (BatchImportJob& job : jobs) {
+        std::sort(job.replacements.begin(), job.replacements.end(), [](const auto& a, const auto& b) {
+            return a.textureIdx < b.textureIdx;
+        });
+        for (size_t i = 1; i < job.replacements.size(); ++i) {
+            if (job.replacements[i - 1].textureIdx == job.replacements[i].textureIdx) {
+                ErrorLine("%s: more than one image for texture %zu", job.source.u8string().c_str(), job.replacements[i].textureIdx);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int CommandInject(const Options& options) {
+    MyArray<BatchImportJob> jobs;
+    if (!options.manifest.empty()) {
+        if (!ReadManifest(options, jobs)) {
+            return 1;
+        }
+    } else if (!options.images.empty() && !options.positional.empty()) {
+        if (!MatchExportedImages(options, jobs)) {
+            return 1;
+        }
+    } else {
+        ErrorLine("inject: expected --manifest <file>, or inputs and --images <folder>");
+        return 1;
+    }
+
+    std::atomic<size_t> numReplaced{ 0 };
+    const auto startTime = std::chrono::steady_clock::now();
+
+    const size_t numFailed = ImportTexturesBatch(jobs, MakeImportOptions(options), options.numThreads, [&](const BatchImportFileStats& stats) {
+        for (const CharString& error : stats.errors) {
+            ErrorLine("%s: %s", stats.source.u8string().c_str(), error.c_str());
+        }
+
+        if (stats.saved) {
+            numReplaced += stats.numReplaced;
+            LogLine("%s: replaced %zu texture(s) in %.1f ms", stats.output.u8string().c_str(), stats.numReplaced, stats.seconds * 1000.0);
+        } else if (stats.loaded) {
+            ErrorLine("%s: not saved", stats.source.u8string().c_str());
+        }
+    });
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    LogLine("Replaced %zu texture(s) in %zu file(s) in %.2f sec, %zu failure(s)", numReplaced.load(), jobs.size(), elapsed, numFailed);
+
+    return numFailed ? 1 : 0;
+}
+
+static void PrintUsage() {
+    std::fprintf(stdout,
+                 "usage: sh2tex-cli <command> [options] <inputs...>\n"
+                 "\n"
+                 "commands:\n"
+                 "  info   <file|folder>...                     list textures\n"
+                 "  export <file|folder>... -o <folder>         extract all textures\n"
+                 "  import <file> <index> <image.dds|png> [-o <file>] replace a texture\n"
+                 "  import <file> <index> <image.png>... [-o <file>] replace a multi-palette PS2 texture, one image per palette\n"
+                 "  inject <file|folder>... --images <folder> [-o <folder>]\n"
+                 "                                              replace textures from <name>_<index>.dds|png images\n"
+                 "                                              (or <name>_<index>_p<palette>.png, one per palette)\n"
+                 "  inject --manifest <file> [-o <folder>]      replace textures listed as <file>|<index>|<image>[|<image>...]\n"
+                 "  selftest                                    check the SIMD code paths against the reference ones\n"
+                 "\n"
+                 "options:\n"
+                 "  -r, --recursive     walk folders recursively\n"
+                 "  -o, --output        output folder (export, inject) or file (import), in place if omitted\n"
+                 "  --images            folder with the edited images, laid out the way export writes them\n"
+                 "  --manifest          text file listing the replacements\n"
+                 "  --png               export as PNG instead of DDS\n"
+                 "  --fast              quicker, lower quality DXT compression of PNG images (import, inject)\n"
+                 "  --dither            dither true color images going into paletted textures (import, inject)\n"
+                 "  -j, --threads N     number of worker threads (default: all cores)\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    const CharString command = argv[1];
+
+    Options options;
+    for (int i = 2; i < argc; ++i) {
+        const CharString arg = argv[i];
+        if (arg == "-r" || arg == "--recursive") {
+            options.recursive = true;
+        } else if (arg == "--png") {
+            options.png = true;
+        } else if (arg == "--fast") {
+            options.fast = true;
+        } else if (arg == "--dither") {
+            options.dither = true;
+        } else if ((arg == "-o" || arg == "--output") && (i + 1) < argc) {
+            options.output = fs::u8path(argv[++i]);
+        } else if (arg == "--images" && (i + 1) < argc) {
+            options.images = fs::u8path(argv[++i]);
+        } else if (arg == "--manifest" && (i + 1) < argc) {
+            options.manifest = fs::u8path(argv[++i]);
+        } else if ((arg == "-j" || arg == "--threads") && (i + 1) < argc) {
+            options.numThreads = scast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        } else {
+            options.positional.push_back(arg);
+        }
+    }
+
+    if (command == "info") {
+        return CommandInfo(options);
+    } else if (command == "export") {
+        return CommandExport(options);
+    } else if (command == "import") {
+        return CommandImport(options);
+    } else if (command == "inject") {
+        return CommandInject(options);
+    } else if (command == "selftest") {
+        return RunSelfTest() ? 1 : 0;
+    } else {
+        PrintUsage();
+        return 1;
+    }
+}
@@ -0,0 +1,1244 @@
+#include "selftest.h"
+#include "../mycommon.h"
+#include "../cpufeatures.h"
+#include "../ps2textures.h"
+#include "../bcdecoder.h"
+#include "../bcencoder.h"
+#include "../pixelconvert.h"
+#include "../sh2texture.h"
+#include "../texturedecoder.h"
+#include "../sh2map.h"
+#include "../filewritestream.h"
+#include "../mappedfile.h"
+#include "../pngfile.h"
+#include "../palettequantizer.h"
+#include "../libs/bcdec/bcdec.h"
+
+#include <cstdio>
+#include <cstdarg>
+#include <thread>
+
+
+// every check reports the first mismatch only, a broken path usually breaks everywhere
+struct SelfTest {
+    std::mt19937    rng{ 0x534832u };
+    size_t          numChecks = 0;
+    size_t          numFailed = 0;
+
+    void Check(const bool ok, const char* fmt, ...) {
+        ++numChecks;
+        if (!ok) {
+            ++numFailed;
+            std::va_list args;
+            va_start(args, fmt);
+            std::fputs("FAILED: ", stderr);
+            std::vfprintf(stderr, fmt, args);
+            std::fputc('\n', stderr);
+            va_end(args);
+        }
+    }
+
+    BytesArray RandomBytes(const size_t count) {
+        BytesArray result(count);
+        for (uint8_t& b : result) {
+            b = scast<uint8_t>(rng());
+        }
+        return result;
+    }
+};
+
+// SIMD levels up to what the running CPU (and SH2TEX_SIMD) allows
+static MyArray<SIMDLevel> GetTestLevels() {
+    MyArray<SIMDLevel> result;
+    for (int i = 0; i <= scast<int>(GetSupportedSIMDLevel()); ++i) {
+        result.push_back(scast<SIMDLevel>(i));
+    }
+    return result;
+}
+
+static const char* LayoutToString(const PixelLayout layout) {
+    switch (layout) {
+        case PixelLayout::RGBA: return "RGBA";
+        case PixelLayout::BGRA: return "BGRA";
+        case PixelLayout::RGBAPremultiplied: return "RGBAPremultiplied";
+        default: return "Unknown";
+    }
+}
+
+// plain per-pixel conversion of RGBA to the layout, written independently of the pixel ops
+static void ReferenceFromRGBA(uint8_t* pixels, const size_t numPixels, const PixelLayout layout) {
+    for (size_t i = 0; i < numPixels; ++i, pixels += 4) {
+        if (layout == PixelLayout::BGRA) {
+            std::swap(pixels[0], pixels[2]);
+        } else if (layout == PixelLayout::RGBAPremultiplied) {
+            const uint32_t a = pixels[3];
+            for (int j = 0; j < 3; ++j) {
+                pixels[j] = scast<uint8_t>((pixels[j] * a + 127) / 255);
+            }
+        }
+    }
+}
+
+
+//// BCn decoding - every format, layout and SIMD level against bcdec, edge blocks included
+
+static void TestBCDecode(SelfTest& test) {
+    struct Size { uint32_t width, height; };
+    static const Size kSizes[] = { { 4, 4 }, { 1, 1 }, { 3, 5 }, { 13, 7 }, { 17, 33 }, { 64, 4 }, { 100, 37 }, { 256, 128 } };
+    static const PixelLayout kLayouts[] = { PixelLayout::RGBA, PixelLayout::BGRA, PixelLayout::RGBAPremultiplied };
+    static const char* kFormatNames[] = { "BC1", "BC2", "BC3" };
+
+    const MyArray<SIMDLevel> levels = GetTestLevels();
+
+    for (const BCFormat format : { BCFormat::BC1, BCFormat::BC2, BCFormat::BC3 }) {
+        for (const Size& size : kSizes) {
+            const size_t blocksX = (size.width + 3) / 4, blocksY = (size.height + 3) / 4;
+            const size_t blockSize = BCGetBlockSize(format);
+            const BytesArray blocks = test.RandomBytes(blocksX * blocksY * blockSize);
+
+            // bcdec into a block-aligned image, then cropped
+            const size_t alignedPitch = blocksX * 16;
+            BytesArray aligned(alignedPitch * blocksY * 4);
+            for (size_t by = 0; by < blocksY; ++by) {
+                for (size_t bx = 0; bx < blocksX; ++bx) {
+                    const uint8_t* block = blocks.data() + (by * blocksX + bx) * blockSize;
+                    uint8_t* dst = aligned.data() + by * 4 * alignedPitch + bx * 16;
+                    if (format == BCFormat::BC1) {
+                        bcdec_bc1(block, dst, scast<int>(alignedPitch));
+                    } else if (format == BCFormat::BC2) {
+                        bcdec_bc2(block, dst, scast<int>(alignedPitch));
+                    } else {
+                        bcdec_bc3(block, dst, scast<int>(alignedPitch));
+                    }
+                }
+            }
+            const size_t pitch = scast<size_t>(size.width) * 4;
+            BytesArray reference(pitch * size.height);
+            for (size_t y = 0; y < size.height; ++y) {
+                std::memcpy(reference.data() + y * pitch, aligned.data() + y * alignedPitch, pitch);
+            }
+
+            BytesArray decoded(reference.size());
+            BCDecodeImage(format, blocks.data(), size.width, size.height, decoded.data());
+            test.Check(decoded == reference, "%s decode %ux%u", kFormatNames[scast<int>(format)], size.width, size.height);
+
+            for (const PixelLayout layout : kLayouts) {
+                BytesArray expected = reference;
+                ReferenceFromRGBA(expected.data(), scast<size_t>(size.width) * size.height, layout);
+
+                for (const SIMDLevel level : levels) {
+                    std::fill(decoded.begin(), decoded.end(), uint8_t(0xCD));
+                    BCDecodeImage(format, blocks.data(), size.width, size.height, decoded.data(), layout, level);
+                    test.Check(decoded == expected, "%s decode %ux%u %s %s", kFormatNames[scast<int>(format)],
+                               size.width, size.height, LayoutToString(layout), SIMDLevelToString(level));
+                }
+            }
+        }
+    }
+}
+
+
+//// PS2 swizzling - the direct page tables against the emulated GS memory
+
+static void TestPS2Swizzle(SelfTest& test) {
+    struct Size { int width, height; };
+    static const Size kSizes8[] = { { 128, 64 }, { 256, 128 }, { 128, 256 }, { 512, 512 } };
+    static const Size kSizes4[] = { { 128, 128 }, { 256, 128 }, { 128, 512 }, { 512, 512 } };
+
+    for (const bool is4Bit : { false, true }) {
+        for (const Size& size : (is4Bit ? kSizes4 : kSizes8)) {
+            const int ww = size.width, hh = size.height;
+            const int rrw = ww >> 1;
+            const int rrh = is4Bit ? (hh >> 2) : (hh >> 1);
+            const size_t dataSize = is4Bit ? scast<size_t>(ww) * hh / 2 : scast<size_t>(ww) * hh;
+            const char* name = is4Bit ? "PSMT4" : "PSMT8";
+
+            // unswizzle
+            const BytesArray swizzled = test.RandomBytes(dataSize);
+            BytesArray expected(dataSize), actual(dataSize);
+            {
+                PS2GSMemory gsmem;
+                gsmem.WriteTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, swizzled.data());
+                if (is4Bit) {
+                    gsmem.ReadTexPSMT4(0, ww >> 6, 0, 0, ww, hh, expected.data());
+                } else {
+                    gsmem.ReadTexPSMT8(0, ww >> 6, 0, 0, ww, hh, expected.data());
+                }
+            }
+            const bool unswizzled = is4Bit ? PS2UnswizzlePSMT4(swizzled.data(), actual.data(), ww, hh)
+                                           : PS2UnswizzlePSMT8(swizzled.data(), actual.data(), ww, hh);
+            test.Check(unswizzled && actual == expected, "%s unswizzle %dx%d", name, ww, hh);
+
+            // and back
+            const BytesArray linear = test.RandomBytes(dataSize);
+            {
+                PS2GSMemory gsmem;
+                if (is4Bit) {
+                    gsmem.WriteTexPSMT4(0, ww >> 6, 0, 0, ww, hh, linear.data());
+                } else {
+                    gsmem.WriteTexPSMT8(0, ww >> 6, 0, 0, ww, hh, linear.data());
+                }
+                gsmem.ReadTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, expected.data());
+            }
+            const bool swizzledOk = is4Bit ? PS2SwizzlePSMT4(linear.data(), actual.data(), ww, hh)
+                                           : PS2SwizzlePSMT8(linear.data(), actual.data(), ww, hh);
+            test.Check(swizzledOk && actual == expected, "%s swizzle %dx%d", name, ww, hh);
+        }
+    }
+
+    // sizes that aren't whole pages are left to the GS memory
+    BytesArray src(64 * 32), dst(64 * 32);
+    test.Check(!PS2UnswizzlePSMT8(src.data(), dst.data(), 64, 32), "PSMT8 rejects 64x32");
+    test.Check(!PS2SwizzlePSMT8(src.data(), dst.data(), 64, 32), "PSMT8 rejects 64x32");
+    test.Check(!PS2UnswizzlePSMT4(src.data(), dst.data(), 64, 32), "PSMT4 rejects 64x32");
+    test.Check(!PS2SwizzlePSMT4(src.data(), dst.data(), 64, 32), "PSMT4 rejects 64x32");
+}
+
+
+//// 4 bit indices - every SIMD level against a plain per-nibble loop, in place too
+
+static void TestNibbles(SelfTest& test) {
+    static const size_t kCounts[] = { 0, 1, 2, 15, 31, 32, 33, 63, 64, 65, 127, 1000, 4097 };
+
+    for (const size_t numPixels : kCounts) {
+        const size_t packedSize = (numPixels + 1) / 2;
+        const BytesArray packed = test.RandomBytes(packedSize);
+        const BytesArray indices = test.RandomBytes(numPixels);   // high nibbles set, packing has to drop them
+
+        BytesArray unpackedRef(numPixels), packedRef(packedSize, 0);
+        for (size_t i = 0; i < numPixels; ++i) {
+            unpackedRef[i] = (packed[i / 2] >> ((i & 1) * 4)) & 0x0F;
+            packedRef[i / 2] |= scast<uint8_t>((indices[i] & 0x0F) << ((i & 1) * 4));
+        }
+
+        for (const SIMDLevel level : GetTestLevels()) {
+            const char* levelName = SIMDLevelToString(level);
+
+            BytesArray unpacked(numPixels, 0xCD);
+            IndicesUnpack4Bit(packed.data(), unpacked.data(), numPixels, level);
+            test.Check(unpacked == unpackedRef, "unpack %zu indices %s", numPixels, levelName);
+
+            BytesArray inPlace(numPixels, 0xCD);
+            std::copy(packed.begin(), packed.end(), inPlace.begin());
+            IndicesUnpack4Bit(inPlace.data(), inPlace.data(), numPixels, level);
+            test.Check(inPlace == unpackedRef, "unpack %zu indices in place %s", numPixels, levelName);
+
+            BytesArray repacked(packedSize, 0xCD);
+            IndicesPack4Bit(indices.data(), repacked.data(), numPixels, level);
+            test.Check(repacked == packedRef, "pack %zu indices %s", numPixels, levelName);
+
+            inPlace = indices;
+            IndicesPack4Bit(inPlace.data(), inPlace.data(), numPixels, level);
+            test.Check(std::equal(packedRef.begin(), packedRef.end(), inPlace.begin()), "pack %zu indices in place %s", numPixels, levelName);
+        }
+    }
+}
+
+
+//// pixel conversions - every SIMD level against plain per-pixel loops, vector tails and in place calls included
+
+static void TestPixelConversions(SelfTest& test) {
+    static const size_t kCounts[] = { 0, 1, 3, 7, 9, 33 };
+    static const PixelLayout kLayouts[] = { PixelLayout::RGBA, PixelLayout::BGRA, PixelLayout::RGBAPremultiplied };
+    const size_t kGuardSize = 16;
+
+    struct Conversion {
+        CharString  name;
+        std::function<void(const uint8_t*, uint8_t*, size_t, SIMDLevel)> func;
+        std::function<void(uint8_t*)> reference;  // one pixel, in place
+    };
+
+    MyArray<Conversion> conversions = {
+        { "PixelsSwapRedBlue",
+          [](const uint8_t* src, uint8_t* dst, size_t n, SIMDLevel level) { PixelsSwapRedBlue(src, dst, n, level); },
+          [](uint8_t* px) { std::swap(px[0], px[2]); } },
+        { "PixelsFromPS2",
+          [](const uint8_t* src, uint8_t* dst, size_t n, SIMDLevel level) { PixelsFromPS2(src, dst, n, level); },
+          [](uint8_t* px) {
+              std::swap(px[0], px[2]);
+              px[3] = (px[3] == 0x80) ? 0xFF : scast<uint8_t>((px[3] << 1) | (px[3] & 1));
+          } },
+        { "PixelsToPS2",
+          [](const uint8_t* src, uint8_t* dst, size_t n, SIMDLevel level) { PixelsToPS2(src, dst, n, level); },
+          [](uint8_t* px) {
+              std::swap(px[0], px[2]);
+              px[3] = (px[3] == 0xFF) ? 0x80 : scast<uint8_t>(px[3] >> 1);
+          } },
+    };
+    for (const PixelLayout layout : kLayouts) {
+        conversions.push_back({ CharString("PixelsFromBGRA ") + LayoutToString(layout),
+            [layout](const uint8_t* src, uint8_t* dst, size_t n, SIMDLevel level) { PixelsFromBGRA(src, dst, n, layout, level); },
+            [layout](uint8_t* px) {
+                std::swap(px[0], px[2]);
+                ReferenceFromRGBA(px, 1, layout);
+            } });
+    }
+
+    for (const Conversion& conv : conversions) {
+        for (const size_t numPixels : kCounts) {
+            // the PS2 alpha edge cases show up in short runs too
+            BytesArray src = test.RandomBytes(numPixels * 4);
+            for (size_t i = 0; i < numPixels; i += 3) {
+                src[i * 4 + 3] = (i % 2) ? 0x80 : 0xFF;
+            }
+
+            BytesArray expected = src;
+            for (size_t i = 0; i < numPixels; ++i) {
+                conv.reference(expected.data() + i * 4);
+            }
+
+            for (const SIMDLevel level : GetTestLevels()) {
+                const char* levelName = SIMDLevelToString(level);
+
+                // guard bytes catch tails written past numPixels
+                BytesArray dst(src.size() + kGuardSize, 0xCD);
+                conv.func(src.data(), dst.data(), numPixels, level);
+                test.Check(std::equal(expected.begin(), expected.end(), dst.begin()) &&
+                           std::all_of(dst.begin() + src.size(), dst.end(), [](const uint8_t b) { return b == 0xCD; }),
+                           "%s %zu pixels %s", conv.name.c_str(), numPixels, levelName);
+
+                BytesArray inPlace = src;
+                conv.func(inPlace.data(), inPlace.data(), numPixels, level);
+                test.Check(inPlace == expected, "%s %zu pixels in place %s", conv.name.c_str(), numPixels, levelName);
+            }
+        }
+    }
+}
+
+
+//// palette lookup - every SIMD level against a plain table lookup, both the in-register and the gather path
+
+static void TestPaletteLookup(SelfTest& test) {
+    static const size_t kCounts[] = { 0, 1, 7, 31, 32, 33, 63, 64, 65, 1000, 4097 };
+    // 16 and below take the in-register path, the rest gathers
+    static const size_t kNumColors[] = { 2, 16, 17, 256 };
+
+    for (const size_t numColors : kNumColors) {
+        // entries past numColors stay 0 as the small path expects, so any stray index has to come out black
+        const BytesArray paletteBytes = test.RandomBytes(256 * 4);
+        MyArray<uint32_t> palette(256, 0);
+        std::memcpy(palette.data(), paletteBytes.data(), numColors * 4);
+
+        for (const size_t numPixels : kCounts) {
+            BytesArray indices = test.RandomBytes(numPixels);
+            if (numPixels > 1) {
+                indices[0] = scast<uint8_t>(numColors - 1);
+                indices[numPixels - 1] = 0xFF;
+            }
+
+            MyArray<uint32_t> expected(numPixels);
+            for (size_t i = 0; i < numPixels; ++i) {
+                expected[i] = palette[indices[i]];
+            }
+
+            for (const SIMDLevel level : GetTestLevels()) {
+                MyArray<uint32_t> pixels(numPixels + 1, 0xCDCDCDCD);
+                PixelsFromIndices(indices.data(), palette.data(), numColors, rcast<uint8_t*>(pixels.data()), numPixels, level);
+                test.Check(std::equal(expected.begin(), expected.end(), pixels.begin()) && pixels[numPixels] == 0xCDCDCDCD,
+                           "%zu pixels from %zu colors %s", numPixels, numColors, SIMDLevelToString(level));
+            }
+        }
+    }
+}
+
+
+//// save size estimates - saving into memory should allocate once, and CalculateStreamSize() be exact
+
+static void WriteTexture_PC(SelfTest& test, MemWriteStream& stream, const uint32_t id, const SH2Texture::Format format, const uint16_t width, const uint16_t height) {
+    const bool isDXT1 = (format == SH2Texture::Format::DXT1);
+    const uint32_t dataSize = isDXT1 ? (width * height / 2) : (width * height * (format == SH2Texture::Format::Paletted ? 1 : 4));
+
+    SH2TextureHeader header = { id, width, height, width, height, 1, 0 };
+    SH2TextureHeader2 header2 = {};
+    SH2SpriteHeader sprite = {};
+    sprite.id = id;
+    sprite.width = width;
+    sprite.height = height;
+    sprite.format = scast<uint8_t>(format);
+    sprite.isCompressed = isDXT1 ? 1 : 0;
+    sprite.dataSize = dataSize;
+    sprite.dataSize2 = dataSize + 16;
+    sprite.marker = 0x9900;
+
+    stream.Write(header);
+    stream.Write(header2);
+    stream.Write(sprite);
+    const BytesArray data = test.RandomBytes(dataSize);
+    stream.Write(data.data(), data.size());
+
+    if (format == SH2Texture::Format::Paletted) {
+        SH2SpriteHeader paletteHeader = {};
+        paletteHeader.id = id;
+        paletteHeader.x = 8;
+        paletteHeader.dataSize = 1024;
+        paletteHeader.dataSize2 = 1024 + 16;
+        paletteHeader.marker = 0x9900;
+        stream.Write(paletteHeader);
+        const BytesArray palette = test.RandomBytes(1024);
+        stream.Write(palette.data(), palette.size());
+    }
+}
+
+// returns the raw palette bytes it wrote
+static BytesArray WriteTexture_PS2(SelfTest& test, MemWriteStream& stream, const uint32_t id, const SH2Texture::Format format, const uint16_t width, const uint16_t height, const uint16_t numPalettes) {
+    const bool is4Bit = (format == SH2Texture::Format::Paletted4);
+    const uint32_t dataSize = is4Bit ? (((width * 4 + 7) / 8) * height) : (width * height * (format == SH2Texture::Format::Paletted ? 1 : 4));
+    const uint32_t headerSize = 128;
+
+    SH2SpriteHeader sprite = {};
+    sprite.id = id;
+    sprite.width = width;
+    sprite.height = height;
+    sprite.format = scast<uint8_t>(format);
+    sprite.dataSize = dataSize;
+    sprite.dataSize2 = dataSize + headerSize;
+    sprite.marker = 0x9999;
+
+    stream.Write(sprite);
+    stream.WriteDupByte(0, headerSize - sizeof(sprite));
+    const BytesArray data = test.RandomBytes(dataSize);
+    stream.Write(data.data(), data.size());
+
+    if (format == SH2Texture::Format::Paletted || is4Bit) {
+        // a single palette is stored as is, more of them get interleaved in 4 KB CLUT blocks
+        const uint32_t paletteSize = is4Bit ? 64 : 1024;
+        const uint32_t paletteDataSize = (numPalettes == 1) ? paletteSize : 4096 * ((numPalettes * paletteSize + 4095) / 4096);
+
+        SH2TexturePaletteHeader_SH2 paletteHeader = {};
+        paletteHeader.paletteDataSize = paletteDataSize;
+        paletteHeader.unknown_0 = paletteDataSize;
+        paletteHeader.unknown_1 = paletteDataSize;
+        paletteHeader.palettesCount = numPalettes;
+        paletteHeader.numColors = is4Bit ? 16 : 32;
+        paletteHeader.readSize = is4Bit ? 32 : 64;
+        stream.Write(paletteHeader);
+        const BytesArray palettes = test.RandomBytes(paletteDataSize);
+        stream.Write(palettes.data(), palettes.size());
+        return palettes;
+    }
+
+    return BytesArray();
+}
+
+// saves, checks the allocations and the estimate, then loads the result back and saves again
+template <typename T>
+static void CheckSaveEstimate(SelfTest& test, T& object, const char* name) {
+    MemWriteStream saved(0);
+    const bool ok = object.SaveToStream(saved);
+    test.Check(ok && saved.GetNumReallocs() <= 1, "%s saves with %zu reallocations", name, saved.GetNumReallocs());
+    test.Check(ok && saved.GetWrittenBytesCount() == object.CalculateStreamSize(), "%s writes %zu bytes, estimated %zu",
+               name, saved.GetWrittenBytesCount(), object.CalculateStreamSize());
+
+    T reloaded;
+    MemStream stream(saved.Data(), saved.GetWrittenBytesCount());
+    MemWriteStream resaved(0);
+    const bool roundTrip = reloaded.LoadFromStream(stream) && reloaded.SaveToStream(resaved) &&
+                           resaved.GetWrittenBytesCount() == saved.GetWrittenBytesCount() &&
+                           std::memcmp(resaved.Data(), saved.Data(), saved.GetWrittenBytesCount()) == 0;
+    test.Check(roundTrip, "%s saves the same bytes after a reload", name);
+}
+
+static void TestSaveEstimates(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    // PC container
+    {
+        MemWriteStream source;
+        const SH2TextureContainerHeader header = { 0x19990901, 0, 0, 0 };
+        source.Write(header);
+        WriteTexture_PC(test, source, 1, Format::DXT1, 64, 64);
+        WriteTexture_PC(test, source, 2, Format::Paletted, 96, 32);
+        WriteTexture_PC(test, source, 3, Format::RGBA8, 64, 48);
+        source.Write(SH2TextureContainerHeader{});
+
+        SH2TextureContainer container;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        test.Check(container.LoadFromStream(stream), "PC container loads");
+        CheckSaveEstimate(test, container, "PC container");
+    }
+
+    // PS2 textures, page-aligned and odd sized ones take different (un)swizzle paths
+    struct PS2Texture { Format format; uint16_t width, height, numPalettes; const char* name; };
+    static const PS2Texture kPS2Textures[] = {
+        { Format::Paletted4, 128, 128, 1, "PS2 Paletted4 128x128" },
+        { Format::Paletted4, 64, 32, 1, "PS2 Paletted4 64x32" },
+        { Format::Paletted4, 128, 128, 8, "PS2 Paletted4 128x128, 8 palettes" },
+        { Format::Paletted, 128, 64, 1, "PS2 Paletted8 128x64" },
+        { Format::Paletted, 64, 64, 4, "PS2 Paletted8 64x64, 4 palettes" },
+        { Format::RGBX8, 32, 32, 0, "PS2 RGBX8 32x32" },
+    };
+    for (const PS2Texture& t : kPS2Textures) {
+        MemWriteStream source;
+        WriteTexture_PS2(test, source, 1, t.format, t.width, t.height, t.numPalettes);
+
+        SH2TextureContainer container;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        test.Check(container.LoadFromStream(stream), "%s loads", t.name);
+        CheckSaveEstimate(test, container, t.name);
+    }
+
+    // PC map, a textures sub-data between two opaque ones
+    {
+        MemWriteStream textures;
+        const SH2TextureContainerHeader header = { 0x19990901, 0, 0, 0 };
+        textures.Write(header);
+        WriteTexture_PC(test, textures, 1, Format::DXT1, 128, 64);
+        WriteTexture_PC(test, textures, 2, Format::Paletted, 64, 64);
+        textures.Write(SH2TextureContainerHeader{});
+
+        const BytesArray geometry = test.RandomBytes(3000);
+        MemWriteStream source;
+        source.Write(SH2MapHeader{ 0x20010510, 0, 3, 0 });
+        source.Write(SH2MapSubDataHeader{ 1, scast<uint32_t>(geometry.size()), 0, 0 });
+        source.Write(geometry.data(), geometry.size());
+        source.Write(SH2MapSubDataHeader{ 2, scast<uint32_t>(textures.GetWrittenBytesCount()), 0, 0 });
+        source.Append(textures);
+        source.Write(SH2MapSubDataHeader{ 3, scast<uint32_t>(geometry.size()), 0, 0 });
+        source.Write(geometry.data(), geometry.size());
+
+        SH2Map map;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        test.Check(map.LoadFromStream(stream), "PC map loads");
+        CheckSaveEstimate(test, map, "PC map");
+    }
+
+    // PS2 map, textures sit at the offsets listed in the header
+    {
+        MemWriteStream texture0, texture1;
+        WriteTexture_PS2(test, texture0, 1, Format::Paletted4, 64, 32, 1);
+        WriteTexture_PS2(test, texture1, 2, Format::Paletted, 128, 64, 1);
+
+        uint32_t header[12] = { 0x77777777 };
+        header[4] = sizeof(header);
+        header[5] = scast<uint32_t>(sizeof(header) + texture0.GetWrittenBytesCount());
+        header[10] = 2;
+
+        MemWriteStream source;
+        source.Write(header);
+        source.Append(texture0);
+        source.Append(texture1);
+        const BytesArray tail = test.RandomBytes(1000);
+        source.Write(tail.data(), tail.size());
+
+        SH2Map map;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        test.Check(map.LoadFromStream(stream), "PS2 map loads");
+        CheckSaveEstimate(test, map, "PS2 map");
+    }
+}
+
+
+//// BCn encoding - every SIMD level and thread count give the same blocks, odd sizes stay inside BCGetImageSize()
+
+static void TestBCEncode(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    struct Size { uint32_t width, height; };
+    static const Size kSizes[] = { { 4, 4 }, { 1, 1 }, { 3, 5 }, { 37, 29 }, { 64, 36 } };
+    static const char* kFormatNames[] = { "BC1", "BC2", "BC3" };
+    static const char* kQualityNames[] = { "Fast", "High" };
+    const size_t kGuardSize = 64;
+
+    const MyArray<SIMDLevel> levels = GetTestLevels();
+
+    for (const BCFormat format : { BCFormat::BC1, BCFormat::BC2, BCFormat::BC3 }) {
+        for (const Size& size : kSizes) {
+            const BytesArray pixels = test.RandomBytes(scast<size_t>(size.width) * size.height * 4);
+            const size_t blocksSize = BCGetImageSize(format, size.width, size.height);
+
+            for (const BCEncodeQuality quality : { BCEncodeQuality::Fast, BCEncodeQuality::High }) {
+                // guard bytes past the end catch an encoder writing more than the size helper promises
+                BytesArray expected(blocksSize + kGuardSize, 0xCD);
+                BCEncodeImage(format, pixels.data(), size.width, size.height, expected.data(), quality, 1, SIMDLevel::Scalar);
+                test.Check(std::all_of(expected.begin() + blocksSize, expected.end(), [](const uint8_t b) { return b == 0xCD; }),
+                           "%s %s encode %ux%u stays within %zu bytes", kFormatNames[scast<int>(format)], kQualityNames[scast<int>(quality)],
+                           size.width, size.height, blocksSize);
+
+                for (const SIMDLevel level : levels) {
+                    for (const size_t numThreads : { size_t(1), size_t(0) }) {
+                        BytesArray encoded(expected.size(), 0xCD);
+                        BCEncodeImage(format, pixels.data(), size.width, size.height, encoded.data(), quality, numThreads, level);
+                        test.Check(encoded == expected, "%s %s encode %ux%u %s, %zu threads", kFormatNames[scast<int>(format)],
+                                   kQualityNames[scast<int>(quality)], size.width, size.height, SIMDLevelToString(level), numThreads);
+                    }
+                }
+            }
+        }
+    }
+
+    // a DXT texture replaced with an image whose sides aren't multiples of 4 keeps all of its edge blocks
+    {
+        MemWriteStream source;
+        source.Write(SH2TextureContainerHeader{ 0x19990901, 0, 0, 0 });
+        WriteTexture_PC(test, source, 1, Format::DXT1, 64, 64);
+        source.Write(SH2TextureContainerHeader{});
+
+        SH2TextureContainer container;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        if (!container.LoadFromStream(stream) || container.GetNumTextures() != 1) {
+            test.Check(false, "DXT1 texture loads");
+            return;
+        }
+
+        const uint32_t width = 37, height = 29;
+        const BytesArray pixels = test.RandomBytes(scast<size_t>(width) * height * 4);
+        BytesArray blocks(BCGetImageSize(BCFormat::BC1, width, height));
+        BCEncodeImage(BCFormat::BC1, pixels.data(), width, height, blocks.data(), BCEncodeQuality::Fast, 0);
+
+        SH2Texture* texture = container.GetTexture(0);
+        texture->Replace(Format::DXT1, width, height, blocks.data());
+        test.Check(texture->CalculateDataSize() == blocks.size() && std::equal(blocks.begin(), blocks.end(), texture->GetData()),
+                   "DXT1 %ux%u replace keeps all %zu bytes", width, height, blocks.size());
+
+        MemWriteStream saved;
+        bool ok = container.SaveToStream(saved);
+        MemStream savedStream(saved.Data(), saved.GetWrittenBytesCount());
+        SH2TextureContainer reloaded;
+        ok = ok && reloaded.LoadFromStream(savedStream) && reloaded.GetNumTextures() == 1;
+        const SH2Texture* reloadedTexture = ok ? reloaded.GetTexture(0) : nullptr;
+        test.Check(ok && reloadedTexture->GetWidth() == width && reloadedTexture->GetHeight() == height &&
+                   std::equal(blocks.begin(), blocks.end(), reloadedTexture->GetData()), "DXT1 %ux%u survives a save", width, height);
+    }
+}
+
+
+//// band decoding - big textures split into bands of block rows over several threads decode the same as in one pass
+
+static void TestBandDecode(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    // heights that aren't multiples of the band height leave a short last band, 517 ends in a partial block row too
+    struct BigTexture { Format format; uint32_t width, height; const char* name; };
+    static const BigTexture kTextures[] = {
+        { Format::DXT1, 1024, 517, "DXT1 1024x517" },
+        { Format::DXT5, 600, 500, "DXT5 600x500" },
+        { Format::Paletted, 1024, 520, "Paletted 1024x520" },
+        { Format::RGBA8, 700, 450, "RGBA8 700x450" },
+    };
+    static const PixelLayout kLayouts[] = { PixelLayout::RGBA, PixelLayout::BGRA, PixelLayout::RGBAPremultiplied };
+
+    for (const BigTexture& t : kTextures) {
+        MemWriteStream source;
+        source.Write(SH2TextureContainerHeader{ 0x19990901, 0, 0, 0 });
+        WriteTexture_PC(test, source, 1, Format::DXT1, 64, 64);
+        source.Write(SH2TextureContainerHeader{});
+
+        SH2TextureContainer container;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        if (!container.LoadFromStream(stream) || container.GetNumTextures() != 1) {
+            test.Check(false, "%s base texture loads", t.name);
+            continue;
+        }
+
+        SH2Texture* texture = container.GetTexture(0);
+        size_t dataSize;
+        if (t.format == Format::DXT1 || t.format == Format::DXT5) {
+            dataSize = BCGetImageSize((t.format == Format::DXT1) ? BCFormat::BC1 : BCFormat::BC3, t.width, t.height);
+        } else {
+            dataSize = scast<size_t>(t.width) * t.height * ((t.format == Format::Paletted) ? 1 : 4);
+        }
+        const BytesArray data = test.RandomBytes(dataSize);
+        const BytesArray palette = test.RandomBytes(256 * 4);
+        texture->Replace(t.format, t.width, t.height, data.data(), (t.format == Format::Paletted) ? palette.data() : nullptr);
+
+        const size_t outputSize = scast<size_t>(t.width) * t.height * 4;
+        for (const PixelLayout layout : kLayouts) {
+            BytesArray expected(outputSize, 0xCD);
+            DecompressTexture(texture, expected, layout, 1);
+
+            for (const size_t numThreads : { size_t(0), size_t(3) }) {
+                BytesArray banded(outputSize, 0xCD);
+                DecompressTexture(texture, banded, layout, numThreads);
+                test.Check(banded == expected, "%s %s decoded in bands, %zu threads", t.name, LayoutToString(layout), numThreads);
+            }
+        }
+    }
+}
+
+
+//// failed saves - a save that can't finish must leave the file on disk as it was
+
+static bool FileEquals(const fs::path& path, const uint8_t* data, const size_t size) {
+    MemStream stream = ReadFileToStream(path);
+    return stream && stream.Length() == size && std::memcmp(stream.Data(), data, size) == 0;
+}
+
+static void TestFailedSaves(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    const fs::path path = fs::temp_directory_path() / "sh2tex_selftest.map";
+    fs::path tempPath = path;
+    tempPath += ".tmp";
+
+    // PS2 map with both textures at the same offset, loads fine but saving refuses the overlap
+    MemWriteStream texture;
+    WriteTexture_PS2(test, texture, 1, Format::Paletted, 128, 64, 1);
+
+    uint32_t header[12] = { 0x77777777 };
+    header[4] = sizeof(header);
+    header[5] = sizeof(header);
+    header[10] = 2;
+
+    MemWriteStream source;
+    source.Write(header);
+    source.Append(texture);
+    const uint8_t* original = rcast<const uint8_t*>(source.Data());
+    const size_t originalSize = source.GetWrittenBytesCount();
+
+    {
+        FileWriteStream file;
+        test.Check(file.Open(path), "can't create %s", path.u8string().c_str());
+        file.Write(original, originalSize);
+        test.Check(file.Close() && FileEquals(path, original, originalSize), "finished save replaces the file");
+    }
+
+    {
+        SH2Map map;
+        const bool loaded = map.LoadFromFile(path);
+        test.Check(loaded, "PS2 map with overlapping textures loads");
+        test.Check(loaded && !map.SaveToFile(path), "PS2 map with overlapping textures refuses to save");
+    }
+    test.Check(FileEquals(path, original, originalSize), "failed map save kept the file");
+    test.Check(!fs::exists(tempPath), "failed map save left %s behind", tempPath.u8string().c_str());
+
+    // a stream destroyed without Close() never got to finish either
+    {
+        const BytesArray garbage = test.RandomBytes(100);
+        FileWriteStream file;
+        file.Open(path);
+        file.Write(garbage.data(), garbage.size());
+    }
+    test.Check(FileEquals(path, original, originalSize), "unclosed stream kept the file");
+    test.Check(!fs::exists(tempPath), "unclosed stream left %s behind", tempPath.u8string().c_str());
+
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+
+//// PS2 CLUT layout - 256 color palettes have their 8 entry blocks swapped, 16 color ones are linear
+
+static void TestPS2Palettes(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    for (const Format format : { Format::Paletted4, Format::Paletted }) {
+        const size_t numEntries = (format == Format::Paletted4) ? 16 : 256;
+        const char* name = (format == Format::Paletted4) ? "Paletted4" : "Paletted8";
+
+        MemWriteStream source;
+        const BytesArray raw = WriteTexture_PS2(test, source, 1, format, 128, 128, 1);
+
+        SH2TextureContainer container;
+        MemStream stream(source.Data(), source.GetWrittenBytesCount());
+        if (!container.LoadFromStream(stream) || container.GetNumTextures() != 1) {
+            test.Check(false, "PS2 %s palette texture loads", name);
+            continue;
+        }
+
+        BytesArray expected(numEntries * 4);
+        for (size_t i = 0; i < numEntries; ++i) {
+            size_t stored = i;
+            if (numEntries == 256 && (i & 31) >= 8 && (i & 31) < 24) {
+                stored = ((i & 31) < 16) ? (i + 8) : (i - 8);
+            }
+            std::memcpy(expected.data() + i * 4, raw.data() + stored * 4, 4);
+        }
+        PixelsFromPS2(expected.data(), expected.data(), numEntries, SIMDLevel::Scalar);
+
+        const uint8_t* palette = container.GetTexture(0)->GetPalette(0);
+        test.Check(std::equal(expected.begin(), expected.end(), palette), "PS2 %s palette entry order", name);
+    }
+}
+
+
+//// palette quantizer - SIMD levels and thread counts agree, few enough colors come back exact, bad counts are refused
+
+// random pixels drawn from numDistinct colors
+static BytesArray RandomPixelsFromColors(SelfTest& test, const size_t numPixels, const size_t numDistinct) {
+    const BytesArray colors = test.RandomBytes(numDistinct * 4);
+    BytesArray pixels(numPixels * 4);
+    for (size_t i = 0; i < numPixels; ++i) {
+        std::memcpy(pixels.data() + i * 4, colors.data() + (test.rng() % numDistinct) * 4, 4);
+    }
+    return pixels;
+}
+
+static void TestQuantizer(SelfTest& test) {
+    const uint32_t width = 160, height = 100;
+    const size_t numPixels = scast<size_t>(width) * height;
+    const MyArray<SIMDLevel> levels = GetTestLevels();
+
+    // single image, with and without dithering, against the scalar single threaded run
+    for (const size_t numColors : { size_t(16), size_t(256) }) {
+        const BytesArray pixels = RandomPixelsFromColors(test, numPixels, 3000);
+        for (const bool dither : { false, true }) {
+            BytesArray expectedIndices(numPixels), expectedPalette(numColors * 4);
+            QuantizeImage(pixels.data(), width, height, numColors, dither, expectedIndices.data(), expectedPalette.data(), 1, SIMDLevel::Scalar);
+
+            for (const SIMDLevel level : levels) {
+                for (const size_t numThreads : { size_t(1), size_t(0) }) {
+                    BytesArray indices(numPixels), palette(numColors * 4);
+                    const bool ok = QuantizeImage(pixels.data(), width, height, numColors, dither, indices.data(), palette.data(), numThreads, level);
+                    test.Check(ok && indices == expectedIndices && palette == expectedPalette, "quantize to %zu colors%s %s, %zu threads",
+                               numColors, dither ? " dithered" : "", SIMDLevelToString(level), numThreads);
+                }
+            }
+        }
+    }
+
+    // no more colors than the palette holds, every pixel has to come back as it was
+    for (const size_t numColors : { size_t(2), size_t(16), size_t(256) }) {
+        const BytesArray pixels = RandomPixelsFromColors(test, numPixels, numColors);
+        BytesArray indices(numPixels), palette(numColors * 4);
+        bool exact = QuantizeImage(pixels.data(), width, height, numColors, true, indices.data(), palette.data(), 0);
+        for (size_t i = 0; i < numPixels && exact; ++i) {
+            exact = indices[i] < numColors && std::memcmp(palette.data() + indices[i] * 4, pixels.data() + i * 4, 4) == 0;
+        }
+        test.Check(exact, "%zu color image quantizes losslessly", numColors);
+    }
+
+    // several images sharing the indices, tuples instead of colors
+    {
+        const size_t numImages = 3, numColors = 16;
+        MyArray<BytesArray> images;
+        MyArray<const uint8_t*> imagePtrs;
+        for (size_t n = 0; n < numImages; ++n) {
+            images.push_back(RandomPixelsFromColors(test, numPixels, 500));
+        }
+        for (const BytesArray& image : images) {
+            imagePtrs.push_back(image.data());
+        }
+
+        BytesArray expectedIndices(numPixels), expectedPalettes(numImages * numColors * 4);
+        QuantizeImages(imagePtrs.data(), numImages, width, height, numColors, expectedIndices.data(), expectedPalettes.data(), 1, SIMDLevel::Scalar);
+
+        for (const SIMDLevel level : levels) {
+            for (const size_t numThreads : { size_t(1), size_t(0) }) {
+                BytesArray indices(numPixels), palettes(expectedPalettes.size());
+                const bool ok = QuantizeImages(imagePtrs.data(), numImages, width, height, numColors, indices.data(), palettes.data(), numThreads, level);
+                test.Check(ok && indices == expectedIndices && palettes == expectedPalettes, "quantize %zu images to %zu colors %s, %zu threads",
+                           numImages, numColors, SIMDLevelToString(level), numThreads);
+            }
+        }
+
+        // the same pixel of every image comes from one tuple, so few tuples are few colors for all of them
+        const BytesArray tupleIdx = RandomPixelsFromColors(test, numPixels, numColors);
+        MyArray<BytesArray> tupleImages(numImages, BytesArray(numPixels * 4));
+        MyArray<const uint8_t*> tuplePtrs;
+        for (size_t n = 0; n < numImages; ++n) {
+            const BytesArray colors = test.RandomBytes(numColors * 4);
+            for (size_t i = 0; i < numPixels; ++i) {
+                std::memcpy(tupleImages[n].data() + i * 4, colors.data() + (tupleIdx[i * 4] % numColors) * 4, 4);
+            }
+            tuplePtrs.push_back(tupleImages[n].data());
+        }
+
+        BytesArray indices(numPixels), palettes(numImages * numColors * 4);
+        bool exact = QuantizeImages(tuplePtrs.data(), numImages, width, height, numColors, indices.data(), palettes.data(), 0);
+        for (size_t n = 0; n < numImages && exact; ++n) {
+            for (size_t i = 0; i < numPixels && exact; ++i) {
+                exact = indices[i] < numColors && std::memcmp(palettes.data() + (n * numColors + indices[i]) * 4, tupleImages[n].data() + i * 4, 4) == 0;
+            }
+        }
+        test.Check(exact, "%zu images of %zu color tuples quantize losslessly", numImages, numColors);
+    }
+
+    // out of range counts must not write anything
+    {
+        const BytesArray pixels = RandomPixelsFromColors(test, numPixels, 100);
+        const uint8_t* imagePtr = pixels.data();
+        for (const size_t numColors : { size_t(0), size_t(1), size_t(257) }) {
+            BytesArray indices(numPixels, 0xCD), palette(257 * 4, 0xCD);
+            const bool ok = QuantizeImage(pixels.data(), width, height, numColors, false, indices.data(), palette.data(), 0);
+            const bool okMulti = QuantizeImages(&imagePtr, 1, width, height, numColors, indices.data(), palette.data(), 0);
+            const bool untouched = std::all_of(indices.begin(), indices.end(), [](const uint8_t b) { return b == 0xCD; }) &&
+                                   std::all_of(palette.begin(), palette.end(), [](const uint8_t b) { return b == 0xCD; });
+            test.Check(!ok && !okMulti && untouched, "quantizing to %zu colors is refused", numColors);
+        }
+    }
+}
+
+
+//// lazy loading - pixels referenced from an owning stream get read once, whichever thread asks first, and Replace wins over them
+
+static void TestLazyLoad(SelfTest& test) {
+    using Format = SH2Texture::Format;
+
+    MemWriteStream pcSource;
+    pcSource.Write(SH2TextureContainerHeader{ 0x19990901, 0, 0, 0 });
+    WriteTexture_PC(test, pcSource, 1, Format::DXT1, 64, 64);
+    WriteTexture_PC(test, pcSource, 2, Format::Paletted, 96, 32);
+    WriteTexture_PC(test, pcSource, 3, Format::RGBA8, 64, 48);
+    pcSource.Write(SH2TextureContainerHeader{});
+
+    MemWriteStream ps2Source;
+    WriteTexture_PS2(test, ps2Source, 1, Format::Paletted4, 128, 128, 2);
+
+    const MemWriteStream* sources[] = { &pcSource, &ps2Source };
+    const char* kNames[] = { "PC", "PS2" };
+    for (size_t si = 0; si < std::size(sources); ++si) {
+        const char* name = kNames[si];
+
+        // borrowed memory is read right away, that's the reference
+        SH2TextureContainer eager;
+        MemStream eagerStream(sources[si]->Data(), sources[si]->GetWrittenBytesCount());
+        // the lazy one holds the only reference to its copy of the file
+        SH2TextureContainer lazy;
+        MemStream lazyStream = eagerStream.Copy();
+        if (!eager.LoadFromStream(eagerStream) || !lazy.LoadFromStream(lazyStream) || eager.GetNumTextures() != lazy.GetNumTextures()) {
+            test.Check(false, "%s container loads from an owning stream", name);
+            continue;
+        }
+        lazyStream = MemStream();
+
+        const size_t numTextures = lazy.GetNumTextures();
+        const size_t kNumThreads = 8;
+        MyArray<MyArray<const uint8_t*>> seen(kNumThreads, MyArray<const uint8_t*>(numTextures));
+        {
+            MyArray<std::thread> threads;
+            for (size_t t = 0; t < kNumThreads; ++t) {
+                threads.emplace_back([&lazy, &seen, t, numTextures]() {
+                    for (size_t i = 0; i < numTextures; ++i) {
+                        // every thread starts on a different texture so they collide on all of them
+                        const size_t idx = (i + t) % numTextures;
+                        seen[t][idx] = lazy.GetTexture(idx)->GetData();
+                    }
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+
+        for (size_t i = 0; i < numTextures; ++i) {
+            const SH2Texture* expected = eager.GetTexture(i);
+            const SH2Texture* texture = lazy.GetTexture(i);
+            const size_t dataSize = (expected->GetFormat() == Format::Paletted4 && expected->IsPS2File())
+                ? scast<size_t>(expected->GetWidth()) * expected->GetHeight() : expected->CalculateDataSize();
+
+            const bool samePointer = std::all_of(seen.begin(), seen.end(), [&](const MyArray<const uint8_t*>& s) { return s[i] == texture->GetData(); });
+            test.Check(samePointer && std::equal(expected->GetData(), expected->GetData() + dataSize, texture->GetData()),
+                       "%s texture %zu read once with the same pixels from %zu threads", name, i, kNumThreads);
+        }
+
+        // replaced pixels must stay, not get overwritten by a late read of the old ones
+        if (si == 0) {
+            SH2TextureContainer pending;
+            MemStream pendingStream = eagerStream.Copy();
+            if (pending.LoadFromStream(pendingStream)) {
+                const BytesArray pixels = test.RandomBytes(32 * 16 * 4);
+                SH2Texture* texture = pending.GetTexture(0);
+                texture->Replace(Format::RGBA8, 32, 16, pixels.data());
+                test.Check(std::equal(pixels.begin(), pixels.end(), texture->GetData()), "%s texture replaced before its first read keeps the new pixels", name);
+            }
+
+            SH2Texture* texture = lazy.GetTexture(1);
+            const BytesArray pixels = test.RandomBytes(16 * 16 * 4);
+            texture->Replace(Format::RGBA8, 16, 16, pixels.data());
+            test.Check(std::equal(pixels.begin(), pixels.end(), texture->GetData()), "%s texture replaced after a threaded read keeps the new pixels", name);
+        } else {
+            SH2Texture* texture = lazy.GetTexture(0);
+            const size_t numPixels = scast<size_t>(texture->GetWidth()) * texture->GetHeight();
+            BytesArray indices = test.RandomBytes(numPixels);
+            for (uint8_t& idx : indices) {
+                idx &= 0x0F;
+            }
+            BytesArray palette(texture->GetPalette(), texture->GetPalette() + 16 * 4);
+            test.Check(texture->Replace_PS2(indices.data(), palette.data()) && std::equal(indices.begin(), indices.end(), texture->GetData()),
+                       "%s texture replaced after a threaded read keeps the new indices", name);
+        }
+    }
+}
+
+
+//// PNG loading - every deflate block type and the less common pixel formats against a plain per-sample reference
+
+// zlib streams made by the real zlib out of the rows PNGFixtureRow() generates (all with filter 0),
+// level 0 and the fixed, default and RLE strategies cover every block type and overlapping copies
+static const uint8_t kPNGZlib_Stored[] = {
+    0x78, 0x01, 0x01, 0x6E, 0x00, 0x91, 0xFF, 0x00, 0x00, 0x25, 0x4A, 0x6F, 0x94, 0xB9, 0xDE, 0x03,
+    0x28, 0x4D, 0x72, 0x97, 0xBC, 0xE1, 0x06, 0x2B, 0x50, 0x75, 0x9A, 0xBF, 0xE4, 0x00, 0x0B, 0x30,
+    0x55, 0x7A, 0x9F, 0xC4, 0xE9, 0x0E, 0x33, 0x58, 0x7D, 0xA2, 0xC7, 0xEC, 0x11, 0x36, 0x5B, 0x80,
+    0xA5, 0xCA, 0xEF, 0x00, 0x16, 0x3B, 0x60, 0x85, 0xAA, 0xCF, 0xF4, 0x19, 0x3E, 0x63, 0x88, 0xAD,
+    0xD2, 0xF7, 0x1C, 0x41, 0x66, 0x8B, 0xB0, 0xD5, 0xFA, 0x00, 0x21, 0x46, 0x6B, 0x90, 0xB5, 0xDA,
+    0xFF, 0x24, 0x49, 0x6E, 0x93, 0xB8, 0xDD, 0x02, 0x27, 0x4C, 0x71, 0x96, 0xBB, 0xE0, 0x05, 0x00,
+    0x2C, 0x51, 0x76, 0x9B, 0xC0, 0xE5, 0x0A, 0x2F, 0x54, 0x79, 0x9E, 0xC3, 0xE8, 0x0D, 0x32, 0x57,
+    0x7C, 0xA1, 0xC6, 0xEB, 0x10, 0xA7, 0x06, 0x32, 0xC9,
+};
+static const uint8_t kPNGZlib_Fixed[] = {
+    0x78, 0x01, 0x63, 0xE0, 0x35, 0x0A, 0xAF, 0x59, 0x78, 0xEC, 0xB5, 0x80, 0x69, 0x54, 0xFD, 0x92,
+    0x93, 0xEF, 0x84, 0x2D, 0x62, 0x9B, 0x96, 0x9F, 0xF9, 0x28, 0x66, 0x9D, 0xD0, 0xBA, 0xEA, 0xFC,
+    0x17, 0x49, 0xBB, 0xE4, 0x8E, 0xB5, 0x97, 0xBE, 0xCB, 0x38, 0xA6, 0x75, 0x6F, 0xB8, 0xFA, 0x4B,
+    0xDE, 0x85, 0x41, 0xC2, 0x36, 0xA9, 0x7D, 0xCD, 0xC5, 0x6F, 0xD2, 0x0E, 0xA9, 0x5D, 0xEB, 0xAF,
+    0xFC, 0x94, 0x73, 0xCE, 0xE8, 0xDD, 0x74, 0xFD, 0x8F, 0xA2, 0x5B, 0xF6, 0x84, 0xAD, 0xB7, 0xFE,
+    0xAB, 0x78, 0xE6, 0x4D, 0xDE, 0x71, 0x97, 0x49, 0xDD, 0xA7, 0x70, 0xDA, 0xEE, 0x07, 0xAC, 0x5A,
+    0xFE, 0x0C, 0xCA, 0x1E, 0xB9, 0x93, 0xB6, 0xDF, 0x61, 0x54, 0xF3, 0x2E, 0x98, 0xBA, 0xEB, 0x3E,
+    0x8B, 0xA6, 0x5F, 0xF1, 0x8C, 0xBD, 0x8F, 0xD8, 0x75, 0x02, 0xCB, 0x66, 0x1F, 0x78, 0xCA, 0xA5,
+    0x1F, 0x52, 0x39, 0xEF, 0xF0, 0x0B, 0x84, 0xDD, 0x0C, 0x7A, 0xC1, 0x15, 0x73, 0x0F, 0x3D, 0xE7,
+    0x31, 0x0C, 0xAB, 0x5E, 0x70, 0xF4, 0x15, 0xBF, 0x49, 0x64, 0xDD, 0xE2, 0x13, 0x6F, 0x85, 0xCC,
+    0x63, 0x1A, 0x97, 0x9D, 0xFE, 0x20, 0x6A, 0x15, 0xDF, 0xB2, 0xF2, 0xDC, 0x67, 0x84, 0xDD, 0x0C,
+    0x96, 0x71, 0xCD, 0x2B, 0xCE, 0x7E, 0x12, 0xB7, 0x49, 0x6C, 0x5B, 0x7D, 0xE1, 0xAB, 0x94, 0x7D,
+    0x4A, 0xE7, 0xBA, 0xCB, 0x3F, 0x64, 0x9D, 0xD2, 0x7B, 0x36, 0x5E, 0xFB, 0xAD, 0xE0, 0x9A, 0xD5,
+    0xBF, 0xE5, 0xE6, 0x3F, 0x84, 0xDD, 0x0C, 0x2E, 0x99, 0x7D, 0x9B, 0x6F, 0xFC, 0x55, 0x72, 0xCF,
+    0x99, 0xB8, 0xED, 0x36, 0x83, 0xAA, 0x57, 0xFE, 0x94, 0x9D, 0xF7, 0x98, 0x35, 0x7C, 0x8B, 0xA6,
+    0xEF, 0x79, 0xC8, 0xA6, 0x1D, 0x50, 0x3A, 0x6B, 0xFF, 0x13, 0x4E, 0x84, 0xDD, 0x00, 0xE7, 0x4B,
+    0x80, 0x21,
+};
+static const uint8_t kPNGZlib_Dynamic[] = {
+    0x78, 0xDA, 0xB5, 0x92, 0xC1, 0x0D, 0x00, 0x20, 0x08, 0x03, 0x6F, 0x34, 0x47, 0x63, 0x34, 0x46,
+    0x33, 0xEA, 0x93, 0x10, 0x14, 0xD3, 0xD7, 0xFD, 0x2E, 0x2D, 0x14, 0x18, 0x66, 0xEE, 0x8C, 0x08,
+    0x22, 0x3C, 0x85, 0x45, 0x64, 0x12, 0x7B, 0x96, 0x94, 0xF1, 0x0A, 0xC9, 0x6F, 0xC7, 0x77, 0x49,
+    0xBB, 0x63, 0x5B, 0x52, 0xC4, 0xF3, 0xCF, 0xA3, 0x17, 0x1D, 0xDB, 0x9F, 0x13, 0x1F, 0xEA, 0x36,
+    0x1E, 0xCA, 0x75, 0x2E, 0xA0, 0x5B, 0xE7, 0x01, 0xEA, 0x75, 0x22, 0x5C, 0xE7, 0xC6, 0x04, 0x9E,
+    0xA1, 0xB2, 0x50,
+};
+static const uint8_t kPNGZlib_RLE[] = {
+    0x78, 0x01, 0x1D, 0xC1, 0x21, 0xAC, 0x01, 0x50, 0x00, 0x00, 0xC0, 0x27, 0xD8, 0x04, 0x41, 0x13,
+    0x7E, 0x13, 0x48, 0x02, 0x99, 0xFC, 0x05, 0x89, 0xA0, 0x09, 0x9A, 0x20, 0xD8, 0x04, 0x41, 0x13,
+    0x34, 0x41, 0xB0, 0x09, 0x82, 0x26, 0x68, 0x82, 0x60, 0x13, 0x04, 0x4D, 0xD0, 0x04, 0xC1, 0x26,
+    0x08, 0x9A, 0xA0, 0xD9, 0xBC, 0xDD, 0x5D, 0x28, 0x50, 0xA7, 0xCF, 0x9C, 0x3D, 0x77, 0x92, 0x51,
+    0x28, 0xD3, 0x62, 0xC4, 0x8A, 0x13, 0x2F, 0x32, 0x51, 0xA8, 0xD2, 0x61, 0xC2, 0x86, 0x0B, 0x1F,
+    0xFE, 0xA2, 0x50, 0xA3, 0xC7, 0x8C, 0x1D, 0x37, 0x12, 0xE4, 0xA3, 0xD0, 0x64, 0xC8, 0x92, 0x23,
+    0x4F, 0xD2, 0x94, 0xA2, 0xD0, 0x66, 0xCC, 0x9A, 0x33, 0x6F, 0xB2, 0x54, 0xA2, 0xD0, 0x65, 0xCA,
+    0x96, 0x2B, 0x5F, 0x72, 0xFC, 0x47, 0x61, 0xC0, 0x82, 0x03, 0x0F, 0x52, 0x14, 0x69, 0x44, 0x3F,
+    0xEE, 0x73, 0xA0, 0xB1,
+};
+static const uint8_t kPNGZlib_RGBA16[] = {
+    0x78, 0xDA, 0x01, 0x7B, 0x00, 0x84, 0xFF, 0x00, 0x34, 0x59, 0x7E, 0xA3, 0xC8, 0xED, 0x12, 0x37,
+    0x5C, 0x81, 0xA6, 0xCB, 0xF0, 0x15, 0x3A, 0x5F, 0x84, 0xA9, 0xCE, 0xF3, 0x18, 0x3D, 0x62, 0x87,
+    0xAC, 0xD1, 0xF6, 0x1B, 0x40, 0x65, 0x8A, 0xAF, 0xD4, 0xF9, 0x1E, 0x43, 0x68, 0x8D, 0xB2, 0xD7,
+    0x00, 0x3F, 0x64, 0x89, 0xAE, 0xD3, 0xF8, 0x1D, 0x42, 0x67, 0x8C, 0xB1, 0xD6, 0xFB, 0x20, 0x45,
+    0x6A, 0x8F, 0xB4, 0xD9, 0xFE, 0x23, 0x48, 0x6D, 0x92, 0xB7, 0xDC, 0x01, 0x26, 0x4B, 0x70, 0x95,
+    0xBA, 0xDF, 0x04, 0x29, 0x4E, 0x73, 0x98, 0xBD, 0xE2, 0x00, 0x4A, 0x6F, 0x94, 0xB9, 0xDE, 0x03,
+    0x28, 0x4D, 0x72, 0x97, 0xBC, 0xE1, 0x06, 0x2B, 0x50, 0x75, 0x9A, 0xBF, 0xE4, 0x09, 0x2E, 0x53,
+    0x78, 0x9D, 0xC2, 0xE7, 0x0C, 0x31, 0x56, 0x7B, 0xA0, 0xC5, 0xEA, 0x0F, 0x34, 0x59, 0x7E, 0xA3,
+    0xC8, 0xED, 0xBB, 0xF9, 0x3C, 0xBD,
+};
+static const uint8_t kPNGZlib_Paletted4[] = {
+    0x78, 0xDA, 0x63, 0x70, 0x4C, 0xEB, 0xDE, 0x70, 0x95, 0xC1, 0xA7, 0x70, 0xDA, 0xEE, 0x07, 0x0C,
+    0xE1, 0x35, 0x0B, 0x8F, 0xBD, 0x66, 0x48, 0x6A, 0x5F, 0x73, 0xF1, 0x1B, 0x00, 0x85, 0xA6, 0x0C,
+    0x27,
+};
+static const uint8_t kPNGZlib_Grey1[] = {
+    0x78, 0xDA, 0x63, 0xF0, 0x2B, 0x66, 0x88, 0xAC, 0x63, 0x48, 0xE9, 0x04, 0x00, 0x0A, 0xA4, 0x02,
+    0x86,
+};
+
+struct PNGFixture {
+    const char*     name;
+    const uint8_t*  zlib;
+    size_t          zlibSize;
+    uint32_t        width;
+    uint32_t        height;
+    uint8_t         colorType;
+    uint8_t         bitDepth;
+    uint32_t        run;        // bytes repeat this many times, so RLE has something to find
+    uint8_t         mask;       // fewer distinct bytes make zlib go for a dynamic block
+};
+
+#define PNG_FIXTURE(zlib) kPNGZlib_##zlib, sizeof(kPNGZlib_##zlib)
+static const PNGFixture kPNGFixtures[] = {
+    { "stored",             PNG_FIXTURE(Stored),     7,  5, 2,  8, 1, 0xFF },
+    { "fixed Huffman",      PNG_FIXTURE(Fixed),     11,  6, 6,  8, 1, 0xFF },
+    { "dynamic Huffman",    PNG_FIXTURE(Dynamic),   24, 12, 6,  8, 1, 0xC0 },
+    { "RLE",                PNG_FIXTURE(RLE),       20,  8, 4,  8, 6, 0xFF },
+    { "16 bit RGBA",        PNG_FIXTURE(RGBA16),     5,  3, 6, 16, 1, 0xFF },
+    { "4 bit paletted",     PNG_FIXTURE(Paletted4),  9,  4, 3,  4, 1, 0xFF },
+    { "1 bit grey",         PNG_FIXTURE(Grey1),     13,  3, 0,  1, 1, 0xFF },
+};
+#undef PNG_FIXTURE
+
+static size_t PNGChannels(const uint8_t colorType) {
+    return (colorType == 2) ? 3 : (colorType == 4) ? 2 : (colorType == 6) ? 4 : 1;
+}
+
+static void PNGFixtureRow(const PNGFixture& f, const size_t fixtureIdx, const uint32_t y, uint8_t* row, const size_t rowSize) {
+    const size_t seed = fixtureIdx * 13;
+    for (size_t i = 0; i < rowSize; ++i) {
+        row[i] = scast<uint8_t>((((i / f.run) * 37 + y * 11 + seed) & 0xFF) & f.mask);
+    }
+}
+
+// the loader doesn't look at CRCs, so they're left as zeroes
+static void WritePNGChunk(MemWriteStream& stream, const char* type, const void* data, const size_t length) {
+    const uint8_t lengthBE[4] = { scast<uint8_t>(length >> 24), scast<uint8_t>(length >> 16), scast<uint8_t>(length >> 8), scast<uint8_t>(length) };
+    stream.Write(lengthBE, 4);
+    stream.Write(type, 4);
+    if (length) {
+        stream.Write(data, length);
+    }
+    stream.WriteU32(0);
+}
+
+static void WritePNGHeader(MemWriteStream& stream, const uint32_t width, const uint32_t height, const uint8_t colorType, const uint8_t bitDepth) {
+    static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    stream.Write(kSignature, sizeof(kSignature));
+
+    const uint8_t ihdr[13] = {
+        scast<uint8_t>(width >> 24), scast<uint8_t>(width >> 16), scast<uint8_t>(width >> 8), scast<uint8_t>(width),
+        scast<uint8_t>(height >> 24), scast<uint8_t>(height >> 16), scast<uint8_t>(height >> 8), scast<uint8_t>(height),
+        bitDepth, colorType, 0, 0, 0
+    };
+    WritePNGChunk(stream, "IHDR", ihdr, sizeof(ihdr));
+}
+
+static bool LoadPNGFromMemory(const MemWriteStream& source, PNGImage& image) {
+    MemStream stream(source.Data(), source.GetWrittenBytesCount());
+    return LoadPNGFromStream(stream, image);
+}
+
+static void TestPNGLoad(SelfTest& test) {
+    // 16 colors, only the first 10 get an alpha from tRNS
+    uint8_t plte[16 * 3], trns[10];
+    for (size_t i = 0; i < 16; ++i) {
+        plte[i * 3 + 0] = scast<uint8_t>(i * 16);
+        plte[i * 3 + 1] = scast<uint8_t>(255 - i * 16);
+        plte[i * 3 + 2] = scast<uint8_t>(i * 5);
+    }
+    for (size_t i = 0; i < 10; ++i) {
+        trns[i] = scast<uint8_t>(i * 20);
+    }
+
+    for (size_t fi = 0; fi < std::size(kPNGFixtures); ++fi) {
+        const PNGFixture& f = kPNGFixtures[fi];
+        const size_t channels = PNGChannels(f.colorType);
+        const size_t rowSize = (f.width * channels * f.bitDepth + 7) / 8;
+        const bool isPaletted = (f.colorType == 3);
+
+        MemWriteStream source;
+        WritePNGHeader(source, f.width, f.height, f.colorType, f.bitDepth);
+        if (isPaletted) {
+            WritePNGChunk(source, "PLTE", plte, sizeof(plte));
+            WritePNGChunk(source, "tRNS", trns, sizeof(trns));
+        }
+        // split in two IDATs, the stream has to be glued back together
+        WritePNGChunk(source, "IDAT", f.zlib, f.zlibSize / 2);
+        WritePNGChunk(source, "IDAT", f.zlib + f.zlibSize / 2, f.zlibSize - f.zlibSize / 2);
+        WritePNGChunk(source, "IEND", nullptr, 0);
+
+        PNGImage image;
+        const bool loaded = LoadPNGFromMemory(source, image);
+        test.Check(loaded && image.width == f.width && image.height == f.height && image.isPaletted == isPaletted, "PNG %s loads", f.name);
+        if (!loaded) {
+            continue;
+        }
+
+        BytesArray row(rowSize);
+        bool pixelsOk = image.pixels.size() == scast<size_t>(f.width) * f.height * (isPaletted ? 1 : 4);
+        for (uint32_t y = 0; y < f.height && pixelsOk; ++y) {
+            PNGFixtureRow(f, fi, y, row.data(), rowSize);
+            for (uint32_t x = 0; x < f.width && pixelsOk; ++x) {
+                uint8_t samples[4];
+                for (size_t c = 0; c < channels; ++c) {
+                    const size_t s = x * channels + c;
+                    if (f.bitDepth < 8) {
+                        const uint32_t maxValue = (1u << f.bitDepth) - 1;
+                        const uint32_t value = (row[s * f.bitDepth / 8] >> (8 - f.bitDepth - (s * f.bitDepth) % 8)) & maxValue;
+                        samples[c] = scast<uint8_t>(isPaletted ? value : value * 255 / maxValue);
+                    } else {
+                        samples[c] = row[s * (f.bitDepth / 8)];   // 16 bit keeps the high byte
+                    }
+                }
+
+                if (isPaletted) {
+                    pixelsOk = image.pixels[scast<size_t>(y) * f.width + x] == samples[0];
+                    continue;
+                }
+
+                uint8_t expected[4];
+                switch (f.colorType) {
+                    case 0:  expected[0] = expected[1] = expected[2] = samples[0]; expected[3] = 0xFF; break;
+                    case 2:  std::memcpy(expected, samples, 3); expected[3] = 0xFF; break;
+                    case 4:  expected[0] = expected[1] = expected[2] = samples[0]; expected[3] = samples[1]; break;
+                    default: std::memcpy(expected, samples, 4); break;
+                }
+                pixelsOk = std::memcmp(image.pixels.data() + (scast<size_t>(y) * f.width + x) * 4, expected, 4) == 0;
+            }
+        }
+        test.Check(pixelsOk, "PNG %s pixels", f.name);
+
+        if (isPaletted) {
+            bool paletteOk = image.palette.size() == 256 * 4;
+            for (size_t i = 0; i < 16 && paletteOk; ++i) {
+                const uint8_t* entry = image.palette.data() + i * 4;
+                paletteOk = std::memcmp(entry, plte + i * 3, 3) == 0 && entry[3] == ((i < 10) ? trns[i] : 0xFF);
+            }
+            test.Check(paletteOk, "PNG %s palette and tRNS alpha", f.name);
+        }
+
+        // a cut off stream must fail, not read past the end
+        MemWriteStream truncated;
+        WritePNGHeader(truncated, f.width, f.height, f.colorType, f.bitDepth);
+        WritePNGChunk(truncated, "IDAT", f.zlib, f.zlibSize - 6);
+        WritePNGChunk(truncated, "IEND", nullptr, 0);
+        test.Check(!LoadPNGFromMemory(truncated, image), "truncated PNG %s is rejected", f.name);
+    }
+
+    // our own writer (fixed Huffman + LZ77, adaptive filters) has to come back bit exact
+    {
+        const uint32_t width = 37, height = 29;
+        BytesArray rgba = test.RandomBytes(width * height * 4);
+        std::memset(rgba.data() + width * 4 * 10, 0x5A, width * 4 * 5);   // something for the matcher
+
+        MemWriteStream saved;
+        PNGImage image;
+        const bool ok = SavePNGToStream(saved, rgba.data(), width, height) && LoadPNGFromMemory(saved, image);
+        test.Check(ok && image.width == width && image.height == height && !image.isPaletted && image.pixels == rgba, "RGBA PNG round trip");
+
+        const BytesArray indices = test.RandomBytes(width * height);
+        const BytesArray palette = test.RandomBytes(256 * 4);
+        MemWriteStream savedPaletted;
+        const bool okPaletted = SavePNGToStream(savedPaletted, indices.data(), width, height, palette.data()) && LoadPNGFromMemory(savedPaletted, image);
+        test.Check(okPaletted && image.isPaletted && image.pixels == indices && image.palette == palette, "paletted PNG round trip");
+    }
+
+    // headers promising more than is sane (or than the data could ever inflate to) get refused before allocating
+    {
+        const PNGFixture& f = kPNGFixtures[1];
+        const uint32_t sizes[][2] = { { 0x7FFFFFFF, 0x7FFFFFFF }, { 16385, 1 }, { 16384, 16384 }, { 4096, 4096 } };
+        for (const auto& size : sizes) {
+            MemWriteStream source;
+            WritePNGHeader(source, size[0], size[1], f.colorType, f.bitDepth);
+            WritePNGChunk(source, "IDAT", f.zlib, f.zlibSize);
+            WritePNGChunk(source, "IEND", nullptr, 0);
+
+            PNGImage image;
+            test.Check(!LoadPNGFromMemory(source, image), "%ux%u PNG with a %zu byte IDAT is rejected", size[0], size[1], f.zlibSize);
+        }
+    }
+}
+
+
+int RunSelfTest() {
+    SelfTest test;
+
+    struct Group {
+        const char* name;
+        void        (*func)(SelfTest&);
+    };
+    static const Group kGroups[] = {
+        { "BCn decoding", TestBCDecode },
+        { "BCn encoding", TestBCEncode },
+        { "PS2 swizzling", TestPS2Swizzle },
+        { "4 bit indices", TestNibbles },
+        { "Pixel conversions", TestPixelConversions },
+        { "Palette lookup", TestPaletteLookup },
+        { "Palette quantizer", TestQuantizer },
+        { "PS2 palettes", TestPS2Palettes },
+        { "Save size estimates", TestSaveEstimates },
+        { "Band decoding", TestBandDecode },
+        { "Failed saves", TestFailedSaves },
+        { "Lazy loading", TestLazyLoad },
+        { "PNG loading", TestPNGLoad },
+    };
+
+    std::fprintf(stdout, "SIMD level: %s\n", SIMDLevelToString(GetSupportedSIMDLevel()));
+    for (const Group& group : kGroups) {
+        const size_t failedBefore = test.numFailed;
+        group.func(test);
+        std::fprintf(stdout, "%-24s %s\n", group.name, (test.numFailed == failedBefore) ? "ok" : "FAILED");
+    }
+    std::fprintf(stdout, "%zu checks, %zu failed\n", test.numChecks, test.numFailed);
+
+    return scast<int>(test.numFailed);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Differential checks of the optimized code paths against their reference implementations,
+// "sh2tex-cli selftest" runs them and ctest runs that once per SH2TEX_SIMD level.
+// Returns the number of failed checks.
+int     RunSelfTest();
@@ -0,0 +1,73 @@
+#include "cpufeatures.h"
+#include <cstdlib>
+
+#if SH2TEX_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+static SIMDLevel DetectSIMDLevel() {
+#if !SH2TEX_X86
+    return SIMDLevel::Scalar;
+#elif defined(_MSC_VER)
+    int regs[4] = {};
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+
+    __cpuid(regs, 1);
+    const bool sse2 = (regs[3] & (1 << 26)) != 0;
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+    const bool avx = (regs[2] & (1 << 28)) != 0;
+
+    bool avx2 = false;
+    // the OS has to save the ymm registers too, not just the CPU supporting them
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(regs, 7, 0);
+        avx2 = (regs[1] & (1 << 5)) != 0;
+    }
+
+    return avx2 ? SIMDLevel::AVX2 : (sse2 ? SIMDLevel::SSE2 : SIMDLevel::Scalar);
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMDLevel::AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return SIMDLevel::SSE2;
+    } else {
+        return SIMDLevel::Scalar;
+    }
+#endif
+}
+
+static SIMDLevel ApplySIMDLevelOverride(const SIMDLevel detected) {
+    const char* value = std::getenv("SH2TEX_SIMD");
+    if (!value) {
+        return detected;
+    }
+
+    const CharString name = value;
+    SIMDLevel requested = detected;
+    if (name == "scalar") {
+        requested = SIMDLevel::Scalar;
+    } else if (name == "sse2") {
+        requested = SIMDLevel::SSE2;
+    } else if (name == "avx2") {
+        requested = SIMDLevel::AVX2;
+    }
+
+    // never go above what the CPU can actually run
+    return std::min(requested, detected);
+}
+
+SIMDLevel GetSupportedSIMDLevel() {
+    static const SIMDLevel sLevel = ApplySIMDLevelOverride(DetectSIMDLevel());
+    return sLevel;
+}
+
+const char* SIMDLevelToString(const SIMDLevel level) {
+    switch (level) {
+        case SIMDLevel::SSE2:   return "SSE2";
+        case SIMDLevel::AVX2:   return "AVX2";
+        default:                return "scalar";
+    }
+}
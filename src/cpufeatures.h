@@ -0,0 +1,28 @@
+#pragma once
+#include "mycommon.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SH2TEX_X86  1
+#else
+#define SH2TEX_X86  0
+#endif
+
+// lets individual functions use instructions the rest of the build doesn't assume
+#if SH2TEX_X86 && (defined(__GNUC__) || defined(__clang__))
+#define SH2TEX_TARGET_SSE2  __attribute__((target("sse2")))
+#define SH2TEX_TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#define SH2TEX_TARGET_SSE2
+#define SH2TEX_TARGET_AVX2
+#endif
+
+enum class SIMDLevel : int {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Best instruction set level supported by the running CPU, detected once.
+// Setting the SH2TEX_SIMD environment variable to "scalar", "sse2" or "avx2" caps it.
+SIMDLevel   GetSupportedSIMDLevel();
+const char* SIMDLevelToString(const SIMDLevel level);
@@ -1,5 +1,6 @@
 #include "ddstexture.h"
-#include "libs/bcdec/bcdec.h" // no implementation, just size helpers
+#include "mappedfile.h"
+#include "bcdecoder.h"
 #include <fstream>
 
 struct DDCOLORKEY {
@@ -60,20 +61,11 @@ DDSTexture::~DDSTexture() {
 }
 
 bool DDSTexture::LoadFromFile(const fs::path& path) {
-    std::ifstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+    MemStream stream = MapFileToStream(path);
+    if (!stream) {
         return false;
     }
 
-    file.seekg(0, std::ios_base::end);
-    const size_t fileSize = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-
-    void* data = std::malloc(fileSize);
-    file.read(rcast<char*>(data), fileSize);
-    file.close();
-
-    MemStream stream(data, fileSize, true);
     return this->LoadFromStream(stream);
 }
 
@@ -113,7 +105,7 @@ bool DDSTexture::LoadFromStream(MemStream& stream) {
 
     size_t dataSize;
     if (isDXT) {
-        dataSize = (mFormat == DDS_FOURCC_DXT1) ? BCDEC_BC1_COMPRESSED_SIZE(mWidth, mHeight) : BCDEC_BC3_COMPRESSED_SIZE(mWidth, mHeight);
+        dataSize = BCGetImageSize((mFormat == DDS_FOURCC_DXT1) ? BCFormat::BC1 : BCFormat::BC3, mWidth, mHeight);
     } else {
         dataSize = mWidth * mHeight * 4;
     }
@@ -0,0 +1,103 @@
+#include "filewritestream.h"
+
+constexpr size_t kFileWriteBufferSize = 256 * 1024;
+
+
+FileWriteStream::FileWriteStream()
+    : mSize(0)
+{
+}
+FileWriteStream::~FileWriteStream() {
+    // never closed means the save didn't finish, don't let it replace anything
+    this->Discard();
+}
+
+bool FileWriteStream::Open(const fs::path& path) {
+    this->Discard();
+
+    // bigger buffer than the default one, has to be set before opening
+    mFileBuffer.resize(kFileWriteBufferSize);
+    mFile.rdbuf()->pubsetbuf(rcast<char*>(mFileBuffer.data()), scast<std::streamsize>(mFileBuffer.size()));
+
+    // same folder as the target, so the final rename doesn't cross file systems
+    mPath = path;
+    mTempPath = path;
+    mTempPath += ".tmp";
+
+    mFile.clear();
+    mFile.open(mTempPath, std::ios_base::binary | std::ios_base::trunc);
+    mSize = 0;
+
+    return mFile.good();
+}
+
+bool FileWriteStream::Close() {
+    if (!mFile.is_open()) {
+        return true;
+    }
+
+    mFile.flush();
+    bool result = mFile.good();
+    mFile.close();
+    result = result && !mFile.fail();
+
+    std::error_code ec;
+    if (result) {
+        fs::rename(mTempPath, mPath, ec);
+        result = !ec;
+    }
+    if (!result) {
+        fs::remove(mTempPath, ec);
+    }
+
+    mPath.clear();
+    mTempPath.clear();
+    return result;
+}
+
+void FileWriteStream::Discard() {
+    if (!mFile.is_open()) {
+        return;
+    }
+
+    mFile.close();
+
+    std::error_code ec;
+    fs::remove(mTempPath, ec);
+
+    mPath.clear();
+    mTempPath.clear();
+}
+
+bool FileWriteStream::Good() const {
+    return mFile.is_open() && mFile.good();
+}
+
+void FileWriteStream::Write(const void* data, const size_t length) {
+    mFile.write(rcast<const char*>(data), scast<std::streamsize>(length));
+    mSize += length;
+}
+
+void FileWriteStream::WriteDupByte(const uint8_t value, const size_t numBytes) {
+    uint8_t chunk[256];
+    memset(chunk, scast<int>(value), sizeof(chunk));
+
+    size_t left = numBytes;
+    while (left > 0) {
+        const size_t toWrite = std::min(left, sizeof(chunk));
+        this->Write(chunk, toWrite);
+        left -= toWrite;
+    }
+}
+
+void FileWriteStream::WriteAt(const size_t offset, const void* data, const size_t length) {
+    assert(offset + length <= mSize);
+
+    mFile.seekp(scast<std::streamoff>(offset));
+    mFile.write(rcast<const char*>(data), scast<std::streamsize>(length));
+    mFile.seekp(scast<std::streamoff>(mSize));
+}
+
+size_t FileWriteStream::GetWrittenBytesCount() const {
+    return mSize;
+}
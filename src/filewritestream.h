@@ -0,0 +1,35 @@
+#pragma once
+#include "mycommon.h"
+#include <fstream>
+
+// Writes straight to a file through a fixed-size buffer, so big saves don't need
+// the whole file in memory. WriteAt seeks back to patch already written bytes.
+// The bytes go to a temporary file next to the target, which only gets replaced by a successful Close(),
+// so a save that fails halfway (or a stream destroyed without Close) leaves the old file as it was.
+class FileWriteStream : public WriteStream {
+public:
+    FileWriteStream();
+    ~FileWriteStream();
+
+    using WriteStream::Write;
+    using WriteStream::WriteAt;
+
+    bool    Open(const fs::path& path);
+    // flushes everything and moves it over the target, returns false (and keeps the target) if any write failed
+    bool    Close();
+    // drops everything written so far, the target stays untouched
+    void    Discard();
+    bool    Good() const;
+
+    void    Write(const void* data, const size_t length) override;
+    void    WriteDupByte(const uint8_t value, const size_t numBytes) override;
+    void    WriteAt(const size_t offset, const void* data, const size_t length) override;
+    size_t  GetWrittenBytesCount() const override;
+
+private:
+    std::ofstream   mFile;
+    fs::path        mPath;
+    fs::path        mTempPath;
+    BytesArray      mFileBuffer;
+    size_t          mSize;
+};
@@ -0,0 +1,96 @@
+#include "mappedfile.h"
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MemStream ReadFileToStream(const fs::path& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file.good()) {
+        return MemStream();
+    }
+
+    file.seekg(0, std::ios_base::end);
+    const size_t fileSize = file.tellg();
+    file.seekg(0, std::ios_base::beg);
+
+    if (!fileSize) {
+        return MemStream();
+    }
+
+    void* data = std::malloc(fileSize);
+    file.read(rcast<char*>(data), fileSize);
+    file.close();
+
+    return MemStream(data, fileSize, true);
+}
+
+MemStream MapFileToStream(const fs::path& path) {
+#ifdef _WIN32
+    HANDLE file = ::CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return MemStream();
+    }
+
+    LARGE_INTEGER fileSize = {};
+    if (!::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0) {
+        ::CloseHandle(file);
+        return MemStream();
+    }
+
+    // the view keeps the mapping and the file alive, so both handles can go right away
+    HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) {
+        ::CloseHandle(mapping);
+    }
+    ::CloseHandle(file);
+
+    if (!view) {
+        return ReadFileToStream(path);
+    }
+
+    const size_t size = scast<size_t>(fileSize.QuadPart);
+    MemStream::OwnedPtrType owner(rcast<uint8_t*>(view), [](uint8_t* ptr) {
+        ::UnmapViewOfFile(ptr);
+    });
+    return MemStream(view, size, owner);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return MemStream();
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return MemStream();
+    }
+
+    const size_t size = scast<size_t>(st.st_size);
+    void* view = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (view == MAP_FAILED) {
+        return ReadFileToStream(path);
+    }
+
+    MemStream::OwnedPtrType owner(rcast<uint8_t*>(view), [size](uint8_t* ptr) {
+        ::munmap(ptr, size);
+    });
+    return MemStream(view, size, owner);
+#endif
+}
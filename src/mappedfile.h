@@ -0,0 +1,13 @@
+#pragma once
+#include "mycommon.h"
+
+// Maps the whole file read-only and returns a stream over it, the mapping stays alive as long
+// as the stream or any copy of it does, so pages nobody reads are never loaded from disk.
+// Falls back to reading the file into memory if it can't be mapped.
+// Returns an empty stream if the file can't be opened or is empty.
+// Pixel data is read lazily from the mapping, so the file must stay intact while anything uses it:
+// if another program truncates it in the meantime, touching the missing pages faults (SIGBUS on POSIX).
+// Long-lived readers that can't promise that (the GUI) should use ReadFileToStream instead.
+MemStream   MapFileToStream(const fs::path& path);
+// Reads the whole file into memory, same empty stream on failure.
+MemStream   ReadFileToStream(const fs::path& path);
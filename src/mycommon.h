@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <functional>
 #include <cassert>
+#include <cstring>
 #include <cuchar>
 #include <random>
 #include <cctype>   // std::tolower
@@ -80,9 +81,9 @@ inline bool WStrEqualsCaseInsensitive(const WideString& str1, const WideString&
 }
 
 class MemStream {
+public:
     using OwnedPtrType = std::shared_ptr<uint8_t>;
 
-public:
     MemStream()
         : data(nullptr)
         , length(0)
@@ -99,6 +100,13 @@ public:
             ownedPtr = OwnedPtrType(const_cast<uint8_t*>(data), free);
         }
     }
+    // shares ownership of memory released by _owner's deleter (file mappings and such)
+    MemStream(const void* _data, const size_t _size, const OwnedPtrType& _owner)
+        : data(rcast<const uint8_t*>(_data))
+        , length(_size)
+        , cursor(0)
+        , ownedPtr(_owner) {
+    }
     MemStream(const MemStream& other)
         : data(other.data)
         , length(other.length)
@@ -163,6 +171,11 @@ public:
         return this->data;
     }
 
+    // true if someone keeps our bytes alive (malloc'ed copy or a file mapping)
+    inline bool IsOwning() const {
+        return this->ownedPtr != nullptr;
+    }
+
     inline const CharString& Name() const {
         return this->name;
     }
@@ -244,15 +257,26 @@ public:
         return this->data + this->cursor;
     }
 
+    // substreams share the ownership, so they can safely outlive their parent
     MemStream Substream(const size_t subStreamLength) const {
         const size_t allowedLength = ((this->cursor + subStreamLength) > this->Length()) ? (this->Length() - this->cursor) : subStreamLength;
-        return MemStream(this->GetDataAtCursor(), allowedLength);
+        return MemStream(this->GetDataAtCursor(), allowedLength, this->ownedPtr);
     }
 
     MemStream Substream(const size_t subStreamOffset, const size_t subStreamLength) const {
         const size_t allowedOffset = (subStreamOffset > this->Length()) ? this->Length() : subStreamOffset;
         const size_t allowedLength = ((allowedOffset + subStreamLength) > this->Length()) ? (this->Length() - allowedOffset) : subStreamLength;
-        return MemStream(this->data + allowedOffset, allowedLength);
+        return MemStream(this->data + allowedOffset, allowedLength, this->ownedPtr);
+    }
+
+    // unlike Clone() always makes a private copy of the bytes
+    MemStream Copy() const {
+        void* dataCopy = malloc(this->Length());
+        assert(dataCopy != nullptr || !this->Length());
+        if (this->Length()) {
+            memcpy(dataCopy, this->data, this->Length());
+        }
+        return MemStream(dataCopy, this->Length(), true);
     }
 
     MemStream Clone() const {
@@ -275,36 +299,29 @@ private:
 };
 
 
-class MemWriteStream {
+// base for everything we serialize to, so the same save code can go to memory or straight to disk
+class WriteStream {
 public:
-    MemWriteStream(const size_t startupSize = 4096) { mBuffer.reserve(startupSize); }
-    ~MemWriteStream() {}
-
-    void Swap(MemWriteStream& other) {
-        mBuffer.swap(other.mBuffer);
-    }
-
-    void SwapBuffer(BytesArray& buffer) {
-        mBuffer.swap(buffer);
-    }
+    virtual ~WriteStream() {}
 
-    void Write(const void* data, const size_t length) {
-        const size_t cursor = this->GetWrittenBytesCount();
-        mBuffer.resize(mBuffer.size() + length);
-        memcpy(mBuffer.data() + cursor, data, length);
-    }
-
-    void WriteDupByte(const uint8_t value, const size_t numBytes) {
-        const size_t cursor = this->GetWrittenBytesCount();
-        mBuffer.resize(mBuffer.size() + numBytes);
-        memset(mBuffer.data() + cursor, scast<int>(value), numBytes);
-    }
+    virtual void    Write(const void* data, const size_t length) = 0;
+    virtual void    WriteDupByte(const uint8_t value, const size_t numBytes) = 0;
+    // overwrites already written bytes, used to patch sizes we only know after writing the data
+    virtual void    WriteAt(const size_t offset, const void* data, const size_t length) = 0;
+    virtual size_t  GetWrittenBytesCount() const = 0;
+    // a hint that the stream is going to hold at least totalBytes, so it can allocate once
+    virtual void    Reserve(const size_t /*totalBytes*/) {}
 
     template <typename T>
     void Write(const T& v) {
         this->Write(&v, sizeof(T));
     }
 
+    template <typename T>
+    void WriteAt(const size_t offset, const T& v) {
+        this->WriteAt(offset, &v, sizeof(T));
+    }
+
 #define _IMPL_WRITE_FOR_TYPE(type, name)        \
     inline void Write##name(const type& v) {    \
         this->Write<type>(v);                   \
@@ -327,27 +344,112 @@ public:
     inline void Append(const MemStream& stream) {
         this->Write(stream.Data(), stream.Length());
     }
+};
+
+class MemWriteStream : public WriteStream {
+public:
+    MemWriteStream(const size_t startupSize = 4096)
+        : mCapacity(0)
+        , mSize(0)
+        , mNumReallocs(0) {
+        this->Reallocate(startupSize);
+        mNumReallocs = 0;
+    }
+    ~MemWriteStream() {}
+
+    using WriteStream::Write;
+    using WriteStream::WriteAt;
+    using WriteStream::Append;
+
+    void Swap(MemWriteStream& other) {
+        mBuffer.swap(other.mBuffer);
+        std::swap(mCapacity, other.mCapacity);
+        std::swap(mSize, other.mSize);
+        std::swap(mNumReallocs, other.mNumReallocs);
+    }
+
+    // the buffers are of different kinds, so this one has to copy both ways
+    void SwapBuffer(BytesArray& buffer) {
+        BytesArray written(mBuffer.get(), mBuffer.get() + mSize);
+        mSize = 0;
+        this->Reallocate(buffer.size());
+        if (!buffer.empty()) {
+            memcpy(mBuffer.get(), buffer.data(), buffer.size());
+        }
+        mSize = buffer.size();
+        buffer.swap(written);
+    }
+
+    void Write(const void* data, const size_t length) override {
+        this->Grow(length);
+        memcpy(mBuffer.get() + mSize, data, length);
+        mSize += length;
+    }
+
+    void WriteDupByte(const uint8_t value, const size_t numBytes) override {
+        this->Grow(numBytes);
+        memset(mBuffer.get() + mSize, scast<int>(value), numBytes);
+        mSize += numBytes;
+    }
+
+    void WriteAt(const size_t offset, const void* data, const size_t length) override {
+        assert(offset + length <= mSize);
+        memcpy(mBuffer.get() + offset, data, length);
+    }
+
+    void Reserve(const size_t totalBytes) override {
+        if (totalBytes > mCapacity) {
+            this->Reallocate(totalBytes);
+        }
+    }
 
     inline void Append(const MemWriteStream& stream) {
         this->Write(stream.Data(), stream.GetWrittenBytesCount());
     }
 
-    size_t GetWrittenBytesCount() const {
-        return mBuffer.size();
+    size_t GetWrittenBytesCount() const override {
+        return mSize;
+    }
+
+    // how many times the buffer had to grow, handy to check the size estimations
+    size_t GetNumReallocs() const {
+        return mNumReallocs;
     }
 
     void* Data() {
-        return mBuffer.data();
+        return mBuffer.get();
     }
 
     const void* Data() const {
-        return mBuffer.data();
+        return mBuffer.get();
     }
 
     inline void SwapToBytesArray(BytesArray& dst) {
-        mBuffer.swap(dst);
+        this->SwapBuffer(dst);
+    }
+
+private:
+    // buffer only ever grows geometrically, mSize tracks the actually written part
+    inline void Grow(const size_t length) {
+        if (mSize + length > mCapacity) {
+            this->Reserve(std::max(mSize + length, mCapacity * 2));
+        }
+    }
+
+    // new[] without () leaves the bytes uninitialized, everything past mSize gets written before it's read
+    void Reallocate(const size_t capacity) {
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[std::max<size_t>(capacity, 1)]);
+        if (mSize) {
+            memcpy(buffer.get(), mBuffer.get(), mSize);
+        }
+        mBuffer.swap(buffer);
+        mCapacity = capacity;
+        ++mNumReallocs;
     }
 
 private:
-    BytesArray  mBuffer;
+    std::unique_ptr<uint8_t[]>  mBuffer;
+    size_t                      mCapacity;
+    size_t                      mSize;
+    size_t                      mNumReallocs;
 };
@@ -0,0 +1,953 @@
+#include "palettequantizer.h"
+#include "parallel.h"
+
+#include <climits>
+#include <mutex>
+
+#if SH2TEX_X86
+#include <immintrin.h>
+#endif
+
+
+// palette entries as pairs of 16 bit channels, so one madd gives the squared distance of two channels.
+// padded up to a multiple of 8 with entries far away from any color
+struct SearchPalette {
+    alignas(32) int32_t c01[256];
+    alignas(32) int32_t c23[256];
+    size_t              numEntries;
+};
+
+// index of the nearest entry, ties go to the lower index
+using NearestFunc = uint32_t(*)(const SearchPalette& palette, const uint32_t color);
+
+static const int kPaddingValue = 1000;
+static const int kMaxKMeansPasses = 6;
+static const size_t kColorsPerTask = 4096;
+static const size_t kRowsPerTask = 16;
+static const size_t kCacheBits = 12;
+// median cut and k-means run on at most this many (bucketed) colors, only the final mapping sees every pixel
+static const size_t kMaxRefineColors = 65536;
+
+
+static inline int Channel(const uint32_t color, const int c) {
+    return scast<int>((color >> (c * 8)) & 0xFF);
+}
+
+static inline int32_t PackPair(const int lo, const int hi) {
+    return scast<int32_t>((scast<uint32_t>(lo) & 0xFFFF) | (scast<uint32_t>(hi) << 16));
+}
+
+static void BuildSearchPalette(const MyArray<uint32_t>& colors, SearchPalette& palette) {
+    palette.numEntries = (colors.size() + 7) & ~size_t(7);
+    for (size_t i = 0; i < palette.numEntries; ++i) {
+        if (i < colors.size()) {
+            palette.c01[i] = PackPair(Channel(colors[i], 0), Channel(colors[i], 1));
+            palette.c23[i] = PackPair(Channel(colors[i], 2), Channel(colors[i], 3));
+        } else {
+            palette.c01[i] = palette.c23[i] = PackPair(kPaddingValue, kPaddingValue);
+        }
+    }
+}
+
+static uint32_t FindNearest_Scalar(const SearchPalette& palette, const uint32_t color) {
+    const int c[4] = { Channel(color, 0), Channel(color, 1), Channel(color, 2), Channel(color, 3) };
+
+    int best = INT_MAX;
+    uint32_t bestIdx = 0;
+    for (size_t i = 0; i < palette.numEntries; ++i) {
+        const int d0 = c[0] - scast<int16_t>(palette.c01[i] & 0xFFFF);
+        const int d1 = c[1] - scast<int16_t>(palette.c01[i] >> 16);
+        const int d2 = c[2] - scast<int16_t>(palette.c23[i] & 0xFFFF);
+        const int d3 = c[3] - scast<int16_t>(palette.c23[i] >> 16);
+        const int d = d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+        if (d < best) {
+            best = d;
+            bestIdx = scast<uint32_t>(i);
+        }
+    }
+    return bestIdx;
+}
+
+
+#if SH2TEX_X86
+
+// lanes keep their own best, the lowest index wins among equal distances
+static inline uint32_t ReduceLanes(const int32_t* dists, const int32_t* idxs, const size_t numLanes) {
+    int32_t best = dists[0];
+    int32_t bestIdx = idxs[0];
+    for (size_t i = 1; i < numLanes; ++i) {
+        if (dists[i] < best || (dists[i] == best && idxs[i] < bestIdx)) {
+            best = dists[i];
+            bestIdx = idxs[i];
+        }
+    }
+    return scast<uint32_t>(bestIdx);
+}
+
+SH2TEX_TARGET_SSE2 static uint32_t FindNearest_SSE2(const SearchPalette& palette, const uint32_t color) {
+    const __m128i c01 = _mm_set1_epi32(PackPair(Channel(color, 0), Channel(color, 1)));
+    const __m128i c23 = _mm_set1_epi32(PackPair(Channel(color, 2), Channel(color, 3)));
+
+    __m128i best = _mm_set1_epi32(INT_MAX);
+    __m128i bestIdx = _mm_setzero_si128();
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    for (size_t i = 0; i < palette.numEntries; i += 4) {
+        const __m128i d01 = _mm_sub_epi16(c01, _mm_load_si128(rcast<const __m128i*>(palette.c01 + i)));
+        const __m128i d23 = _mm_sub_epi16(c23, _mm_load_si128(rcast<const __m128i*>(palette.c23 + i)));
+        const __m128i d = _mm_add_epi32(_mm_madd_epi16(d01, d01), _mm_madd_epi16(d23, d23));
+        const __m128i less = _mm_cmplt_epi32(d, best);
+        best = _mm_or_si128(_mm_and_si128(less, d), _mm_andnot_si128(less, best));
+        bestIdx = _mm_or_si128(_mm_and_si128(less, idx), _mm_andnot_si128(less, bestIdx));
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+
+    alignas(16) int32_t dists[4], idxs[4];
+    _mm_store_si128(rcast<__m128i*>(dists), best);
+    _mm_store_si128(rcast<__m128i*>(idxs), bestIdx);
+    return ReduceLanes(dists, idxs, 4);
+}
+
+SH2TEX_TARGET_AVX2 static uint32_t FindNearest_AVX2(const SearchPalette& palette, const uint32_t color) {
+    const __m256i c01 = _mm256_set1_epi32(PackPair(Channel(color, 0), Channel(color, 1)));
+    const __m256i c23 = _mm256_set1_epi32(PackPair(Channel(color, 2), Channel(color, 3)));
+
+    __m256i best = _mm256_set1_epi32(INT_MAX);
+    __m256i bestIdx = _mm256_setzero_si256();
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (size_t i = 0; i < palette.numEntries; i += 8) {
+        const __m256i d01 = _mm256_sub_epi16(c01, _mm256_load_si256(rcast<const __m256i*>(palette.c01 + i)));
+        const __m256i d23 = _mm256_sub_epi16(c23, _mm256_load_si256(rcast<const __m256i*>(palette.c23 + i)));
+        const __m256i d = _mm256_add_epi32(_mm256_madd_epi16(d01, d01), _mm256_madd_epi16(d23, d23));
+        const __m256i less = _mm256_cmpgt_epi32(best, d);
+        best = _mm256_min_epi32(best, d);
+        bestIdx = _mm256_blendv_epi8(bestIdx, idx, less);
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+
+    alignas(32) int32_t dists[8], idxs[8];
+    _mm256_store_si256(rcast<__m256i*>(dists), best);
+    _mm256_store_si256(rcast<__m256i*>(idxs), bestIdx);
+    return ReduceLanes(dists, idxs, 8);
+}
+
+#endif // SH2TEX_X86
+
+
+static NearestFunc GetNearestFunc(const SIMDLevel level) {
+#if SH2TEX_X86
+    if (level >= SIMDLevel::AVX2) {
+        return FindNearest_AVX2;
+    } else if (level >= SIMDLevel::SSE2) {
+        return FindNearest_SSE2;
+    }
+#endif
+    return FindNearest_Scalar;
+}
+
+// direct mapped color -> index cache, textures repeat the same colors a lot
+class NearestCache {
+public:
+    NearestCache(const SearchPalette& palette, const NearestFunc findNearest)
+        : mPalette(palette)
+        , mFindNearest(findNearest)
+        , mEntries(size_t(1) << kCacheBits, 0)
+    {
+    }
+
+    uint32_t Find(const uint32_t color) {
+        // color in the high half, index + 1 in the low, 0 is an empty slot
+        uint64_t& entry = mEntries[(color * 2654435761u) >> (32 - kCacheBits)];
+        if (entry && scast<uint32_t>(entry >> 32) == color) {
+            return scast<uint32_t>(entry & 0xFFFFFFFF) - 1;
+        }
+
+        const uint32_t idx = mFindNearest(mPalette, color);
+        entry = (scast<uint64_t>(color) << 32) | (idx + 1);
+        return idx;
+    }
+
+private:
+    const SearchPalette&    mPalette;
+    NearestFunc             mFindNearest;
+    MyArray<uint64_t>       mEntries;
+};
+
+
+struct ColorCount {
+    uint32_t color;
+    uint32_t count;
+};
+
+// LSD radix sort, a lot quicker than std::sort on millions of pixels
+static void CollectUniqueColors(const uint8_t* pixels, const size_t numPixels, MyArray<ColorCount>& unique) {
+    MyArray<uint32_t> colors(numPixels), scratch(numPixels);
+    std::memcpy(colors.data(), pixels, numPixels * 4);
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offsets[257] = {};
+        for (const uint32_t c : colors) {
+            ++offsets[((c >> shift) & 0xFF) + 1];
+        }
+        for (size_t i = 1; i < 257; ++i) {
+            offsets[i] += offsets[i - 1];
+        }
+        for (const uint32_t c : colors) {
+            scratch[offsets[(c >> shift) & 0xFF]++] = c;
+        }
+        colors.swap(scratch);
+    }
+
+    unique.clear();
+    for (size_t i = 0; i < numPixels; ) {
+        size_t j = i + 1;
+        while (j < numPixels && colors[j] == colors[i]) {
+            ++j;
+        }
+        unique.push_back({ colors[i], scast<uint32_t>(j - i) });
+        i = j;
+    }
+}
+
+// averages the colors sharing the top bits of every channel, 5 bits if that's few enough buckets, 4 otherwise
+static void BucketColors(const MyArray<ColorCount>& unique, MyArray<ColorCount>& buckets) {
+    for (int bits = 5; bits >= 4; --bits) {
+        const int shift = 8 - bits;
+        MyArray<uint32_t> slots(size_t(1) << (bits * 4), ~0u);
+        MyArray<uint64_t> sums;
+        MyArray<uint64_t> counts;
+
+        for (const ColorCount& cc : unique) {
+            uint32_t key = 0;
+            for (int c = 0; c < 4; ++c) {
+                key |= scast<uint32_t>(Channel(cc.color, c) >> shift) << (c * bits);
+            }
+
+            if (slots[key] == ~0u) {
+                slots[key] = scast<uint32_t>(counts.size());
+                counts.push_back(0);
+                sums.resize(sums.size() + 4, 0);
+            }
+
+            const size_t slot = slots[key];
+            for (int c = 0; c < 4; ++c) {
+                sums[slot * 4 + c] += scast<uint64_t>(Channel(cc.color, c)) * cc.count;
+            }
+            counts[slot] += cc.count;
+        }
+
+        if (counts.size() > kMaxRefineColors && bits > 4) {
+            continue;
+        }
+
+        buckets.resize(counts.size());
+        for (size_t i = 0; i < counts.size(); ++i) {
+            uint32_t color = 0;
+            for (int c = 0; c < 4; ++c) {
+                color |= scast<uint32_t>((sums[i * 4 + c] + counts[i] / 2) / counts[i]) << (c * 8);
+            }
+            buckets[i] = { color, scast<uint32_t>(std::min<uint64_t>(counts[i], UINT32_MAX)) };
+        }
+        return;
+    }
+}
+
+struct ColorBox {
+    size_t      begin;
+    size_t      end;
+    uint64_t    weight;
+    int         channel;    // the widest one
+    int         range;
+};
+
+static ColorBox MakeColorBox(const MyArray<ColorCount>& colors, const size_t begin, const size_t end) {
+    int lo[4] = { 255, 255, 255, 255 }, hi[4] = {};
+    uint64_t weight = 0;
+    for (size_t i = begin; i < end; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            lo[c] = std::min(lo[c], Channel(colors[i].color, c));
+            hi[c] = std::max(hi[c], Channel(colors[i].color, c));
+        }
+        weight += colors[i].count;
+    }
+
+    ColorBox box = { begin, end, weight, 0, hi[0] - lo[0] };
+    for (int c = 1; c < 4; ++c) {
+        if (hi[c] - lo[c] > box.range) {
+            box.channel = c;
+            box.range = hi[c] - lo[c];
+        }
+    }
+    return box;
+}
+
+// the box with the most pixels times extent gets split at its weighted median, until we have enough boxes
+static void MedianCut(MyArray<ColorCount>& colors, const size_t numColors, MyArray<uint32_t>& palette) {
+    MyArray<ColorBox> boxes = { MakeColorBox(colors, 0, colors.size()) };
+
+    while (boxes.size() < numColors) {
+        size_t splitIdx = boxes.size();
+        uint64_t bestScore = 0;
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            const uint64_t score = boxes[i].weight * scast<uint64_t>(boxes[i].range);
+            if (boxes[i].end - boxes[i].begin > 1 && score > bestScore) {
+                splitIdx = i;
+                bestScore = score;
+            }
+        }
+        if (splitIdx == boxes.size()) {
+            break;
+        }
+
+        const ColorBox box = boxes[splitIdx];
+        const int channel = box.channel;
+        std::sort(colors.begin() + box.begin, colors.begin() + box.end, [channel](const ColorCount& a, const ColorCount& b) {
+            return Channel(a.color, channel) < Channel(b.color, channel);
+        });
+
+        size_t median = box.begin + 1;
+        uint64_t accumulated = colors[box.begin].count;
+        while (median < box.end - 1 && accumulated * 2 < box.weight) {
+            accumulated += colors[median].count;
+            ++median;
+        }
+
+        boxes[splitIdx] = MakeColorBox(colors, box.begin, median);
+        boxes.push_back(MakeColorBox(colors, median, box.end));
+    }
+
+    palette.clear();
+    for (const ColorBox& box : boxes) {
+        uint64_t sum[4] = {};
+        for (size_t i = box.begin; i < box.end; ++i) {
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += scast<uint64_t>(Channel(colors[i].color, c)) * colors[i].count;
+            }
+        }
+
+        uint32_t color = 0;
+        for (int c = 0; c < 4; ++c) {
+            color |= scast<uint32_t>((sum[c] + box.weight / 2) / box.weight) << (c * 8);
+        }
+        palette.push_back(color);
+    }
+}
+
+// Lloyd iterations over the unique colors, weighted by how often they appear
+static void RefinePalette(const MyArray<ColorCount>& colors, const NearestFunc findNearest, const size_t numThreads, MyArray<uint32_t>& palette) {
+    struct Accumulator {
+        uint64_t sum[4];
+        uint64_t count;
+    };
+
+    const size_t numTasks = (colors.size() + kColorsPerTask - 1) / kColorsPerTask;
+
+    for (int pass = 0; pass < kMaxKMeansPasses; ++pass) {
+        SearchPalette search;
+        BuildSearchPalette(palette, search);
+
+        MyArray<Accumulator> total(palette.size(), Accumulator{});
+        std::mutex totalLock;
+
+        ParallelFor(numTasks, [&](const size_t task) {
+            MyArray<Accumulator> local(palette.size(), Accumulator{});
+            const size_t end = std::min(colors.size(), (task + 1) * kColorsPerTask);
+            for (size_t i = task * kColorsPerTask; i < end; ++i) {
+                Accumulator& acc = local[findNearest(search, colors[i].color)];
+                for (int c = 0; c < 4; ++c) {
+                    acc.sum[c] += scast<uint64_t>(Channel(colors[i].color, c)) * colors[i].count;
+                }
+                acc.count += colors[i].count;
+            }
+
+            std::lock_guard<std::mutex> lock(totalLock);
+            for (size_t i = 0; i < local.size(); ++i) {
+                for (int c = 0; c < 4; ++c) {
+                    total[i].sum[c] += local[i].sum[c];
+                }
+                total[i].count += local[i].count;
+            }
+        }, numThreads);
+
+        bool changed = false;
+        for (size_t i = 0; i < palette.size(); ++i) {
+            // an entry nobody picked keeps its color
+            if (!total[i].count) {
+                continue;
+            }
+
+            uint32_t color = 0;
+            for (int c = 0; c < 4; ++c) {
+                color |= scast<uint32_t>((total[i].sum[c] + total[i].count / 2) / total[i].count) << (c * 8);
+            }
+            changed = changed || color != palette[i];
+            palette[i] = color;
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+static void MapPixels(const uint8_t* pixels, const uint32_t width, const uint32_t height, const SearchPalette& search,
+                      const NearestFunc findNearest, const size_t numThreads, uint8_t* indices) {
+    const size_t numTasks = (height + kRowsPerTask - 1) / kRowsPerTask;
+    ParallelFor(numTasks, [&](const size_t task) {
+        NearestCache cache(search, findNearest);
+        const size_t begin = task * kRowsPerTask * width;
+        const size_t end = std::min<size_t>(height, (task + 1) * kRowsPerTask) * width;
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t color;
+            std::memcpy(&color, pixels + i * 4, sizeof(color));
+            indices[i] = scast<uint8_t>(cache.Find(color));
+        }
+    }, numThreads);
+}
+
+// Floyd-Steinberg, every row depends on the one above so this one stays serial
+static void MapPixelsDithered(const uint8_t* pixels, const uint32_t width, const uint32_t height, const MyArray<uint32_t>& palette,
+                              const SearchPalette& search, const NearestFunc findNearest, uint8_t* indices) {
+    NearestCache cache(search, findNearest);
+
+    // errors in 1/16ths, with a pixel of padding on both sides
+    MyArray<int> thisRow((width + 2) * 4, 0), nextRow((width + 2) * 4, 0);
+
+    for (size_t y = 0; y < height; ++y) {
+        std::fill(nextRow.begin(), nextRow.end(), 0);
+        for (size_t x = 0; x < width; ++x) {
+            const uint8_t* src = pixels + (y * width + x) * 4;
+            int* err = thisRow.data() + (x + 1) * 4;
+
+            int wanted[4];
+            uint32_t color = 0;
+            for (int c = 0; c < 4; ++c) {
+                wanted[c] = std::clamp(src[c] + (err[c] + 8) / 16, 0, 255);
+                color |= scast<uint32_t>(wanted[c]) << (c * 8);
+            }
+
+            const uint32_t idx = cache.Find(color);
+            indices[y * width + x] = scast<uint8_t>(idx);
+
+            int* below = nextRow.data() + (x + 1) * 4;
+            for (int c = 0; c < 4; ++c) {
+                const int e = wanted[c] - Channel(palette[idx], c);
+                err[4 + c] += e * 7;
+                below[c - 4] += e * 3;
+                below[c] += e * 5;
+                below[c + 4] += e;
+            }
+        }
+        thisRow.swap(nextRow);
+    }
+}
+
+bool QuantizeImage(const uint8_t* pixels, const uint32_t width, const uint32_t height, const size_t numColors, const bool dither,
+                   uint8_t* indices, uint8_t* palette, const size_t numThreads) {
+    return QuantizeImage(pixels, width, height, numColors, dither, indices, palette, numThreads, GetSupportedSIMDLevel());
+}
+
+bool QuantizeImage(const uint8_t* pixels, const uint32_t width, const uint32_t height, const size_t numColors, const bool dither,
+                   uint8_t* indices, uint8_t* palette, const size_t numThreads, const SIMDLevel level) {
+    // indices are bytes, and median cut needs at least two boxes
+    if (numColors < 2 || numColors > 256) {
+        return false;
+    }
+
+    std::memset(palette, 0, numColors * 4);
+
+    const size_t numPixels = scast<size_t>(width) * height;
+    if (!numPixels) {
+        return true;
+    }
+
+    const NearestFunc findNearest = GetNearestFunc(std::min(level, GetSupportedSIMDLevel()));
+
+    MyArray<ColorCount> unique;
+    CollectUniqueColors(pixels, numPixels, unique);
+
+    MyArray<uint32_t> colors;
+    const bool lossless = unique.size() <= numColors;
+    if (lossless) {
+        for (const ColorCount& cc : unique) {
+            colors.push_back(cc.color);
+        }
+    } else {
+        if (unique.size() > kMaxRefineColors) {
+            MyArray<ColorCount> buckets;
+            BucketColors(unique, buckets);
+            unique.swap(buckets);
+        }
+        MedianCut(unique, numColors, colors);
+        RefinePalette(unique, findNearest, numThreads, colors);
+    }
+
+    SearchPalette search;
+    BuildSearchPalette(colors, search);
+
+    // nothing to spread when every color is in the palette
+    if (dither && !lossless) {
+        MapPixelsDithered(pixels, width, height, colors, search, findNearest, indices);
+    } else {
+        MapPixels(pixels, width, height, search, findNearest, numThreads, indices);
+    }
+
+    std::memcpy(palette, colors.data(), colors.size() * 4);
+    return true;
+}
+
+
+// multi-palette quantization: a pixel is the tuple of its colors in every image, everything below is the
+// same median cut + k-means as above, only with numImages * 4 channels
+
+static const size_t kMaxImages = 256;
+
+struct TupleSet {
+    size_t              numImages;
+    MyArray<uint32_t>   colors;     // numImages per tuple
+    MyArray<uint32_t>   counts;
+};
+
+// index of the nearest tuple, ties go to the lower index
+using NearestTupleFunc = uint32_t(*)(const SearchPalette* palettes, const size_t numImages, const uint32_t* tuple);
+
+static inline uint64_t HashTuple(const uint32_t* tuple, const size_t numImages, const uint32_t mask) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < numImages; ++i) {
+        hash = (hash ^ (tuple[i] & mask)) * 1099511628211ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// merges the tuples that are equal once the low shift bits of every channel are gone, a group gets the weighted
+// average of its tuples. remap (optional) receives the group of every input tuple
+static void GroupTuples(const uint32_t* colors, const uint32_t* counts, const size_t numTuples, const size_t numImages, const int shift,
+                        TupleSet& groups, MyArray<uint32_t>* remap) {
+    struct TupleKey {
+        uint64_t hash;
+        uint32_t idx;
+    };
+
+    const uint32_t mask = ((0xFFu >> shift) << shift) * 0x01010101u;
+
+    MyArray<TupleKey> keys(numTuples);
+    for (size_t i = 0; i < numTuples; ++i) {
+        keys[i] = { HashTuple(colors + i * numImages, numImages, mask), scast<uint32_t>(i) };
+    }
+
+    // hash first, the tuples themselves only break hash collisions
+    std::sort(keys.begin(), keys.end(), [&](const TupleKey& a, const TupleKey& b) {
+        if (a.hash != b.hash) {
+            return a.hash < b.hash;
+        }
+        for (size_t n = 0; n < numImages; ++n) {
+            const uint32_t ca = colors[a.idx * numImages + n] & mask;
+            const uint32_t cb = colors[b.idx * numImages + n] & mask;
+            if (ca != cb) {
+                return ca < cb;
+            }
+        }
+        return false;
+    });
+
+    auto sameGroup = [&](const TupleKey& a, const TupleKey& b) {
+        if (a.hash != b.hash) {
+            return false;
+        }
+        for (size_t n = 0; n < numImages; ++n) {
+            if ((colors[a.idx * numImages + n] ^ colors[b.idx * numImages + n]) & mask) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    groups.numImages = numImages;
+    groups.colors.clear();
+    groups.counts.clear();
+    if (remap) {
+        remap->resize(numTuples);
+    }
+
+    MyArray<uint64_t> sums(numImages * 4);
+    for (size_t i = 0; i < numTuples; ) {
+        const uint32_t groupIdx = scast<uint32_t>(groups.counts.size());
+        std::fill(sums.begin(), sums.end(), 0);
+        uint64_t weight = 0;
+
+        size_t j = i;
+        for (; j < numTuples && sameGroup(keys[i], keys[j]); ++j) {
+            const uint32_t idx = keys[j].idx;
+            const uint64_t count = counts ? counts[idx] : 1;
+            for (size_t n = 0; n < numImages; ++n) {
+                for (int c = 0; c < 4; ++c) {
+                    sums[n * 4 + c] += scast<uint64_t>(Channel(colors[idx * numImages + n], c)) * count;
+                }
+            }
+            weight += count;
+            if (remap) {
+                (*remap)[idx] = groupIdx;
+            }
+        }
+
+        for (size_t n = 0; n < numImages; ++n) {
+            uint32_t color = 0;
+            for (int c = 0; c < 4; ++c) {
+                color |= scast<uint32_t>((sums[n * 4 + c] + weight / 2) / weight) << (c * 8);
+            }
+            groups.colors.push_back(color);
+        }
+        groups.counts.push_back(scast<uint32_t>(std::min<uint64_t>(weight, UINT32_MAX)));
+
+        i = j;
+    }
+}
+
+// one search palette per image, padded with copies of entry 0 that can never win a tie against it
+static void BuildSearchPalettes(const MyArray<uint32_t>& entries, const size_t numImages, MyArray<SearchPalette>& palettes) {
+    const size_t numEntries = entries.size() / numImages;
+    palettes.resize(numImages);
+    for (size_t n = 0; n < numImages; ++n) {
+        SearchPalette& palette = palettes[n];
+        palette.numEntries = (numEntries + 7) & ~size_t(7);
+        for (size_t i = 0; i < palette.numEntries; ++i) {
+            const uint32_t color = entries[((i < numEntries) ? i : 0) * numImages + n];
+            palette.c01[i] = PackPair(Channel(color, 0), Channel(color, 1));
+            palette.c23[i] = PackPair(Channel(color, 2), Channel(color, 3));
+        }
+    }
+}
+
+static uint32_t FindNearestTuple_Scalar(const SearchPalette* palettes, const size_t numImages, const uint32_t* tuple) {
+    int best = INT_MAX;
+    uint32_t bestIdx = 0;
+    for (size_t i = 0; i < palettes[0].numEntries; ++i) {
+        int d = 0;
+        for (size_t n = 0; n < numImages; ++n) {
+            const int d0 = Channel(tuple[n], 0) - scast<int16_t>(palettes[n].c01[i] & 0xFFFF);
+            const int d1 = Channel(tuple[n], 1) - scast<int16_t>(palettes[n].c01[i] >> 16);
+            const int d2 = Channel(tuple[n], 2) - scast<int16_t>(palettes[n].c23[i] & 0xFFFF);
+            const int d3 = Channel(tuple[n], 3) - scast<int16_t>(palettes[n].c23[i] >> 16);
+            d += d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3;
+        }
+        if (d < best) {
+            best = d;
+            bestIdx = scast<uint32_t>(i);
+        }
+    }
+    return bestIdx;
+}
+
+
+#if SH2TEX_X86
+
+SH2TEX_TARGET_SSE2 static uint32_t FindNearestTuple_SSE2(const SearchPalette* palettes, const size_t numImages, const uint32_t* tuple) {
+    int32_t pairs01[kMaxImages], pairs23[kMaxImages];
+    for (size_t n = 0; n < numImages; ++n) {
+        pairs01[n] = PackPair(Channel(tuple[n], 0), Channel(tuple[n], 1));
+        pairs23[n] = PackPair(Channel(tuple[n], 2), Channel(tuple[n], 3));
+    }
+
+    __m128i best = _mm_set1_epi32(INT_MAX);
+    __m128i bestIdx = _mm_setzero_si128();
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    for (size_t i = 0; i < palettes[0].numEntries; i += 4) {
+        __m128i d = _mm_setzero_si128();
+        for (size_t n = 0; n < numImages; ++n) {
+            const __m128i d01 = _mm_sub_epi16(_mm_set1_epi32(pairs01[n]), _mm_load_si128(rcast<const __m128i*>(palettes[n].c01 + i)));
+            const __m128i d23 = _mm_sub_epi16(_mm_set1_epi32(pairs23[n]), _mm_load_si128(rcast<const __m128i*>(palettes[n].c23 + i)));
+            d = _mm_add_epi32(d, _mm_add_epi32(_mm_madd_epi16(d01, d01), _mm_madd_epi16(d23, d23)));
+        }
+        const __m128i less = _mm_cmplt_epi32(d, best);
+        best = _mm_or_si128(_mm_and_si128(less, d), _mm_andnot_si128(less, best));
+        bestIdx = _mm_or_si128(_mm_and_si128(less, idx), _mm_andnot_si128(less, bestIdx));
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+
+    alignas(16) int32_t dists[4], idxs[4];
+    _mm_store_si128(rcast<__m128i*>(dists), best);
+    _mm_store_si128(rcast<__m128i*>(idxs), bestIdx);
+    return ReduceLanes(dists, idxs, 4);
+}
+
+SH2TEX_TARGET_AVX2 static uint32_t FindNearestTuple_AVX2(const SearchPalette* palettes, const size_t numImages, const uint32_t* tuple) {
+    int32_t pairs01[kMaxImages], pairs23[kMaxImages];
+    for (size_t n = 0; n < numImages; ++n) {
+        pairs01[n] = PackPair(Channel(tuple[n], 0), Channel(tuple[n], 1));
+        pairs23[n] = PackPair(Channel(tuple[n], 2), Channel(tuple[n], 3));
+    }
+
+    __m256i best = _mm256_set1_epi32(INT_MAX);
+    __m256i bestIdx = _mm256_setzero_si256();
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (size_t i = 0; i < palettes[0].numEntries; i += 8) {
+        __m256i d = _mm256_setzero_si256();
+        for (size_t n = 0; n < numImages; ++n) {
+            const __m256i d01 = _mm256_sub_epi16(_mm256_set1_epi32(pairs01[n]), _mm256_load_si256(rcast<const __m256i*>(palettes[n].c01 + i)));
+            const __m256i d23 = _mm256_sub_epi16(_mm256_set1_epi32(pairs23[n]), _mm256_load_si256(rcast<const __m256i*>(palettes[n].c23 + i)));
+            d = _mm256_add_epi32(d, _mm256_add_epi32(_mm256_madd_epi16(d01, d01), _mm256_madd_epi16(d23, d23)));
+        }
+        const __m256i less = _mm256_cmpgt_epi32(best, d);
+        best = _mm256_min_epi32(best, d);
+        bestIdx = _mm256_blendv_epi8(bestIdx, idx, less);
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+
+    alignas(32) int32_t dists[8], idxs[8];
+    _mm256_store_si256(rcast<__m256i*>(dists), best);
+    _mm256_store_si256(rcast<__m256i*>(idxs), bestIdx);
+    return ReduceLanes(dists, idxs, 8);
+}
+
+#endif // SH2TEX_X86
+
+
+static NearestTupleFunc GetNearestTupleFunc(const SIMDLevel level) {
+#if SH2TEX_X86
+    if (level >= SIMDLevel::AVX2) {
+        return FindNearestTuple_AVX2;
+    } else if (level >= SIMDLevel::SSE2) {
+        return FindNearestTuple_SSE2;
+    }
+#endif
+    return FindNearestTuple_Scalar;
+}
+
+struct TupleBox {
+    size_t      begin;
+    size_t      end;
+    uint64_t    weight;
+    size_t      channel;    // the widest one, image * 4 + channel
+    int         range;
+};
+
+static TupleBox MakeTupleBox(const TupleSet& tuples, const MyArray<uint32_t>& order, const size_t begin, const size_t end) {
+    const size_t numChannels = tuples.numImages * 4;
+    MyArray<int> lo(numChannels, 255), hi(numChannels, 0);
+    uint64_t weight = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const uint32_t* tuple = tuples.colors.data() + order[i] * tuples.numImages;
+        for (size_t ch = 0; ch < numChannels; ++ch) {
+            const int value = Channel(tuple[ch / 4], scast<int>(ch % 4));
+            lo[ch] = std::min(lo[ch], value);
+            hi[ch] = std::max(hi[ch], value);
+        }
+        weight += tuples.counts[order[i]];
+    }
+
+    TupleBox box = { begin, end, weight, 0, hi[0] - lo[0] };
+    for (size_t ch = 1; ch < numChannels; ++ch) {
+        if (hi[ch] - lo[ch] > box.range) {
+            box.channel = ch;
+            box.range = hi[ch] - lo[ch];
+        }
+    }
+    return box;
+}
+
+static void MedianCutTuples(const TupleSet& tuples, const size_t numColors, MyArray<uint32_t>& entries) {
+    const size_t numImages = tuples.numImages;
+
+    MyArray<uint32_t> order(tuples.counts.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = scast<uint32_t>(i);
+    }
+
+    MyArray<TupleBox> boxes = { MakeTupleBox(tuples, order, 0, order.size()) };
+
+    while (boxes.size() < numColors) {
+        size_t splitIdx = boxes.size();
+        uint64_t bestScore = 0;
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            const uint64_t score = boxes[i].weight * scast<uint64_t>(boxes[i].range);
+            if (boxes[i].end - boxes[i].begin > 1 && score > bestScore) {
+                splitIdx = i;
+                bestScore = score;
+            }
+        }
+        if (splitIdx == boxes.size()) {
+            break;
+        }
+
+        const TupleBox box = boxes[splitIdx];
+        const size_t image = box.channel / 4;
+        const int channel = scast<int>(box.channel % 4);
+        std::sort(order.begin() + box.begin, order.begin() + box.end, [&](const uint32_t a, const uint32_t b) {
+            return Channel(tuples.colors[a * numImages + image], channel) < Channel(tuples.colors[b * numImages + image], channel);
+        });
+
+        size_t median = box.begin + 1;
+        uint64_t accumulated = tuples.counts[order[box.begin]];
+        while (median < box.end - 1 && accumulated * 2 < box.weight) {
+            accumulated += tuples.counts[order[median]];
+            ++median;
+        }
+
+        boxes[splitIdx] = MakeTupleBox(tuples, order, box.begin, median);
+        boxes.push_back(MakeTupleBox(tuples, order, median, box.end));
+    }
+
+    entries.clear();
+    MyArray<uint64_t> sums(numImages * 4);
+    for (const TupleBox& box : boxes) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (size_t i = box.begin; i < box.end; ++i) {
+            for (size_t n = 0; n < numImages; ++n) {
+                for (int c = 0; c < 4; ++c) {
+                    sums[n * 4 + c] += scast<uint64_t>(Channel(tuples.colors[order[i] * numImages + n], c)) * tuples.counts[order[i]];
+                }
+            }
+        }
+
+        for (size_t n = 0; n < numImages; ++n) {
+            uint32_t color = 0;
+            for (int c = 0; c < 4; ++c) {
+                color |= scast<uint32_t>((sums[n * 4 + c] + box.weight / 2) / box.weight) << (c * 8);
+            }
+            entries.push_back(color);
+        }
+    }
+}
+
+static void RefineTuples(const TupleSet& tuples, const NearestTupleFunc findNearest, const size_t numThreads, MyArray<uint32_t>& entries) {
+    const size_t numImages = tuples.numImages;
+    const size_t numEntries = entries.size() / numImages;
+    const size_t numTuples = tuples.counts.size();
+    const size_t numTasks = (numTuples + kColorsPerTask - 1) / kColorsPerTask;
+
+    // numImages * 4 channel sums and then the count, per entry
+    const size_t stride = numImages * 4 + 1;
+
+    for (int pass = 0; pass < kMaxKMeansPasses; ++pass) {
+        MyArray<SearchPalette> search;
+        BuildSearchPalettes(entries, numImages, search);
+
+        MyArray<uint64_t> total(numEntries * stride, 0);
+        std::mutex totalLock;
+
+        ParallelFor(numTasks, [&](const size_t task) {
+            MyArray<uint64_t> local(numEntries * stride, 0);
+            const size_t end = std::min(numTuples, (task + 1) * kColorsPerTask);
+            for (size_t i = task * kColorsPerTask; i < end; ++i) {
+                const uint32_t* tuple = tuples.colors.data() + i * numImages;
+                uint64_t* acc = local.data() + findNearest(search.data(), numImages, tuple) * stride;
+                for (size_t n = 0; n < numImages; ++n) {
+                    for (int c = 0; c < 4; ++c) {
+                        acc[n * 4 + c] += scast<uint64_t>(Channel(tuple[n], c)) * tuples.counts[i];
+                    }
+                }
+                acc[stride - 1] += tuples.counts[i];
+            }
+
+            std::lock_guard<std::mutex> lock(totalLock);
+            for (size_t i = 0; i < total.size(); ++i) {
+                total[i] += local[i];
+            }
+        }, numThreads);
+
+        bool changed = false;
+        for (size_t i = 0; i < numEntries; ++i) {
+            const uint64_t* acc = total.data() + i * stride;
+            const uint64_t count = acc[stride - 1];
+            // an entry nobody picked keeps its colors
+            if (!count) {
+                continue;
+            }
+
+            for (size_t n = 0; n < numImages; ++n) {
+                uint32_t color = 0;
+                for (int c = 0; c < 4; ++c) {
+                    color |= scast<uint32_t>((acc[n * 4 + c] + count / 2) / count) << (c * 8);
+                }
+                changed = changed || color != entries[i * numImages + n];
+                entries[i * numImages + n] = color;
+            }
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+bool QuantizeImages(const uint8_t* const* images, const size_t numImages, const uint32_t width, const uint32_t height, const size_t numColors,
+                    uint8_t* indices, uint8_t* palettes, const size_t numThreads) {
+    return QuantizeImages(images, numImages, width, height, numColors, indices, palettes, numThreads, GetSupportedSIMDLevel());
+}
+
+bool QuantizeImages(const uint8_t* const* images, const size_t numImages, const uint32_t width, const uint32_t height, const size_t numColors,
+                    uint8_t* indices, uint8_t* palettes, const size_t numThreads, const SIMDLevel level) {
+    if (numColors < 2 || numColors > 256 || !numImages || numImages > kMaxImages) {
+        return false;
+    }
+
+    std::memset(palettes, 0, numImages * numColors * 4);
+
+    const size_t numPixels = scast<size_t>(width) * height;
+    if (!numPixels) {
+        return true;
+    }
+
+    const NearestTupleFunc findNearest = GetNearestTupleFunc(std::min(level, GetSupportedSIMDLevel()));
+
+    // pixel tuples, image after image
+    MyArray<uint32_t> pixelTuples(numPixels * numImages);
+    for (size_t n = 0; n < numImages; ++n) {
+        for (size_t i = 0; i < numPixels; ++i) {
+            std::memcpy(&pixelTuples[i * numImages + n], images[n] + i * 4, 4);
+        }
+    }
+
+    TupleSet unique;
+    MyArray<uint32_t> pixelToUnique;
+    GroupTuples(pixelTuples.data(), nullptr, numPixels, numImages, 0, unique, &pixelToUnique);
+    pixelTuples = MyArray<uint32_t>();
+
+    const size_t numUnique = unique.counts.size();
+    MyArray<uint32_t> entries;
+    MyArray<uint32_t> uniqueToEntry(numUnique);
+
+    if (numUnique <= numColors) {
+        entries = unique.colors;
+        for (size_t i = 0; i < numUnique; ++i) {
+            uniqueToEntry[i] = scast<uint32_t>(i);
+        }
+    } else {
+        // coarser and coarser channels till there are few enough to refine, every tuple costs numImages colors
+        // in there. an average stays in its bucket, so the previous groups can be grouped again
+        TupleSet refine = unique;
+        const size_t maxRefine = kMaxRefineColors / numImages;
+        for (int shift = 3; refine.counts.size() > maxRefine && shift < 8; ++shift) {
+            TupleSet coarser;
+            GroupTuples(refine.colors.data(), refine.counts.data(), refine.counts.size(), numImages, shift, coarser, nullptr);
+            refine.colors.swap(coarser.colors);
+            refine.counts.swap(coarser.counts);
+        }
+
+        MedianCutTuples(refine, numColors, entries);
+        RefineTuples(refine, findNearest, numThreads, entries);
+
+        MyArray<SearchPalette> search;
+        BuildSearchPalettes(entries, numImages, search);
+
+        const size_t numTasks = (numUnique + kColorsPerTask - 1) / kColorsPerTask;
+        ParallelFor(numTasks, [&](const size_t task) {
+            const size_t end = std::min(numUnique, (task + 1) * kColorsPerTask);
+            for (size_t i = task * kColorsPerTask; i < end; ++i) {
+                uniqueToEntry[i] = findNearest(search.data(), numImages, unique.colors.data() + i * numImages);
+            }
+        }, numThreads);
+    }
+
+    for (size_t i = 0; i < numPixels; ++i) {
+        indices[i] = scast<uint8_t>(uniqueToEntry[pixelToUnique[i]]);
+    }
+
+    const size_t numEntries = entries.size() / numImages;
+    for (size_t n = 0; n < numImages; ++n) {
+        for (size_t i = 0; i < numEntries; ++i) {
+            std::memcpy(palettes + (n * numColors + i) * 4, &entries[i * numImages + n], 4);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "mycommon.h"
+#include "cpufeatures.h"
+
+// Reduces 32bpp pixels to at most numColors (2..256) palette entries. Any channel order works, all 4 channels
+// count and the palette comes out in the same order. Median cut over the unique colors seeds the palette and
+// a few k-means passes refine it, images with numColors unique colors or less are kept lossless.
+// indices receives one byte per pixel, palette numColors * 4 bytes (unused entries are zeroed).
+// Returns false, without touching the outputs, if numColors is out of range.
+// dither spreads the error Floyd-Steinberg style. The nearest color search uses the best SIMD path the CPU
+// supports behind a per-thread color cache, the work is spread over numThreads threads (0 means all cores).
+bool    QuantizeImage(const uint8_t* pixels, const uint32_t width, const uint32_t height, const size_t numColors, const bool dither,
+                      uint8_t* indices, uint8_t* palette, const size_t numThreads);
+// Same, but forces a specific code path (clamped to what the CPU supports)
+bool    QuantizeImage(const uint8_t* pixels, const uint32_t width, const uint32_t height, const size_t numColors, const bool dither,
+                      uint8_t* indices, uint8_t* palette, const size_t numThreads, const SIMDLevel level);
+
+// Several images sharing one index map, like PS2 textures with more than one CLUT: every pixel gets the one index
+// that looks best across all of them. A pixel is treated as its numImages (up to 256) colors at once, so it's the
+// same median cut + k-means, just in more dimensions, and it's lossless if there are numColors color tuples or less.
+// palettes receives numImages palettes of numColors * 4 bytes, one after another. No dithering here, an error
+// spread in one image would end up on completely different colors in the others.
+// Returns false if numColors or numImages is out of range.
+bool    QuantizeImages(const uint8_t* const* images, const size_t numImages, const uint32_t width, const uint32_t height, const size_t numColors,
+                       uint8_t* indices, uint8_t* palettes, const size_t numThreads);
+// Same, but forces a specific code path (clamped to what the CPU supports)
+bool    QuantizeImages(const uint8_t* const* images, const size_t numImages, const uint32_t width, const uint32_t height, const size_t numColors,
+                       uint8_t* indices, uint8_t* palettes, const size_t numThreads, const SIMDLevel level);
@@ -0,0 +1,210 @@
+#include "parallel.h"
+
+// items of one ParallelFor call, shared with the helper tasks it spawned into a pool,
+// helpers that only get to run after everything was claimed find nothing left and never touch func
+struct ParallelForGroup {
+    const std::function<void(size_t)>*  func = nullptr;
+    size_t                              count = 0;
+    std::atomic<size_t>                 nextIdx{ 0 };
+    std::atomic<size_t>                 numDone{ 0 };
+    std::mutex                          lock;
+    std::condition_variable             allDone;
+};
+
+static void RunGroupItems(ParallelForGroup& group) {
+    size_t numRun = 0;
+    for (size_t i = group.nextIdx++; i < group.count; i = group.nextIdx++) {
+        (*group.func)(i);
+        ++numRun;
+    }
+
+    if (numRun && (group.numDone += numRun) == group.count) {
+        std::lock_guard<std::mutex> lock(group.lock);
+        group.allDone.notify_all();
+    }
+}
+
+// lets spawned tasks (and nested ParallelFor calls) find their pool and worker's queue
+static thread_local TaskPool*   tCurrentPool = nullptr;
+static thread_local size_t      tCurrentWorker = 0;
+
+// ParallelFor calls made outside of any pool share this one, so they don't start and join threads every time
+static TaskPool& GetSharedPool() {
+    static TaskPool sPool;
+    return sPool;
+}
+
+void ParallelFor(const size_t count, const std::function<void(size_t)>& func, size_t numThreads) {
+    if (!count) {
+        return;
+    }
+
+    // inside a pool task the pool's workers are busy with our siblings or idle,
+    // so hand them helper tasks instead of starting more threads than there are cores
+    TaskPool& pool = tCurrentPool ? *tCurrentPool : GetSharedPool();
+    numThreads = numThreads ? std::min(numThreads, pool.GetNumThreads()) : pool.GetNumThreads();
+    numThreads = std::min(numThreads, count);
+
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    std::shared_ptr<ParallelForGroup> group = std::make_shared<ParallelForGroup>();
+    group->func = &func;
+    group->count = count;
+    for (size_t i = 1; i < numThreads; ++i) {
+        pool.Spawn([group]() {
+            RunGroupItems(*group);
+        });
+    }
+    RunGroupItems(*group);
+
+    // whatever is left was claimed by helpers that are running right now
+    std::unique_lock<std::mutex> lock(group->lock);
+    group->allDone.wait(lock, [&group]() {
+        return group->numDone == group->count;
+    });
+}
+
+
+struct TaskPool::Queue {
+    std::mutex          lock;
+    MyDeque<Task>       tasks;
+};
+
+TaskPool::TaskPool(const size_t numThreads)
+    : mNumPending(0)
+    , mNumQueued(0)
+    , mNextQueue(0)
+    , mStop(false)
+{
+    const size_t count = numThreads ? numThreads : std::max<size_t>(1, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < count; ++i) {
+        mQueues.emplace_back(std::make_unique<Queue>());
+    }
+
+    // the thread calling Run() (or ParallelFor) is the missing one
+    for (size_t i = 1; i < count; ++i) {
+        mThreads.emplace_back(&TaskPool::WorkerLoop, this, i);
+    }
+}
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+        mStop = true;
+    }
+    mWake.notify_all();
+
+    for (auto& t : mThreads) {
+        t.join();
+    }
+}
+
+void TaskPool::Spawn(Task task) {
+    const size_t queueIdx = (tCurrentPool == this) ? tCurrentWorker : (mNextQueue++ % mQueues.size());
+
+    // counted before it's visible, so a quick thief can't take mNumQueued below zero
+    ++mNumPending;
+    ++mNumQueued;
+
+    {
+        Queue& queue = *mQueues[queueIdx];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.emplace_back(std::move(task));
+    }
+
+    // an idle worker checks mNumQueued under mWakeLock, so taking it here means the wakeup can't get lost
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+    }
+    mWake.notify_one();
+}
+
+void TaskPool::Run() {
+    TaskPool* prevPool = tCurrentPool;
+    const size_t prevWorker = tCurrentWorker;
+    tCurrentPool = this;
+    tCurrentWorker = 0;
+
+    Task task;
+    while (mNumPending > 0) {
+        if (this->PopOrSteal(0, task)) {
+            this->RunTask(task);
+        } else {
+            // nothing to take, but somebody is still busy and might spawn more
+            std::unique_lock<std::mutex> lock(mWakeLock);
+            mWake.wait(lock, [this]() {
+                return mNumQueued > 0 || mNumPending == 0;
+            });
+        }
+    }
+
+    tCurrentPool = prevPool;
+    tCurrentWorker = prevWorker;
+}
+
+size_t TaskPool::GetNumThreads() const {
+    return mQueues.size();
+}
+
+bool TaskPool::PopOrSteal(const size_t workerIdx, Task& task) {
+    // own queue first, newest task is the most likely to be hot in cache
+    {
+        Queue& own = *mQueues[workerIdx];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --mNumQueued;
+            return true;
+        }
+    }
+
+    // then steal the oldest one from somebody else, that's usually the biggest chunk of work
+    for (size_t i = 1; i < mQueues.size(); ++i) {
+        Queue& victim = *mQueues[(workerIdx + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --mNumQueued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskPool::RunTask(Task& task) {
+    task();
+    task = nullptr;
+    if (--mNumPending == 0) {
+        // that was the last one, Run() may be waiting for it
+        std::lock_guard<std::mutex> lock(mWakeLock);
+        mWake.notify_all();
+    }
+}
+
+void TaskPool::WorkerLoop(const size_t workerIdx) {
+    tCurrentPool = this;
+    tCurrentWorker = workerIdx;
+
+    Task task;
+    for (;;) {
+        if (this->PopOrSteal(workerIdx, task)) {
+            this->RunTask(task);
+        } else {
+            // parked till something gets spawned or the pool goes away
+            std::unique_lock<std::mutex> lock(mWakeLock);
+            mWake.wait(lock, [this]() {
+                return mNumQueued > 0 || mStop;
+            });
+            if (mStop) {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "mycommon.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Runs func(i) for every i in [0, count) on up to numThreads threads (0 means all cores).
+// Indices are handed out one at a time, so uneven work items balance themselves.
+// The calling thread participates, the call returns when all items are done.
+// No threads are started: the other numThreads - 1 are helper tasks on the TaskPool the caller runs in,
+// or on a shared pool of all the cores created on first use, so numThreads is capped at that pool's size.
+void    ParallelFor(const size_t count, const std::function<void(size_t)>& func, size_t numThreads = 0);
+
+// Work-stealing pool for uneven, nested work: every worker pops tasks from the back of its own
+// queue and idle workers steal from the front of the others. Tasks spawned from inside a task go
+// to the current worker's queue, so a big item can split itself up and the idle workers help out.
+// The workers live as long as the pool and sleep while there's nothing to do, tasks start as soon as they're spawned.
+class TaskPool {
+public:
+    using Task = std::function<void()>;
+
+    TaskPool(const size_t numThreads = 0);  // 0 means all cores, including the one calling Run()
+    ~TaskPool();
+
+    void    Spawn(Task task);
+    // runs until all the tasks, including the ones spawned meanwhile, are done,
+    // the calling thread participates
+    void    Run();
+
+    size_t  GetNumThreads() const;
+
+private:
+    struct Queue;
+
+    bool    PopOrSteal(const size_t workerIdx, Task& task);
+    void    RunTask(Task& task);
+    void    WorkerLoop(const size_t workerIdx);
+
+private:
+    MyArray<std::unique_ptr<Queue>> mQueues;
+    MyArray<std::thread>            mThreads;
+    std::atomic<size_t>             mNumPending;    // spawned and not finished yet
+    std::atomic<size_t>             mNumQueued;     // spawned and not picked up yet
+    std::atomic<size_t>             mNextQueue;
+    // idle workers park here till there's something to take or everything is done
+    std::mutex                      mWakeLock;
+    std::condition_variable         mWake;
+    bool                            mStop;          // guarded by mWakeLock
+};
@@ -0,0 +1,311 @@
+#include "pixelops.h"
+
+
+template <typename Op>
+static void Convert_Scalar(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    for (size_t i = 0; i < numPixels; ++i) {
+        uint32_t c;
+        std::memcpy(&c, src + i * 4, sizeof(c));
+        c = Op::Scalar(c);
+        std::memcpy(dst + i * 4, &c, sizeof(c));
+    }
+}
+
+#if SH2TEX_X86
+
+template <typename Op>
+SH2TEX_TARGET_SSE2 static void Convert_SSE2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    size_t i = 0;
+    for (; i + 4 <= numPixels; i += 4) {
+        const __m128i v = _mm_loadu_si128(rcast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(rcast<__m128i*>(dst + i * 4), Op::SSE2(v));
+    }
+    Convert_Scalar<Op>(src + i * 4, dst + i * 4, numPixels - i);
+}
+
+template <typename Op>
+SH2TEX_TARGET_AVX2 static void Convert_AVX2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    size_t i = 0;
+    for (; i + 8 <= numPixels; i += 8) {
+        const __m256i v = _mm256_loadu_si256(rcast<const __m256i*>(src + i * 4));
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i * 4), Op::AVX2(v));
+    }
+    Convert_Scalar<Op>(src + i * 4, dst + i * 4, numPixels - i);
+}
+
+#endif // SH2TEX_X86
+
+
+template <typename Op>
+static void Convert(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+#if SH2TEX_X86
+    const SIMDLevel actualLevel = std::min(level, GetSupportedSIMDLevel());
+    if (actualLevel >= SIMDLevel::AVX2) {
+        Convert_AVX2<Op>(src, dst, numPixels);
+        return;
+    } else if (actualLevel >= SIMDLevel::SSE2) {
+        Convert_SSE2<Op>(src, dst, numPixels);
+        return;
+    }
+#endif
+    Convert_Scalar<Op>(src, dst, numPixels);
+}
+
+
+void PixelsSwapRedBlue(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    Convert<SwapRedBlueOp>(src, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void PixelsFromPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    Convert<FromPS2Op>(src, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void PixelsToPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    Convert<ToPS2Op>(src, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void PixelsFromBGRA(const uint8_t* src, uint8_t* dst, const size_t numPixels, const PixelLayout layout) {
+    PixelsFromBGRA(src, dst, numPixels, layout, GetSupportedSIMDLevel());
+}
+
+void PixelsSwapRedBlue(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+    Convert<SwapRedBlueOp>(src, dst, numPixels, level);
+}
+
+void PixelsFromPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+    Convert<FromPS2Op>(src, dst, numPixels, level);
+}
+
+void PixelsToPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+    Convert<ToPS2Op>(src, dst, numPixels, level);
+}
+
+void PixelsFromBGRA(const uint8_t* src, uint8_t* dst, const size_t numPixels, const PixelLayout layout, const SIMDLevel level) {
+    if (layout == PixelLayout::BGRA) {
+        if (src != dst) {
+            std::memcpy(dst, src, numPixels * 4);
+        }
+    } else if (layout == PixelLayout::RGBAPremultiplied) {
+        Convert<FromBGRAOp<PixelLayout::RGBAPremultiplied>>(src, dst, numPixels, level);
+    } else {
+        Convert<FromBGRAOp<PixelLayout::RGBA>>(src, dst, numPixels, level);
+    }
+}
+
+
+// palette lookups, SSE2 has neither byte shuffles nor gathers so only the AVX2 level gets a vector path
+
+static void FromIndices_Scalar(const uint8_t* indices, const uint32_t* palette, uint8_t* dst, const size_t numPixels) {
+    for (size_t i = 0; i < numPixels; ++i) {
+        std::memcpy(dst + i * 4, &palette[indices[i]], 4);
+    }
+}
+
+#if SH2TEX_X86
+
+SH2TEX_TARGET_AVX2 static void FromIndices_AVX2(const uint8_t* indices, const uint32_t* palette, uint8_t* dst, const size_t numPixels) {
+    const int* table = rcast<const int*>(palette);
+    size_t i = 0;
+    for (; i + 16 <= numPixels; i += 16) {
+        const __m256i idx0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(rcast<const __m128i*>(indices + i)));
+        const __m256i idx1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(rcast<const __m128i*>(indices + i + 8)));
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i * 4), _mm256_i32gather_epi32(table, idx0, 4));
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i * 4 + 32), _mm256_i32gather_epi32(table, idx1, 4));
+    }
+    FromIndices_Scalar(indices + i, palette, dst + i * 4, numPixels - i);
+}
+
+// 16 colors: the palette split into 4 byte planes, each one a single shuffle away from 32 pixels' worth of a channel
+SH2TEX_TARGET_AVX2 static void FromIndices16_AVX2(const uint8_t* indices, const uint32_t* palette, uint8_t* dst, const size_t numPixels) {
+    alignas(16) uint8_t planeBytes[4][16];
+    for (size_t k = 0; k < 16; ++k) {
+        for (size_t c = 0; c < 4; ++c) {
+            planeBytes[c][k] = scast<uint8_t>(palette[k] >> (c * 8));
+        }
+    }
+
+    __m256i planes[4];
+    for (size_t c = 0; c < 4; ++c) {
+        planes[c] = _mm256_broadcastsi128_si256(_mm_load_si128(rcast<const __m128i*>(planeBytes[c])));
+    }
+
+    const __m256i highNibble = _mm256_set1_epi8(scast<char>(0xF0));
+    const __m256i zeroBit = _mm256_set1_epi8(scast<char>(0x80));
+    size_t i = 0;
+    for (; i + 32 <= numPixels; i += 32) {
+        __m256i idx = _mm256_loadu_si256(rcast<const __m256i*>(indices + i));
+        // past the 16 colors the palette is 0, the shuffle zeroes bytes with the top bit set
+        const __m256i inRange = _mm256_cmpeq_epi8(_mm256_and_si256(idx, highNibble), _mm256_setzero_si256());
+        idx = _mm256_or_si256(idx, _mm256_andnot_si256(inRange, zeroBit));
+
+        const __m256i c0 = _mm256_shuffle_epi8(planes[0], idx);
+        const __m256i c1 = _mm256_shuffle_epi8(planes[1], idx);
+        const __m256i c2 = _mm256_shuffle_epi8(planes[2], idx);
+        const __m256i c3 = _mm256_shuffle_epi8(planes[3], idx);
+
+        // interleave back to pixels, the unpacks stay inside 128 bit lanes so the halves get swapped in place at the end
+        const __m256i c01lo = _mm256_unpacklo_epi8(c0, c1);
+        const __m256i c01hi = _mm256_unpackhi_epi8(c0, c1);
+        const __m256i c23lo = _mm256_unpacklo_epi8(c2, c3);
+        const __m256i c23hi = _mm256_unpackhi_epi8(c2, c3);
+        const __m256i p0 = _mm256_unpacklo_epi16(c01lo, c23lo);    // pixels 0..3   | 16..19
+        const __m256i p1 = _mm256_unpackhi_epi16(c01lo, c23lo);    // pixels 4..7   | 20..23
+        const __m256i p2 = _mm256_unpacklo_epi16(c01hi, c23hi);    // pixels 8..11  | 24..27
+        const __m256i p3 = _mm256_unpackhi_epi16(c01hi, c23hi);    // pixels 12..15 | 28..31
+
+        uint8_t* out = dst + i * 4;
+        _mm256_storeu_si256(rcast<__m256i*>(out), _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(rcast<__m256i*>(out + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(rcast<__m256i*>(out + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(rcast<__m256i*>(out + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    FromIndices_Scalar(indices + i, palette, dst + i * 4, numPixels - i);
+}
+
+#endif // SH2TEX_X86
+
+
+void PixelsFromIndices(const uint8_t* indices, const uint32_t* palette, const size_t numColors, uint8_t* dst, const size_t numPixels) {
+    PixelsFromIndices(indices, palette, numColors, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void PixelsFromIndices(const uint8_t* indices, const uint32_t* palette, const size_t numColors, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+#if SH2TEX_X86
+    const SIMDLevel actualLevel = std::min(level, GetSupportedSIMDLevel());
+    if (actualLevel >= SIMDLevel::AVX2) {
+        if (numColors <= 16) {
+            FromIndices16_AVX2(indices, palette, dst, numPixels);
+        } else {
+            FromIndices_AVX2(indices, palette, dst, numPixels);
+        }
+        return;
+    }
+#endif
+    FromIndices_Scalar(indices, palette, dst, numPixels);
+}
+
+// 4 bit indices. Unpacking walks backwards and packing forwards, so in place works: a block is always loaded
+// before anything overlapping it gets stored, and stores never reach bytes still waiting to be read.
+
+static void Unpack4Bit_Scalar(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    for (size_t i = numPixels; i > 0; --i) {
+        const size_t x = i - 1;
+        dst[x] = (src[x >> 1] >> ((x & 1) * 4)) & 0x0F;
+    }
+}
+
+static void Pack4Bit_Scalar(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    size_t i = 0;
+    for (; i + 2 <= numPixels; i += 2) {
+        dst[i >> 1] = scast<uint8_t>((src[i] & 0x0F) | ((src[i + 1] & 0x0F) << 4));
+    }
+    if (i < numPixels) {
+        dst[i >> 1] = src[i] & 0x0F;
+    }
+}
+
+#if SH2TEX_X86
+
+SH2TEX_TARGET_SSE2 static void Unpack4Bit_SSE2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    const size_t numBlocks = numPixels / 32;
+    // the odd tail sits at the end, so it goes first
+    Unpack4Bit_Scalar(src + numBlocks * 16, dst + numBlocks * 32, numPixels - numBlocks * 32);
+
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    for (size_t b = numBlocks; b > 0; --b) {
+        const size_t i = (b - 1) * 32;
+        const __m128i v = _mm_loadu_si128(rcast<const __m128i*>(src + i / 2));
+        const __m128i lo = _mm_and_si128(v, mask);
+        const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        _mm_storeu_si128(rcast<__m128i*>(dst + i), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128(rcast<__m128i*>(dst + i + 16), _mm_unpackhi_epi8(lo, hi));
+    }
+}
+
+SH2TEX_TARGET_SSE2 static void Pack4Bit_SSE2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    const __m128i mask = _mm_set1_epi16(0x0F0F);
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 32 <= numPixels; i += 32) {
+        // every 16 bit lane is an even/odd pair, fold the odd one into the high nibble of the even one
+        __m128i a = _mm_and_si128(_mm_loadu_si128(rcast<const __m128i*>(src + i)), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(rcast<const __m128i*>(src + i + 16)), mask);
+        a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), low);
+        b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), low);
+        _mm_storeu_si128(rcast<__m128i*>(dst + i / 2), _mm_packus_epi16(a, b));
+    }
+    Pack4Bit_Scalar(src + i, dst + i / 2, numPixels - i);
+}
+
+SH2TEX_TARGET_AVX2 static void Unpack4Bit_AVX2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    const size_t numBlocks = numPixels / 64;
+    Unpack4Bit_SSE2(src + numBlocks * 32, dst + numBlocks * 64, numPixels - numBlocks * 64);
+
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    for (size_t b = numBlocks; b > 0; --b) {
+        const size_t i = (b - 1) * 64;
+        const __m256i v = _mm256_loadu_si256(rcast<const __m256i*>(src + i / 2));
+        const __m256i lo = _mm256_and_si256(v, mask);
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        // unpacks stay inside 128 bit lanes, put the halves back in order
+        const __m256i a = _mm256_unpacklo_epi8(lo, hi);
+        const __m256i c = _mm256_unpackhi_epi8(lo, hi);
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i), _mm256_permute2x128_si256(a, c, 0x20));
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i + 32), _mm256_permute2x128_si256(a, c, 0x31));
+    }
+}
+
+SH2TEX_TARGET_AVX2 static void Pack4Bit_AVX2(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    const __m256i mask = _mm256_set1_epi16(0x0F0F);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 64 <= numPixels; i += 64) {
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256(rcast<const __m256i*>(src + i)), mask);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256(rcast<const __m256i*>(src + i + 32)), mask);
+        a = _mm256_and_si256(_mm256_or_si256(a, _mm256_srli_epi16(a, 4)), low);
+        b = _mm256_and_si256(_mm256_or_si256(b, _mm256_srli_epi16(b, 4)), low);
+        // packus interleaves the 128 bit lanes of a and b, 0xD8 restores the order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(rcast<__m256i*>(dst + i / 2), packed);
+    }
+    Pack4Bit_SSE2(src + i, dst + i / 2, numPixels - i);
+}
+
+#endif // SH2TEX_X86
+
+
+void IndicesUnpack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    IndicesUnpack4Bit(src, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void IndicesPack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels) {
+    IndicesPack4Bit(src, dst, numPixels, GetSupportedSIMDLevel());
+}
+
+void IndicesUnpack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+#if SH2TEX_X86
+    const SIMDLevel actualLevel = std::min(level, GetSupportedSIMDLevel());
+    if (actualLevel >= SIMDLevel::AVX2) {
+        Unpack4Bit_AVX2(src, dst, numPixels);
+        return;
+    } else if (actualLevel >= SIMDLevel::SSE2) {
+        Unpack4Bit_SSE2(src, dst, numPixels);
+        return;
+    }
+#endif
+    Unpack4Bit_Scalar(src, dst, numPixels);
+}
+
+void IndicesPack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level) {
+#if SH2TEX_X86
+    const SIMDLevel actualLevel = std::min(level, GetSupportedSIMDLevel());
+    if (actualLevel >= SIMDLevel::AVX2) {
+        Pack4Bit_AVX2(src, dst, numPixels);
+        return;
+    } else if (actualLevel >= SIMDLevel::SSE2) {
+        Pack4Bit_SSE2(src, dst, numPixels);
+        return;
+    }
+#endif
+    Pack4Bit_Scalar(src, dst, numPixels);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "mycommon.h"
+#include "cpufeatures.h"
+
+// 32bpp layouts the decoders can write, so every consumer gets its pixels in one pass
+enum class PixelLayout : int {
+    RGBA,               // R in the lowest byte, straight alpha (PNG, Qt RGBA8888)
+    BGRA,               // B in the lowest byte, SH2 pixels and palettes, 32 bit DDS
+    RGBAPremultiplied   // RGBA with the color multiplied by alpha (Qt RGBA8888_Premultiplied)
+};
+
+// 32bpp pixel conversions shared by loading, saving, import and export. src and dst hold numPixels * 4 bytes,
+// can be the same buffer and need no alignment. They use the best SIMD path the CPU supports.
+
+// BGRA <-> RGBA
+void    PixelsSwapRedBlue(const uint8_t* src, uint8_t* dst, const size_t numPixels);
+// PS2 RGBA with 0..0x80 alpha -> BGRA
+void    PixelsFromPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels);
+// BGRA -> PS2 RGBA with 0..0x80 alpha
+void    PixelsToPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels);
+// BGRA -> any layout
+void    PixelsFromBGRA(const uint8_t* src, uint8_t* dst, const size_t numPixels, const PixelLayout layout);
+// One byte indices -> 32bpp palette colors, palette holds 256 entries already in the wanted layout. With numColors
+// up to 16 the entries past it have to be 0, that palette lives in registers and gets looked up 32 pixels at a time.
+void    PixelsFromIndices(const uint8_t* indices, const uint32_t* palette, const size_t numColors, uint8_t* dst, const size_t numPixels);
+
+// Same, but force a specific code path (clamped to what the CPU supports)
+void    PixelsSwapRedBlue(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
+void    PixelsFromPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
+void    PixelsToPS2(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
+void    PixelsFromBGRA(const uint8_t* src, uint8_t* dst, const size_t numPixels, const PixelLayout layout, const SIMDLevel level);
+void    PixelsFromIndices(const uint8_t* indices, const uint32_t* palette, const size_t numColors, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
+
+// 4 bit indices, low nibble first <-> one index per byte. The packed side holds (numPixels + 1) / 2 bytes, an odd
+// count leaves the last high nibble unused (written as 0). src and dst can be the same buffer, it just has to be big
+// enough for the unpacked indices. Unpacking drops the high nibble, packing ignores anything above 15.
+void    IndicesUnpack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels);
+void    IndicesPack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels);
+
+// Same, but force a specific code path (clamped to what the CPU supports)
+void    IndicesUnpack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
+void    IndicesPack4Bit(const uint8_t* src, uint8_t* dst, const size_t numPixels, const SIMDLevel level);
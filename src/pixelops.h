@@ -0,0 +1,199 @@
+#pragma once
+#include "pixelconvert.h"
+
+#if SH2TEX_X86
+#include <immintrin.h>
+#endif
+
+// Per pixel operations behind the pixelconvert functions, also used by the decoders to write their output
+// layout straight from registers. Internal header, every op has the same Scalar / SSE2 / AVX2 shape.
+
+// every conversion works on whole 32 bit pixels: a scalar version plus the same thing on 4 and 8 lanes
+
+struct SwapRedBlueOp {
+    static inline uint32_t Scalar(const uint32_t c) {
+        return (c & 0xFF00FF00) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+    }
+
+#if SH2TEX_X86
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        const __m128i ga = _mm_and_si128(v, _mm_set1_epi32(scast<int>(0xFF00FF00)));
+        const __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xFF));
+        const __m128i b = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFF)), 16);
+        return _mm_or_si128(ga, _mm_or_si128(r, b));
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                                 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        return _mm256_shuffle_epi8(v, shuffle);
+    }
+#endif
+};
+
+// PS2 alpha goes 0..0x80, 0x80 is opaque
+struct FromPS2Op {
+    static inline uint32_t Scalar(const uint32_t c) {
+        const uint32_t a = c >> 24;
+        const uint32_t expanded = (a == 0x80) ? 0xFF : (((a << 1) | (a & 1)) & 0xFF);
+        return (SwapRedBlueOp::Scalar(c) & 0x00FFFFFF) | (expanded << 24);
+    }
+
+#if SH2TEX_X86
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        const __m128i a = _mm_srli_epi32(v, 24);
+        const __m128i opaque = _mm_cmpeq_epi32(a, _mm_set1_epi32(0x80));
+        __m128i expanded = _mm_and_si128(_mm_or_si128(_mm_slli_epi32(a, 1), _mm_and_si128(a, _mm_set1_epi32(1))), _mm_set1_epi32(0xFF));
+        expanded = _mm_or_si128(expanded, _mm_and_si128(opaque, _mm_set1_epi32(0xFF)));
+        const __m128i rgb = _mm_and_si128(SwapRedBlueOp::SSE2(v), _mm_set1_epi32(0x00FFFFFF));
+        return _mm_or_si128(rgb, _mm_slli_epi32(expanded, 24));
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        const __m256i a = _mm256_srli_epi32(v, 24);
+        const __m256i opaque = _mm256_cmpeq_epi32(a, _mm256_set1_epi32(0x80));
+        __m256i expanded = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi32(a, 1), _mm256_and_si256(a, _mm256_set1_epi32(1))), _mm256_set1_epi32(0xFF));
+        expanded = _mm256_or_si256(expanded, _mm256_and_si256(opaque, _mm256_set1_epi32(0xFF)));
+        const __m256i rgb = _mm256_and_si256(SwapRedBlueOp::AVX2(v), _mm256_set1_epi32(0x00FFFFFF));
+        return _mm256_or_si256(rgb, _mm256_slli_epi32(expanded, 24));
+    }
+#endif
+};
+
+struct ToPS2Op {
+    static inline uint32_t Scalar(const uint32_t c) {
+        const uint32_t a = c >> 24;
+        const uint32_t compressed = (a == 0xFF) ? 0x80 : (a >> 1);
+        return (SwapRedBlueOp::Scalar(c) & 0x00FFFFFF) | (compressed << 24);
+    }
+
+#if SH2TEX_X86
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        const __m128i a = _mm_srli_epi32(v, 24);
+        // 0xFF >> 1 is 0x7F, the all ones compare result bumps it to 0x80
+        const __m128i opaque = _mm_cmpeq_epi32(a, _mm_set1_epi32(0xFF));
+        const __m128i compressed = _mm_sub_epi32(_mm_srli_epi32(a, 1), opaque);
+        const __m128i rgb = _mm_and_si128(SwapRedBlueOp::SSE2(v), _mm_set1_epi32(0x00FFFFFF));
+        return _mm_or_si128(rgb, _mm_slli_epi32(compressed, 24));
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        const __m256i a = _mm256_srli_epi32(v, 24);
+        const __m256i opaque = _mm256_cmpeq_epi32(a, _mm256_set1_epi32(0xFF));
+        const __m256i compressed = _mm256_sub_epi32(_mm256_srli_epi32(a, 1), opaque);
+        const __m256i rgb = _mm256_and_si256(SwapRedBlueOp::AVX2(v), _mm256_set1_epi32(0x00FFFFFF));
+        return _mm256_or_si256(rgb, _mm256_slli_epi32(compressed, 24));
+    }
+#endif
+};
+
+// color * alpha / 255 rounded like Qt's qPremultiply, alpha is the top byte so RGBA and BGRA both work
+struct PremultiplyOp {
+    static inline uint32_t Scalar(const uint32_t c) {
+        const uint32_t a = c >> 24;
+        uint32_t result = c & 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            const uint32_t t = ((c >> shift) & 0xFF) * a + 128;
+            result |= ((t + (t >> 8)) >> 8) << shift;
+        }
+        return result;
+    }
+
+#if SH2TEX_X86
+    // 4 pixels as 16 bit channels, the alpha lane gets multiplied by 255 so it stays the same
+    SH2TEX_TARGET_SSE2 static inline __m128i Multiply16_SSE2(const __m128i v) {
+        __m128i factors = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+        factors = _mm_or_si128(_mm_and_si128(factors, _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0)), _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255));
+        const __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, factors), _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i lo = Multiply16_SSE2(_mm_unpacklo_epi8(v, zero));
+        const __m128i hi = Multiply16_SSE2(_mm_unpackhi_epi8(v, zero));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i Multiply16_AVX2(const __m256i v) {
+        __m256i factors = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xFF), 0xFF);
+        factors = _mm256_or_si256(_mm256_and_si256(factors, _mm256_set1_epi64x(0x0000FFFFFFFFFFFFll)), _mm256_set1_epi64x(0x00FF000000000000ll));
+        const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, factors), _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    // unpack and pack both stay inside 128 bit lanes, so the pixel order comes out right
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i lo = Multiply16_AVX2(_mm256_unpacklo_epi8(v, zero));
+        const __m256i hi = Multiply16_AVX2(_mm256_unpackhi_epi8(v, zero));
+        return _mm256_packus_epi16(lo, hi);
+    }
+#endif
+};
+
+// straight RGBA (what the BCn decoders produce) -> L
+template <PixelLayout L>
+struct FromRGBAOp {
+    static inline uint32_t Scalar(const uint32_t c) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return SwapRedBlueOp::Scalar(c);
+        } else if constexpr (L == PixelLayout::RGBAPremultiplied) {
+            return PremultiplyOp::Scalar(c);
+        } else {
+            return c;
+        }
+    }
+
+#if SH2TEX_X86
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return SwapRedBlueOp::SSE2(v);
+        } else if constexpr (L == PixelLayout::RGBAPremultiplied) {
+            return PremultiplyOp::SSE2(v);
+        } else {
+            return v;
+        }
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return SwapRedBlueOp::AVX2(v);
+        } else if constexpr (L == PixelLayout::RGBAPremultiplied) {
+            return PremultiplyOp::AVX2(v);
+        } else {
+            return v;
+        }
+    }
+#endif
+};
+
+// straight BGRA (SH2 pixels and palettes) -> L
+template <PixelLayout L>
+struct FromBGRAOp {
+    static inline uint32_t Scalar(const uint32_t c) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return c;
+        } else {
+            return FromRGBAOp<L>::Scalar(SwapRedBlueOp::Scalar(c));
+        }
+    }
+
+#if SH2TEX_X86
+    SH2TEX_TARGET_SSE2 static inline __m128i SSE2(const __m128i v) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return v;
+        } else {
+            return FromRGBAOp<L>::SSE2(SwapRedBlueOp::SSE2(v));
+        }
+    }
+
+    SH2TEX_TARGET_AVX2 static inline __m256i AVX2(const __m256i v) {
+        if constexpr (L == PixelLayout::BGRA) {
+            return v;
+        } else {
+            return FromRGBAOp<L>::AVX2(SwapRedBlueOp::AVX2(v));
+        }
+    }
+#endif
+};
@@ -0,0 +1,871 @@
+#include "pngfile.h"
+#include "mappedfile.h"
+#include <fstream>
+
+// PNG spec - https://www.w3.org/TR/png/
+// DEFLATE spec - https://www.rfc-editor.org/rfc/rfc1951
+
+static uint32_t Crc32(const uint8_t* data, const size_t length, uint32_t crc = 0u) {
+    static const MyArray<uint32_t> sTable = []() {
+        MyArray<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = sTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t Adler32(const uint8_t* data, const size_t length) {
+    uint32_t a = 1, b = 0;
+    size_t i = 0;
+    while (i < length) {
+        // 5552 is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits 32 bits
+        const size_t blockEnd = std::min<size_t>(length, i + 5552);
+        for (; i < blockEnd; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521u;
+        b %= 65521u;
+    }
+    return (b << 16) | a;
+}
+
+class DeflateBitWriter {
+public:
+    explicit DeflateBitWriter(BytesArray& output) : mOutput(output), mBits(0), mBitsCount(0) {}
+
+    // deflate packs data elements starting from the least-significant bit
+    void PutBits(const uint32_t bits, const int count) {
+        mBits |= bits << mBitsCount;
+        mBitsCount += count;
+        while (mBitsCount >= 8) {
+            mOutput.push_back(scast<uint8_t>(mBits & 0xFF));
+            mBits >>= 8;
+            mBitsCount -= 8;
+        }
+    }
+
+    // ... while Huffman codes are packed starting from the most-significant bit
+    void PutCode(const uint32_t code, const int count) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; ++i) {
+            reversed |= ((code >> i) & 1) << (count - 1 - i);
+        }
+        this->PutBits(reversed, count);
+    }
+
+    void Flush() {
+        if (mBitsCount > 0) {
+            mOutput.push_back(scast<uint8_t>(mBits & 0xFF));
+        }
+        mBits = 0;
+        mBitsCount = 0;
+    }
+
+private:
+    BytesArray& mOutput;
+    uint32_t    mBits;
+    int         mBitsCount;
+};
+
+static const uint16_t kLengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t  kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t kDistBase[30]    = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t  kDistExtra[30]   = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static void PutFixedLiteral(DeflateBitWriter& bw, const uint32_t lit) {
+    if (lit < 144) {
+        bw.PutCode(0x30 + lit, 8);
+    } else if (lit < 256) {
+        bw.PutCode(0x190 + (lit - 144), 9);
+    } else if (lit < 280) {
+        bw.PutCode(lit - 256, 7);
+    } else {
+        bw.PutCode(0xC0 + (lit - 280), 8);
+    }
+}
+
+// single fixed-Huffman block with a simple hash-chain LZ77, good enough for textures
+static void ZlibCompress(const uint8_t* data, const size_t length, BytesArray& output) {
+    constexpr size_t kWindowSize = 32768;
+    constexpr size_t kHashSize = 1 << 15;
+    constexpr size_t kMaxChain = 32;
+    constexpr size_t kMinMatch = 3;
+    constexpr size_t kMaxMatch = 258;
+    constexpr int32_t kNoPos = -1;
+
+    output.push_back(0x78);     // CM = 8, CINFO = 7
+    output.push_back(0x01);     // FCHECK, fastest compression level
+
+    DeflateBitWriter bw(output);
+    bw.PutBits(1, 1);           // BFINAL
+    bw.PutBits(1, 2);           // BTYPE = fixed Huffman
+
+    MyArray<int32_t> head(kHashSize, kNoPos);
+    MyArray<int32_t> prev(kWindowSize, kNoPos);
+
+    auto hash3 = [data](const size_t pos) -> size_t {
+        const uint32_t v = (scast<uint32_t>(data[pos]) << 16) | (scast<uint32_t>(data[pos + 1]) << 8) | data[pos + 2];
+        return ((v * 2654435761u) >> 17) & (kHashSize - 1);
+    };
+
+    auto insert = [&](const size_t pos) {
+        if (pos + kMinMatch <= length) {
+            const size_t h = hash3(pos);
+            prev[pos & (kWindowSize - 1)] = head[h];
+            head[h] = scast<int32_t>(pos);
+        }
+    };
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t bestLen = 0, bestDist = 0;
+
+        if (pos + kMinMatch <= length) {
+            const size_t maxLen = std::min<size_t>(kMaxMatch, length - pos);
+            int32_t candidate = head[hash3(pos)];
+            for (size_t chain = 0; candidate != kNoPos && chain < kMaxChain; ++chain) {
+                const size_t cpos = scast<size_t>(candidate);
+                if (pos - cpos > kWindowSize - 1) {
+                    break;
+                }
+
+                size_t len = 0;
+                while (len < maxLen && data[cpos + len] == data[pos + len]) {
+                    ++len;
+                }
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestDist = pos - cpos;
+                    if (len == maxLen) {
+                        break;
+                    }
+                }
+
+                const int32_t next = prev[cpos & (kWindowSize - 1)];
+                if (next >= candidate) {
+                    break;  // stale entry from an overwritten window slot
+                }
+                candidate = next;
+            }
+        }
+
+        if (bestLen >= kMinMatch) {
+            size_t lc = 0;
+            while (lc < 28 && kLengthBase[lc + 1] <= bestLen) {
+                ++lc;
+            }
+            PutFixedLiteral(bw, 257 + scast<uint32_t>(lc));
+            bw.PutBits(scast<uint32_t>(bestLen - kLengthBase[lc]), kLengthExtra[lc]);
+
+            size_t dc = 0;
+            while (dc < 29 && kDistBase[dc + 1] <= bestDist) {
+                ++dc;
+            }
+            bw.PutCode(scast<uint32_t>(dc), 5);
+            bw.PutBits(scast<uint32_t>(bestDist - kDistBase[dc]), kDistExtra[dc]);
+
+            for (size_t i = 0; i < bestLen; ++i) {
+                insert(pos + i);
+            }
+            pos += bestLen;
+        } else {
+            PutFixedLiteral(bw, data[pos]);
+            insert(pos);
+            ++pos;
+        }
+    }
+
+    PutFixedLiteral(bw, 256);   // end of block
+    bw.Flush();
+
+    const uint32_t adler = Adler32(data, length);
+    output.push_back(scast<uint8_t>(adler >> 24));
+    output.push_back(scast<uint8_t>(adler >> 16));
+    output.push_back(scast<uint8_t>(adler >> 8));
+    output.push_back(scast<uint8_t>(adler));
+}
+
+static uint8_t Paeth(const int a, const int b, const int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return scast<uint8_t>(a);
+    } else if (pb <= pc) {
+        return scast<uint8_t>(b);
+    } else {
+        return scast<uint8_t>(c);
+    }
+}
+
+// picks the filter with the smallest sum of absolute differences per scanline
+static void FilterScanlines(const uint8_t* pixels, const uint32_t width, const uint32_t height, const size_t bpp, BytesArray& filtered) {
+    const size_t stride = width * bpp;
+    filtered.resize((stride + 1) * height);
+
+    BytesArray candidate(stride);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = pixels + y * stride;
+        const uint8_t* above = (y > 0) ? (row - stride) : nullptr;
+        uint8_t* dst = filtered.data() + y * (stride + 1);
+
+        // palette indices do not benefit from filtering
+        const int numFilters = (bpp == 1) ? 1 : 5;
+
+        uint64_t bestScore = ~uint64_t(0);
+        for (int filter = 0; filter < numFilters; ++filter) {
+            uint64_t score = 0;
+            for (size_t x = 0; x < stride; ++x) {
+                const int a = (x >= bpp) ? row[x - bpp] : 0;
+                const int b = above ? above[x] : 0;
+                const int c = (above && x >= bpp) ? above[x - bpp] : 0;
+
+                uint8_t v;
+                switch (filter) {
+                    case 0: v = row[x]; break;
+                    case 1: v = scast<uint8_t>(row[x] - a); break;
+                    case 2: v = scast<uint8_t>(row[x] - b); break;
+                    case 3: v = scast<uint8_t>(row[x] - ((a + b) >> 1)); break;
+                    default: v = scast<uint8_t>(row[x] - Paeth(a, b, c)); break;
+                }
+                candidate[x] = v;
+                score += scast<uint64_t>(std::abs(scast<int>(scast<int8_t>(v))));
+            }
+
+            if (score < bestScore) {
+                bestScore = score;
+                dst[0] = scast<uint8_t>(filter);
+                std::memcpy(dst + 1, candidate.data(), stride);
+            }
+        }
+    }
+}
+
+static void WriteChunk(MemWriteStream& stream, const char* type, const uint8_t* data, const size_t length) {
+    const uint32_t lengthBE = scast<uint32_t>(length);
+    const uint8_t lengthBytes[4] = { scast<uint8_t>(lengthBE >> 24), scast<uint8_t>(lengthBE >> 16), scast<uint8_t>(lengthBE >> 8), scast<uint8_t>(lengthBE) };
+    stream.Write(lengthBytes, 4);
+
+    uint32_t crc = Crc32(rcast<const uint8_t*>(type), 4);
+    stream.Write(type, 4);
+    if (length > 0) {
+        crc = Crc32(data, length, crc);
+        stream.Write(data, length);
+    }
+
+    const uint8_t crcBytes[4] = { scast<uint8_t>(crc >> 24), scast<uint8_t>(crc >> 16), scast<uint8_t>(crc >> 8), scast<uint8_t>(crc) };
+    stream.Write(crcBytes, 4);
+}
+
+bool SavePNGToStream(MemWriteStream& stream, const uint8_t* pixels, const uint32_t width, const uint32_t height, const uint8_t* palette) {
+    if (!pixels || !width || !height) {
+        return false;
+    }
+
+    const bool isPaletted = (palette != nullptr);
+
+    static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    stream.Write(kSignature, sizeof(kSignature));
+
+    uint8_t ihdr[13] = {
+        scast<uint8_t>(width >> 24), scast<uint8_t>(width >> 16), scast<uint8_t>(width >> 8), scast<uint8_t>(width),
+        scast<uint8_t>(height >> 24), scast<uint8_t>(height >> 16), scast<uint8_t>(height >> 8), scast<uint8_t>(height),
+        8,                              // bit depth
+        scast<uint8_t>(isPaletted ? 3 : 6),  // color type: indexed or RGBA
+        0, 0, 0                         // compression, filter, interlace
+    };
+    WriteChunk(stream, "IHDR", ihdr, sizeof(ihdr));
+
+    if (isPaletted) {
+        uint8_t plte[256 * 3], trns[256];
+        for (size_t i = 0; i < 256; ++i) {
+            plte[i * 3 + 0] = palette[i * 4 + 0];
+            plte[i * 3 + 1] = palette[i * 4 + 1];
+            plte[i * 3 + 2] = palette[i * 4 + 2];
+            trns[i] = palette[i * 4 + 3];
+        }
+        WriteChunk(stream, "PLTE", plte, sizeof(plte));
+        WriteChunk(stream, "tRNS", trns, sizeof(trns));
+    }
+
+    BytesArray filtered;
+    FilterScanlines(pixels, width, height, isPaletted ? 1 : 4, filtered);
+
+    BytesArray compressed;
+    compressed.reserve(filtered.size() / 2);
+    ZlibCompress(filtered.data(), filtered.size(), compressed);
+    WriteChunk(stream, "IDAT", compressed.data(), compressed.size());
+
+    WriteChunk(stream, "IEND", nullptr, 0);
+
+    return true;
+}
+
+bool SavePNG(const fs::path& path, const uint8_t* pixels, const uint32_t width, const uint32_t height, const uint8_t* palette) {
+    MemWriteStream stream;
+    if (!SavePNGToStream(stream, pixels, width, height, palette)) {
+        return false;
+    }
+
+    std::ofstream file(path, std::ios_base::binary);
+    if (!file.good()) {
+        return false;
+    }
+
+    file.write(rcast<const char*>(stream.Data()), stream.GetWrittenBytesCount());
+    file.flush();
+    file.close();
+
+    return true;
+}
+
+
+
+class InflateBitReader {
+public:
+    InflateBitReader(const uint8_t* data, const size_t size) : mData(data), mSize(size), mPos(0), mBits(0), mBitsCount(0), mOverrun(false) {}
+
+    inline void Refill() {
+        while (mBitsCount <= 56) {
+            if (mPos < mSize) {
+                mBits |= scast<uint64_t>(mData[mPos]) << mBitsCount;
+            }
+            // past the end we feed zeroes, Consume catches reading them
+            mPos++;
+            mBitsCount += 8;
+        }
+    }
+
+    inline uint32_t Peek(const int count) const {
+        return scast<uint32_t>(mBits & ((uint64_t(1) << count) - 1));
+    }
+
+    inline void Consume(const int count) {
+        mBits >>= count;
+        mBitsCount -= count;
+        if (mPos > mSize && (mPos - mSize) * 8 > scast<size_t>(mBitsCount)) {
+            mOverrun = true;
+        }
+    }
+
+    inline uint32_t GetBits(const int count) {
+        if (!count) {
+            return 0;
+        }
+        this->Refill();
+        const uint32_t result = this->Peek(count);
+        this->Consume(count);
+        return result;
+    }
+
+    // stored blocks start at a byte boundary
+    void AlignToByte() {
+        this->Consume(mBitsCount & 7);
+    }
+
+    bool Overrun() const {
+        return mOverrun;
+    }
+
+private:
+    const uint8_t*  mData;
+    size_t          mSize;
+    size_t          mPos;
+    uint64_t        mBits;
+    int             mBitsCount;
+    bool            mOverrun;
+};
+
+// canonical Huffman decoder, short codes go through a lookup table, long ones are decoded bit by bit
+class InflateHuffman {
+public:
+    static constexpr int kFastBits = 10;
+    static constexpr int kMaxBits = 15;
+
+    bool Build(const uint8_t* lengths, const size_t numSymbols) {
+        std::memset(mCounts, 0, sizeof(mCounts));
+        for (size_t i = 0; i < numSymbols; ++i) {
+            mCounts[lengths[i]]++;
+        }
+        mCounts[0] = 0;
+
+        // over-subscribed codes are broken, incomplete ones are allowed (i.e. single distance code)
+        int left = 1;
+        for (int len = 1; len <= kMaxBits; ++len) {
+            left = (left << 1) - mCounts[len];
+            if (left < 0) {
+                return false;
+            }
+        }
+
+        uint16_t offsets[kMaxBits + 1] = {};
+        for (int len = 1; len < kMaxBits; ++len) {
+            offsets[len + 1] = offsets[len] + mCounts[len];
+        }
+        for (size_t i = 0; i < numSymbols; ++i) {
+            if (lengths[i]) {
+                mSymbols[offsets[lengths[i]]++] = scast<uint16_t>(i);
+            }
+        }
+
+        std::memset(mFast, 0, sizeof(mFast));
+        uint32_t code = 0;
+        size_t symbolIdx = 0;
+        for (int len = 1; len <= kFastBits; ++len) {
+            for (int i = 0; i < mCounts[len]; ++i, ++code, ++symbolIdx) {
+                // codes are stored MSB first, but we peek LSB first
+                uint32_t reversed = 0;
+                for (int b = 0; b < len; ++b) {
+                    reversed |= ((code >> b) & 1) << (len - 1 - b);
+                }
+                const uint16_t entry = scast<uint16_t>((mSymbols[symbolIdx] << 4) | len);
+                for (uint32_t j = reversed; j < (1u << kFastBits); j += (1u << len)) {
+                    mFast[j] = entry;
+                }
+            }
+            code <<= 1;
+        }
+
+        return true;
+    }
+
+    int Decode(InflateBitReader& br) const {
+        br.Refill();
+        const uint16_t entry = mFast[br.Peek(kFastBits)];
+        if (entry) {
+            br.Consume(entry & 15);
+            return entry >> 4;
+        }
+
+        const uint32_t bits = br.Peek(kMaxBits);
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= kMaxBits; ++len) {
+            code |= (bits >> (len - 1)) & 1;
+            const int count = mCounts[len];
+            if (code - first < count) {
+                br.Consume(len);
+                return mSymbols[index + (code - first)];
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+
+        return -1;
+    }
+
+private:
+    uint16_t    mFast[1 << kFastBits];   // (symbol << 4) | length, 0 means "take the slow path"
+    uint16_t    mCounts[kMaxBits + 1];
+    uint16_t    mSymbols[288];
+};
+
+static bool InflateBlock(InflateBitReader& br, const InflateHuffman& litLen, const InflateHuffman& dist, BytesArray& output, size_t& outPos) {
+    for (;;) {
+        const int sym = litLen.Decode(br);
+        if (sym < 0 || br.Overrun()) {
+            return false;
+        }
+
+        if (sym < 256) {
+            if (outPos >= output.size()) {
+                return false;
+            }
+            output[outPos++] = scast<uint8_t>(sym);
+        } else if (sym == 256) {
+            return true;
+        } else {
+            const int lenIdx = sym - 257;
+            if (lenIdx >= 29) {
+                return false;
+            }
+            const size_t length = kLengthBase[lenIdx] + br.GetBits(kLengthExtra[lenIdx]);
+
+            const int distIdx = dist.Decode(br);
+            if (distIdx < 0 || distIdx >= 30) {
+                return false;
+            }
+            const size_t distance = kDistBase[distIdx] + br.GetBits(kDistExtra[distIdx]);
+
+            if (distance > outPos || (outPos + length) > output.size()) {
+                return false;
+            }
+
+            // overlapping copies are legal (and common for runs), so byte by byte
+            uint8_t* dst = output.data() + outPos;
+            const uint8_t* src = dst - distance;
+            for (size_t i = 0; i < length; ++i) {
+                dst[i] = src[i];
+            }
+            outPos += length;
+        }
+    }
+}
+
+// output must be sized to the exact expected amount, which PNG always knows in advance
+static bool ZlibDecompress(const uint8_t* data, const size_t length, BytesArray& output) {
+    if (length < 2 || (data[0] & 0x0F) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20)) {
+        return false;
+    }
+
+    InflateBitReader br(data + 2, length - 2);
+    size_t outPos = 0;
+
+    InflateHuffman litLen, dist;
+
+    bool isFinal = false;
+    while (!isFinal) {
+        isFinal = br.GetBits(1) != 0;
+        const uint32_t type = br.GetBits(2);
+
+        if (type == 0) {            // stored
+            br.AlignToByte();
+            const uint32_t len = br.GetBits(16);
+            const uint32_t nlen = br.GetBits(16);
+            if ((len ^ 0xFFFF) != nlen || (outPos + len) > output.size()) {
+                return false;
+            }
+            for (uint32_t i = 0; i < len; ++i) {
+                output[outPos++] = scast<uint8_t>(br.GetBits(8));
+            }
+        } else if (type == 1) {     // fixed Huffman
+            uint8_t lengths[288 + 30];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths + 144, 9, 112);
+            std::memset(lengths + 256, 7, 24);
+            std::memset(lengths + 280, 8, 8);
+            std::memset(lengths + 288, 5, 30);
+            litLen.Build(lengths, 288);
+            dist.Build(lengths + 288, 30);
+
+            if (!InflateBlock(br, litLen, dist, output, outPos)) {
+                return false;
+            }
+        } else if (type == 2) {     // dynamic Huffman
+            const size_t numLitLen = br.GetBits(5) + 257;
+            const size_t numDist = br.GetBits(5) + 1;
+            const size_t numCodeLen = br.GetBits(4) + 4;
+
+            static const uint8_t kCodeLenOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+            uint8_t codeLenLengths[19] = {};
+            for (size_t i = 0; i < numCodeLen; ++i) {
+                codeLenLengths[kCodeLenOrder[i]] = scast<uint8_t>(br.GetBits(3));
+            }
+
+            InflateHuffman codeLen;
+            if (!codeLen.Build(codeLenLengths, 19)) {
+                return false;
+            }
+
+            uint8_t lengths[288 + 32] = {};
+            size_t idx = 0;
+            while (idx < numLitLen + numDist) {
+                const int sym = codeLen.Decode(br);
+                if (sym < 0 || br.Overrun()) {
+                    return false;
+                }
+
+                if (sym < 16) {
+                    lengths[idx++] = scast<uint8_t>(sym);
+                } else {
+                    uint8_t value = 0;
+                    size_t repeat = 0;
+                    if (sym == 16) {
+                        if (!idx) {
+                            return false;
+                        }
+                        value = lengths[idx - 1];
+                        repeat = 3 + br.GetBits(2);
+                    } else if (sym == 17) {
+                        repeat = 3 + br.GetBits(3);
+                    } else {
+                        repeat = 11 + br.GetBits(7);
+                    }
+
+                    if (idx + repeat > numLitLen + numDist) {
+                        return false;
+                    }
+                    std::memset(lengths + idx, value, repeat);
+                    idx += repeat;
+                }
+            }
+
+            if (!litLen.Build(lengths, numLitLen) || !dist.Build(lengths + numLitLen, numDist)) {
+                return false;
+            }
+
+            if (!InflateBlock(br, litLen, dist, output, outPos)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        if (br.Overrun()) {
+            return false;
+        }
+    }
+
+    return outPos == output.size();
+}
+
+// way past anything the games use, but keeps a broken header from asking for gigabytes
+static const uint32_t kMaxPNGDimension = 16384;
+static const size_t   kMaxPNGDataSize = 512u * 1024u * 1024u;
+
+static uint32_t ReadBE32(const uint8_t* p) {
+    return (scast<uint32_t>(p[0]) << 24) | (scast<uint32_t>(p[1]) << 16) | (scast<uint32_t>(p[2]) << 8) | scast<uint32_t>(p[3]);
+}
+
+static void UnfilterScanlines(const uint8_t* filtered, uint8_t* output, const size_t rowSize, const uint32_t height, const size_t bpp) {
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t filter = filtered[y * (rowSize + 1)];
+        const uint8_t* src = filtered + y * (rowSize + 1) + 1;
+        uint8_t* dst = output + y * rowSize;
+        const uint8_t* prev = (y > 0) ? (dst - rowSize) : nullptr;
+
+        // the first row behaves as if the previous one was all zeroes,
+        // so Up is a plain copy there and Paeth turns into Sub
+        const size_t head = std::min(bpp, rowSize);
+        switch (filter) {
+            case 1:
+                std::memcpy(dst, src, head);
+                for (size_t x = bpp; x < rowSize; ++x) {
+                    dst[x] = scast<uint8_t>(src[x] + dst[x - bpp]);
+                }
+            break;
+            case 2:
+                if (!prev) {
+                    std::memcpy(dst, src, rowSize);
+                } else {
+                    for (size_t x = 0; x < rowSize; ++x) {
+                        dst[x] = scast<uint8_t>(src[x] + prev[x]);
+                    }
+                }
+            break;
+            case 3:
+                for (size_t x = 0; x < head; ++x) {
+                    dst[x] = scast<uint8_t>(src[x] + ((prev ? prev[x] : 0) >> 1));
+                }
+                for (size_t x = bpp; x < rowSize; ++x) {
+                    dst[x] = scast<uint8_t>(src[x] + ((dst[x - bpp] + (prev ? prev[x] : 0)) >> 1));
+                }
+            break;
+            case 4:
+                if (!prev) {
+                    std::memcpy(dst, src, head);
+                    for (size_t x = bpp; x < rowSize; ++x) {
+                        dst[x] = scast<uint8_t>(src[x] + dst[x - bpp]);
+                    }
+                } else {
+                    for (size_t x = 0; x < head; ++x) {
+                        dst[x] = scast<uint8_t>(src[x] + prev[x]);
+                    }
+                    for (size_t x = bpp; x < rowSize; ++x) {
+                        dst[x] = scast<uint8_t>(src[x] + Paeth(dst[x - bpp], prev[x], prev[x - bpp]));
+                    }
+                }
+            break;
+            default:
+                std::memcpy(dst, src, rowSize);
+            break;
+        }
+    }
+}
+
+bool LoadPNGFromStream(MemStream& stream, PNGImage& image) {
+    static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    uint8_t signature[8];
+    if (!stream.ReadToBuffer(signature, sizeof(signature)) || std::memcmp(signature, kSignature, sizeof(kSignature)) != 0) {
+        return false;
+    }
+
+    uint32_t width = 0, height = 0;
+    uint8_t bitDepth = 0, colorType = 0, interlace = 0;
+    uint8_t plte[256 * 3] = {}, trns[256];
+    std::memset(trns, 0xFF, sizeof(trns));
+    size_t numPaletteEntries = 0;
+    bool hasHeader = false;
+    BytesArray idat;
+
+    while (stream.Remains() >= 12) {
+        uint8_t chunkHeader[8];
+        stream.ReadToBuffer(chunkHeader, sizeof(chunkHeader));
+        const uint32_t length = ReadBE32(chunkHeader);
+        if (length > stream.Remains() - 4) {
+            return false;
+        }
+
+        const uint8_t* data = stream.GetDataAtCursor();
+        const char* type = rcast<const char*>(chunkHeader + 4);
+
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            if (length < 13) {
+                return false;
+            }
+            width = ReadBE32(data);
+            height = ReadBE32(data + 4);
+            bitDepth = data[8];
+            colorType = data[9];
+            interlace = data[12];
+            hasHeader = true;
+        } else if (std::memcmp(type, "PLTE", 4) == 0) {
+            numPaletteEntries = std::min<size_t>(length / 3, 256);
+            std::memcpy(plte, data, numPaletteEntries * 3);
+        } else if (std::memcmp(type, "tRNS", 4) == 0) {
+            if (colorType == 3) {
+                std::memcpy(trns, data, std::min<size_t>(length, 256));
+            }
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), data, data + length);
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+
+        stream.SkipBytes(length + 4);   // + crc
+    }
+
+    if (!hasHeader || !width || !height || interlace != 0) {
+        return false;
+    }
+
+    size_t channels = 0;
+    switch (colorType) {
+        case 0: channels = 1; break;    // grey
+        case 2: channels = 3; break;    // RGB
+        case 3: channels = 1; break;    // indexed
+        case 4: channels = 2; break;    // grey + alpha
+        case 6: channels = 4; break;    // RGBA
+        default: return false;
+    }
+
+    const bool validDepth = (colorType == 3) ? (bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8)
+                                             : (bitDepth == 8 || bitDepth == 16 || (colorType == 0 && bitDepth < 8 && bitDepth > 0 && (8 % bitDepth) == 0));
+    if (!validDepth) {
+        return false;
+    }
+
+    if (width > kMaxPNGDimension || height > kMaxPNGDimension) {
+        return false;
+    }
+
+    const size_t bitsPerPixel = channels * bitDepth;
+    const size_t rowSize = (width * bitsPerPixel + 7) / 8;
+    const size_t bpp = std::max<size_t>(1, bitsPerPixel / 8);
+
+    // deflate can't expand more than 1032:1, a header promising more than the IDATs can hold is lying
+    const size_t filteredSize = (rowSize + 1) * height;
+    const size_t outputSize = std::max<size_t>(rowSize, scast<size_t>(width) * 4) * height;
+    if (outputSize > kMaxPNGDataSize || filteredSize / 1032 > idat.size()) {
+        return false;
+    }
+
+    BytesArray filtered(filteredSize);
+    if (!ZlibDecompress(idat.data(), idat.size(), filtered)) {
+        return false;
+    }
+
+    BytesArray raw(rowSize * height);
+    UnfilterScanlines(filtered.data(), raw.data(), rowSize, height, bpp);
+
+    image.width = width;
+    image.height = height;
+    image.isPaletted = (colorType == 3);
+
+    const size_t numPixels = scast<size_t>(width) * height;
+    if (image.isPaletted) {
+        image.pixels.resize(numPixels);
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t* src = raw.data() + y * rowSize;
+            uint8_t* dst = image.pixels.data() + y * width;
+            if (bitDepth == 8) {
+                std::memcpy(dst, src, width);
+            } else {
+                const uint32_t mask = (1u << bitDepth) - 1;
+                const uint32_t perByte = 8 / bitDepth;
+                for (uint32_t x = 0; x < width; ++x) {
+                    const uint32_t shift = 8 - bitDepth * (1 + (x % perByte));
+                    dst[x] = scast<uint8_t>((src[x / perByte] >> shift) & mask);
+                }
+            }
+        }
+
+        image.palette.assign(256 * 4, 0);
+        for (size_t i = 0; i < 256; ++i) {
+            image.palette[i * 4 + 0] = plte[i * 3 + 0];
+            image.palette[i * 4 + 1] = plte[i * 3 + 1];
+            image.palette[i * 4 + 2] = plte[i * 3 + 2];
+            image.palette[i * 4 + 3] = (i < numPaletteEntries) ? trns[i] : 0xFF;
+        }
+    } else {
+        image.pixels.resize(numPixels * 4);
+        image.palette.clear();
+
+        // 16bit samples are big endian, so the first byte is the one we keep
+        const size_t sampleStride = (bitDepth == 16) ? 2 : 1;
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t* src = raw.data() + y * rowSize;
+            uint8_t* dst = image.pixels.data() + scast<size_t>(y) * width * 4;
+            for (uint32_t x = 0; x < width; ++x, dst += 4) {
+                if (bitDepth < 8) {
+                    const uint32_t perByte = 8 / bitDepth;
+                    const uint32_t shift = 8 - bitDepth * (1 + (x % perByte));
+                    const uint32_t value = (src[x / perByte] >> shift) & ((1u << bitDepth) - 1);
+                    const uint8_t grey = scast<uint8_t>(value * 255 / ((1u << bitDepth) - 1));
+                    dst[0] = dst[1] = dst[2] = grey;
+                    dst[3] = 0xFF;
+                    continue;
+                }
+
+                const uint8_t* px = src + x * channels * sampleStride;
+                switch (colorType) {
+                    case 0:
+                        dst[0] = dst[1] = dst[2] = px[0];
+                        dst[3] = 0xFF;
+                    break;
+                    case 2:
+                        dst[0] = px[0];
+                        dst[1] = px[sampleStride];
+                        dst[2] = px[sampleStride * 2];
+                        dst[3] = 0xFF;
+                    break;
+                    case 4:
+                        dst[0] = dst[1] = dst[2] = px[0];
+                        dst[3] = px[sampleStride];
+                    break;
+                    default:
+                        dst[0] = px[0];
+                        dst[1] = px[sampleStride];
+                        dst[2] = px[sampleStride * 2];
+                        dst[3] = px[sampleStride * 3];
+                    break;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool LoadPNG(const fs::path& path, PNGImage& image) {
+    MemStream stream = MapFileToStream(path);
+    if (!stream) {
+        return false;
+    }
+
+    return LoadPNGFromStream(stream, image);
+}
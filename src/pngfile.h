@@ -0,0 +1,21 @@
+#pragma once
+#include "mycommon.h"
+
+// Minimal, dependency-free PNG reader/writer used by the headless tools.
+// pixels are tightly packed RGBA8 (or 8bit indices when palette is given).
+// palette, if not null, is 256 RGBA8 entries.
+bool    SavePNG(const fs::path& path, const uint8_t* pixels, const uint32_t width, const uint32_t height, const uint8_t* palette = nullptr);
+bool    SavePNGToStream(MemWriteStream& stream, const uint8_t* pixels, const uint32_t width, const uint32_t height, const uint8_t* palette = nullptr);
+
+struct PNGImage {
+    uint32_t    width = 0;
+    uint32_t    height = 0;
+    bool        isPaletted = false;
+    BytesArray  pixels;     // RGBA8, or 8bit indices for paletted images
+    BytesArray  palette;    // 256 RGBA8 entries, paletted images only
+};
+
+// Reads any non-interlaced PNG, 16bit channels are cut down to 8 bits.
+// Indexed images keep their indices and palette (with tRNS alpha), everything else is expanded to RGBA8.
+bool    LoadPNG(const fs::path& path, PNGImage& image);
+bool    LoadPNGFromStream(MemStream& stream, PNGImage& image);
@@ -1,9 +1,12 @@
 // I got this code from here, it does all the magic!
 // https://ps2linux.no-ip.info/playstation2-linux.com/projects/ezswizzle/index.html
+//
+// The original code worked on a global 4MB GS memory buffer, now every function gets the memory
+// to work on from PS2GSMemory, which makes it reentrant.
 
-unsigned int gsmem[1024 * 1024];
+#include "ps2textures.h"
 
-int block32[32] =
+static const int block32[32] =
 {
      0,  1,  4,  5, 16, 17, 20, 21,
      2,  3,  6,  7, 18, 19, 22, 23,
@@ -12,13 +15,13 @@ int block32[32] =
 };
 
 
-int columnWord32[16] =
+static const int columnWord32[16] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15
 };
 
-void writeTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMCT32(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     unsigned int* src = (unsigned int*)data;
     int startBlockPos = dbp * 64;
@@ -53,7 +56,7 @@ void writeTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, voi
     }
 }
 
-void readTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMCT32(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     unsigned int* src = (unsigned int*)data;
     int startBlockPos = dbp * 64;
@@ -88,7 +91,7 @@ void readTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void
     }
 }
 
-int blockZ32[32] =
+static const int blockZ32[32] =
 {
      24, 25, 28, 29, 8, 9, 12, 13,
      26, 27, 30, 31,10, 11, 14, 15,
@@ -96,13 +99,13 @@ int blockZ32[32] =
      18, 19, 22, 23, 2, 3, 6, 7
 };
 
-int columnWordZ32[16] =
+static const int columnWordZ32[16] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15
 };
 
-void writeTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMZ32(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     unsigned int* src = (unsigned int*)data;
     int startBlockPos = dbp * 64;
@@ -137,7 +140,7 @@ void writeTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void
     }
 }
 
-void readTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMZ32(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     unsigned int* src = (unsigned int*)data;
     int startBlockPos = dbp * 64;
@@ -172,7 +175,7 @@ void readTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
     }
 }
 
-int block16[32] =
+static const int block16[32] =
 {
      0,  2,  8, 10,
      1,  3,  9, 11,
@@ -184,13 +187,13 @@ int block16[32] =
     21, 23, 29, 31
 };
 
-int columnWord16[32] =
+static const int columnWord16[32] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15,   2,  3,  6,  7, 10, 11, 14, 15
 };
 
-int columnHalf16[32] =
+static const int columnHalf16[32] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1,
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1
@@ -198,7 +201,7 @@ int columnHalf16[32] =
 
 
 
-void writeTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMCT16(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -236,7 +239,7 @@ void writeTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, voi
     }
 }
 
-void readTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMCT16(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -274,7 +277,7 @@ void readTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void
     }
 }
 
-int blockZ16[32] =
+static const int blockZ16[32] =
 {
      24,  26,  16, 18,
      25,  27,  17, 19,
@@ -286,19 +289,19 @@ int blockZ16[32] =
     13, 15, 5, 7
 };
 
-int columnWordZ16[32] =
+static const int columnWordZ16[32] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15,   2,  3,  6,  7, 10, 11, 14, 15
 };
 
-int columnHalfZ16[32] =
+static const int columnHalfZ16[32] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1,
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1
 };
 
-void writeTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMZ16(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -336,7 +339,7 @@ void writeTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void
     }
 }
 
-void readTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMZ16(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -374,7 +377,7 @@ void readTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
     }
 }
 
-int blockZ16S[32] =
+static const int blockZ16S[32] =
 {
      24,  26,  8, 10,
      25,  27,  9, 11,
@@ -386,19 +389,19 @@ int blockZ16S[32] =
     21, 23, 5, 7
 };
 
-int columnWordZ16S[32] =
+static const int columnWordZ16S[32] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15,   2,  3,  6,  7, 10, 11, 14, 15
 };
 
-int columnHalfZ16S[32] =
+static const int columnHalfZ16S[32] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1,
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1
 };
 
-void writeTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMZ16S(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -435,7 +438,7 @@ void writeTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, voi
         }
     }
 }
-void readTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMZ16S(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -473,7 +476,7 @@ void readTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void
     }
 }
 
-int block16S[32] =
+static const int block16S[32] =
 {
      0,  2, 16, 18,
      1,  3, 17, 19,
@@ -485,19 +488,19 @@ int block16S[32] =
     13, 15, 29, 31
 };
 
-int columnWord16S[32] =
+static const int columnWord16S[32] =
 {
      0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
      2,  3,  6,  7, 10, 11, 14, 15,   2,  3,  6,  7, 10, 11, 14, 15
 };
 
-int columnHalf16S[32] =
+static const int columnHalf16S[32] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1,
     0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1
 };
 
-void writeTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMCT16S(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -535,7 +538,7 @@ void writeTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, vo
     }
 }
 
-void readTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMCT16S(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     //dbw >>= 1;
     unsigned short* src = (unsigned short*)data;
@@ -572,7 +575,7 @@ void readTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, voi
         }
     }
 }
-int block8[32] =
+static const int block8[32] =
 {
      0,  1,  4,  5, 16, 17, 20, 21,
      2,  3,  6,  7, 18, 19, 22, 23,
@@ -580,7 +583,7 @@ int block8[32] =
     10, 11, 14, 15, 26, 27, 30, 31
 };
 
-int columnWord8[2][64] =
+static const int columnWord8[2][64] =
 {
     {
          0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
@@ -598,7 +601,7 @@ int columnWord8[2][64] =
     }
 };
 
-int columnByte8[64] =
+static const int columnByte8[64] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  2, 2, 2, 2, 2, 2, 2, 2,
     0, 0, 0, 0, 0, 0, 0, 0,  2, 2, 2, 2, 2, 2, 2, 2,
@@ -607,7 +610,7 @@ int columnByte8[64] =
     1, 1, 1, 1, 1, 1, 1, 1,  3, 3, 3, 3, 3, 3, 3, 3
 };
 
-void writeTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMT8(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     dbw >>= 1;
     unsigned char* src = (unsigned char*)data;
@@ -644,7 +647,7 @@ void writeTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
     }
 }
 
-void readTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMT8(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     dbw >>= 1;
     unsigned char* src = (unsigned char*)data;
@@ -682,7 +685,7 @@ void readTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
     }
 }
 
-int block4[32] =
+static const int block4[32] =
 {
      0,  2,  8, 10,
      1,  3,  9, 11,
@@ -694,7 +697,7 @@ int block4[32] =
     21, 23, 29, 31
 };
 
-int columnWord4[2][128] =
+static const int columnWord4[2][128] =
 {
     {
          0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,   0,  1,  4,  5,  8,  9, 12, 13,
@@ -712,7 +715,7 @@ int columnWord4[2][128] =
     }
 };
 
-int columnByte4[128] =
+static const int columnByte4[128] =
 {
     0, 0, 0, 0, 0, 0, 0, 0,  2, 2, 2, 2, 2, 2, 2, 2,  4, 4, 4, 4, 4, 4, 4, 4,  6, 6, 6, 6, 6, 6, 6, 6,
     0, 0, 0, 0, 0, 0, 0, 0,  2, 2, 2, 2, 2, 2, 2, 2,  4, 4, 4, 4, 4, 4, 4, 4,  6, 6, 6, 6, 6, 6, 6, 6,
@@ -721,7 +724,7 @@ int columnByte4[128] =
     1, 1, 1, 1, 1, 1, 1, 1,  3, 3, 3, 3, 3, 3, 3, 3,  5, 5, 5, 5, 5, 5, 5, 5,  7, 7, 7, 7, 7, 7, 7, 7
 };
 
-void writeTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void writeTexPSMT4(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     dbw >>= 1;
     unsigned char* src = (unsigned char*)data;
@@ -778,7 +781,7 @@ void writeTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
     }
 }
 
-void readTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
+static void readTexPSMT4(unsigned int* gsmem, int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data)
 {
     dbw >>= 1;
     unsigned char* src = (unsigned char*)data;
@@ -834,3 +837,325 @@ void readTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void*
         }
     }
 }
+
+
+
+constexpr int kGSPageSizeInWords = 2048;    // 8KB
+constexpr int kGSBlockSizeInWords = 64;     // 256 bytes
+
+PS2GSMemory::PS2GSMemory() {
+}
+PS2GSMemory::~PS2GSMemory() {
+}
+
+void PS2GSMemory::Clear() {
+    mMemory.clear();
+}
+
+size_t PS2GSMemory::GetSizeInBytes() const {
+    return mMemory.size() * sizeof(unsigned int);
+}
+
+// makes sure all the pages the rectangle touches are backed by memory
+unsigned int* PS2GSMemory::Reserve(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, int pageWidth, int pageHeight) {
+    if (rrw > 0 && rrh > 0) {
+        const int lastPageX = (dsax + rrw - 1) / pageWidth;
+        const int lastPageY = (dsay + rrh - 1) / pageHeight;
+        const size_t lastPage = scast<size_t>(lastPageX + lastPageY * dbw);
+        const size_t requiredSize = scast<size_t>(dbp) * kGSBlockSizeInWords + (lastPage + 1) * kGSPageSizeInWords;
+
+        if (mMemory.size() < requiredSize) {
+            mMemory.resize(requiredSize, 0u);
+        }
+    }
+
+    return mMemory.data();
+}
+
+void PS2GSMemory::WriteTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMCT32(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 32), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMCT32(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 32), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMZ32(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 32), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMZ32(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 32), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMCT16(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMCT16(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMCT16S(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMCT16S(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMZ16(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMZ16(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMZ16S(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMZ16S(this->Reserve(dbp, dbw, dsax, dsay, rrw, rrh, 64, 64), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+// 8 and 4 bit formats use pages of 128 pixels wide, so the buffer width is halved
+void PS2GSMemory::WriteTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMT8(this->Reserve(dbp, dbw >> 1, dsax, dsay, rrw, rrh, 128, 64), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMT8(this->Reserve(dbp, dbw >> 1, dsax, dsay, rrw, rrh, 128, 64), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+void PS2GSMemory::WriteTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data) {
+    writeTexPSMT4(this->Reserve(dbp, dbw >> 1, dsax, dsay, rrw, rrh, 128, 128), dbp, dbw, dsax, dsay, rrw, rrh, const_cast<void*>(data));
+}
+
+void PS2GSMemory::ReadTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data) {
+    readTexPSMT4(this->Reserve(dbp, dbw >> 1, dsax, dsay, rrw, rrh, 128, 128), dbp, dbw, dsax, dsay, rrw, rrh, data);
+}
+
+
+
+// Both PSMT8 (128x64) and PSMT4 (128x128) pages occupy the same 8KB as a PSMCT32 page (64x32),
+// so a texture uploaded as PSMCT32 maps onto itself page by page. For every pixel of a PSMT8/PSMT4
+// page we precompute where it lives in the PSMCT32 page: the row (0..31) and the byte (PSMT8)
+// or nibble (PSMT4) offset inside that row.
+struct PS2PageEntry {
+    uint16_t    row;
+    uint16_t    offset;
+};
+
+constexpr int kCT32PageWidth = 64;
+constexpr int kCT32PageHeight = 32;
+constexpr int kT8PageWidth = 128;
+constexpr int kT8PageHeight = 64;
+constexpr int kT4PageWidth = 128;
+constexpr int kT4PageHeight = 128;
+
+// word address inside a page -> PSMCT32 pixel coordinates
+static MyArray<PS2PageEntry> BuildCT32PageInverse() {
+    MyArray<PS2PageEntry> result(kGSPageSizeInWords);
+    for (int y = 0; y < kCT32PageHeight; ++y) {
+        for (int x = 0; x < kCT32PageWidth; ++x) {
+            const int blockX = x / 8;
+            const int blockY = y / 8;
+            const int block = block32[blockX + blockY * 8];
+
+            const int bx = x - blockX * 8;
+            const int by = y - blockY * 8;
+            const int column = by / 2;
+            const int cy = by - column * 2;
+            const int cw = columnWord32[bx + cy * 8];
+
+            PS2PageEntry& e = result[block * 64 + column * 16 + cw];
+            e.row = scast<uint16_t>(y);
+            e.offset = scast<uint16_t>(x);
+        }
+    }
+    return result;
+}
+
+static const PS2PageEntry* GetPSMT8PageTable() {
+    static const MyArray<PS2PageEntry> sTable = []() {
+        const MyArray<PS2PageEntry> ct32 = BuildCT32PageInverse();
+
+        MyArray<PS2PageEntry> table(kT8PageWidth * kT8PageHeight);
+        for (int py = 0; py < kT8PageHeight; ++py) {
+            for (int px = 0; px < kT8PageWidth; ++px) {
+                const int blockX = px / 16;
+                const int blockY = py / 16;
+                const int block = block8[blockX + blockY * 8];
+
+                const int bx = px - blockX * 16;
+                const int by = py - blockY * 16;
+                const int column = by / 4;
+                const int cy = by - column * 4;
+                const int cw = columnWord8[column & 1][bx + cy * 16];
+                const int cb = columnByte8[bx + cy * 16];
+
+                const PS2PageEntry& word = ct32[block * 64 + column * 16 + cw];
+                PS2PageEntry& e = table[px + py * kT8PageWidth];
+                e.row = word.row;
+                e.offset = scast<uint16_t>(word.offset * 4 + cb);     // byte offset
+            }
+        }
+        return table;
+    }();
+
+    return sTable.data();
+}
+
+static const PS2PageEntry* GetPSMT4PageTable() {
+    static const MyArray<PS2PageEntry> sTable = []() {
+        const MyArray<PS2PageEntry> ct32 = BuildCT32PageInverse();
+
+        MyArray<PS2PageEntry> table(kT4PageWidth * kT4PageHeight);
+        for (int py = 0; py < kT4PageHeight; ++py) {
+            for (int px = 0; px < kT4PageWidth; ++px) {
+                const int blockX = px / 32;
+                const int blockY = py / 16;
+                const int block = block4[blockX + blockY * 4];
+
+                const int bx = px - blockX * 32;
+                const int by = py - blockY * 16;
+                const int column = by / 4;
+                const int cy = by - column * 4;
+                const int cw = columnWord4[column & 1][bx + cy * 32];
+                const int cb = columnByte4[bx + cy * 32];
+
+                const PS2PageEntry& word = ct32[block * 64 + column * 16 + cw];
+                PS2PageEntry& e = table[px + py * kT4PageWidth];
+                e.row = word.row;
+                e.offset = scast<uint16_t>(word.offset * 8 + cb);     // nibble offset
+            }
+        }
+        return table;
+    }();
+
+    return sTable.data();
+}
+
+static bool IsPageAligned(const int width, const int height, const int pageWidth, const int pageHeight) {
+    return width > 0 && height > 0 && (width % pageWidth) == 0 && (height % pageHeight) == 0;
+}
+
+bool PS2UnswizzlePSMT8(const uint8_t* src, uint8_t* dst, const int width, const int height) {
+    if (!IsPageAligned(width, height, kT8PageWidth, kT8PageHeight)) {
+        return false;
+    }
+
+    const PS2PageEntry* table = GetPSMT8PageTable();
+    const size_t srcStride = scast<size_t>(width) * 2;    // PSMCT32 image is (width / 2) * 4 bytes wide
+    const int pagesX = width / kT8PageWidth;
+
+    for (int y = 0; y < height; ++y) {
+        const int pageY = y / kT8PageHeight;
+        const PS2PageEntry* rowTable = table + (y % kT8PageHeight) * kT8PageWidth;
+        const uint8_t* srcPageRow = src + scast<size_t>(pageY) * kCT32PageHeight * srcStride;
+        uint8_t* dstRow = dst + scast<size_t>(y) * width;
+
+        for (int pageX = 0; pageX < pagesX; ++pageX) {
+            const uint8_t* srcPage = srcPageRow + pageX * kCT32PageWidth * 4;
+            for (int px = 0; px < kT8PageWidth; ++px) {
+                const PS2PageEntry& e = rowTable[px];
+                dstRow[px] = srcPage[e.row * srcStride + e.offset];
+            }
+            dstRow += kT8PageWidth;
+        }
+    }
+
+    return true;
+}
+
+bool PS2SwizzlePSMT8(const uint8_t* src, uint8_t* dst, const int width, const int height) {
+    if (!IsPageAligned(width, height, kT8PageWidth, kT8PageHeight)) {
+        return false;
+    }
+
+    const PS2PageEntry* table = GetPSMT8PageTable();
+    const size_t dstStride = scast<size_t>(width) * 2;
+    const int pagesX = width / kT8PageWidth;
+
+    for (int y = 0; y < height; ++y) {
+        const int pageY = y / kT8PageHeight;
+        const PS2PageEntry* rowTable = table + (y % kT8PageHeight) * kT8PageWidth;
+        uint8_t* dstPageRow = dst + scast<size_t>(pageY) * kCT32PageHeight * dstStride;
+        const uint8_t* srcRow = src + scast<size_t>(y) * width;
+
+        for (int pageX = 0; pageX < pagesX; ++pageX) {
+            uint8_t* dstPage = dstPageRow + pageX * kCT32PageWidth * 4;
+            for (int px = 0; px < kT8PageWidth; ++px) {
+                const PS2PageEntry& e = rowTable[px];
+                dstPage[e.row * dstStride + e.offset] = srcRow[px];
+            }
+            srcRow += kT8PageWidth;
+        }
+    }
+
+    return true;
+}
+
+bool PS2UnswizzlePSMT4(const uint8_t* src, uint8_t* dst, const int width, const int height) {
+    if (!IsPageAligned(width, height, kT4PageWidth, kT4PageHeight)) {
+        return false;
+    }
+
+    const PS2PageEntry* table = GetPSMT4PageTable();
+    const size_t srcStride = scast<size_t>(width) * 2;    // in bytes, PSMCT32 image is (width / 2) * 4 bytes wide
+    const int pagesX = width / kT4PageWidth;
+
+    for (int y = 0; y < height; ++y) {
+        const int pageY = y / kT4PageHeight;
+        const PS2PageEntry* rowTable = table + (y % kT4PageHeight) * kT4PageWidth;
+        const uint8_t* srcPageRow = src + scast<size_t>(pageY) * kCT32PageHeight * srcStride;
+        uint8_t* dstRow = dst + scast<size_t>(y) * (width / 2);
+
+        for (int pageX = 0; pageX < pagesX; ++pageX) {
+            const uint8_t* srcPage = srcPageRow + pageX * kCT32PageWidth * 4;
+            for (int px = 0; px < kT4PageWidth; px += 2) {
+                const PS2PageEntry& e0 = rowTable[px + 0];
+                const PS2PageEntry& e1 = rowTable[px + 1];
+                const uint8_t v0 = (srcPage[e0.row * srcStride + (e0.offset >> 1)] >> ((e0.offset & 1) * 4)) & 0x0F;
+                const uint8_t v1 = (srcPage[e1.row * srcStride + (e1.offset >> 1)] >> ((e1.offset & 1) * 4)) & 0x0F;
+                dstRow[px >> 1] = scast<uint8_t>(v0 | (v1 << 4));
+            }
+            dstRow += kT4PageWidth / 2;
+        }
+    }
+
+    return true;
+}
+
+bool PS2SwizzlePSMT4(const uint8_t* src, uint8_t* dst, const int width, const int height) {
+    if (!IsPageAligned(width, height, kT4PageWidth, kT4PageHeight)) {
+        return false;
+    }
+
+    const PS2PageEntry* table = GetPSMT4PageTable();
+    const size_t dstStride = scast<size_t>(width) * 2;
+    const int pagesX = width / kT4PageWidth;
+
+    for (int y = 0; y < height; ++y) {
+        const int pageY = y / kT4PageHeight;
+        const PS2PageEntry* rowTable = table + (y % kT4PageHeight) * kT4PageWidth;
+        uint8_t* dstPageRow = dst + scast<size_t>(pageY) * kCT32PageHeight * dstStride;
+        const uint8_t* srcRow = src + scast<size_t>(y) * (width / 2);
+
+        for (int pageX = 0; pageX < pagesX; ++pageX) {
+            uint8_t* dstPage = dstPageRow + pageX * kCT32PageWidth * 4;
+            for (int px = 0; px < kT4PageWidth; ++px) {
+                const PS2PageEntry& e = rowTable[px];
+                const uint8_t v = (srcRow[px >> 1] >> ((px & 1) * 4)) & 0x0F;
+                const int shift = (e.offset & 1) * 4;
+                uint8_t& d = dstPage[e.row * dstStride + (e.offset >> 1)];
+                d = scast<uint8_t>((d & ~(0x0F << shift)) | (v << shift));
+            }
+            srcRow += kT4PageWidth / 2;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "mycommon.h"
+
+// swizzling info - https://ps2linux.no-ip.info/playstation2-linux.com/download/ezswizzle/TextureSwizzling.pdf
+//
+// Emulates just enough of the PS2 GS local memory to (un)swizzle textures.
+// Instead of a global 4MB buffer, every instance owns its scratch memory and grows it
+// to cover only the pages touched by the transferred rectangles.
+// Separate instances can be safely used from different threads at the same time.
+class PS2GSMemory {
+public:
+    PS2GSMemory();
+    ~PS2GSMemory();
+
+    void        Clear();
+    size_t      GetSizeInBytes() const;
+
+    void        WriteTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMZ32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMCT16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMCT16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMZ16(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMZ16S(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+    void        WriteTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, const void* data);
+    void        ReadTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+
+private:
+    unsigned int* Reserve(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, int pageWidth, int pageHeight);
+
+private:
+    MyArray<unsigned int>   mMemory;
+};
+
+// Direct PSMCT32 <-> PSMT8/PSMT4 remapping, without the GS memory round-trip.
+// Uses precomputed per-page address tables, so it's a single pass over the pixels.
+// Only whole pages are supported, these return false if the texture is not page-aligned,
+// in which case the caller should fall back to PS2GSMemory.
+// 4 bit data is packed, two pixels per byte, low nibble first. src and dst must not overlap.
+bool    PS2UnswizzlePSMT8(const uint8_t* src, uint8_t* dst, const int width, const int height);
+bool    PS2SwizzlePSMT8(const uint8_t* src, uint8_t* dst, const int width, const int height);
+bool    PS2UnswizzlePSMT4(const uint8_t* src, uint8_t* dst, const int width, const int height);
+bool    PS2SwizzlePSMT4(const uint8_t* src, uint8_t* dst, const int width, const int height);
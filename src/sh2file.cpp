@@ -0,0 +1,46 @@
+#include "sh2file.h"
+#include "sh2texture.h"
+#include "sh2map.h"
+#include "sh2model.h"
+
+
+bool SH2File::Load(const fs::path& filePath) {
+    path = filePath;
+
+    if (WStrEqualsCaseInsensitive(path.extension().wstring(), L".map")) {
+        map = MakeRefPtr<SH2Map>();
+        if (map->LoadFromFile(path)) {
+            container = map->GetTexturesContainer();
+        }
+    } else if (WStrEqualsCaseInsensitive(path.extension().wstring(), L".mdl")) {
+        model = MakeRefPtr<SH2Model>();
+        if (model->LoadFromFile(path)) {
+            container = model->GetTexturesContainer();
+        }
+    } else {
+        RefPtr<SH2TextureContainer> textures = MakeRefPtr<SH2TextureContainer>();
+        if (textures->LoadFromFile(path)) {
+            container = textures;
+        }
+    }
+
+    return container != nullptr;
+}
+
+bool SH2File::Save(const fs::path& dstPath) {
+    if (map) {
+        return map->SaveToFile(dstPath);
+    } else if (model) {
+        return model->SaveToFile(dstPath);
+    } else {
+        return container->SaveToFile(dstPath);
+    }
+}
+
+bool IsSH2FileExtension(const fs::path& path) {
+    const WideString ext = path.extension().wstring();
+    return WStrEqualsCaseInsensitive(ext, L".tex")  ||
+           WStrEqualsCaseInsensitive(ext, L".tbn2") ||
+           WStrEqualsCaseInsensitive(ext, L".map")  ||
+           WStrEqualsCaseInsensitive(ext, L".mdl");
+}
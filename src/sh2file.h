@@ -0,0 +1,19 @@
+#pragma once
+#include "mycommon.h"
+
+class SH2Map;
+class SH2Model;
+class SH2TextureContainer;
+
+// any of the supported files (.tex, .tbn2, .map, .mdl), loaded through the matching class
+struct SH2File {
+    fs::path                    path;
+    RefPtr<SH2Map>              map;
+    RefPtr<SH2Model>            model;
+    RefPtr<SH2TextureContainer> container;  // all the textures, for maps and models too
+
+    bool    Load(const fs::path& filePath);
+    bool    Save(const fs::path& dstPath);
+};
+
+bool    IsSH2FileExtension(const fs::path& path);
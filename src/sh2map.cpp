@@ -1,7 +1,10 @@
 #include "sh2map.h"
 #include "sh2texture.h"
+#include "parallel.h"
+#include "mappedfile.h"
+#include "filewritestream.h"
 
-#include <fstream>
+#include <atomic>
 
 constexpr uint32_t kMapFileMagic = 0x20010510;
 
@@ -11,29 +14,15 @@ SH2Map::SH2Map()
 {
 }
 SH2Map::~SH2Map() {
-    std::for_each(mSubDatas.begin(), mSubDatas.end(), [](SubData& sd) {
-        if (sd.second != nullptr) {
-            std::free(sd.second);
-        }
-    });
-    mSubDatas.clear();
 }
 
-bool SH2Map::LoadFromFile(const fs::path& path) {
-    std::ifstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+bool SH2Map::LoadFromFile(const fs::path& path, const bool mapFile) {
+    MemStream stream = mapFile ? MapFileToStream(path) : ReadFileToStream(path);
+    if (!stream) {
         return false;
     }
 
-    file.seekg(0, std::ios_base::end);
-    const size_t fileSize = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-
-    void* data = std::malloc(fileSize);
-    file.read(rcast<char*>(data), fileSize);
-    file.close();
-
-    MemStream stream(data, fileSize, true);
+    mSourcePath = path;
     return this->LoadFromStream(stream);
 }
 
@@ -56,10 +45,10 @@ bool SH2Map::LoadFromStream(MemStream& stream) {
 
     mSubDatas.resize(mHeader.numFiles);
     for (auto& sd : mSubDatas) {
-        sd.second = nullptr;
-        stream.ReadStruct(sd.first);
+        sd.isPrivate = false;
+        stream.ReadStruct(sd.header);
 
-        const auto& subDataHeader = sd.first;
+        const auto& subDataHeader = sd.header;
         if (subDataHeader.subDataType == 2) {    // textures
             RefPtr<SH2TextureContainer> container = MakeRefPtr<SH2TextureContainer>();
             MemStream subStream = stream.Substream(subDataHeader.subDataSize);
@@ -69,9 +58,12 @@ bool SH2Map::LoadFromStream(MemStream& stream) {
                 return false;
             }
         } else {
-            void* dataMem = std::malloc(subDataHeader.subDataSize);
-            std::memcpy(dataMem, stream.GetDataAtCursor(), subDataHeader.subDataSize);
-            sd.second = dataMem;
+            // keep a view if the source bytes are owned, otherwise they might be gone by the time we save
+            sd.data = stream.Substream(subDataHeader.subDataSize);
+            if (!stream.IsOwning()) {
+                sd.data = sd.data.Copy();
+                sd.isPrivate = true;
+            }
         }
 
         stream.SkipBytes(subDataHeader.subDataSize);
@@ -101,6 +93,7 @@ bool SH2Map::LoadFromStream_PS2(MemStream& stream) {
     //const uint32_t palOffset1 = header[9];
     const uint32_t numTextures = header[10];
 
+    // only the headers are parsed here, the pixels get unswizzled on first access
     mVirtualTexturesContainer = MakeRefPtr<SH2TextureContainer>();
     for (size_t i = 0; i < numTextures; ++i) {
         MemStream tstream = stream.Substream(header[i + 4], stream.Length());
@@ -108,60 +101,156 @@ bool SH2Map::LoadFromStream_PS2(MemStream& stream) {
         SH2Texture* texture = new SH2Texture();
         if (texture->LoadFromStream_PS2(tstream)) {
             mVirtualTexturesContainer->AddTexture(texture);
+            mTextureOffsets_PS2.push_back(header[i + 4]);
         } else {
             delete texture;
         }
     }
 
+    mSource_PS2 = stream.Substream(0, stream.Length());
+    if (!stream.IsOwning()) {
+        mSource_PS2 = mSource_PS2.Copy();
+    }
+
     mIsPS2 = true;
 
     return true;
 }
 
 bool SH2Map::SaveToFile(const fs::path& path) {
-    MemWriteStream stream;
-    if (!this->SaveToStream(stream)) {
-        return false;
+    // the sub-datas and textures still point into the file we loaded from, get them out before it gets overwritten
+    std::error_code ec;
+    if (!mSourcePath.empty() && fs::equivalent(path, mSourcePath, ec)) {
+        this->MakeSubDatasPrivate();
+        if (mSource_PS2.IsOwning()) {
+            mSource_PS2 = mSource_PS2.Copy();
+        }
+        if (mVirtualTexturesContainer) {
+            mVirtualTexturesContainer->LoadPendingData();
+        }
+        mSourcePath.clear();
     }
 
-    std::ofstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+    FileWriteStream stream;
+    if (!stream.Open(path)) {
         return false;
     }
 
-    file.write(rcast<const char*>(stream.Data()), stream.GetWrittenBytesCount());
-    file.flush();
-    file.close();
+    if (!this->SaveToStream(stream)) {
+        return false;
+    }
 
-    return true;
+    return stream.Close();
 }
 
-bool SH2Map::SaveToStream(MemWriteStream& stream) {
+bool SH2Map::SaveToStream(WriteStream& stream) {
+    if (mIsPS2) {
+        return this->SaveToStream_PS2(stream);
+    }
+
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
+
     stream.Write(mHeader);
 
     size_t containerIdx = 0;
     for (auto& sd : mSubDatas) {
-        auto& subDataHeader = sd.first;
+        auto& subDataHeader = sd.header;
 
         if (subDataHeader.subDataType == 2) {    // textures
-            // save our textures container to stream to know the subData size
-            MemWriteStream texturesStream;
-            if (!mTexturesContainers[containerIdx]->SaveToStream(texturesStream)) {
+            // we only know the subData size after the container is written, so patch the header afterwards
+            const size_t headerOffset = stream.GetWrittenBytesCount();
+            stream.Write(subDataHeader);
+
+            if (!mTexturesContainers[containerIdx]->SaveToStream(stream)) {
                 return false;
             }
 
-            subDataHeader.subDataSize = scast<uint32_t>(texturesStream.GetWrittenBytesCount());
+            subDataHeader.subDataSize = scast<uint32_t>(stream.GetWrittenBytesCount() - headerOffset - sizeof(subDataHeader));
+            stream.WriteAt(headerOffset, subDataHeader);
+
+            ++containerIdx;
+        } else {
+            subDataHeader.subDataSize = scast<uint32_t>(sd.data.Length());
 
             stream.Write(subDataHeader);
-            stream.Write(texturesStream.Data(), texturesStream.GetWrittenBytesCount());
+            stream.Append(sd.data);
+        }
+    }
 
+    return true;
+}
+
+size_t SH2Map::CalculateStreamSize() const {
+    if (mIsPS2) {
+        // PS2 textures can't change their size, so we always write the same amount of bytes
+        return mSource_PS2.Length();
+    }
+
+    size_t result = sizeof(mHeader);
+
+    size_t containerIdx = 0;
+    for (const auto& sd : mSubDatas) {
+        result += sizeof(sd.header);
+        if (sd.header.subDataType == 2) {    // textures
+            result += mTexturesContainers[containerIdx]->CalculateStreamSize();
             ++containerIdx;
         } else {
-            stream.Write(subDataHeader);
-            stream.Write(sd.second, subDataHeader.subDataSize);
+            result += sd.data.Length();
         }
     }
 
+    return result;
+}
+
+bool SH2Map::SaveToStream_PS2(WriteStream& stream) {
+    const size_t numTextures = mVirtualTexturesContainer ? mVirtualTexturesContainer->GetNumTextures() : 0;
+
+    // re-swizzling is the expensive part, so serialize textures to their own buffers in parallel
+    MyArray<MemWriteStream> textureStreams(numTextures);
+    std::atomic<bool> allSaved{ true };
+    ParallelFor(numTextures, [this, &textureStreams, &allSaved](const size_t i) {
+        if (!mVirtualTexturesContainer->GetTexture(i)->SaveToStream_PS2(textureStreams[i])) {
+            allSaved = false;
+        }
+    });
+    if (!allSaved) {
+        return false;
+    }
+
+    // and now stitch them in the file order over the original bytes
+    MyArray<size_t> order(numTextures);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [this](const size_t a, const size_t b) {
+        return mTextureOffsets_PS2[a] < mTextureOffsets_PS2[b];
+    });
+
+    size_t cursor = 0;
+    for (const size_t i : order) {
+        const size_t offset = mTextureOffsets_PS2[i];
+        const size_t size = textureStreams[i].GetWrittenBytesCount();
+
+        // we have to fit exactly into the place of the original texture
+        const size_t originalSize = mVirtualTexturesContainer->GetTexture(i)->CalculateStreamSize();
+        if (offset < cursor || size != originalSize || (offset + size) > mSource_PS2.Length()) {
+            return false;
+        }
+
+        cursor = offset + size;
+    }
+
+    stream.Reserve(stream.GetWrittenBytesCount() + mSource_PS2.Length());
+
+    cursor = 0;
+    for (const size_t i : order) {
+        const size_t offset = mTextureOffsets_PS2[i];
+        const size_t size = textureStreams[i].GetWrittenBytesCount();
+
+        stream.Write(mSource_PS2.Data() + cursor, offset - cursor);
+        stream.Write(textureStreams[i].Data(), size);
+        cursor = offset + size;
+    }
+    stream.Write(mSource_PS2.Data() + cursor, mSource_PS2.Length() - cursor);
+
     return true;
 }
 
@@ -172,3 +261,36 @@ bool SH2Map::IsPS2() const {
 RefPtr<SH2TextureContainer> SH2Map::GetTexturesContainer() {
     return mVirtualTexturesContainer;
 }
+
+size_t SH2Map::GetNumSubDatas() const {
+    return mSubDatas.size();
+}
+
+const SH2MapSubDataHeader& SH2Map::GetSubDataHeader(const size_t idx) const {
+    return mSubDatas[idx].header;
+}
+
+const uint8_t* SH2Map::GetSubData(const size_t idx) const {
+    const SubData& sd = mSubDatas[idx];
+    return (sd.header.subDataType == 2) ? nullptr : sd.data.Data();
+}
+
+uint8_t* SH2Map::EditSubData(const size_t idx) {
+    SubData& sd = mSubDatas[idx];
+    if (sd.header.subDataType == 2) {
+        return nullptr;
+    }
+
+    if (!sd.isPrivate) {
+        sd.data = sd.data.Copy();
+        sd.isPrivate = true;
+    }
+
+    return const_cast<uint8_t*>(sd.data.Data());
+}
+
+void SH2Map::MakeSubDatasPrivate() {
+    for (size_t i = 0; i < mSubDatas.size(); ++i) {
+        this->EditSubData(i);
+    }
+}
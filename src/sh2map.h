@@ -26,24 +26,45 @@ public:
     SH2Map();
     ~SH2Map();
 
-    bool    LoadFromFile(const fs::path& path);
+    bool    LoadFromFile(const fs::path& path, const bool mapFile = true);
     bool    LoadFromStream(MemStream& stream);
 
     bool    LoadFromStream_PS2(MemStream& stream);
 
     bool    SaveToFile(const fs::path& path);
-    bool    SaveToStream(MemWriteStream& stream);
+    bool    SaveToStream(WriteStream& stream);
+    size_t  CalculateStreamSize() const;
+
+    bool    SaveToStream_PS2(WriteStream& stream);
 
     bool    IsPS2() const;
 
     RefPtr<SH2TextureContainer> GetTexturesContainer();
 
+    // non-texture sub-datas are opaque to us, they stay views into the loaded file until edited
+    size_t                      GetNumSubDatas() const;
+    const SH2MapSubDataHeader&  GetSubDataHeader(const size_t idx) const;
+    const uint8_t*              GetSubData(const size_t idx) const;    // nullptr for textures
+    uint8_t*                    EditSubData(const size_t idx);         // copies the sub-data first
+
 private:
-    using SubData = std::pair<SH2MapSubDataHeader, void*>;
+    void    MakeSubDatasPrivate();
+
+private:
+    struct SubData {
+        SH2MapSubDataHeader header;
+        MemStream           data;
+        bool                isPrivate;  // data is our own copy, not a view
+    };
 
     bool                        mIsPS2;
+    fs::path                    mSourcePath;
     SH2MapHeader                mHeader;
     MyArray<SubData>            mSubDatas;
     MyArray<RefPtr<SH2TextureContainer>> mTexturesContainers;
     RefPtr<SH2TextureContainer> mVirtualTexturesContainer;
+
+    // PS2 stuff, we only understand textures there, so everything else is written back as is
+    MemStream                   mSource_PS2;
+    MyArray<size_t>             mTextureOffsets_PS2;    // one per texture in the virtual container
 };
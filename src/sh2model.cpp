@@ -1,7 +1,7 @@
 #include "sh2model.h"
 #include "sh2texture.h"
-
-#include <fstream>
+#include "mappedfile.h"
+#include "filewritestream.h"
 
 
 SH2Model::SH2Model()
@@ -11,21 +11,13 @@ SH2Model::SH2Model()
 SH2Model::~SH2Model() {
 }
 
-bool SH2Model::LoadFromFile(const fs::path& path) {
-    std::ifstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+bool SH2Model::LoadFromFile(const fs::path& path, const bool mapFile) {
+    MemStream stream = mapFile ? MapFileToStream(path) : ReadFileToStream(path);
+    if (!stream) {
         return false;
     }
 
-    file.seekg(0, std::ios_base::end);
-    const size_t fileSize = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-
-    void* data = std::malloc(fileSize);
-    file.read(rcast<char*>(data), fileSize);
-    file.close();
-
-    MemStream stream(data, fileSize, true);
+    mSourcePath = path;
     return this->LoadFromStream(stream);
 }
 
@@ -59,29 +51,38 @@ bool SH2Model::LoadFromStream(MemStream& stream) {
 }
 
 bool SH2Model::SaveToFile(const fs::path& path) {
-    MemWriteStream stream;
-    if (!this->SaveToStream(stream)) {
-        return false;
+    // textures still point into the file we loaded from, read them before it gets overwritten
+    std::error_code ec;
+    if (mTexturesContainer && !mSourcePath.empty() && fs::equivalent(path, mSourcePath, ec)) {
+        mTexturesContainer->LoadPendingData();
+        mSourcePath.clear();
     }
 
-    std::ofstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+    FileWriteStream stream;
+    if (!stream.Open(path)) {
         return false;
     }
 
-    file.write(rcast<const char*>(stream.Data()), stream.GetWrittenBytesCount());
-    file.flush();
-    file.close();
+    if (!this->SaveToStream(stream)) {
+        return false;
+    }
 
-    return true;
+    return stream.Close();
 }
 
-bool SH2Model::SaveToStream(MemWriteStream& stream) {
+bool SH2Model::SaveToStream(WriteStream& stream) {
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
+
     stream.Write(mHeader);
     stream.Write(mGeometryData.data(), mGeometryData.size());
     return mTexturesContainer->SaveToStream(stream);
 }
 
+size_t SH2Model::CalculateStreamSize() const {
+    const size_t texturesSize = mTexturesContainer ? mTexturesContainer->CalculateStreamSize() : 0;
+    return sizeof(mHeader) + mGeometryData.size() + texturesSize;
+}
+
 RefPtr<SH2TextureContainer> SH2Model::GetTexturesContainer() {
     return mTexturesContainer;
 
@@ -17,16 +17,18 @@ public:
     SH2Model();
     ~SH2Model();
 
-    bool    LoadFromFile(const fs::path& path);
+    bool    LoadFromFile(const fs::path& path, const bool mapFile = true);
     bool    LoadFromStream(MemStream& stream);
 
     bool    SaveToFile(const fs::path& path);
-    bool    SaveToStream(MemWriteStream& stream);
+    bool    SaveToStream(WriteStream& stream);
+    size_t  CalculateStreamSize() const;
 
     RefPtr<SH2TextureContainer> GetTexturesContainer();
 
 private:
     SH2MDLContainerHeader        mHeader;
+    fs::path                     mSourcePath;
     MyArray<uint8_t>             mGeometryData;
     RefPtr<SH2TextureContainer>  mTexturesContainer;
 };
@@ -0,0 +1,27 @@
+#pragma once
+
+// sh2tex_core public API - everything needed to load, inspect, decode,
+// export and re-save Silent Hill 2 texture containers, maps and models
+
+#define SH2TEX_CORE_VERSION_MAJOR 0
+#define SH2TEX_CORE_VERSION_MINOR 1
+
+#include "mycommon.h"
+#include "mappedfile.h"
+#include "filewritestream.h"
+#include "sh2texture.h"
+#include "sh2map.h"
+#include "sh2model.h"
+#include "sh2file.h"
+#include "ddstexture.h"
+#include "cpufeatures.h"
+#include "bcdecoder.h"
+#include "bcencoder.h"
+#include "texturedecoder.h"
+#include "textureexport.h"
+#include "textureimport.h"
+#include "thumbnailcache.h"
+#include "pngfile.h"
+#include "palettequantizer.h"
+#include "pixelconvert.h"
+#include "parallel.h"
@@ -1,6 +1,9 @@
 #include "sh2texture.h"
-#include "libs/bcdec/bcdec.h" // no implementation, just size helpers
-#include <fstream>
+#include "ps2textures.h"
+#include "mappedfile.h"
+#include "filewritestream.h"
+#include "pixelconvert.h"
+#include "bcdecoder.h"
 
 #define FIX_WRONG_DATASIZE 0
 
@@ -23,42 +26,34 @@ enum PS2_PSM {
     PSMT4HH  = 44,      // 4 - bit indexed, where the bits 4 - 7 are evaluated and the rest discarded.
 };
 
-static uint8_t FromPS2Alpha(const uint8_t ps2Alpha) {
-    return (ps2Alpha == 0x80) ? 0xFF : ((ps2Alpha << 1) | (ps2Alpha & 1));
-}
-
-static uint8_t ToPS2Alpha(const uint8_t alpha) {
-    return (alpha == 0xFF) ? 0x80 : (alpha >> 1);
-}
+// A 256 color CLUT is stored as 8x2 entry blocks in CSM1 order, which swaps entries 8..15 and 16..23 of every 32.
+// A 16 color CLUT is a single 8x2 block, so it's linear - swapping would pull in entries past its end.
+// The swap is its own inverse, loading and saving both use it.
+static void SwapCLUTBlocks(uint8_t* palette, const size_t numEntries) {
+    if (numEntries != 256) {
+        return;
+    }
 
-static void FromPS2Palette(uint8_t* palette) {
     uint32_t* palette32 = rcast<uint32_t*>(palette);
     for (size_t i = 0; i < 8; ++i) {
         for (size_t j = 0; j < 8; ++j) {
             std::swap(palette32[8 + i * 32 + j], palette32[16 + i * 32 + j]);
         }
     }
+}
 
-    for (size_t i = 0; i < 1024; i += 4) {
-        std::swap(palette[i + 0], palette[i + 2]);
-        // weird PS2 alpha
-        palette[i + 3] = FromPS2Alpha(palette[i + 3]);
-    }
+static void FromPS2Palette(uint8_t* palette, const size_t numEntries) {
+    SwapCLUTBlocks(palette, numEntries);
+
+    // weird PS2 alpha
+    PixelsFromPS2(palette, palette, numEntries);
 }
 
-static void ToPS2Palette(uint8_t* palette) {
-    for (size_t i = 0; i < 1024; i += 4) {
-        std::swap(palette[i + 0], palette[i + 2]);
-        // weird PS2 alpha
-        palette[i + 3] = ToPS2Alpha(palette[i + 3]);
-    }
+static void ToPS2Palette(uint8_t* palette, const size_t numEntries) {
+    // weird PS2 alpha
+    PixelsToPS2(palette, palette, numEntries);
 
-    uint32_t* palette32 = rcast<uint32_t*>(palette);
-    for (size_t i = 0; i < 8; ++i) {
-        for (size_t j = 0; j < 8; ++j) {
-            std::swap(palette32[8 + i * 32 + j], palette32[16 + i * 32 + j]);
-        }
-    }
+    SwapCLUTBlocks(palette, numEntries);
 }
 
 
@@ -70,6 +65,7 @@ SH2Texture::SH2Texture()
     , mHeader2{}
     , mFormat{}
     , mOriginalDataSize{0u}
+    , mHasPendingData(false)
     // PS2 stuff
     , mIsPS2File(false)
     , mHeader_PS2{}
@@ -124,8 +120,15 @@ bool SH2Texture::LoadFromStream(MemStream& stream) {
             }
 #endif
 
-            mData.resize(expectedDataSize);
-            stream.ReadToBuffer(mData.data(), mData.size());
+            // only remember where the pixels are, we'll read them when somebody asks
+            if (stream.IsOwning() && stream.Remains() >= expectedDataSize) {
+                mPendingData = stream.Substream(expectedDataSize);
+                mHasPendingData = true;
+                stream.SkipBytes(expectedDataSize);
+            } else {
+                mData.resize(expectedDataSize);
+                stream.ReadToBuffer(mData.data(), mData.size());
+            }
 
             if (mFormat == SH2Texture::Format::Paletted) {
                 SH2SpriteHeader paletteHeader; // WHY ????
@@ -143,11 +146,6 @@ bool SH2Texture::LoadFromStream(MemStream& stream) {
     return true;
 }
 
-// swizzling info - https://ps2linux.no-ip.info/playstation2-linux.com/download/ezswizzle/TextureSwizzling.pdf
-extern void writeTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
-extern void readTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
-extern void readTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
-
 // https://youtu.be/LbcZCEAN1nY
 
 bool SH2Texture::LoadFromStream_PS2(MemStream& stream) {
@@ -167,8 +165,17 @@ bool SH2Texture::LoadFromStream_PS2(MemStream& stream) {
     const bool bloatedPalette = (mHeader_PS2.isCompressed != 0);
 
     stream.SetCursor(startOffset + pixelsOffset);
-    mData.resize(expectedDataSize);
-    stream.ReadToBuffer(mData.data(), mData.size());
+
+    // unswizzling is the expensive part, postpone it (and the read) till somebody asks for pixels
+    const bool isLazy = stream.IsOwning() && stream.Remains() >= expectedDataSize;
+    if (isLazy) {
+        mPendingData = stream.Substream(expectedDataSize);
+        mHasPendingData = true;
+        stream.SkipBytes(expectedDataSize);
+    } else {
+        mData.resize(expectedDataSize);
+        stream.ReadToBuffer(mData.data(), mData.size());
+    }
 
     if (mFormat == Format::Paletted || mFormat == Format::Paletted4) {
         stream.ReadStruct(mPaletteHeader_PS2);
@@ -178,85 +185,143 @@ bool SH2Texture::LoadFromStream_PS2(MemStream& stream) {
         mPalettePS2.resize(mPaletteHeader_PS2.paletteDataSize);
         stream.ReadToBuffer(mPalettePS2.data(), mPalettePS2.size());
 
+        // all of them converted once, switching is just a copy then
+        const size_t paletteSize = this->GetPaletteSize_PS2();
+        mPalettes.resize(this->GetPalettesCount() * paletteSize);
+        for (size_t i = 0, end = this->GetPalettesCount(); i < end; ++i) {
+            this->GatherPalette_PS2(i, mPalettes.data() + i * paletteSize);
+        }
+
+        mPaletteIdx = ~size_t(0);
+        this->SetCurrentPaletteIdx(0);
+    }
+
+    if (!isLazy) {
+        this->UnpackData_PS2();
+    }
+
+    return true;
+}
+
+size_t SH2Texture::GetPaletteSize_PS2() const {
+    return (mFormat == Format::Paletted4) ? (16 * 4) : (256 * 4);
+}
+
+// picks palette idx out of the CLUT blocks and converts it
+void SH2Texture::GatherPalette_PS2(const size_t idx, uint8_t* dst) const {
+    const bool is4Bit = (mFormat == Format::Paletted4);
+    const size_t paletteEntries = is4Bit ? 16 : 256;
+    const size_t paletteSize = paletteEntries * 4;
+    const size_t paletteBlockSize = is4Bit ? 32 : 64;
+    const size_t numPaletteBlocks = 256 / paletteBlockSize;
+    const size_t numBlocksPerPalette = paletteSize / paletteBlockSize;
+
+    if (mPalettePS2.size() == paletteSize) {
+        std::memcpy(dst, mPalettePS2.data(), paletteSize);
+    } else {
+        const size_t bigOffset = (idx / numPaletteBlocks) * 4096;
+        const size_t smallOffset = (idx % numPaletteBlocks) * paletteBlockSize;
+
+        // broken files can claim more palettes than they have
+        if (bigOffset + smallOffset + (numBlocksPerPalette - 1) * 256 + paletteBlockSize > mPalettePS2.size()) {
+            std::memset(dst, 0, paletteSize);
+            return;
+        }
+
+        uint8_t* blockDst = dst;
+        const uint8_t* src = mPalettePS2.data() + bigOffset + smallOffset;
+        for (size_t i = 0; i < numBlocksPerPalette; ++i) {
+            std::memcpy(blockDst, src, paletteBlockSize);
+            blockDst += paletteBlockSize;
+            src += 256;
+        }
+    }
+
+    FromPS2Palette(dst, paletteEntries);
+}
+
+void SH2Texture::UnpackData_PS2() const {
+    if (mFormat == Format::Paletted || mFormat == Format::Paletted4) {
         const int ww = this->GetWidth();
         const int hh = this->GetHeight();
         const int rrw = ww >> 1;
         const int rrh = (mFormat == Format::Paletted) ? (hh >> 1) : (hh >> 2);
 
-        writeTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, mData.data());
-        if (mFormat == Format::Paletted) {
-            readTexPSMT8(0, ww >> 6, 0, 0, ww, this->GetHeight(), mData.data());
-        } else {
-            readTexPSMT4(0, ww >> 6, 0, 0, ww, this->GetHeight(), mData.data());
-
-            // "eplode" 4bit image to 8bit
-            const size_t bitsPerLine = mHeader_PS2.width * 4;
-            const size_t bytesPerLine = (bitsPerLine >> 3) + ((bitsPerLine % 8 == 0) ? 0 : 1);
-
-            BytesArray exploded(ww * hh);
-            const uint8_t* src = mData.data();
-            uint8_t* dst = exploded.data();
-            for (size_t y = 0; y < mHeader_PS2.height; ++y) {
-                const uint8_t* ptr4 = src + y * bytesPerLine;
-                for (size_t x = 0; x < (mHeader_PS2.width - 1); x += 2) {
-                    dst[0] = (ptr4[0] & 0xF);
-                    dst[1] = ((ptr4[0] >> 4) & 0xF);
-
-                    ptr4 += 1;
-                    dst += 2;
+        const bool is4Bit = (mFormat == Format::Paletted4);
+        // 4 bit rows are padded to whole bytes, every row gets exploded to one index per byte
+        const size_t bytesPerLine = is4Bit ? ((scast<size_t>(ww) * 4 + 7) >> 3) : 0;
+
+        // page-aligned textures are remapped directly, odd sizes go through the emulated GS memory
+        BytesArray unswizzled(mData.size());
+        const bool remapped = is4Bit ? PS2UnswizzlePSMT4(mData.data(), unswizzled.data(), ww, hh)
+                                     : PS2UnswizzlePSMT8(mData.data(), unswizzled.data(), ww, hh);
+        if (remapped) {
+            if (is4Bit) {
+                // explode straight from the remapped image
+                mData.resize(scast<size_t>(ww) * hh);
+                if (bytesPerLine * 2 == scast<size_t>(ww)) {
+                    IndicesUnpack4Bit(unswizzled.data(), mData.data(), mData.size());
+                } else {
+                    for (int y = 0; y < hh; ++y) {
+                        IndicesUnpack4Bit(unswizzled.data() + y * bytesPerLine, mData.data() + scast<size_t>(y) * ww, ww);
+                    }
                 }
-
-                if (mHeader_PS2.width & 1) {
-                    dst[0] = (ptr4[0] & 0xF);
-
-                    ++ptr4;
-                    ++dst;
+            } else {
+                mData.swap(unswizzled);
+            }
+        } else {
+            // scratch GS memory is local, so different textures can be unswizzled in parallel
+            PS2GSMemory gsmem;
+            gsmem.WriteTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, mData.data());
+            if (is4Bit) {
+                gsmem.ReadTexPSMT4(0, ww >> 6, 0, 0, ww, this->GetHeight(), mData.data());
+
+                // explode in place, the last row first so nothing gets overwritten before it's read
+                mData.resize(scast<size_t>(ww) * hh);
+                for (int y = hh; y > 0; --y) {
+                    IndicesUnpack4Bit(mData.data() + (y - 1) * bytesPerLine, mData.data() + scast<size_t>(y - 1) * ww, ww);
                 }
+            } else {
+                gsmem.ReadTexPSMT8(0, ww >> 6, 0, 0, ww, this->GetHeight(), mData.data());
             }
-
-            mData = exploded;
         }
-
-        mPaletteIdx = ~size_t(0);
-        this->SetCurrentPaletteIdx(0);
     } else {
-        for (size_t i = 0; i < mData.size(); i += 4) {
-            std::swap(mData[i + 0], mData[i + 2]);
-            // weird PS2 alpha
-            mData[i + 3] = FromPS2Alpha(mData[i + 3]);
-        }
+        // weird PS2 alpha
+        PixelsFromPS2(mData.data(), mData.data(), mData.size() / 4);
     }
-
-    return true;
 }
 
 bool SH2Texture::SaveToFile(const fs::path& path) {
-    MemWriteStream stream;
-    if (!this->SaveToStream(stream)) {
+    FileWriteStream stream;
+    if (!stream.Open(path)) {
         return false;
     }
 
-    std::ofstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+    if (!this->SaveToStream(stream)) {
         return false;
     }
 
-    file.write(rcast<const char*>(stream.Data()), stream.GetWrittenBytesCount());
-    file.flush();
-    file.close();
-
-    return true;
+    return stream.Close();
 }
 
-bool SH2Texture::SaveToStream(MemWriteStream& stream) {
+bool SH2Texture::SaveToStream(WriteStream& stream) {
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
+
     stream.Write(mHeader);
     stream.Write(mHeader2);
 
+    // PC pixels are stored as is, so untouched ones go straight from the source buffer
+    std::lock_guard<std::mutex> lock(mPendingDataLock);
+
     for (auto& sprHdr : mSprites) {
         stream.Write(sprHdr);
 
         if (sprHdr.dataSize > 0) {
-            stream.Write(mData.data(), mData.size());
+            if (mHasPendingData) {
+                stream.Append(mPendingData);
+            } else {
+                stream.Write(mData.data(), mData.size());
+            }
 
             if (mFormat == SH2Texture::Format::Paletted) {
                 SH2SpriteHeader paletteHeader = {}; // WHY ????
@@ -274,43 +339,62 @@ bool SH2Texture::SaveToStream(MemWriteStream& stream) {
     return true;
 }
 
-// swizzling info - https://ps2linux.no-ip.info/playstation2-linux.com/download/ezswizzle/TextureSwizzling.pdf
-extern void readTexPSMCT32(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
-extern void writeTexPSMT8(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
-extern void writeTexPSMT4(int dbp, int dbw, int dsax, int dsay, int rrw, int rrh, void* data);
+bool SH2Texture::SaveToStream_PS2(WriteStream& stream) {
+    this->LoadPendingData();
+
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
 
-bool SH2Texture::SaveToStream_PS2(MemWriteStream& stream) {
     stream.Write(mHeader_PS2);
 
     const size_t totalHeaderSize = mHeader_PS2.dataSize2 - mHeader_PS2.dataSize;
     const size_t paddingSize = totalHeaderSize - sizeof(mHeader_PS2);
     stream.WriteDupByte(0, paddingSize);
 
-    BytesArray ps2Image = mData;
+    BytesArray ps2Image;
 
     if (mFormat == Format::RGBX8) {
-        for (size_t i = 0; i < ps2Image.size(); i += 4) {
-            std::swap(ps2Image[i + 0], ps2Image[i + 2]);
-            // weird PS2 alpha
-            ps2Image[i + 3] = ToPS2Alpha(mData[i + 3]);
-        }
+        ps2Image.resize(mData.size());
+        // weird PS2 alpha
+        PixelsToPS2(mData.data(), ps2Image.data(), mData.size() / 4);
     } else { // paletted
         const int ww = this->GetWidth();
         const int hh = this->GetHeight();
         const int rrw = ww >> 1;
         const int rrh = (mFormat == Format::Paletted) ? (hh >> 1) : (hh >> 2);
 
-        if (mFormat == Format::Paletted) {
-            writeTexPSMT8(0, ww >> 6, 0, 0, ww, this->GetHeight(), ps2Image.data());
-        } else {
-            writeTexPSMT4(0, ww >> 6, 0, 0, ww, this->GetHeight(), ps2Image.data());
+        // 4 bit indices go back to 2 per byte first, both sides of the swizzle are packed
+        BytesArray packed;
+        const uint8_t* indices = mData.data();
+        if (mFormat == Format::Paletted4) {
+            const size_t bytesPerLine = (scast<size_t>(ww) * 4 + 7) >> 3;
+            packed.resize(this->CalculateDataSize());
+            if (bytesPerLine * 2 == scast<size_t>(ww)) {
+                IndicesPack4Bit(mData.data(), packed.data(), mData.size());
+            } else {
+                for (int y = 0; y < hh; ++y) {
+                    IndicesPack4Bit(mData.data() + scast<size_t>(y) * ww, packed.data() + y * bytesPerLine, ww);
+                }
+            }
+            indices = packed.data();
+        }
+
+        ps2Image.resize(this->CalculateDataSize());
+        const bool remapped = (mFormat == Format::Paletted) ? PS2SwizzlePSMT8(indices, ps2Image.data(), ww, hh)
+                                                            : PS2SwizzlePSMT4(indices, ps2Image.data(), ww, hh);
+        if (!remapped) {
+            PS2GSMemory gsmem;
+            if (mFormat == Format::Paletted) {
+                gsmem.WriteTexPSMT8(0, ww >> 6, 0, 0, ww, this->GetHeight(), indices);
+            } else {
+                gsmem.WriteTexPSMT4(0, ww >> 6, 0, 0, ww, this->GetHeight(), indices);
+            }
+            gsmem.ReadTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, ps2Image.data());
         }
-        readTexPSMCT32(0, rrw >> 6, 0, 0, rrw, rrh, ps2Image.data());
     }
 
     stream.Write(ps2Image.data(), ps2Image.size());
 
-    if (mFormat == Format::Paletted) {
+    if (mFormat == Format::Paletted || mFormat == Format::Paletted4) {
         stream.Write(mPaletteHeader_PS2);
         stream.Write(mPalettePS2.data(), mPalettePS2.size());
     }
@@ -318,6 +402,32 @@ bool SH2Texture::SaveToStream_PS2(MemWriteStream& stream) {
     return true;
 }
 
+size_t SH2Texture::CalculateStreamSize() const {
+    const size_t dataSize = this->CalculateDataSize();
+
+    if (mIsPS2File) {
+        const size_t totalHeaderSize = mHeader_PS2.dataSize2 - mHeader_PS2.dataSize;
+        size_t result = totalHeaderSize + dataSize;
+        if (mFormat == Format::Paletted || mFormat == Format::Paletted4) {
+            result += sizeof(mPaletteHeader_PS2) + mPalettePS2.size();
+        }
+        return result;
+    }
+
+    size_t result = sizeof(mHeader) + sizeof(mHeader2);
+    for (const auto& sprHdr : mSprites) {
+        result += sizeof(sprHdr);
+        if (sprHdr.dataSize > 0) {
+            result += dataSize;
+            if (mFormat == Format::Paletted) {
+                result += sizeof(SH2SpriteHeader) + mPalette.size();
+            }
+        }
+    }
+
+    return result;
+}
+
 uint32_t SH2Texture::GetID() const {
     return mIsPS2File ? mHeader_PS2.id : mHeader.id;
 }
@@ -335,6 +445,7 @@ SH2Texture::Format SH2Texture::GetFormat() const {
 }
 
 const uint8_t* SH2Texture::GetData() const {
+    this->LoadPendingData();
     return mData.data();
 }
 
@@ -342,6 +453,24 @@ const uint8_t* SH2Texture::GetPalette() const {
     return mPalette.data();
 }
 
+void SH2Texture::LoadPendingData() const {
+    if (!mHasPendingData.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    // thumbnails and the viewer might ask for the same texture from different threads
+    std::lock_guard<std::mutex> lock(mPendingDataLock);
+    if (mHasPendingData.load(std::memory_order_relaxed)) {
+        mData.assign(mPendingData.Data(), mPendingData.Data() + mPendingData.Length());
+        if (mIsPS2File) {
+            this->UnpackData_PS2();
+        }
+
+        mPendingData = MemStream();
+        mHasPendingData.store(false, std::memory_order_release);
+    }
+}
+
 // PS2 specific palette funcs
 size_t SH2Texture::GetPalettesCount() const {
     return mIsPS2File ? mPaletteHeader_PS2.palettesCount : 1;
@@ -351,44 +480,31 @@ size_t SH2Texture::GetCurrentPaletteIdx() const {
     return mIsPS2File ? mPaletteIdx : 0;
 }
 
+const uint8_t* SH2Texture::GetPalette(const size_t idx) const {
+    if (mIsPS2File && idx < this->GetPalettesCount() && !mPalettes.empty()) {
+        return mPalettes.data() + idx * this->GetPaletteSize_PS2();
+    }
+    return mPalette.data();
+}
+
 void SH2Texture::SetCurrentPaletteIdx(const size_t idx) {
     if (mIsPS2File && idx < this->GetPalettesCount()) {
         if (idx != mPaletteIdx) {
             mPaletteIdx = idx;
 
-            const bool is4Bit = (this->GetFormat() == SH2Texture::Format::Paletted4);
-            const size_t paletteEntries = is4Bit ? 16 : 256;
-            const size_t paletteSize = paletteEntries * 4;
-            const size_t paletteBlockSize = is4Bit ? 32 : 64;
-            const size_t numPaletteBlocks = 256 / paletteBlockSize;
-            const size_t numBlocksPerPalette = paletteSize / paletteBlockSize;
-
-            if (mPalettePS2.size() == paletteSize) {
-                std::memcpy(mPalette.data(), mPalettePS2.data(), mPalettePS2.size());
-            } else {
-                const size_t bigOffset = (idx / numPaletteBlocks) * 4096;
-                const size_t smallOffset = (idx % numPaletteBlocks) * paletteBlockSize;
-
-                uint8_t* dst = mPalette.data();
-                const uint8_t* src = mPalettePS2.data() + bigOffset + smallOffset;
-                for (size_t i = 0; i < numBlocksPerPalette; ++i) {
-                    std::memcpy(dst, src, paletteBlockSize);
-                    dst += paletteBlockSize;
-                    src += 256;
-                }
-            }
-
-            FromPS2Palette(mPalette.data());
+            const size_t paletteSize = this->GetPaletteSize_PS2();
+            std::memcpy(mPalette.data(), mPalettes.data() + idx * paletteSize, paletteSize);
         }
     }
 }
 
 void SH2Texture::ImportPalette() {
-    BytesArray ps2Palette = mPalette;
-    ToPS2Palette(ps2Palette.data());
-
     const bool is4Bit = (this->GetFormat() == SH2Texture::Format::Paletted4);
     const size_t paletteEntries = is4Bit ? 16 : 256;
+
+    BytesArray ps2Palette = mPalette;
+    ToPS2Palette(ps2Palette.data(), paletteEntries);
+
     const size_t paletteSize = paletteEntries * 4;
     const size_t paletteBlockSize = is4Bit ? 32 : 64;
     const size_t numPaletteBlocks = 256 / paletteBlockSize;
@@ -401,13 +517,20 @@ void SH2Texture::ImportPalette() {
         const size_t smallOffset = (mPaletteIdx % numPaletteBlocks) * paletteBlockSize;
 
         uint8_t* dst = mPalettePS2.data() + bigOffset + smallOffset;
-        const uint8_t* src = mPalette.data();
+        const uint8_t* src = ps2Palette.data();
         for (size_t i = 0; i < numBlocksPerPalette; ++i) {
             std::memcpy(dst, src, paletteBlockSize);
             dst += 256;
             src += paletteBlockSize;
         }
     }
+
+    // read back what we've stored, PS2 alpha has a bit less precision
+    if (mPaletteIdx < this->GetPalettesCount()) {
+        uint8_t* converted = mPalettes.data() + mPaletteIdx * paletteSize;
+        this->GatherPalette_PS2(mPaletteIdx, converted);
+        std::memcpy(mPalette.data(), converted, paletteSize);
+    }
 }
 
 bool SH2Texture::IsCompressed() const {
@@ -440,7 +563,7 @@ uint32_t SH2Texture::CalculateDataSize() const {
     }
 
     if (this->IsCompressed()) {
-        return (mFormat == Format::DXT1) ? BCDEC_BC1_COMPRESSED_SIZE(width, height) : BCDEC_BC3_COMPRESSED_SIZE(width, height);
+        return scast<uint32_t>(BCGetImageSize((mFormat == Format::DXT1) ? BCFormat::BC1 : BCFormat::BC3, width, height));
     } else if (mFormat == Format::Paletted) {
         return width * height;
     } else if (mFormat == Format::Paletted4) {
@@ -461,6 +584,13 @@ void SH2Texture::Replace(const SH2Texture::Format format, const uint32_t width,
 
     const uint32_t dataSize = this->CalculateDataSize();
 
+    {
+        // old pixels are going away, no need to read them
+        std::lock_guard<std::mutex> lock(mPendingDataLock);
+        mPendingData = MemStream();
+        mHasPendingData = false;
+    }
+
     for (auto& sprHdr : mSprites) {
         sprHdr.width = width;
         sprHdr.height = height;
@@ -490,6 +620,8 @@ bool SH2Texture::Replace_PS2(const uint8_t* data, const uint8_t* palette) {
     const uint32_t width = this->GetWidth();
     const uint32_t height = this->GetHeight();
 
+    this->LoadPendingData();
+
     if (mFormat == Format::RGBX8) {
         if (palette) {
             return false;
@@ -504,6 +636,16 @@ bool SH2Texture::Replace_PS2(const uint8_t* data, const uint8_t* palette) {
         std::memcpy(mData.data(), data, width * height);
         std::memcpy(mPalette.data(), palette, mPalette.size());
 
+        this->ImportPalette();
+    } else if (mFormat == Format::Paletted4) {
+        // indices are kept one per byte, palette has 16 entries
+        if (!palette || std::any_of(data, data + width * height, [](const uint8_t idx) { return idx >= 16; })) {
+            return false;
+        }
+
+        std::memcpy(mData.data(), data, width * height);
+        std::memcpy(mPalette.data(), palette, 16 * 4);
+
         this->ImportPalette();
     } else {
         return false;
@@ -512,6 +654,35 @@ bool SH2Texture::Replace_PS2(const uint8_t* data, const uint8_t* palette) {
     return true;
 }
 
+bool SH2Texture::ReplaceAllPalettes_PS2(const uint8_t* data, const uint8_t* palettes) {
+    const bool is4Bit = (mFormat == Format::Paletted4);
+    if (!mIsPS2File || (mFormat != Format::Paletted && !is4Bit) || !palettes) {
+        return false;
+    }
+
+    const size_t numPixels = scast<size_t>(this->GetWidth()) * this->GetHeight();
+    if (is4Bit && std::any_of(data, data + numPixels, [](const uint8_t idx) { return idx >= 16; })) {
+        return false;
+    }
+
+    this->LoadPendingData();
+    std::memcpy(mData.data(), data, numPixels);
+
+    const size_t paletteSize = (is4Bit ? 16 : 256) * 4;
+    const size_t currentIdx = mPaletteIdx;
+    for (size_t i = 0, end = this->GetPalettesCount(); i < end; ++i) {
+        mPaletteIdx = i;
+        std::memcpy(mPalette.data(), palettes + i * paletteSize, paletteSize);
+        this->ImportPalette();
+    }
+
+    // back to the palette we had selected
+    mPaletteIdx = ~size_t(0);
+    this->SetCurrentPaletteIdx(currentIdx);
+
+    return true;
+}
+
 const StringArray& SH2Texture::GetErrors() const {
     return mErrors;
 }
@@ -546,22 +717,14 @@ SH2TextureContainer::~SH2TextureContainer() {
     mTextures.clear();
 }
 
-bool SH2TextureContainer::LoadFromFile(const fs::path& path) {
-    std::ifstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+bool SH2TextureContainer::LoadFromFile(const fs::path& path, const bool mapFile) {
+    MemStream stream = mapFile ? MapFileToStream(path) : ReadFileToStream(path);
+    if (!stream) {
         merror("Couldn't read file!");
         return false;
     }
 
-    file.seekg(0, std::ios_base::end);
-    const size_t fileSize = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-
-    void* data = std::malloc(fileSize);
-    file.read(rcast<char*>(data), fileSize);
-    file.close();
-
-    MemStream stream(data, fileSize, true);
+    mSourcePath = path;
     return this->LoadFromStream(stream);
 }
 
@@ -656,26 +819,32 @@ bool SH2TextureContainer::LoadFromStream_PS2(MemStream& stream) {
 }
 
 bool SH2TextureContainer::SaveToFile(const fs::path& path) {
-    MemWriteStream stream;
+    // untouched textures still point into the file we loaded from, read them before it gets overwritten
+    std::error_code ec;
+    if (!mSourcePath.empty() && fs::equivalent(path, mSourcePath, ec)) {
+        this->LoadPendingData();
+        mSourcePath.clear();
+    }
 
-    const bool ok = mIsPS2File ? this->SaveToStream_PS2(stream) : this->SaveToStream(stream);
-    if (!ok) {
+    FileWriteStream stream;
+    if (!stream.Open(path)) {
         return false;
     }
 
-    std::ofstream file(path, std::ios_base::binary);
-    if (!file.good()) {
+    if (!this->SaveToStream(stream)) {
         return false;
     }
 
-    file.write(rcast<const char*>(stream.Data()), stream.GetWrittenBytesCount());
-    file.flush();
-    file.close();
-
-    return true;
+    return stream.Close();
 }
 
-bool SH2TextureContainer::SaveToStream(MemWriteStream& stream) {
+bool SH2TextureContainer::SaveToStream(WriteStream& stream) {
+    if (mIsPS2File) {
+        return this->SaveToStream_PS2(stream);
+    }
+
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
+
     stream.Write(mHeader);
 
     for (auto texture : mTextures) {
@@ -692,7 +861,9 @@ bool SH2TextureContainer::SaveToStream(MemWriteStream& stream) {
     return true;
 }
 
-bool SH2TextureContainer::SaveToStream_PS2(MemWriteStream& stream) {
+bool SH2TextureContainer::SaveToStream_PS2(WriteStream& stream) {
+    stream.Reserve(stream.GetWrittenBytesCount() + this->CalculateStreamSize());
+
     if (mHasPS2Header) {
         stream.Write(mHeader_PS2);
     }
@@ -704,6 +875,24 @@ bool SH2TextureContainer::SaveToStream_PS2(MemWriteStream& stream) {
     }
 }
 
+size_t SH2TextureContainer::CalculateStreamSize() const {
+    if (mIsPS2File) {
+        const size_t headerSize = mHasPS2Header ? sizeof(mHeader_PS2) : 0;
+        return headerSize + (mTextures.empty() ? 0 : mTextures.front()->CalculateStreamSize());
+    }
+
+    size_t result = sizeof(mHeader);
+    for (const SH2Texture* texture : mTextures) {
+        result += texture->CalculateStreamSize();
+    }
+
+    if (mTextures.empty() || mTextures.size() > 1 || mHasTrailingHeader) {
+        result += sizeof(mTrailingHeader);
+    }
+
+    return result;
+}
+
 size_t SH2TextureContainer::GetNumTextures() const {
     return mTextures.size();
 }
@@ -731,3 +920,9 @@ const StringArray& SH2TextureContainer::GetWarnings() const {
 bool SH2TextureContainer::IsPS2File() const {
     return mIsPS2File;
 }
+
+void SH2TextureContainer::LoadPendingData() {
+    for (SH2Texture* texture : mTextures) {
+        texture->LoadPendingData();
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include "mycommon.h"
+#include <atomic>
+#include <mutex>
 
 struct SH2SpriteHeader {
     uint32_t id;
@@ -99,9 +101,11 @@ public:
     bool                        LoadFromStream_PS2(MemStream& stream);
 
     bool                        SaveToFile(const fs::path& path);
-    bool                        SaveToStream(MemWriteStream& stream);
+    bool                        SaveToStream(WriteStream& stream);
 
-    bool                        SaveToStream_PS2(MemWriteStream& stream);
+    bool                        SaveToStream_PS2(WriteStream& stream);
+    // how many bytes SaveToStream / SaveToStream_PS2 is going to write
+    size_t                      CalculateStreamSize() const;
 
     uint32_t                    GetID() const;
     uint32_t                    GetWidth() const;
@@ -110,11 +114,17 @@ public:
     const uint8_t*              GetData() const;
     const uint8_t*              GetPalette() const;
 
+    // pixel data is only referenced on load and gets read on the first GetData(),
+    // this forces it (i.e. before overwriting the file we were loaded from)
+    void                        LoadPendingData() const;
+
     // PS2 specific palette funcs
     size_t                      GetPalettesCount() const;
     size_t                      GetCurrentPaletteIdx() const;
     void                        SetCurrentPaletteIdx(const size_t idx);
     void                        ImportPalette();
+    // any of the palettes converted like GetPalette(), without switching to it (the current one on PC)
+    const uint8_t*              GetPalette(const size_t idx) const;
 
     bool                        IsCompressed() const;
     bool                        IsPremultiplied() const;
@@ -125,17 +135,29 @@ public:
 
     void                        Replace(const Format format, const uint32_t width, const uint32_t height, const uint8_t* data, const uint8_t* palette = nullptr);
     bool                        Replace_PS2(const uint8_t* data, const uint8_t* palette);
+    // paletted PS2 textures only, palettes holds all GetPalettesCount() of them one after another
+    bool                        ReplaceAllPalettes_PS2(const uint8_t* data, const uint8_t* palettes);
 
     const StringArray&          GetErrors() const;
     const StringArray&          GetWarnings() const;
 
+private:
+    void                        UnpackData_PS2() const;
+    size_t                      GetPaletteSize_PS2() const;
+    void                        GatherPalette_PS2(const size_t idx, uint8_t* dst) const;
+
 private:
     SH2TextureHeader            mHeader;
     SH2TextureHeader2           mHeader2;
     MyArray<SH2SpriteHeader>    mSprites;
     Format                      mFormat;            // cached from sprite that has data
     uint32_t                    mOriginalDataSize;  // cached from sprite that has data
-    BytesArray                  mData;
+    mutable BytesArray          mData;
+
+    // lazy loading, raw pixel bytes still sitting in the source buffer
+    mutable MemStream           mPendingData;
+    mutable std::atomic<bool>   mHasPendingData;
+    mutable std::mutex          mPendingDataLock;
     BytesArray                  mPalette;
 
     StringArray                 mErrors;
@@ -146,6 +168,7 @@ private:
     SH2SpriteHeader             mHeader_PS2;
     SH2TexturePaletteHeader_SH2 mPaletteHeader_PS2;
     BytesArray                  mPalettePS2;        // this will hold all the PS2 palette bytes
+    BytesArray                  mPalettes;          // every PS2 palette converted (BGRA), one after another
     size_t                      mPaletteIdx;        // PS2 only
 };
 
@@ -154,13 +177,14 @@ public:
     SH2TextureContainer();
     ~SH2TextureContainer();
 
-    bool                            LoadFromFile(const fs::path& path);
+    bool                            LoadFromFile(const fs::path& path, const bool mapFile = true);
     bool                            LoadFromStream(MemStream& stream);
     bool                            LoadFromStream_PS2(MemStream& stream);
 
     bool                            SaveToFile(const fs::path& path);
-    bool                            SaveToStream(MemWriteStream& stream);
-    bool                            SaveToStream_PS2(MemWriteStream& stream);
+    bool                            SaveToStream(WriteStream& stream);
+    bool                            SaveToStream_PS2(WriteStream& stream);
+    size_t                          CalculateStreamSize() const;
 
     size_t                          GetNumTextures() const;
     SH2Texture*                     GetTexture(const size_t idx);
@@ -173,8 +197,12 @@ public:
 
     bool                            IsPS2File() const;
 
+    // reads all the lazily loaded pixel data so we no longer reference the source buffer
+    void                            LoadPendingData();
+
 private:
     SH2TextureContainerHeader       mHeader;
+    fs::path                        mSourcePath;
     MyArray<SH2Texture*>            mTextures;
     StringArray                     mErrors;
     StringArray                     mWarnings;
@@ -0,0 +1,162 @@
+#include "texturedecoder.h"
+#include "sh2texture.h"
+#include "bcdecoder.h"
+#include "pixelops.h"
+#include "parallel.h"
+
+
+// below this decoding is over before the threads are up
+static const size_t kMinPixelsForBands = 512 * 512;
+// a multiple of 4, so every band starts on a block row
+static const uint32_t kBandHeight = 64;
+
+
+static BCFormat GetBCFormat(const SH2Texture::Format format) {
+    if (format == SH2Texture::Format::DXT2 || format == SH2Texture::Format::DXT3) {
+        return BCFormat::BC2;
+    } else if (format == SH2Texture::Format::DXT4 || format == SH2Texture::Format::DXT5) {
+        return BCFormat::BC3;
+    } else {
+        return BCFormat::BC1;
+    }
+}
+
+// premultiplied data only needs the channel order
+static PixelLayout GetSourceLayout(const SH2Texture* texture, const PixelLayout layout) {
+    return (texture->IsPremultiplied() && layout == PixelLayout::RGBAPremultiplied) ? PixelLayout::RGBA : layout;
+}
+
+// the palette in the output layout, so expanding the indices is a plain lookup
+static void MakePaletteLUT(const SH2Texture* texture, const size_t paletteIdx, const PixelLayout layout, uint32_t* lut) {
+    const size_t numEntries = (texture->GetFormat() == SH2Texture::Format::Paletted4) ? 16 : 256;
+    PixelsFromBGRA(texture->GetPalette(paletteIdx), rcast<uint8_t*>(lut), numEntries, layout);
+    std::fill(lut + numEntries, lut + 256, 0u);
+}
+
+// decodes rows [y, y + numRows) of the texture, y is a multiple of 4
+static void DecompressRows(const SH2Texture* texture, const uint32_t* lut, const PixelLayout layout, const uint32_t y, const uint32_t numRows, uint8_t* output) {
+    const SH2Texture::Format format = texture->GetFormat();
+    const uint32_t width = texture->GetWidth();
+    const uint8_t* data = texture->GetData();
+    uint8_t* dst = output + scast<size_t>(y) * width * 4;
+
+    if (texture->IsCompressed()) {
+        const BCFormat bcFormat = GetBCFormat(format);
+        const size_t blockRowSize = ((width + 3) / 4) * BCGetBlockSize(bcFormat);
+        BCDecodeImage(bcFormat, data + (y / 4) * blockRowSize, width, numRows, dst, GetSourceLayout(texture, layout));
+    } else if (lut) {
+        const size_t numColors = (format == SH2Texture::Format::Paletted4) ? 16 : 256;
+        PixelsFromIndices(data + scast<size_t>(y) * width, lut, numColors, dst, scast<size_t>(width) * numRows);
+    } else {
+        // RGBX8 and RGBA8 are BGRA
+        PixelsFromBGRA(data + scast<size_t>(y) * width * 4, dst, scast<size_t>(width) * numRows, layout);
+    }
+}
+
+void DecompressTexture(const SH2Texture* texture, BytesArray& output, const PixelLayout layout, const size_t numThreads) {
+    const SH2Texture::Format format = texture->GetFormat();
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+
+    uint32_t lut[256];
+    const bool isPaletted = !texture->IsCompressed() && (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4);
+    if (isPaletted) {
+        MakePaletteLUT(texture, texture->GetCurrentPaletteIdx(), layout, lut);
+    }
+
+    // big textures are split into bands of block rows, they all write to their own part of output
+    const size_t numBands = (height + kBandHeight - 1) / kBandHeight;
+    if (numThreads == 1 || numBands < 2 || scast<size_t>(width) * height < kMinPixelsForBands) {
+        DecompressRows(texture, isPaletted ? lut : nullptr, layout, 0, height, output.data());
+    } else {
+        ParallelFor(numBands, [&](const size_t band) {
+            const uint32_t y = scast<uint32_t>(band) * kBandHeight;
+            DecompressRows(texture, isPaletted ? lut : nullptr, layout, y, std::min(kBandHeight, height - y), output.data());
+        }, numThreads);
+    }
+}
+
+void DecompressPalettedTexture(const SH2Texture* texture, const size_t paletteIdx, uint8_t* output, const PixelLayout layout) {
+    uint32_t lut[256];
+    MakePaletteLUT(texture, paletteIdx, layout, lut);
+    DecompressRows(texture, lut, layout, 0, texture->GetHeight(), output);
+}
+
+template <PixelLayout L>
+static void DecodeTextureThumbnail_T(const SH2Texture* texture, const size_t paletteIdx, uint8_t* output, const uint32_t thumbWidth, const uint32_t thumbHeight) {
+    const SH2Texture::Format format = texture->GetFormat();
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+    const uint8_t* data = texture->GetData();
+    uint32_t* dst = rcast<uint32_t*>(output);
+
+    // source texel at the center of every thumbnail pixel's footprint
+    MyArray<uint32_t> srcX(thumbWidth), srcY(thumbHeight);
+    for (uint32_t x = 0; x < thumbWidth; ++x) {
+        srcX[x] = scast<uint32_t>((uint64_t(x) * 2 + 1) * width / (uint64_t(thumbWidth) * 2));
+    }
+    for (uint32_t y = 0; y < thumbHeight; ++y) {
+        srcY[y] = scast<uint32_t>((uint64_t(y) * 2 + 1) * height / (uint64_t(thumbHeight) * 2));
+    }
+
+    if (texture->IsCompressed()) {
+        const BCFormat bcFormat = GetBCFormat(format);
+        const size_t blockSize = BCGetBlockSize(bcFormat);
+        const size_t blocksX = (width + 3) / 4;
+
+        if (width >= thumbWidth * 4 && height >= thumbHeight * 4) {
+            // every thumbnail pixel covers at least a whole block, the average of the block under its center will do
+            for (uint32_t y = 0; y < thumbHeight; ++y) {
+                const uint8_t* blockRow = data + (srcY[y] / 4) * blocksX * blockSize;
+                for (uint32_t x = 0; x < thumbWidth; ++x, ++dst) {
+                    *dst = FromRGBAOp<L>::Scalar(BCAverageBlock(bcFormat, blockRow + (srcX[x] / 4) * blockSize));
+                }
+            }
+        } else {
+            // only decode the block rows the thumbnail rows land in
+            BytesArray decoded(scast<size_t>(width) * 4 * 4);
+            size_t decodedBlockRow = ~size_t(0);
+            for (uint32_t y = 0; y < thumbHeight; ++y) {
+                const size_t by = srcY[y] / 4;
+                if (by != decodedBlockRow) {
+                    BCDecodeImage(bcFormat, data + by * blocksX * blockSize, width, std::min<uint32_t>(4, height - scast<uint32_t>(by) * 4), decoded.data(), L);
+                    decodedBlockRow = by;
+                }
+
+                const uint32_t* row = rcast<const uint32_t*>(decoded.data()) + (srcY[y] % 4) * width;
+                for (uint32_t x = 0; x < thumbWidth; ++x, ++dst) {
+                    *dst = row[srcX[x]];
+                }
+            }
+        }
+    } else if (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4) {
+        uint32_t lut[256];
+        MakePaletteLUT(texture, paletteIdx, L, lut);
+        for (uint32_t y = 0; y < thumbHeight; ++y) {
+            const uint8_t* indices = data + scast<size_t>(srcY[y]) * width;
+            for (uint32_t x = 0; x < thumbWidth; ++x, ++dst) {
+                *dst = lut[indices[srcX[x]]];
+            }
+        }
+    } else /* RGBX8 and RGBA8 */ {
+        for (uint32_t y = 0; y < thumbHeight; ++y) {
+            const uint8_t* row = data + scast<size_t>(srcY[y]) * width * 4;
+            for (uint32_t x = 0; x < thumbWidth; ++x, ++dst) {
+                uint32_t color;
+                std::memcpy(&color, row + srcX[x] * 4, sizeof(color));
+                *dst = FromBGRAOp<L>::Scalar(color);
+            }
+        }
+    }
+}
+
+void DecodeTextureThumbnail(const SH2Texture* texture, const size_t paletteIdx, uint8_t* output, const uint32_t thumbWidth, const uint32_t thumbHeight, const PixelLayout layout) {
+    const PixelLayout sourceLayout = GetSourceLayout(texture, layout);
+    if (sourceLayout == PixelLayout::BGRA) {
+        DecodeTextureThumbnail_T<PixelLayout::BGRA>(texture, paletteIdx, output, thumbWidth, thumbHeight);
+    } else if (sourceLayout == PixelLayout::RGBAPremultiplied) {
+        DecodeTextureThumbnail_T<PixelLayout::RGBAPremultiplied>(texture, paletteIdx, output, thumbWidth, thumbHeight);
+    } else {
+        DecodeTextureThumbnail_T<PixelLayout::RGBA>(texture, paletteIdx, output, thumbWidth, thumbHeight);
+    }
+}
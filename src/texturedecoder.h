@@ -0,0 +1,24 @@
+#pragma once
+#include "mycommon.h"
+#include "pixelconvert.h" // PixelLayout
+
+class SH2Texture;
+
+// Decodes any supported SH2 texture into 32bpp pixels of the given layout, in one pass over the data.
+// output must be able to hold width * height * 4 bytes.
+// DXT2/DXT4 colors are premultiplied already, RGBA and BGRA leave them that way.
+// Textures of 512x512 and up are decoded in bands of block rows on numThreads threads (0 means all cores),
+// callers that already spread whole textures over threads keep the default.
+void    DecompressTexture(const SH2Texture* texture, BytesArray& output, const PixelLayout layout, const size_t numThreads = 1);
+
+// Expands a paletted texture with any of its palettes (PS2 textures can have several) without making it the
+// current one. The palette is converted to the output layout once, the pixels are a plain table lookup.
+// output must be able to hold width * height * 4 bytes.
+void    DecompressPalettedTexture(const SH2Texture* texture, const size_t paletteIdx, uint8_t* output, const PixelLayout layout);
+
+// Decodes a thumbWidth x thumbHeight thumbnail straight from the texture data, so the cost
+// follows the thumbnail size rather than the texture size. Compressed textures shrunk by 4 or more
+// average one block per thumbnail pixel, everything else is point sampled.
+// Paletted textures are shown with paletteIdx, which doesn't have to be the current one, so a palette switch
+// on another thread doesn't get in the way. output must be able to hold thumbWidth * thumbHeight * 4 bytes.
+void    DecodeTextureThumbnail(const SH2Texture* texture, const size_t paletteIdx, uint8_t* output, const uint32_t thumbWidth, const uint32_t thumbHeight, const PixelLayout layout);
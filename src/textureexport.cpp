@@ -0,0 +1,175 @@
+#include "textureexport.h"
+#include "texturedecoder.h"
+#include "sh2texture.h"
+#include "ddstexture.h"
+#include "pngfile.h"
+#include "pixelconvert.h"
+#include "sh2file.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <chrono>
+
+
+static bool IsPalettedTexture(const SH2Texture* texture) {
+    const SH2Texture::Format texFormat = texture->GetFormat();
+    return texFormat == SH2Texture::Format::Paletted || (texture->IsPS2File() && texFormat == SH2Texture::Format::Paletted4);
+}
+
+bool ExportTextureToDDS(const SH2Texture* texture, const fs::path& path) {
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+    const SH2Texture::Format texFormat = texture->GetFormat();
+
+    DDSTexture dds;
+    dds.SetWidth(width);
+    dds.SetHeight(height);
+
+    if (texFormat == SH2Texture::Format::RGBA8 || texFormat == SH2Texture::Format::RGBX8) {
+        dds.SetFormat(32);
+        const size_t dataSize = width * height * 4;
+        dds.SetData(texture->GetData(), dataSize);
+    } else if (IsPalettedTexture(texture)) {
+        BytesArray unpaletted(width * height * 4);
+        DecompressTexture(texture, unpaletted, PixelLayout::BGRA);
+        dds.SetData(unpaletted.data(), unpaletted.size());
+        dds.SetFormat(32);
+    } else {
+        switch (texFormat) {
+            case SH2Texture::Format::DXT1:
+                dds.SetFormat(DDS_FOURCC_DXT1);
+            break;
+            case SH2Texture::Format::DXT2:
+                dds.SetFormat(DDS_FOURCC_DXT2);
+            break;
+            case SH2Texture::Format::DXT3:
+                dds.SetFormat(DDS_FOURCC_DXT3);
+            break;
+            case SH2Texture::Format::DXT4:
+                dds.SetFormat(DDS_FOURCC_DXT4);
+            break;
+            case SH2Texture::Format::DXT5:
+                dds.SetFormat(DDS_FOURCC_DXT5);
+            break;
+            default:
+                return false;
+        }
+
+        dds.SetData(texture->GetData(), texture->CalculateDataSize());
+    }
+
+    return dds.SaveToFile(path);
+}
+
+bool ExportTextureToPNG(const SH2Texture* texture, const fs::path& path) {
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+
+    if (IsPalettedTexture(texture)) {
+        // SH2 palettes are BGRA
+        const uint8_t* palette = texture->GetPalette();
+        uint8_t pngPalette[256 * 4];
+        PixelsSwapRedBlue(palette, pngPalette, 256);
+        return SavePNG(path, texture->GetData(), width, height, pngPalette);
+    } else {
+        BytesArray decompressed(width * height * 4);
+        DecompressTexture(texture, decompressed, PixelLayout::RGBA);
+        return SavePNG(path, decompressed.data(), width, height);
+    }
+}
+
+// shared by all the texture tasks of one file, the last one to finish reports it
+struct BatchExportFile {
+    BatchExportJob                          job;
+    SH2File                                 file;
+    std::chrono::steady_clock::time_point   startTime;
+    std::atomic<size_t>                     numRemaining{ 0 };
+    std::atomic<size_t>                     numFailed{ 0 };
+    std::atomic<uint64_t>                   bytesWritten{ 0 };
+};
+
+static void ReportBatchExportFile(const BatchExportFile& file, const bool loaded, const BatchExportCallback& onFileDone) {
+    if (!onFileDone) {
+        return;
+    }
+
+    BatchExportFileStats stats = {};
+    stats.source = file.job.source;
+    stats.loaded = loaded;
+    stats.numTextures = loaded ? file.file.container->GetNumTextures() : 0;
+    stats.numFailed = file.numFailed;
+    stats.bytesWritten = file.bytesWritten;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file.startTime).count();
+    onFileDone(stats);
+}
+
+size_t ExportTexturesBatch(const MyArray<BatchExportJob>& jobs, const bool asPNG, const size_t numThreads, const BatchExportCallback& onFileDone) {
+    // start with the biggest files, so they don't end up being the tail everybody waits for
+    MyArray<std::pair<uintmax_t, size_t>> order;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        std::error_code ec;
+        const uintmax_t fileSize = fs::file_size(jobs[i].source, ec);
+        order.emplace_back(ec ? 0 : fileSize, i);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+
+    std::atomic<size_t> numFailed{ 0 };
+    TaskPool pool(numThreads);
+
+    for (const auto& item : order) {
+        const BatchExportJob& job = jobs[item.second];
+
+        pool.Spawn([&pool, &job, &numFailed, asPNG, &onFileDone]() {
+            RefPtr<BatchExportFile> file = MakeRefPtr<BatchExportFile>();
+            file->job = job;
+            file->startTime = std::chrono::steady_clock::now();
+
+            if (!file->file.Load(job.source)) {
+                ++numFailed;
+                ReportBatchExportFile(*file, false, onFileDone);
+                return;
+            }
+
+            const size_t numTextures = file->file.container->GetNumTextures();
+            if (!numTextures) {
+                ReportBatchExportFile(*file, true, onFileDone);
+                return;
+            }
+
+            std::error_code ec;
+            fs::create_directories(job.outputFolder, ec);
+
+            // textures go to our own queue, idle workers will steal them
+            file->numRemaining = numTextures;
+            for (size_t i = 0; i < numTextures; ++i) {
+                pool.Spawn([file, i, &numFailed, asPNG, &onFileDone]() {
+                    fs::path finalPath = file->job.outputFolder / file->job.source.stem();
+                    finalPath += "_";
+                    finalPath += std::to_string(i);
+                    finalPath += asPNG ? ".png" : ".dds";
+
+                    const SH2Texture* texture = file->file.container->GetTexture(i);
+                    const bool ok = asPNG ? ExportTextureToPNG(texture, finalPath) : ExportTextureToDDS(texture, finalPath);
+                    if (ok) {
+                        std::error_code ec;
+                        const uintmax_t written = fs::file_size(finalPath, ec);
+                        file->bytesWritten += ec ? 0 : written;
+                    } else {
+                        ++file->numFailed;
+                        ++numFailed;
+                    }
+
+                    if (--file->numRemaining == 0) {
+                        ReportBatchExportFile(*file, true, onFileDone);
+                    }
+                });
+            }
+        });
+    }
+
+    pool.Run();
+
+    return numFailed;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "mycommon.h"
+
+class SH2Texture;
+
+// Qt-free export paths shared by the GUI and the command line tool
+bool    ExportTextureToDDS(const SH2Texture* texture, const fs::path& path);
+bool    ExportTextureToPNG(const SH2Texture* texture, const fs::path& path);
+
+struct BatchExportJob {
+    fs::path    source;         // any supported file
+    fs::path    outputFolder;   // textures go there as <source stem>_<index>.dds|png
+};
+
+struct BatchExportFileStats {
+    fs::path    source;
+    bool        loaded;
+    size_t      numTextures;
+    size_t      numFailed;
+    uint64_t    bytesWritten;
+    double      seconds;        // from loading the file till its last texture is written
+};
+
+using BatchExportCallback = std::function<void(const BatchExportFileStats&)>;
+
+// Exports all textures of all the files, every file and then every texture in it is a separate
+// task on a work-stealing pool, so a huge map gets spread over the cores just like a pile of
+// tiny textures does. onFileDone is called from the worker threads, once per file.
+// Returns the number of failures (files that didn't load plus textures that failed to export).
+size_t  ExportTexturesBatch(const MyArray<BatchExportJob>& jobs, const bool asPNG, const size_t numThreads, const BatchExportCallback& onFileDone);
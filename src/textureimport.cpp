@@ -0,0 +1,352 @@
+#include "textureimport.h"
+#include "sh2texture.h"
+#include "ddstexture.h"
+#include "bcencoder.h"
+#include "palettequantizer.h"
+#include "pixelconvert.h"
+#include "pngfile.h"
+#include "sh2file.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+
+// pixels come out in the palette's channel order
+static void ExpandPaletted(const PNGImage& image, BytesArray& pixels) {
+    const size_t numPixels = scast<size_t>(image.width) * image.height;
+    pixels.resize(numPixels * 4);
+    for (size_t i = 0; i < numPixels; ++i) {
+        std::memcpy(pixels.data() + i * 4, image.palette.data() + image.pixels[i] * 4, 4);
+    }
+}
+
+static bool ImportDDS(SH2Texture* texture, const fs::path& imagePath, CharString& error) {
+    DDSTexture dds;
+    if (!dds.LoadFromFile(imagePath)) {
+        error = "failed to load DDS texture";
+        return false;
+    }
+
+    const uint32_t ddsFormat = dds.GetFormat();
+
+    if (texture->IsPS2File()) {
+        // PS2 textures can only be replaced in-place, with the same dimensions and 32bit data
+        if (ddsFormat != 32 || dds.GetWidth() != texture->GetWidth() || dds.GetHeight() != texture->GetHeight() ||
+            !texture->Replace_PS2(dds.GetData(), nullptr)) {
+            error = "non-compatible image for the PS2 texture";
+            return false;
+        }
+        return true;
+    }
+
+    SH2Texture::Format sh2Format;
+    if (ddsFormat == DDS_FOURCC_DXT1) {
+        sh2Format = SH2Texture::Format::DXT1;
+    } else if (ddsFormat == DDS_FOURCC_DXT2) {
+        sh2Format = SH2Texture::Format::DXT2;
+    } else if (ddsFormat == DDS_FOURCC_DXT3) {
+        sh2Format = SH2Texture::Format::DXT3;
+    } else if (ddsFormat == DDS_FOURCC_DXT4) {
+        sh2Format = SH2Texture::Format::DXT4;
+    } else if (ddsFormat == DDS_FOURCC_DXT5) {
+        sh2Format = SH2Texture::Format::DXT5;
+    } else {
+        sh2Format = SH2Texture::Format::RGBA8;
+    }
+
+    texture->Replace(sh2Format, dds.GetWidth(), dds.GetHeight(), dds.GetData());
+    return true;
+}
+
+// DXT textures keep their format (and memory budget), the pixels get compressed here
+static void ImportPNG_Compressed(SH2Texture* texture, const PNGImage& image, const TextureImportOptions& options) {
+    const SH2Texture::Format texFormat = texture->GetFormat();
+    const BCFormat bcFormat = (texFormat == SH2Texture::Format::DXT1) ? BCFormat::BC1 :
+                              ((texFormat == SH2Texture::Format::DXT2 || texFormat == SH2Texture::Format::DXT3) ? BCFormat::BC2 : BCFormat::BC3);
+
+    BytesArray rgba;
+    const uint8_t* pixels = image.pixels.data();
+    if (image.isPaletted) {
+        ExpandPaletted(image, rgba);
+        pixels = rgba.data();
+    }
+
+    BytesArray blocks(BCGetImageSize(bcFormat, image.width, image.height));
+    BCEncodeImage(bcFormat, pixels, image.width, image.height, blocks.data(), options.quality, options.numThreads);
+
+    texture->Replace(texFormat, image.width, image.height, blocks.data());
+}
+
+// paletted images whose indices fit go in as they are, everything else gets quantized to numColors
+static bool MakePaletted(PNGImage& image, const size_t numColors, const TextureImportOptions& options) {
+    const size_t numPixels = scast<size_t>(image.width) * image.height;
+    if (image.isPaletted && std::all_of(image.pixels.begin(), image.pixels.end(), [numColors](const uint8_t idx) { return idx < numColors; })) {
+        return true;
+    }
+
+    BytesArray pixels;
+    if (image.isPaletted) {
+        ExpandPaletted(image, pixels);
+    } else {
+        pixels.swap(image.pixels);
+    }
+
+    image.pixels.resize(numPixels);
+    image.palette.assign(256 * 4, 0);
+    if (!QuantizeImage(pixels.data(), image.width, image.height, numColors, options.dither, image.pixels.data(), image.palette.data(), options.numThreads)) {
+        return false;
+    }
+    image.isPaletted = true;
+    return true;
+}
+
+static bool ImportPNG(SH2Texture* texture, const fs::path& imagePath, const TextureImportOptions& options, CharString& error) {
+    PNGImage image;
+    if (!LoadPNG(imagePath, image)) {
+        error = "failed to load PNG image";
+        return false;
+    }
+
+    // BCn blocks are RGBA, so this goes before the swap
+    if (texture->IsCompressed()) {
+        ImportPNG_Compressed(texture, image, options);
+        return true;
+    }
+
+    const SH2Texture::Format texFormat = texture->GetFormat();
+    const bool isPS2 = texture->IsPS2File();
+    const size_t numColors = (texFormat == SH2Texture::Format::Paletted) ? 256 : ((isPS2 && texFormat == SH2Texture::Format::Paletted4) ? 16 : 0);
+
+    if (isPS2 && (image.width != texture->GetWidth() || image.height != texture->GetHeight())) {
+        error = "image dimensions are non-compatible";
+        return false;
+    }
+
+    // PNG is RGBA, SH2 textures and palettes are BGRA
+    if (image.isPaletted) {
+        PixelsSwapRedBlue(image.palette.data(), image.palette.data(), 256);
+    } else {
+        PixelsSwapRedBlue(image.pixels.data(), image.pixels.data(), scast<size_t>(image.width) * image.height);
+    }
+
+    if (numColors) {
+        if (!MakePaletted(image, numColors, options)) {
+            error = "failed to quantize the image";
+            return false;
+        }
+        if (isPS2) {
+            if (!texture->Replace_PS2(image.pixels.data(), image.palette.data())) {
+                error = "non-compatible image for the PS2 texture";
+                return false;
+            }
+        } else {
+            texture->Replace(SH2Texture::Format::Paletted, image.width, image.height, image.pixels.data(), image.palette.data());
+        }
+        return true;
+    }
+
+    BytesArray expanded;
+    const uint8_t* bgra = image.pixels.data();
+    if (image.isPaletted) {
+        ExpandPaletted(image, expanded);
+        bgra = expanded.data();
+    }
+
+    if (isPS2) {
+        if (!texture->Replace_PS2(bgra, nullptr)) {
+            error = "non-compatible image for the PS2 texture";
+            return false;
+        }
+    } else {
+        texture->Replace(SH2Texture::Format::RGBA8, image.width, image.height, bgra);
+    }
+
+    return true;
+}
+
+bool ImportTextureFromFile(SH2Texture* texture, const fs::path& imagePath, const TextureImportOptions& options, CharString& error) {
+    const WideString ext = imagePath.extension().wstring();
+    if (WStrEqualsCaseInsensitive(ext, L".dds")) {
+        return ImportDDS(texture, imagePath, error);
+    } else if (WStrEqualsCaseInsensitive(ext, L".png")) {
+        return ImportPNG(texture, imagePath, options, error);
+    } else {
+        error = "unsupported image format";
+        return false;
+    }
+}
+
+bool ImportTextureFromFiles(SH2Texture* texture, const MyArray<fs::path>& imagePaths, const TextureImportOptions& options, CharString& error) {
+    if (imagePaths.empty()) {
+        error = "no images";
+        return false;
+    } else if (imagePaths.size() == 1) {
+        return ImportTextureFromFile(texture, imagePaths.front(), options, error);
+    }
+
+    const SH2Texture::Format texFormat = texture->GetFormat();
+    const size_t numColors = (texFormat == SH2Texture::Format::Paletted) ? 256 : ((texFormat == SH2Texture::Format::Paletted4) ? 16 : 0);
+    if (!texture->IsPS2File() || !numColors) {
+        error = "only paletted PS2 textures take an image per palette";
+        return false;
+    }
+    if (imagePaths.size() != texture->GetPalettesCount()) {
+        error = "expected " + std::to_string(texture->GetPalettesCount()) + " images, one per palette";
+        return false;
+    }
+
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+    const size_t numPixels = scast<size_t>(width) * height;
+
+    MyArray<BytesArray> images(imagePaths.size());
+    MyArray<const uint8_t*> imagePtrs(imagePaths.size());
+    for (size_t i = 0; i < imagePaths.size(); ++i) {
+        PNGImage image;
+        if (!WStrEqualsCaseInsensitive(imagePaths[i].extension().wstring(), L".png") || !LoadPNG(imagePaths[i], image)) {
+            error = imagePaths[i].u8string() + ": failed to load PNG image";
+            return false;
+        }
+        if (image.width != width || image.height != height) {
+            error = imagePaths[i].u8string() + ": image dimensions are non-compatible";
+            return false;
+        }
+
+        if (image.isPaletted) {
+            ExpandPaletted(image, images[i]);
+        } else {
+            images[i].swap(image.pixels);
+        }
+        PixelsSwapRedBlue(images[i].data(), images[i].data(), numPixels);
+        imagePtrs[i] = images[i].data();
+    }
+
+    BytesArray indices(numPixels);
+    BytesArray palettes(imagePaths.size() * numColors * 4);
+    if (!QuantizeImages(imagePtrs.data(), imagePtrs.size(), width, height, numColors, indices.data(), palettes.data(), options.numThreads)) {
+        error = "failed to quantize the images";
+        return false;
+    }
+
+    if (!texture->ReplaceAllPalettes_PS2(indices.data(), palettes.data())) {
+        error = "non-compatible images for the PS2 texture";
+        return false;
+    }
+
+    return true;
+}
+
+
+// shared by all the replacement tasks of one file, the last one to finish saves it
+struct BatchImportFile {
+    BatchImportJob                          job;
+    SH2File                                 file;
+    std::chrono::steady_clock::time_point   startTime;
+    std::atomic<size_t>                     numRemaining{ 0 };
+    std::atomic<size_t>                     numReplaced{ 0 };
+    std::mutex                              errorsLock;
+    StringArray                             errors;
+};
+
+static void FinishBatchImportFile(BatchImportFile& file, const bool loaded, std::atomic<size_t>& numFailed, const BatchImportCallback& onFileDone) {
+    BatchImportFileStats stats = {};
+    stats.source = file.job.source;
+    stats.output = file.job.output;
+    stats.loaded = loaded;
+    stats.numReplaced = file.numReplaced;
+
+    // half-applied packs are worse than none, so only save when everything went in
+    if (loaded && file.errors.empty()) {
+        std::error_code ec;
+        if (file.job.output.has_parent_path()) {
+            fs::create_directories(file.job.output.parent_path(), ec);
+        }
+
+        stats.saved = file.file.Save(file.job.output);
+        if (!stats.saved) {
+            file.errors.push_back("failed to save");
+            ++numFailed;
+        }
+    }
+
+    stats.errors = file.errors;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file.startTime).count();
+    if (onFileDone) {
+        onFileDone(stats);
+    }
+}
+
+size_t ImportTexturesBatch(const MyArray<BatchImportJob>& jobs, const TextureImportOptions& options, const size_t numThreads, const BatchImportCallback& onFileDone) {
+    std::atomic<size_t> numFailed{ 0 };
+    TaskPool pool(numThreads);
+
+    // compressing and quantizing run their ParallelFor on this pool too,
+    // so a lone big image gets every worker and many small ones don't oversubscribe
+    for (const BatchImportJob& job : jobs) {
+        pool.Spawn([&pool, &job, &numFailed, &onFileDone, &options]() {
+            RefPtr<BatchImportFile> file = MakeRefPtr<BatchImportFile>();
+            file->job = job;
+            file->startTime = std::chrono::steady_clock::now();
+
+            if (!file->file.Load(job.source)) {
+                file->errors.push_back("failed to load");
+                ++numFailed;
+                FinishBatchImportFile(*file, false, numFailed, onFileDone);
+                return;
+            }
+
+            // the same texture twice would race, the last mention wins
+            MyArray<BatchImportReplacement>& replacements = file->job.replacements;
+            std::stable_sort(replacements.begin(), replacements.end(), [](const auto& a, const auto& b) {
+                return a.textureIdx < b.textureIdx;
+            });
+            for (size_t i = 1; i < replacements.size(); ) {
+                if (replacements[i - 1].textureIdx == replacements[i].textureIdx) {
+                    replacements.erase(replacements.begin() + (i - 1));
+                } else {
+                    ++i;
+                }
+            }
+
+            if (replacements.empty()) {
+                FinishBatchImportFile(*file, true, numFailed, onFileDone);
+                return;
+            }
+
+            // images are decoded on our own queue, idle workers will steal them
+            file->numRemaining = replacements.size();
+            for (size_t i = 0; i < replacements.size(); ++i) {
+                pool.Spawn([file, i, &numFailed, &onFileDone, &options]() {
+                    const BatchImportReplacement& replacement = file->job.replacements[i];
+
+                    CharString error;
+                    bool ok = false;
+                    if (replacement.textureIdx < file->file.container->GetNumTextures()) {
+                        ok = ImportTextureFromFiles(file->file.container->GetTexture(replacement.textureIdx), replacement.images, options, error);
+                    } else {
+                        error = "texture index is out of range";
+                    }
+
+                    if (ok) {
+                        ++file->numReplaced;
+                    } else {
+                        std::lock_guard<std::mutex> lock(file->errorsLock);
+                        const CharString imageName = replacement.images.empty() ? CharString("texture " + std::to_string(replacement.textureIdx)) : replacement.images.front().u8string();
+                        file->errors.push_back(imageName + ": " + error);
+                        ++numFailed;
+                    }
+
+                    if (--file->numRemaining == 0) {
+                        FinishBatchImportFile(*file, true, numFailed, onFileDone);
+                    }
+                });
+            }
+        });
+    }
+
+    pool.Run();
+
+    return numFailed;
+}
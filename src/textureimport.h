@@ -0,0 +1,50 @@
+#pragma once
+#include "mycommon.h"
+#include "bcencoder.h"
+
+class SH2Texture;
+
+struct TextureImportOptions {
+    BCEncodeQuality quality = BCEncodeQuality::High;   // PNG images into DXTn textures
+    bool            dither = false;                     // true color images into paletted textures
+    size_t          numThreads = 0;                     // per image, 0 means all cores (all pool workers in a batch)
+};
+
+// Qt-free import paths shared by the command line tool and batch tools.
+// DDS images keep their format on PC (DXTn or 32bit). PNG images keep the texture's format: they get compressed
+// to its DXTn format, or quantized to 256 colors (16 for PS2 4bit) for paletted textures unless they're already
+// paletted with indices that fit, everything else becomes 32bit. PS2 textures can only be replaced in place,
+// the image must have the same dimensions.
+bool    ImportTextureFromFile(SH2Texture* texture, const fs::path& imagePath, const TextureImportOptions& options, CharString& error);
+// Paletted PS2 textures with more than one palette: one PNG per palette, all the same size, get quantized together
+// into a shared index map and a palette for each of them. A single image is the same as ImportTextureFromFile.
+bool    ImportTextureFromFiles(SH2Texture* texture, const MyArray<fs::path>& imagePaths, const TextureImportOptions& options, CharString& error);
+
+struct BatchImportReplacement {
+    size_t              textureIdx;
+    MyArray<fs::path>   images;     // .dds or .png, or one .png per palette
+};
+
+struct BatchImportJob {
+    fs::path                        source;     // any supported file
+    fs::path                        output;     // can be the same as source
+    MyArray<BatchImportReplacement> replacements;
+};
+
+struct BatchImportFileStats {
+    fs::path    source;
+    fs::path    output;
+    bool        loaded;
+    bool        saved;
+    size_t      numReplaced;
+    StringArray errors;
+    double      seconds;    // from loading the file till it's saved
+};
+
+using BatchImportCallback = std::function<void(const BatchImportFileStats&)>;
+
+// Applies all the replacements and saves the files, every file and then every replacement in it is a
+// separate task on a work-stealing pool, so image decoding of one big pack spreads over all the cores.
+// A file is saved only if all its replacements succeeded. onFileDone is called from the worker threads.
+// Returns the number of failures (files that didn't load or save plus failed replacements).
+size_t  ImportTexturesBatch(const MyArray<BatchImportJob>& jobs, const TextureImportOptions& options, const size_t numThreads, const BatchImportCallback& onFileDone);
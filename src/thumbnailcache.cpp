@@ -0,0 +1,295 @@
+#include "thumbnailcache.h"
+#include "sh2texture.h"
+#include "mappedfile.h"
+#include "filewritestream.h"
+
+#include <cstdio>
+
+
+static const uint32_t kThumbnailCacheMagic = 0x43543253;  // 'S2TC'
+static const uint32_t kThumbnailCacheVersion = 2;    // 2 - pixels are premultiplied RGBA
+static const wchar_t* kThumbnailCacheExtension = L".sh2thumbs";
+
+struct ThumbnailCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t  sourceTime;
+    uint32_t thumbWidth;
+    uint32_t thumbHeight;
+    uint32_t numThumbnails;
+    uint32_t pathLength;        // utf8 source path follows the header
+};
+static_assert(sizeof(ThumbnailCacheHeader) == 40);
+
+
+// 4 independent multiply-xor lanes, so the multiplies can overlap
+static uint64_t HashBytes(const uint8_t* data, const size_t size, const uint64_t seed) {
+    const uint64_t kMul = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = { seed, seed ^ 0x632BE59BD9B4E019ull, seed ^ 0x8CB92BA72F3D8DD7ull, seed ^ 0xB492B66FBE98F273ull };
+
+    auto mix = [kMul](uint64_t h, uint64_t v) {
+        v *= kMul;
+        v ^= v >> 29;
+        return (h ^ v) * kMul;
+    };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (size_t j = 0; j < 4; ++j) {
+            uint64_t v;
+            std::memcpy(&v, data + i + j * 8, sizeof(v));
+            lanes[j] = mix(lanes[j], v);
+        }
+    }
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, data + i, sizeof(v));
+        lanes[0] = mix(lanes[0], v);
+    }
+    if (i < size) {
+        uint64_t v = 0;
+        std::memcpy(&v, data + i, size - i);
+        lanes[1] = mix(lanes[1], v);
+    }
+
+    uint64_t hash = mix(mix(mix(mix(size, lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static bool GetSourceStamp(const fs::path& sourceFile, uint64_t& size, int64_t& time) {
+    std::error_code ec;
+    size = fs::file_size(sourceFile, ec);
+    if (ec) {
+        return false;
+    }
+
+    const fs::file_time_type fileTime = fs::last_write_time(sourceFile, ec);
+    if (ec) {
+        return false;
+    }
+
+    time = scast<int64_t>(fileTime.time_since_epoch().count());
+    return true;
+}
+
+
+const BytesArray* CachedThumbnails::FindByHash(const uint64_t hash) const {
+    for (size_t i = 0, end = std::min(hashes.size(), pixels.size()); i < end; ++i) {
+        if (hashes[i] == hash && !pixels[i].empty()) {
+            return &pixels[i];
+        }
+    }
+    return nullptr;
+}
+
+
+ThumbnailCache::ThumbnailCache()
+    : mThumbWidth(0)
+    , mThumbHeight(0)
+    , mMaxSize(0)
+{
+}
+ThumbnailCache::~ThumbnailCache() {
+}
+
+bool ThumbnailCache::Open(const fs::path& folder, const uint32_t thumbWidth, const uint32_t thumbHeight, const uint64_t maxSizeInBytes) {
+    std::error_code ec;
+    fs::create_directories(folder, ec);
+    if (!fs::is_directory(folder, ec)) {
+        return false;
+    }
+
+    mFolder = folder;
+    mThumbWidth = thumbWidth;
+    mThumbHeight = thumbHeight;
+    mMaxSize = maxSizeInBytes;
+    return true;
+}
+
+bool ThumbnailCache::IsOpen() const {
+    return !mFolder.empty();
+}
+
+bool ThumbnailCache::Load(const fs::path& sourceFile, CachedThumbnails& thumbnails) const {
+    if (!this->IsOpen()) {
+        return false;
+    }
+
+    const fs::path cachePath = this->GetCacheFilePath(sourceFile);
+    MemStream stream = MapFileToStream(cachePath);
+    if (!stream) {
+        return false;
+    }
+
+    ThumbnailCacheHeader hdr;
+    if (!stream.ReadToBuffer(&hdr, sizeof(hdr)) || hdr.magic != kThumbnailCacheMagic || hdr.version != kThumbnailCacheVersion ||
+        hdr.thumbWidth != mThumbWidth || hdr.thumbHeight != mThumbHeight) {
+        return false;
+    }
+
+    // two paths can share the name hash, make sure it's really ours
+    const CharString sourcePath = fs::absolute(sourceFile).u8string();
+    if (hdr.pathLength != sourcePath.size() || stream.Remains() < hdr.pathLength ||
+        std::memcmp(stream.GetDataAtCursor(), sourcePath.data(), sourcePath.size()) != 0) {
+        return false;
+    }
+    stream.SkipBytes(hdr.pathLength);
+
+    // every entry takes at least its hash and the presence byte, don't trust a count the file can't hold
+    if (hdr.numThumbnails > stream.Remains() / (sizeof(uint64_t) + 1)) {
+        return false;
+    }
+
+    const size_t thumbSize = scast<size_t>(mThumbWidth) * mThumbHeight * 4;
+    thumbnails.hashes.resize(hdr.numThumbnails);
+    thumbnails.pixels.resize(hdr.numThumbnails);
+    for (uint32_t i = 0; i < hdr.numThumbnails; ++i) {
+        if (stream.Remains() < sizeof(uint64_t) + 1) {
+            return false;
+        }
+
+        thumbnails.hashes[i] = stream.ReadU64();
+        const bool present = stream.ReadU8() != 0;
+        if (present) {
+            if (stream.Remains() < thumbSize) {
+                return false;
+            }
+            thumbnails.pixels[i].resize(thumbSize);
+            stream.ReadToBuffer(thumbnails.pixels[i].data(), thumbSize);
+        } else {
+            thumbnails.pixels[i].clear();
+        }
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    thumbnails.upToDate = GetSourceStamp(sourceFile, sourceSize, sourceTime) && sourceSize == hdr.sourceSize && sourceTime == hdr.sourceTime;
+
+    // the modification time is what the trimming goes by
+    std::error_code ec;
+    fs::last_write_time(cachePath, fs::file_time_type::clock::now(), ec);
+
+    return true;
+}
+
+bool ThumbnailCache::Save(const fs::path& sourceFile, const CachedThumbnails& thumbnails) {
+    if (!this->IsOpen()) {
+        return false;
+    }
+
+    ThumbnailCacheHeader hdr = {};
+    if (!GetSourceStamp(sourceFile, hdr.sourceSize, hdr.sourceTime)) {
+        return false;
+    }
+
+    const CharString sourcePath = fs::absolute(sourceFile).u8string();
+    const size_t thumbSize = scast<size_t>(mThumbWidth) * mThumbHeight * 4;
+
+    hdr.magic = kThumbnailCacheMagic;
+    hdr.version = kThumbnailCacheVersion;
+    hdr.thumbWidth = mThumbWidth;
+    hdr.thumbHeight = mThumbHeight;
+    hdr.numThumbnails = scast<uint32_t>(thumbnails.hashes.size());
+    hdr.pathLength = scast<uint32_t>(sourcePath.size());
+
+    // goes through a temporary file, so a failed write (or another instance loading it) never sees half a cache
+    FileWriteStream stream;
+    if (!stream.Open(this->GetCacheFilePath(sourceFile))) {
+        return false;
+    }
+
+    stream.Write(hdr);
+    stream.Write(sourcePath.data(), sourcePath.size());
+    for (size_t i = 0; i < thumbnails.hashes.size(); ++i) {
+        const bool present = i < thumbnails.pixels.size() && thumbnails.pixels[i].size() == thumbSize;
+        stream.WriteU64(thumbnails.hashes[i]);
+        stream.WriteU8(present ? 1 : 0);
+        if (present) {
+            stream.Write(thumbnails.pixels[i].data(), thumbSize);
+        }
+    }
+
+    if (!stream.Close()) {
+        return false;
+    }
+
+    this->Trim();
+    return true;
+}
+
+uint64_t ThumbnailCache::HashTexture(const SH2Texture* texture, const size_t paletteIdx) {
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+    const SH2Texture::Format format = texture->GetFormat();
+
+    // PS2 4 bit textures are kept exploded to a byte per texel
+    size_t dataSize;
+    if (texture->IsCompressed()) {
+        dataSize = texture->CalculateDataSize();
+    } else if (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4) {
+        dataSize = scast<size_t>(width) * height;
+    } else {
+        dataSize = scast<size_t>(width) * height * 4;
+    }
+
+    uint64_t hash = (scast<uint64_t>(width) << 32) | height;
+    hash = HashBytes(rcast<const uint8_t*>(&format), sizeof(format), hash);
+    hash = HashBytes(texture->GetData(), dataSize, hash);
+    if (!texture->IsCompressed() && (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4)) {
+        const size_t paletteSize = ((format == SH2Texture::Format::Paletted4) ? 16 : 256) * 4;
+        hash = HashBytes(texture->GetPalette(paletteIdx), paletteSize, hash);
+    }
+
+    return hash;
+}
+
+fs::path ThumbnailCache::GetCacheFilePath(const fs::path& sourceFile) const {
+    const CharString sourcePath = fs::absolute(sourceFile).u8string();
+    const uint64_t nameHash = HashBytes(rcast<const uint8_t*>(sourcePath.data()), sourcePath.size(), 0);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", scast<unsigned long long>(nameHash));
+
+    fs::path result = mFolder / name;
+    result += kThumbnailCacheExtension;
+    return result;
+}
+
+void ThumbnailCache::Trim() {
+    struct CacheFile {
+        fs::path            path;
+        uint64_t            size;
+        fs::file_time_type  time;
+    };
+
+    MyArray<CacheFile> files;
+    uint64_t totalSize = 0;
+
+    std::error_code ec;
+    for (const fs::directory_entry& e : fs::directory_iterator(mFolder, ec)) {
+        if (e.is_regular_file(ec) && e.path().extension() == kThumbnailCacheExtension) {
+            CacheFile f{ e.path(), e.file_size(ec), e.last_write_time(ec) };
+            totalSize += f.size;
+            files.emplace_back(std::move(f));
+        }
+    }
+
+    if (totalSize <= mMaxSize) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+        return a.time < b.time;
+    });
+
+    for (const CacheFile& f : files) {
+        if (totalSize <= mMaxSize) {
+            break;
+        }
+        if (fs::remove(f.path, ec)) {
+            totalSize -= f.size;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "mycommon.h"
+
+class SH2Texture;
+
+// Thumbnails of all the textures of one source file
+struct CachedThumbnails {
+    bool                    upToDate = false;   // the source file is unchanged since these were stored
+    MyArray<uint64_t>       hashes;             // content hash of every texture (see ThumbnailCache::HashTexture)
+    MyArray<BytesArray>     pixels;             // RGBA thumbnail of every texture, empty if missing
+
+    const BytesArray*       FindByHash(const uint64_t hash) const;
+};
+
+// Persistent on-disk store of decoded thumbnails, one cache file per source file.
+// Stored thumbnails are trusted as a whole while the source file keeps its path, size and
+// modification time, otherwise single thumbnails can still be found by their texture's content hash.
+class ThumbnailCache {
+public:
+    ThumbnailCache();
+    ~ThumbnailCache();
+
+    // folder gets created if needed, once it grows over maxSizeInBytes the least recently used files are removed
+    bool                    Open(const fs::path& folder, const uint32_t thumbWidth, const uint32_t thumbHeight, const uint64_t maxSizeInBytes);
+    bool                    IsOpen() const;
+
+    bool                    Load(const fs::path& sourceFile, CachedThumbnails& thumbnails) const;
+    bool                    Save(const fs::path& sourceFile, const CachedThumbnails& thumbnails);
+
+    // hashes everything that affects the decoded image - format, size, data and the palette it's shown with
+    static uint64_t         HashTexture(const SH2Texture* texture, const size_t paletteIdx);
+
+private:
+    fs::path                GetCacheFilePath(const fs::path& sourceFile) const;
+    void                    Trim();
+
+private:
+    fs::path                mFolder;
+    uint32_t                mThumbWidth;
+    uint32_t                mThumbHeight;
+    uint64_t                mMaxSize;
+};
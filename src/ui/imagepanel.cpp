@@ -81,6 +81,13 @@ void ImagePanel::SetImage(const void* pixelsRGBA, const size_t width, const size
     this->ResetScroll();
 }
 
+void ImagePanel::UpdateImage(const void* pixelsRGBA) {
+    if (pixelsRGBA && !mImageData.empty()) {
+        memcpy(mImageData.data(), pixelsRGBA, mImageData.size());
+        this->ShowTransparency(mTransparency);
+    }
+}
+
 const void* ImagePanel::GetImageData() const {
     return mImageData.empty() ? nullptr : mImageData.data();
 }
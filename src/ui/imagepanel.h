@@ -23,6 +23,8 @@ public:
     ImagePanel(QWidget* parent = nullptr);
 
     void        SetImage(const void* pixelsRGBA, const size_t width, const size_t height, const bool premultiplied = false);
+    // new pixels for the image we already show (same size), zoom and scroll stay where they are
+    void        UpdateImage(const void* pixelsRGBA);
     const void* GetImageData() const;
     size_t      GetImageWidth() const;
     size_t      GetImageHeight() const;
@@ -5,9 +5,10 @@
 #include "../sh2texture.h"
 #include "../sh2map.h"
 #include "../sh2model.h"
-#include "../ddstexture.h"
-#define BCDEC_IMPLEMENTATION
-#include "../libs/bcdec/bcdec.h"
+#include "../texturedecoder.h"
+#include "../textureexport.h"
+#include "../textureimport.h"
+#include "../thumbnailcache.h"
 
 
 #include <QSettings>
@@ -19,6 +20,8 @@
 #include <QMessageBox>
 #include <QKeyEvent>
 #include <QStyleFactory>
+#include <QStandardPaths>
+#include <QCollator>
 
 #ifdef _WIN32
 #include <dwmapi.h>
@@ -42,8 +45,11 @@ static const QString kLastOpenPath("LastOpenPath");
 static const QString kLastSavePath("LastSavePath");
 static const QString kRecentTextureTemplate("RecentTexture_");
 static const QString kDarkThemeValue("DarkThemeEnabled");
+static const QString kDitherImportsValue("DitherImports");
 
 constexpr size_t kMaxRecentTextures = 10;
+constexpr int kThumbnailSize = 128;
+constexpr uint64_t kThumbnailCacheMaxSize = 512ull * 1024 * 1024;
 
 static QString SH2FormatToString(const SH2Texture::Format format, const bool isPS2) {
     switch (format) {
@@ -67,6 +73,50 @@ static bool IsAcceptedExtension(const QString& path) {
            pathLower.endsWith(".mdl");
 }
 
+// runs on the thumbnails pool, so no QPixmap here
+// decoded premultiplied, that's what Qt scales and paints without converting first
+// paletted textures use paletteIdx and not whatever palette is current by the time we get to run
+static QImage MakeTextureThumbnail(const SH2Texture* texture, const size_t paletteIdx) {
+    const uint32_t width = texture->GetWidth();
+    const uint32_t height = texture->GetHeight();
+    const QImage::Format qfmt = QImage::Format_RGBA8888_Premultiplied;
+
+    // shrinking - sample the texture data directly instead of decoding all of it
+    if (scast<int>(width) >= kThumbnailSize && scast<int>(height) >= kThumbnailSize) {
+        QImage icon(kThumbnailSize, kThumbnailSize, qfmt);
+        DecodeTextureThumbnail(texture, paletteIdx, icon.bits(), kThumbnailSize, kThumbnailSize, PixelLayout::RGBAPremultiplied);
+        return icon;
+    }
+
+    // small textures get blown up, decode them fully for the smooth filtering
+    BytesArray decompressed(width * height * 4);
+    const SH2Texture::Format format = texture->GetFormat();
+    if (!texture->IsCompressed() && (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4)) {
+        DecompressPalettedTexture(texture, paletteIdx, decompressed.data(), PixelLayout::RGBAPremultiplied);
+    } else {
+        DecompressTexture(texture, decompressed, PixelLayout::RGBAPremultiplied);
+    }
+
+    // smooth scaling may change the format, the cache wants it back the way it was
+    const QImage image(decompressed.data(), width, height, width * 4, qfmt);
+    return image.scaled(QSize(kThumbnailSize, kThumbnailSize), Qt::IgnoreAspectRatio, Qt::SmoothTransformation).convertToFormat(qfmt);
+}
+
+static QImage ThumbnailPixelsToImage(const BytesArray& pixels) {
+    QImage icon(kThumbnailSize, kThumbnailSize, QImage::Format_RGBA8888_Premultiplied);
+    for (int y = 0; y < kThumbnailSize; ++y) {
+        std::memcpy(icon.scanLine(y), pixels.data() + y * kThumbnailSize * 4, kThumbnailSize * 4);
+    }
+    return icon;
+}
+
+static void ThumbnailImageToPixels(const QImage& icon, BytesArray& pixels) {
+    pixels.resize(kThumbnailSize * kThumbnailSize * 4);
+    for (int y = 0; y < kThumbnailSize; ++y) {
+        std::memcpy(pixels.data() + y * kThumbnailSize * 4, icon.constScanLine(y), kThumbnailSize * 4);
+    }
+}
+
 static bool WindowsIsInDarkTheme() {
     QSettings settings("HKEY_CURRENT_USER\\Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize", QSettings::NativeFormat);
     return settings.value("AppsUseLightTheme", 1).toInt() == 0;
@@ -81,6 +131,11 @@ MainWindow::MainWindow(QWidget *parent)
     , mModel{}
     , mLastPath{}
     , mWasModified(false)
+    , mThumbnailsPool{}
+    , mThumbnailsGeneration(0)
+    , mThumbnailCache{}
+    , mThumbnails{}
+    , mThumbnailsPending(0)
     , mFilesInDirectory{}
     , mFilesInDirectoryIterator{}
     , mOriginalPalette{}
@@ -103,12 +158,18 @@ MainWindow::MainWindow(QWidget *parent)
 
     this->UpdateRecentTexturesList();
 
+    const QString cacheFolder = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cacheFolder.isEmpty()) {
+        mThumbnailCache.Open(fs::path(cacheFolder.toStdWString()) / "thumbnails", kThumbnailSize, kThumbnailSize, kThumbnailCacheMaxSize);
+    }
+
     mOriginalPalette = qApp->palette();
     mOriginalStyleSheet = qApp->styleSheet();
     mOriginalStyleName = qApp->style()->name();
 
     QSettings registry;
     const bool isDark = registry.value(kDarkThemeValue).toBool();
+    ui->actionDither_imports->setChecked(registry.value(kDitherImportsValue).toBool());
 
     if (WindowsIsInDarkTheme() || isDark) {
         ui->actionDark_theme->setChecked(true);
@@ -117,6 +178,7 @@ MainWindow::MainWindow(QWidget *parent)
 }
 
 MainWindow::~MainWindow() {
+    this->CancelThumbnails();
     delete ui;
 }
 
@@ -182,58 +244,18 @@ int MainWindow::GetSelectedTextureIdx() const {
     return l[0]->data(Qt::UserRole).toInt();
 }
 
-void MainWindow::DecompressTexture(const SH2Texture* texture, BytesArray& output, const bool doNotSwizzle) {
-    const SH2Texture::Format format = texture->GetFormat();
-    const uint32_t width = texture->GetWidth();
-    const uint32_t height = texture->GetHeight();
-    const uint8_t* compressed = texture->GetData();
-
-    if (texture->IsCompressed()) {
-        const uint8_t* src = compressed;
-
-        for (size_t i = 0; i < height; i += 4) {
-            for (size_t j = 0; j < width; j += 4) {
-                uint8_t* dst = output.data() + (i * width + j) * 4;
-
-                if (format == SH2Texture::Format::DXT1) {
-                    bcdec_bc1(src, dst, width * 4);
-                    src += BCDEC_BC1_BLOCK_SIZE;
-                } else if (format == SH2Texture::Format::DXT2 || format == SH2Texture::Format::DXT3) {
-                    bcdec_bc2(src, dst, width * 4);
-                    src += BCDEC_BC2_BLOCK_SIZE;
-                } else if (format == SH2Texture::Format::DXT4 || format == SH2Texture::Format::DXT5) {
-                    bcdec_bc3(src, dst, width * 4);
-                    src += BCDEC_BC3_BLOCK_SIZE;
-                }
-            }
-        }
-    } else if (format == SH2Texture::Format::Paletted || format == SH2Texture::Format::Paletted4) {
-        const uint8_t* indices = texture->GetData();
-        const uint32_t* palette = rcast<const uint32_t*>(texture->GetPalette());
-        uint32_t* dst = rcast<uint32_t*>(output.data());
-        for (size_t i = 0, end = (width * height); i < end; ++i, ++indices, ++dst) {
-            *dst = palette[*indices];
-        }
-    } else if (format == SH2Texture::Format::RGBX8) {
-        std::memcpy(output.data(), compressed, output.size());
-    } else /* RGBA8 */ {
-        std::memcpy(output.data(), compressed, output.size());
-    }
-
-    if (!doNotSwizzle && !texture->IsCompressed()) {
-        for (size_t i = 0, end = output.size(); i < end; i += 4) {
-            std::swap(output[i + 0], output[i + 2]);
-        }
-    }
+void MainWindow::DecompressTexture(const SH2Texture* texture, BytesArray& output, const PixelLayout layout) {
+    // the UI waits for this one, so all cores help with the big ones
+    ::DecompressTexture(texture, output, layout, 0);
 }
 
 void MainWindow::SetTextureToImagePanel(const SH2Texture* texture) {
     const uint32_t width = texture->GetWidth();
     const uint32_t height = texture->GetHeight();
     BytesArray decompressed(width * height * 4);
-    this->DecompressTexture(texture, decompressed, false);
+    this->DecompressTexture(texture, decompressed, PixelLayout::RGBA);
 
-    ui->imagePanel->SetImage(decompressed.data(), width, height);
+    ui->imagePanel->SetImage(decompressed.data(), width, height, texture->IsPremultiplied());
 }
 
 void MainWindow::LoadTextureFromFile(const fs::path& path, const bool addToRecent, const bool fromIterator) {
@@ -241,11 +263,12 @@ void MainWindow::LoadTextureFromFile(const fs::path& path, const bool addToRecen
 
     fs::path fixedPath = FixPath(path);
 
+    // pixels are read lazily and the file may get replaced while we show it, so don't map it
     bool loadSucceeded = false;
 
     if (WStrEqualsCaseInsensitive(fixedPath.extension(), L".map")) {
         RefPtr<SH2Map> map = MakeRefPtr<SH2Map>();
-        if (map->LoadFromFile(fixedPath)) {
+        if (map->LoadFromFile(fixedPath, false)) {
             mMap = map;
             mTexturesContainer = mMap->GetTexturesContainer();
             mModel = nullptr;
@@ -253,7 +276,7 @@ void MainWindow::LoadTextureFromFile(const fs::path& path, const bool addToRecen
         }
     } else if (WStrEqualsCaseInsensitive(fixedPath.extension(), L".mdl")) {
         RefPtr<SH2Model> model = MakeRefPtr<SH2Model>();
-        if (model->LoadFromFile(fixedPath)) {
+        if (model->LoadFromFile(fixedPath, false)) {
             mModel = model;
             mTexturesContainer = mModel->GetTexturesContainer();
             mMap = nullptr;
@@ -261,7 +284,7 @@ void MainWindow::LoadTextureFromFile(const fs::path& path, const bool addToRecen
         }
     } else {
         RefPtr<SH2TextureContainer> container = MakeRefPtr<SH2TextureContainer>();
-        if (container->LoadFromFile(fixedPath)) {
+        if (container->LoadFromFile(fixedPath, false)) {
 #if 0
             auto& warnings = container->GetWarnings();
             if (!warnings.empty()) {
@@ -332,32 +355,51 @@ void MainWindow::OnTextureLoaded(const int idx) {
         return;
     }
 
+    this->CancelThumbnails();
     ui->listTextures->clear();
 
-    QListWidgetItem* selected = nullptr;
+    QPixmap placeholder(kThumbnailSize, kThumbnailSize);
+    placeholder.fill(Qt::transparent);
+    const QIcon placeholderIcon(placeholder);
 
     const size_t numTextures = mTexturesContainer->GetNumTextures();
+
+    // thumbnails made for this file before - taken as is if the file didn't change since,
+    // otherwise the jobs below can still find them by the texture content
+    RefPtr<CachedThumbnails> stored = MakeRefPtr<CachedThumbnails>();
+    mThumbnailCache.Load(mLastPath, *stored);
+    const bool storedUpToDate = stored->upToDate && !mWasModified && stored->hashes.size() == numTextures;
+
+    mThumbnails = CachedThumbnails{};
+    mThumbnails.hashes.resize(numTextures);
+    mThumbnails.pixels.resize(numTextures);
+
+    QListWidgetItem* selected = nullptr;
+    MyArray<size_t> toDecode;
+
     for (size_t i = 0; i < numTextures; ++i) {
         const SH2Texture* texture = mTexturesContainer->GetTexture(i);
 
         const uint32_t width = texture->GetWidth();
         const uint32_t height = texture->GetHeight();
-        BytesArray decompressed(width * height * 4);
-        this->DecompressTexture(texture, decompressed, false);
-
-        const QImage::Format qfmt = texture->IsPremultiplied() ? QImage::Format_RGBA8888_Premultiplied : QImage::Format_RGBA8888;
-
-        QImage icon = QImage(decompressed.data(), width, height, width * 4, qfmt).scaled(QSize(128, 128), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 
         QString tooltip = QString("id: %1\n%2x%3\n%4").arg(texture->GetID()).arg(width).arg(height).arg(SH2FormatToString(texture->GetFormat(), texture->IsPS2File()));
 
         QListWidgetItem* item = new QListWidgetItem();
         item->setText(QString("texture %1").arg(i));
         item->setToolTip(tooltip);
-        item->setIcon(QIcon(QPixmap::fromImage(icon)));
         item->setData(Qt::UserRole, scast<int>(i));
         ui->listTextures->addItem(item);
 
+        if (storedUpToDate && !stored->pixels[i].empty()) {
+            item->setIcon(QIcon(QPixmap::fromImage(ThumbnailPixelsToImage(stored->pixels[i]))));
+            mThumbnails.hashes[i] = stored->hashes[i];
+            mThumbnails.pixels[i] = stored->pixels[i];
+        } else {
+            item->setIcon(placeholderIcon);
+            toDecode.push_back(i);
+        }
+
         if (idx < 0 && !selected) {
             selected = item;
         } else if (idx == scast<int>(i)) {
@@ -365,10 +407,56 @@ void MainWindow::OnTextureLoaded(const int idx) {
         }
     }
 
+    // decode the rest on the pool in list order, the selected one first,
+    // the container reference keeps the textures alive even if another file gets opened meanwhile
+    const uint64_t generation = mThumbnailsGeneration;
+    const int selectedIdx = selected ? selected->data(Qt::UserRole).toInt() : -1;
+    RefPtr<SH2TextureContainer> container = mTexturesContainer;
+    mThumbnailsPending = toDecode.size();
+    for (const size_t i : toDecode) {
+        const int priority = (scast<int>(i) == selectedIdx) ? 1 : 0;
+        // the palette is picked here, the job only reads the converted palettes that never change
+        const size_t paletteIdx = container->GetTexture(i)->GetCurrentPaletteIdx();
+        mThumbnailsPool.start([this, container, stored, generation, i, paletteIdx]() {
+            const SH2Texture* texture = container->GetTexture(i);
+            const uint64_t hash = ThumbnailCache::HashTexture(texture, paletteIdx);
+            const BytesArray* found = stored->FindByHash(hash);
+            const QImage icon = found ? ThumbnailPixelsToImage(*found) : MakeTextureThumbnail(texture, paletteIdx);
+            QMetaObject::invokeMethod(this, [this, generation, i, hash, icon]() {
+                this->OnThumbnailReady(generation, i, hash, icon);
+            }, Qt::QueuedConnection);
+        }, priority);
+    }
+
     ui->imagePanel->ResetZoom();
     ui->listTextures->setCurrentItem(selected);
 }
 
+void MainWindow::OnThumbnailReady(const uint64_t generation, const size_t idx, const uint64_t hash, const QImage& icon) {
+    if (generation != mThumbnailsGeneration || idx >= scast<size_t>(ui->listTextures->count())) {
+        return;
+    }
+
+    QListWidgetItem* item = ui->listTextures->item(scast<int>(idx));
+    item->setIcon(QIcon(QPixmap::fromImage(icon)));
+
+    mThumbnails.hashes[idx] = hash;
+    ThumbnailImageToPixels(icon, mThumbnails.pixels[idx]);
+
+    // an edited file doesn't match what's on disk, so don't store anything for it
+    if (--mThumbnailsPending == 0 && !mWasModified) {
+        mThumbnailCache.Save(mLastPath, mThumbnails);
+    }
+}
+
+// drops the queued thumbnails and waits for the running ones,
+// has to be called before the textures get modified or the list rebuilt
+void MainWindow::CancelThumbnails() {
+    mThumbnailsPool.clear();
+    mThumbnailsPool.waitForDone();
+    ++mThumbnailsGeneration;
+}
+
 QString MainWindow::GetLastPathFolder() const {
     if (mLastPath.empty()) {
         return QString();
@@ -483,48 +571,13 @@ void MainWindow::ExportTexture(const SH2Texture* texture, const fs::path& path)
     const bool isDDS = !isPNG;
 
     if (isDDS) {
-        DDSTexture dds;
-        dds.SetWidth(width);
-        dds.SetHeight(height);
-
-        if (texFormat == SH2Texture::Format::RGBA8 || texFormat == SH2Texture::Format::RGBX8) {
-            dds.SetFormat(32);
-            const size_t dataSize = width * height * 4;
-            dds.SetData(texture->GetData(), dataSize);
-        } else if (texFormat == SH2Texture::Format::Paletted || (texture->IsPS2File() && texFormat == SH2Texture::Format::Paletted4)) {
-            BytesArray unpaletted(width * height * 4);
-            this->DecompressTexture(texture, unpaletted, true);
-            dds.SetData(unpaletted.data(), unpaletted.size());
-            dds.SetFormat(32);
-        } else {
-            switch (texFormat) {
-                case SH2Texture::Format::DXT1:
-                    dds.SetFormat(DDS_FOURCC_DXT1);
-                break;
-                case SH2Texture::Format::DXT2:
-                    dds.SetFormat(DDS_FOURCC_DXT2);
-                break;
-                case SH2Texture::Format::DXT3:
-                    dds.SetFormat(DDS_FOURCC_DXT3);
-                break;
-                case SH2Texture::Format::DXT4:
-                    dds.SetFormat(DDS_FOURCC_DXT4);
-                break;
-                case SH2Texture::Format::DXT5:
-                    dds.SetFormat(DDS_FOURCC_DXT5);
-                break;
-            }
-
-            const size_t dataSize = (texFormat == SH2Texture::Format::DXT1) ? BCDEC_BC1_COMPRESSED_SIZE(width, height) : BCDEC_BC3_COMPRESSED_SIZE(width, height);
-            dds.SetData(texture->GetData(), dataSize);
-        }
-        dds.SaveToFile(path);
+        ExportTextureToDDS(texture, path);
     } else {
         RefPtr<QImage> qimg;
         BytesArray decompressed;
         if (texFormat == SH2Texture::Format::RGBA8 || texFormat == SH2Texture::Format::RGBX8) {
             decompressed.resize(width * height * 4);
-            this->DecompressTexture(texture, decompressed, false);
+            this->DecompressTexture(texture, decompressed, PixelLayout::RGBA);
             qimg = MakeRefPtr<QImage>(decompressed.data(), width, height, QImage::Format_RGBA8888);
         } else if (texFormat == SH2Texture::Format::Paletted || (texture->IsPS2File() && texFormat == SH2Texture::Format::Paletted4)) {
             qimg = MakeRefPtr<QImage>(texture->GetData(), width, height, QImage::Format_Indexed8);
@@ -536,7 +589,7 @@ void MainWindow::ExportTexture(const SH2Texture* texture, const fs::path& path)
             qimg->setColorTable(imgPal);
         } else {
             decompressed.resize(width * height * 4);
-            this->DecompressTexture(texture, decompressed, true);
+            this->DecompressTexture(texture, decompressed, PixelLayout::RGBA);
             qimg = MakeRefPtr<QImage>(decompressed.data(), width, height, QImage::Format_RGBA8888);
         }
 
@@ -555,108 +608,53 @@ void MainWindow::ExportAllTextures(const fs::path& dstFolder) {
     }
 }
 
+TextureImportOptions MainWindow::GetImportOptions() const {
+    TextureImportOptions options;
+    options.dither = ui->actionDither_imports->isChecked();
+    return options;
+}
+
 void MainWindow::ImportTexture(const fs::path& path, const int idx) {
     if (!mTexturesContainer || idx < 0 || idx >= mTexturesContainer->GetNumTextures()) {
         return;
     }
 
-    const bool isDDS = WStrEqualsCaseInsensitive(path.extension().wstring(), L".dds");
-
-    SH2Texture* texture = mTexturesContainer->GetTexture(idx);
-
-    const bool isPS2 = texture->IsPS2File();
-
-    if (isDDS) {
-        DDSTexture dds;
-        if (!dds.LoadFromFile(path)) {
-            QMessageBox::critical(this, this->windowTitle(), tr("Failed to load DDS texture!"));
-            return;
-        }
-
-        const uint32_t ddsFormat = dds.GetFormat();
-        SH2Texture::Format sh2Format;
-        if (ddsFormat == DDS_FOURCC_DXT1) {
-            sh2Format = SH2Texture::Format::DXT1;
-        } else if (ddsFormat == DDS_FOURCC_DXT2) {
-            sh2Format = SH2Texture::Format::DXT2;
-        } else if (ddsFormat == DDS_FOURCC_DXT3) {
-            sh2Format = SH2Texture::Format::DXT3;
-        } else if (ddsFormat == DDS_FOURCC_DXT4) {
-            sh2Format = SH2Texture::Format::DXT4;
-        } else if (ddsFormat == DDS_FOURCC_DXT5) {
-            sh2Format = SH2Texture::Format::DXT5;
-        } else {
-            sh2Format = SH2Texture::Format::RGBA8;
-        }
+    // thumbnails might be reading the texture, the list gets rebuilt afterwards anyway
+    this->CancelThumbnails();
 
-        texture->Replace(sh2Format, dds.GetWidth(), dds.GetHeight(), dds.GetData());
+    // same import as the command line tool, DDS as is and PNG compressed or quantized to the texture's format
+    CharString error;
+    if (ImportTextureFromFile(mTexturesContainer->GetTexture(idx), path, this->GetImportOptions(), error)) {
         mWasModified = true;
     } else {
-        RefPtr<QImage> qimg = MakeRefPtr<QImage>();
-        if (qimg->load(QString::fromStdWString(path.wstring()))) {
-
-            const uint32_t width = texture->GetWidth();
-            const uint32_t height = texture->GetHeight();
-
-            if (isPS2 && (qimg->width() != width || qimg->height() != height)) {
-                QMessageBox::critical(this, this->windowTitle(), tr("Image dimensions are non-compatible!"));
-                return;
-            }
-
-            const SH2Texture::Format sh2Format = texture->GetFormat();
-            const uint8_t* dataPtr = qimg->bits();
-            BytesArray swapped;
-            BytesArray palette;
+        QMessageBox::critical(this, this->windowTitle(), QString::fromStdString(error));
+    }
 
-            if (sh2Format == SH2Texture::Format::Paletted) {
-                if (qimg->format() != QImage::Format_Indexed8) {
-                    QMessageBox::critical(this, this->windowTitle(), tr("Please select paletted image!"));
-                    return;
-                }
+    this->OnTextureLoaded(idx);
+}
 
-                const QList<uint>& qpalette = qimg->colorTable();
-                const size_t paletteSize = (std::min<size_t>)(qpalette.size(), 256);
-                palette.resize(256 * 4, 0xFF);
-                for (size_t i = 0; i < paletteSize; ++i) {
-                    const QRgb rgba = qpalette[i];
-                    palette[i * 4 + 0] = qRed(rgba);
-                    palette[i * 4 + 1] = qGreen(rgba);
-                    palette[i * 4 + 2] = qBlue(rgba);
-                    palette[i * 4 + 3] = qAlpha(rgba);
-                }
+void MainWindow::ImportTexturePalettes(QStringList fileNames, const int idx) {
+    if (!mTexturesContainer || idx < 0 || idx >= mTexturesContainer->GetNumTextures()) {
+        return;
+    }
 
-            } else if (sh2Format == SH2Texture::Format::RGBX8 || sh2Format == SH2Texture::Format::RGBA8) {
-                if (qimg->format() != QImage::Format_RGBA8888 && qimg->format() != QImage::Format_ARGB32) {
-                    QMessageBox::critical(this, this->windowTitle(), tr("Please select 32bit image!"));
-                    return;
-                }
+    // the dialog doesn't keep any order, and _p2 has to go before _p10
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(fileNames.begin(), fileNames.end(), collator);
 
-                if (qimg->format() == QImage::Format_RGBA8888) {
-                    swapped.resize(qimg->width() * qimg->height() * 4);
-                    for (size_t i = 0, end = scast<size_t>(qimg->width() * qimg->height()); i < end; ++i) {
-                        swapped[i * 4 + 0] = dataPtr[i * 4 + 3];
-                        swapped[i * 4 + 1] = dataPtr[i * 4 + 2];
-                        swapped[i * 4 + 2] = dataPtr[i * 4 + 1];
-                        swapped[i * 4 + 3] = dataPtr[i * 4 + 0];
-                    }
+    MyArray<fs::path> paths;
+    for (const QString& fileName : fileNames) {
+        paths.push_back(fileName.toStdWString());
+    }
 
-                    dataPtr = swapped.data();
-                }
-            } else {
-                QMessageBox::critical(this, this->windowTitle(), tr("Non-compatible image color format!"));
-                return;
-            }
+    this->CancelThumbnails();
 
-            if (isPS2) {
-                texture->Replace_PS2(dataPtr, palette.empty() ? nullptr : palette.data());
-            } else {
-                texture->Replace(sh2Format, width, height, dataPtr, palette.empty() ? nullptr : palette.data());
-            }
-            mWasModified = true;
-        } else {
-            QMessageBox::critical(this, this->windowTitle(), tr("Failed to load PNG image!"));
-            return;
-        }
+    CharString error;
+    if (ImportTextureFromFiles(mTexturesContainer->GetTexture(idx), paths, this->GetImportOptions(), error)) {
+        mWasModified = true;
+    } else {
+        QMessageBox::critical(this, this->windowTitle(), QString::fromStdString(error));
     }
 
     this->OnTextureLoaded(idx);
@@ -876,6 +874,7 @@ void MainWindow::on_listTextures_customContextMenuRequested(const QPoint &pos) {
         QAction exportTexture(tr("Export texture..."));
         QAction exportAllTextures(tr("Export all textures..."));
         QAction replaceTexture(tr("Replace texture..."));
+        QAction replaceAllPalettes(tr("Replace all palettes..."));
 
         exportAllTextures.setEnabled(mTexturesContainer->GetNumTextures() > 1);
 
@@ -884,6 +883,9 @@ void MainWindow::on_listTextures_customContextMenuRequested(const QPoint &pos) {
         contextMenu.addAction(&exportAllTextures);
         contextMenu.addSeparator();
         contextMenu.addAction(&replaceTexture);
+        if (texture->IsPS2File() && texture->GetPalettesCount() > 1) {
+            contextMenu.addAction(&replaceAllPalettes);
+        }
 
         QAction* selectedAction = contextMenu.exec(ui->listTextures->mapToGlobal(pos));
         if (selectedAction == &exportTexture) {
@@ -926,6 +928,12 @@ void MainWindow::on_listTextures_customContextMenuRequested(const QPoint &pos) {
             if (!fileName.isEmpty()) {
                 this->ImportTexture(fileName.toStdWString(), idx);
             }
+        } else if (selectedAction == &replaceAllPalettes) {
+            const QString title = tr("Select %1 PNG images, one per palette").arg(texture->GetPalettesCount());
+            const QStringList fileNames = QFileDialog::getOpenFileNames(this, title, this->GetLastPathFolder(), tr("PNG image (*.png)"));
+            if (!fileNames.isEmpty()) {
+                this->ImportTexturePalettes(fileNames, idx);
+            }
         }
     } else {
         QAction addTexture(tr("Add texture..."));
@@ -956,6 +964,11 @@ void MainWindow::on_actionDark_theme_triggered() {
     this->SetDarkTheme(ui->actionDark_theme->isChecked());
 }
 
+void MainWindow::on_actionDither_imports_triggered() {
+    QSettings registry;
+    registry.setValue(kDitherImportsValue, ui->actionDither_imports->isChecked());
+}
+
 void MainWindow::on_actionAbout_triggered() {
     AboutDlg dlg(this);
     dlg.exec();
@@ -973,8 +986,19 @@ void MainWindow::on_paletteComboBox_currentIndexChanged(int index) {
     const int idx = this->GetSelectedTextureIdx();
     if (idx >= 0 && idx < mTexturesContainer->GetNumTextures()) {
         SH2Texture* texture = mTexturesContainer->GetTexture(idx);
+
+        // thumbnail jobs got their palette index up front, so nothing to wait for here
         texture->SetCurrentPaletteIdx(index);
 
-        this->SetTextureToImagePanel(texture);
+        // same indices with another (already converted) palette, the view keeps its zoom and scroll
+        const uint32_t width = texture->GetWidth();
+        const uint32_t height = texture->GetHeight();
+        if (ui->imagePanel->GetImageWidth() == width && ui->imagePanel->GetImageHeight() == height) {
+            BytesArray pixels(scast<size_t>(width) * height * 4);
+            DecompressPalettedTexture(texture, texture->GetCurrentPaletteIdx(), pixels.data(), PixelLayout::RGBA);
+            ui->imagePanel->UpdateImage(pixels.data());
+        } else {
+            this->SetTextureToImagePanel(texture);
+        }
     }
 }
@@ -2,14 +2,19 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QThreadPool>
 #include "../mycommon.h"
+#include "../pixelconvert.h"
+#include "../thumbnailcache.h"
 
 class SH2TextureContainer;
 class SH2Texture;
 class SH2Map;
 class SH2Model;
+struct TextureImportOptions;
 
 class QLabel;
+class QImage;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -29,10 +34,12 @@ protected:
 
 public:
     int         GetSelectedTextureIdx() const;
-    void        DecompressTexture(const SH2Texture* texture, BytesArray& output, const bool doNotSwizzle);
+    void        DecompressTexture(const SH2Texture* texture, BytesArray& output, const PixelLayout layout);
     void        SetTextureToImagePanel(const SH2Texture* texture);
     void        LoadTextureFromFile(const fs::path& path, const bool addToRecent, const bool fromIterator);
     void        OnTextureLoaded(const int idx = -1);
+    void        OnThumbnailReady(const uint64_t generation, const size_t idx, const uint64_t hash, const QImage& icon);
+    void        CancelThumbnails();
     QString     GetLastPathFolder() const;
     QString     GetLastPathFileName() const;
     QStringList GetRecentTexturesList() const;
@@ -42,7 +49,10 @@ public:
 
     void        ExportTexture(const SH2Texture* texture, const fs::path& path);
     void        ExportAllTextures(const fs::path& dstFolder);
+    // PNG images into paletted textures get dithered if the user asked for it
+    TextureImportOptions GetImportOptions() const;
     void        ImportTexture(const fs::path& path, const int idx);
+    void        ImportTexturePalettes(QStringList fileNames, const int idx);
 
     void        SetDarkTheme(const bool isDark);
 
@@ -57,6 +67,7 @@ private slots:
     void        on_listTextures_customContextMenuRequested(const QPoint &pos);
     void        on_actionShow_transparency_triggered();
     void        on_actionDark_theme_triggered();
+    void        on_actionDither_imports_triggered();
     void        on_actionAbout_triggered();
     void        on_actionPrevious_file_triggered();
     void        on_actionNext_file_triggered();
@@ -72,6 +83,14 @@ private:
     fs::path                    mLastPath;
     bool                        mWasModified;
 
+    // thumbnails are decoded in the background, results of older lists are dropped
+    QThreadPool                 mThumbnailsPool;
+    uint64_t                    mThumbnailsGeneration;
+    // thumbnails of the current list, written to the cache once all of them are done
+    ThumbnailCache              mThumbnailCache;
+    CachedThumbnails            mThumbnails;
+    size_t                      mThumbnailsPending;
+
     // files iterating stuff
     MyArray<fs::path>           mFilesInDirectory;
     MyArray<fs::path>::iterator mFilesInDirectoryIterator;